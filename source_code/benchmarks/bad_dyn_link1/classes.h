@@ -0,0 +1,15 @@
+#ifndef __CLASSES_H__
+#define __CLASSES_H__
+
+class A {
+public:
+  virtual ~A();
+  virtual void f();
+  virtual void h();
+  //int i;
+};
+
+
+A* func();
+
+#endif
@@ -0,0 +1,25 @@
+#include "classes.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <iostream>
+#include <cstdio>
+
+int main(int argc, char *argv[])
+{
+  A *b = func();
+
+  // the vtable of b is in libT.so, vptr_safe lets the call through
+  b->f();
+
+  // a copy of the vtable on the heap is in no loaded object, vptr_safe must
+  // refuse it and the call has to trap
+  intptr_t *vptr = *(intptr_t**)b;
+  intptr_t *forged = new intptr_t[8];
+  memcpy(forged, vptr - 2, 8 * sizeof(intptr_t));
+  *(intptr_t**)b = forged + 2;
+
+  std::cout << "calling through a forged vtable" << std::endl;
+  b->f();
+  return 0;
+}
@@ -0,0 +1,9 @@
+#include "classes.h"
+#include <cstdio>
+
+A::~A() {}
+void A::f() { printf("A::f\n"); }
+
+void B::onlyB() { printf("B::onlyB\n"); }
+
+void C::onlyC() { printf("C::onlyC\n"); }
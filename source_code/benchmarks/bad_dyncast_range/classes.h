@@ -0,0 +1,23 @@
+#ifndef __CLASSES_H__
+#define __CLASSES_H__
+
+// bad_cast with a dynamic_cast in front: the range check of the downcast has to reject
+// a sibling, and the C-style cast the program then does anyway has to trap
+
+struct A {
+  virtual ~A();
+  virtual void f();
+  int a;
+};
+
+struct B: public A {
+  virtual void onlyB();
+  int b;
+};
+
+struct C: public A {
+  virtual void onlyC();
+  int c;
+};
+
+#endif
@@ -0,0 +1,21 @@
+#include "classes.h"
+#include <cstdio>
+
+__attribute__((noinline)) static B *toB(A *a) { return dynamic_cast<B *>(a); }
+
+int main(int argc, char *argv[])
+{
+  // the output has to be out before the trap
+  setvbuf(stdout, NULL, _IONBF, 0);
+
+  A *a = new C();
+
+  B *b = toB(a);
+  printf("dynamic_cast<B *>(C): %s\n", b ? "not null" : "null");
+
+  // C::onlyC with g++, a trap with SafeDispatch
+  b = (B *) a;
+  b->onlyB();
+
+  return 0;
+}
@@ -0,0 +1,247 @@
+// Writes a synthetic C++ program with a large class hierarchy for the compile-time
+// benchmark of the SD passes:
+//
+//   gen_hierarchy -o DIR [-classes N] [-depth D] [-fanout F] [-multiple P]
+//                 [-virtual P] [-interfaces I] [-methods M] [-calls C]
+//                 [-files K] [-seed S]
+//
+// The N classes form families, trees of depth D in which every class has up to F
+// children (breadth first, a family is full before the next one starts). Every root
+// declares M virtual functions, every class overrides one of them. P% of the classes
+// (-multiple) also derive from one of the I interfaces of their family, which adds
+// secondary vtables, and P% of the inheritance edges (-virtual) are virtual. An
+// interface that a class already inherits only virtually may be inherited again
+// virtually, which gives virtual diamonds. Every class gets a function with C virtual
+// calls through a pointer to it. The families are spread round robin over K
+// translation units DIR/tu0.cpp ... and DIR/main.cpp calls all of them.
+//
+// The same parameters and seed always give the same program.
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <vector>
+
+#include <sys/stat.h>
+
+static void usage(const char *argv0) {
+  fprintf(stderr, "usage: %s -o DIR [-classes N] [-depth D] [-fanout F] [-multiple P] "
+          "[-virtual P] [-interfaces I] [-methods M] [-calls C] [-files K] [-seed S]\n", argv0);
+  exit(1);
+}
+
+// xorshift64*, so that the programs do not depend on the C library
+static unsigned long long state;
+
+static unsigned pick(unsigned bound) {
+  state ^= state >> 12;
+  state ^= state << 25;
+  state ^= state >> 27;
+  return (unsigned) ((state * 2685821657736338717ULL) >> 33) % bound;
+}
+
+static bool percent(int p) {
+  return (int) pick(100) < p;
+}
+
+struct Class {
+  int family;
+  int parent;                                     // -1 for the root of a family
+  int depth;
+  int children;
+  bool virtualParent;
+  int iface;                                      // the interface derived from directly, or -1
+  bool virtualIface;
+  std::map<int, bool> ifaces;                     // inherited interfaces -> only as virtual bases
+};
+
+struct Family {
+  int first;                                      // the classes first .. last
+  int last;
+};
+
+static FILE *create(const char *dir, const char *name) {
+  char path[4096];
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+  FILE *f = fopen(path, "w");
+  if (!f) {
+    fprintf(stderr, "gen_hierarchy: cannot write %s: %s\n", path, strerror(errno));
+    exit(1);
+  }
+  return f;
+}
+
+int main(int argc, char *argv[])
+{
+  const char *dir = NULL;
+  int classes = 1000, depth = 6, fanout = 3, multiple = 10, virt = 10;
+  int interfaces = 4, methods = 4, calls = 2, files = 16, seed = 1;
+
+  for (int i = 1; i < argc; i++) {
+    if (i + 1 == argc)
+      usage(argv[0]);
+    if (!strcmp(argv[i], "-o")) {
+      dir = argv[++i];
+      continue;
+    }
+    int value = atoi(argv[i + 1]);
+    if (!strcmp(argv[i], "-classes"))
+      classes = value;
+    else if (!strcmp(argv[i], "-depth"))
+      depth = value;
+    else if (!strcmp(argv[i], "-fanout"))
+      fanout = value;
+    else if (!strcmp(argv[i], "-multiple"))
+      multiple = value;
+    else if (!strcmp(argv[i], "-virtual"))
+      virt = value;
+    else if (!strcmp(argv[i], "-interfaces"))
+      interfaces = value;
+    else if (!strcmp(argv[i], "-methods"))
+      methods = value;
+    else if (!strcmp(argv[i], "-calls"))
+      calls = value;
+    else if (!strcmp(argv[i], "-files"))
+      files = value;
+    else if (!strcmp(argv[i], "-seed"))
+      seed = value;
+    else
+      usage(argv[0]);
+    i++;
+  }
+  if (!dir || classes < 1 || depth < 0 || fanout < 1 || interfaces < 1 || methods < 1 ||
+      calls < 0 || files < 1)
+    usage(argv[0]);
+  if (mkdir(dir, 0777) && errno != EEXIST) {
+    fprintf(stderr, "gen_hierarchy: cannot create %s: %s\n", dir, strerror(errno));
+    return 1;
+  }
+  state = 0x9e3779b97f4a7c15ULL * (seed + 1);
+
+  // the hierarchy: the next parent is the first class of the family that still has
+  // room for children, the family is full when there is none
+  std::vector<Class> cls(classes);
+  std::vector<Family> fams;
+  int cursor = 0;
+  for (int id = 0; id < classes; id++) {
+    Class &c = cls[id];
+    if (fams.empty() || cursor > fams.back().last) {
+      fams.push_back(Family{id, id});
+      c.family = fams.size() - 1;
+      c.parent = -1;
+      c.depth = 0;
+      c.virtualParent = false;
+      cursor = id;
+    } else {
+      Class &p = cls[cursor];
+      p.children++;
+      c.family = p.family;
+      c.parent = cursor;
+      c.depth = p.depth + 1;
+      c.virtualParent = percent(virt);
+      c.ifaces = p.ifaces;
+      fams.back().last = id;
+    }
+    c.children = 0;
+    c.iface = -1;
+    c.virtualIface = false;
+
+    if (c.parent >= 0 && percent(multiple)) {
+      bool v = percent(virt);
+      unsigned start = pick(interfaces);
+      for (int k = 0; k < interfaces; k++) {
+        int iface = (start + k) % interfaces;
+        auto it = c.ifaces.find(iface);
+        // a second, non-virtual subobject of the interface would make it ambiguous
+        if (it != c.ifaces.end() && !(it->second && v))
+          continue;
+        c.iface = iface;
+        c.virtualIface = v;
+        c.ifaces[iface] = it == c.ifaces.end() ? v : it->second && v;
+        break;
+      }
+    }
+
+    while (cursor <= fams.back().last &&
+           (cls[cursor].children >= fanout || cls[cursor].depth >= depth))
+      cursor++;
+  }
+
+  if (files > (int) fams.size())
+    files = fams.size();
+
+  for (int k = 0; k < files; k++) {
+    char name[64];
+    snprintf(name, sizeof(name), "tu%d.cpp", k);
+    FILE *f = create(dir, name);
+    fprintf(f, "// generated by gen_hierarchy -classes %d -depth %d -fanout %d -multiple %d "
+            "-virtual %d -interfaces %d -methods %d -calls %d -files %d -seed %d\n\n",
+            classes, depth, fanout, multiple, virt, interfaces, methods, calls, files, seed);
+
+    for (unsigned fam = k; fam < fams.size(); fam += files) {
+      fprintf(f, "namespace F%u {\n\n", fam);
+      for (int i = 0; i < interfaces; i++)
+        fprintf(f, "struct I%d {\n  virtual ~I%d() {}\n  virtual int g%d() { return -%d; }\n};\n",
+                i, i, i, i + 1);
+
+      for (int id = fams[fam].first; id <= fams[fam].last; id++) {
+        const Class &c = cls[id];
+        fprintf(f, "struct C%d", id);
+        if (c.parent >= 0)
+          fprintf(f, " : %sC%d", c.virtualParent ? "virtual " : "", c.parent);
+        if (c.iface >= 0)
+          fprintf(f, ", %sI%d", c.virtualIface ? "virtual " : "", c.iface);
+        fprintf(f, " {\n");
+        if (c.parent < 0) {
+          fprintf(f, "  virtual ~C%d() {}\n", id);
+          for (int m = 0; m < methods; m++)
+            fprintf(f, "  virtual int f%d() { return %d; }\n", m, m);
+        } else {
+          fprintf(f, "  int f%d() { return %d; }\n", id % methods, id);
+        }
+        if (c.iface >= 0)
+          fprintf(f, "  int g%d() { return %d; }\n", c.iface, id);
+        fprintf(f, "  long m%d;\n};\n", id);
+
+        // the calls go through a pointer to the class, alternating between the
+        // functions of the root and the inherited interfaces
+        fprintf(f, "static int use%d(C%d *p) {\n  return 0", id, id);
+        std::vector<int> ifaces;
+        for (auto &it : c.ifaces)
+          ifaces.push_back(it.first);
+        for (int n = 0; n < calls; n++) {
+          if (n % 2 && !ifaces.empty())
+            fprintf(f, " + p->g%d()", ifaces[(n / 2) % ifaces.size()]);
+          else
+            fprintf(f, " + p->f%d()", (id + n) % methods);
+        }
+        fprintf(f, ";\n}\n\n");
+      }
+      fprintf(f, "}\n\n");
+
+      // the volatile pointers keep LTO from devirtualizing the calls
+      fprintf(f, "int run_family%u() {\n  int sum = 0;\n", fam);
+      for (int id = fams[fam].first; id <= fams[fam].last; id++)
+        fprintf(f, "  static F%u::C%d o%d;\n  F%u::C%d *volatile p%d = &o%d;\n"
+                "  sum += F%u::use%d(p%d);\n", fam, id, id, fam, id, id, id, fam, id, id);
+      fprintf(f, "  return sum;\n}\n\n");
+    }
+    fclose(f);
+  }
+
+  FILE *f = create(dir, "main.cpp");
+  fprintf(f, "// generated by gen_hierarchy, %d classes in %u families\n\n#include <cstdio>\n\n",
+          classes, (unsigned) fams.size());
+  for (unsigned fam = 0; fam < fams.size(); fam++)
+    fprintf(f, "int run_family%u();\n", fam);
+  fprintf(f, "\nint main() {\n  int sum = 0;\n");
+  for (unsigned fam = 0; fam < fams.size(); fam++)
+    fprintf(f, "  sum += run_family%u();\n", fam);
+  fprintf(f, "  printf(\"%%d\\n\", sum);\n  return 0;\n}\n");
+  fclose(f);
+
+  printf("%d classes in %u families, %d translation units\n", classes, (unsigned) fams.size(), files);
+  return 0;
+}
@@ -0,0 +1,104 @@
+#!/bin/bash
+# Compile-time scaling of the SD passes on the synthetic programs of gen_hierarchy:
+#
+#   LLVM_BUILD_DIR=<llvm build>/bin ./run_scaling.sh [classes ...]
+#
+# For every size (1000 10000 100000 classes by default) the program is generated in
+# work/<classes>, compiled to bitcode with the SD front-end flags and linked with
+# llvm-lto -sd-time-report, which runs the SD pipeline and writes the time and RSS of
+# each pass to work/<classes>/SDOutput/prog.o-stats.json.
+#
+# results.csv gets one line per size and pass. The summary printed at the end shows
+# the seconds of every pass per size and the exponent k of its growth between two
+# sizes (time ~ classes^k): about 1 is linear, 2 or more points at a quadratic hot spot.
+#
+#   GEN_FLAGS   passed to gen_hierarchy, e.g. "-depth 8 -multiple 30 -virtual 20"
+#   CFLAGS      of the bitcode compiles, "-O0 -femit-ivtbl -femit-vtbl-checks" by default
+#   LTO_FLAGS   passed to llvm-lto, "-sd-ivtbl -sd-return" by default
+#   JOBS        parallel compiles, the number of cores by default
+
+CUR_DIR=$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)
+
+: ${LLVM_BUILD_DIR:?set LLVM_BUILD_DIR to the bin directory of the LLVM build}
+CFLAGS=${CFLAGS:-"-O0 -femit-ivtbl -femit-vtbl-checks"}
+LTO_FLAGS=${LTO_FLAGS:-"-sd-ivtbl -sd-return"}
+JOBS=${JOBS:-$(nproc)}
+
+sizes=("$@")
+if [[ ${#sizes[@]} -eq 0 ]]; then
+  sizes=(1000 10000 100000)
+fi
+
+make -C "$CUR_DIR" gen_hierarchy > /dev/null || exit 1
+
+results="$CUR_DIR/results.csv"
+echo "classes,pass,seconds,user_seconds,system_seconds,peak_rss_kb,rss_before_kb,rss_after_kb" > "$results"
+
+for n in ${sizes[@]}; do
+  work="$CUR_DIR/work/$n"
+  rm -rf "$work"
+  mkdir -p "$work"
+
+  echo "############################################################"
+  echo "generating $n classes"
+  "$CUR_DIR/gen_hierarchy" -o "$work" -classes $n $GEN_FLAGS || exit 1
+
+  echo "compiling $n classes"
+  pushd "$work" > /dev/null
+  ls *.cpp | xargs -P $JOBS -I{} sh -c "$LLVM_BUILD_DIR/clang++ $CFLAGS -flto -c {} -o \$(basename {} .cpp).o"
+  if [[ $? -ne 0 ]]; then echo "compilation of $n classes fail"; popd > /dev/null; continue; fi
+
+  echo "running the SD passes on $n classes"
+  start=$(date +%s.%N)
+  if [[ -x /usr/bin/time ]]; then
+    /usr/bin/time -f "%M" -o lto.rss \
+      "$LLVM_BUILD_DIR/llvm-lto" $LTO_FLAGS -sd-time-report -exported-symbol=main -o prog.o *.o 2> lto.log
+  else
+    "$LLVM_BUILD_DIR/llvm-lto" $LTO_FLAGS -sd-time-report -exported-symbol=main -o prog.o *.o 2> lto.log
+  fi
+  if [[ $? -ne 0 ]]; then echo "llvm-lto on $n classes fail, see $work/lto.log"; popd > /dev/null; continue; fi
+  end=$(date +%s.%N)
+  echo "llvm-lto took $(awk "BEGIN { print $end - $start }") s, max RSS $(cat lto.rss 2> /dev/null || echo "?") KB"
+
+  if [[ ! -f SDOutput/prog.o-stats.json ]]; then
+    echo "no SDOutput/prog.o-stats.json for $n classes"
+    popd > /dev/null
+    continue
+  fi
+
+  python3 - $n SDOutput/prog.o-stats.json >> "$results" <<'EOF'
+import json, sys
+n, report = sys.argv[1], json.load(open(sys.argv[2]))
+for p in report["passes"]:
+    print(",".join(str(v) for v in [n, p["name"], p["seconds"], p.get("user_seconds", ""),
+                                    p.get("system_seconds", ""), p["peak_rss_kb"],
+                                    p.get("rss_before_kb", ""), p.get("rss_after_kb", "")]))
+EOF
+  popd > /dev/null
+done
+
+echo
+echo "############################################################"
+echo "seconds per pass (growth exponent to the previous size)"
+echo "############################################################"
+python3 - "$results" <<'EOF'
+import csv, math, sys
+times, rss, sizes = {}, {}, []
+for row in csv.DictReader(open(sys.argv[1])):
+    n = int(row["classes"])
+    if n not in sizes:
+        sizes.append(n)
+    times.setdefault(row["pass"], {})[n] = times.get(row["pass"], {}).get(n, 0) + float(row["seconds"])
+    rss[n] = max(rss.get(n, 0), int(row["peak_rss_kb"]))
+print("%-24s" % "pass" + "".join("%20d" % n for n in sizes))
+for name, t in times.items():
+    line = "%-24s" % name
+    for i, n in enumerate(sizes):
+        cell = "%.3f" % t[n] if n in t else "-"
+        prev = sizes[i - 1] if i else None
+        if prev in t and n in t and t[prev] > 0 and t[n] > 0 and n != prev:
+            cell += " (%.2f)" % (math.log(t[n] / t[prev]) / math.log(float(n) / prev))
+        line += "%20s" % cell
+    print(line)
+print("%-24s" % "peak RSS (KB)" + "".join("%20d" % rss[n] for n in sizes))
+EOF
@@ -10,11 +10,11 @@ int main(int argc, char *argv[])
   A *b = func();
 
   a->f();
-  //printf("%p\n", *(int**)b);
-  //*((intptr_t*)b) = (*((intptr_t*)b) + 0x8);
-  //printf("%p\n", *(int**)b);
-  b->f();
-  
+  // the vtable of b is in libT.so, the second and third call hit the vptr cache
+  for (int i = 0; i < 3; i++)
+    b->f();
+  b->h();
+
   delete b;
   delete a;
   return 0;
@@ -0,0 +1,9 @@
+#include "classes.h"
+
+A::~A() {}
+void A::f() { a++; }
+void B::f() { b++; }
+void C::f() { c++; }
+void D::f() { d++; }
+void E::f() { e++; }
+void F::f() { f_++; }
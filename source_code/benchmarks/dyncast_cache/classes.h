@@ -0,0 +1,38 @@
+#ifndef __CLASSES_H__
+#define __CLASSES_H__
+
+// the bad_cast hierarchy, with A as a virtual base and a few more levels below
+// the diamond so that __do_dyncast has something to walk
+
+struct A {
+  virtual ~A();
+  virtual void f();
+  int a;
+};
+
+struct B: virtual public A {
+  void f();
+  int b;
+};
+
+struct C: virtual public A {
+  void f();
+  int c;
+};
+
+struct D: public B, public C {
+  void f();
+  int d;
+};
+
+struct E: public D {
+  void f();
+  int e;
+};
+
+struct F: public E {
+  void f();
+  int f_;
+};
+
+#endif
@@ -0,0 +1,91 @@
+#include "classes.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+// provided by libdyncast when the program is built with SafeDispatch,
+// missing otherwise (g++ or clang without -femit-ivtbl)
+extern "C" int __ivtbl_dynamic_cast_cache_enable(int) __attribute__((weak));
+extern "C" void __ivtbl_dynamic_cast_cache_stats(unsigned long *, unsigned long *) __attribute__((weak));
+
+#define OBJECTS 64
+
+static F *finals[OBJECTS];       // F objects
+static A *objects[OBJECTS];      // A subobjects of the F objects
+static B *crossBases[OBJECTS];   // B subobjects of the same F objects
+static A *plainBases[OBJECTS];   // B objects
+
+// prevent the compiler from folding the casts
+static void *volatile sink;
+
+template <typename Cast>
+static double nsPerCast(long iterations, Cast cast) {
+  auto start = std::chrono::steady_clock::now();
+  for (long i = 0; i < iterations; i++)
+    sink = cast(i % OBJECTS);
+  std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count() / iterations;
+}
+
+// the results of the casts against the ones the types give
+static bool castsOk() {
+  for (int i = 0; i < OBJECTS; i++) {
+    if (dynamic_cast<F *>(objects[i]) != finals[i] ||
+        dynamic_cast<C *>(crossBases[i]) != static_cast<C *>(finals[i]) ||
+        dynamic_cast<C *>(plainBases[i]) != NULL)
+      return false;
+  }
+  return true;
+}
+
+// the timings go to stderr, stdout only gets what expected_output.txt checks
+static void run(const char *mode, long iterations) {
+  bool ok = castsOk();
+  // A* of an F -> F*, succeeds
+  double down = nsPerCast(iterations, [](long i) -> void * {
+    return dynamic_cast<F *>(objects[i]);
+  });
+  // B* of an F -> C*, a cross cast through the diamond
+  double cross = nsPerCast(iterations, [](long i) -> void * {
+    return dynamic_cast<C *>(crossBases[i]);
+  });
+  // A* of a B -> C*, the cast bad_cast does with a C-style cast, fails
+  double bad = nsPerCast(iterations, [](long i) -> void * {
+    return dynamic_cast<C *>(plainBases[i]);
+  });
+
+  fprintf(stderr, "%-10s down %6.1f ns  cross %6.1f ns  failing %6.1f ns\n", mode, down, cross, bad);
+  printf("%s: casts %s\n", mode, ok && castsOk() ? "ok" : "WRONG");
+}
+
+int main(int argc, char *argv[])
+{
+  long iterations = argc > 1 ? atol(argv[1]) : 10000000;
+
+  for (int i = 0; i < OBJECTS; i++) {
+    F *f = new F();
+    finals[i] = f;
+    objects[i] = f;
+    crossBases[i] = f;
+    plainBases[i] = new B();
+  }
+
+  if (!__ivtbl_dynamic_cast_cache_enable) {
+    run("dyncast", iterations);
+    printf("built without libdyncast, no cache to compare against\n");
+    return 0;
+  }
+
+  __ivtbl_dynamic_cast_cache_enable(0);
+  run("uncached", iterations);
+
+  __ivtbl_dynamic_cast_cache_enable(1);
+  run("cached", iterations);
+
+  unsigned long hits, misses;
+  __ivtbl_dynamic_cast_cache_stats(&hits, &misses);
+  fprintf(stderr, "cache: %lu hits, %lu misses\n", hits, misses);
+  printf("cache: %s\n", hits > 0 && misses > 0 ? "used" : "NOT USED");
+  return 0;
+}
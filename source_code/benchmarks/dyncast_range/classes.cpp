@@ -0,0 +1,14 @@
+#include "classes.h"
+
+A::~A() {}
+const char *A::name() const { return "A"; }
+
+P::~P() {}
+const char *P::pad() const { return "P"; }
+
+const char *B::name() const { return "B"; }
+const char *C::name() const { return "C"; }
+const char *D::name() const { return "D"; }
+const char *E::name() const { return "E"; }
+const char *Other::name() const { return "Other"; }
+const char *Z::name() const { return "Z"; }
@@ -0,0 +1,54 @@
+#ifndef __CLASSES_H__
+#define __CLASSES_H__
+
+// dynamic_cast downcasts to classes without virtual bases, which SafeDispatch turns
+// into a range check of the vptr of the source subobject:
+//  - B and D objects are in the range of B-in-A, C objects in the one of C-in-A
+//    (A at an offset in C), the result is the pointer moved by the offset
+//  - E objects are not, __ivtbl_dynamic_cast fails the cast
+//  - the A of Z that comes from Other is not either, __ivtbl_dynamic_cast finds the
+//    B of Z with a cross cast
+
+struct A {
+  virtual ~A();
+  virtual const char *name() const;
+  int a;
+};
+
+struct P {
+  virtual ~P();
+  virtual const char *pad() const;
+  int p;
+};
+
+struct B: public A {
+  const char *name() const;
+  int b;
+};
+
+struct C: public P, public A {
+  const char *name() const;
+  int c;
+};
+
+struct D: public B {
+  const char *name() const;
+  int d;
+};
+
+struct E: public A {
+  const char *name() const;
+  int e;
+};
+
+struct Other: public A {
+  const char *name() const;
+  int o;
+};
+
+struct Z: public Other, public B {
+  const char *name() const;
+  int z;
+};
+
+#endif
@@ -0,0 +1,32 @@
+#include "classes.h"
+#include <cstdio>
+
+// out of line, so that the casts see only the static types
+__attribute__((noinline)) static B *toB(A *a) { return dynamic_cast<B *>(a); }
+__attribute__((noinline)) static C *toC(A *a) { return dynamic_cast<C *>(a); }
+
+static void check(const char *what, const void *result, const void *expected) {
+  printf("%-24s %s\n", what, result == expected ? "ok" : "WRONG");
+}
+
+int main(int argc, char *argv[])
+{
+  B *b = new B();
+  C *c = new C();
+  D *d = new D();
+  E *e = new E();
+  Z *z = new Z();
+
+  // in range
+  check("B -> B", toB(b), b);
+  check("D -> B", toB(d), static_cast<B *>(d));
+  check("C -> C (A at an offset)", toC(c), c);
+  // out of range, the library decides
+  check("E -> B", toB(e), NULL);
+  check("B -> C", toC(b), NULL);
+  check("Z (Other) -> B", toB(static_cast<Other *>(z)), static_cast<B *>(z));
+
+  // the results are usable
+  printf("%s %s %s\n", toB(d)->name(), toC(c)->name(), toB(static_cast<Other *>(z))->name());
+  return 0;
+}
@@ -0,0 +1,19 @@
+#include "classes.h"
+
+int destroyed = 0;
+
+Base::~Base() { destroyed++; }
+const char *Base::name() const { return "Base::name"; }
+const char *Base::sealed() const { return "Base::sealed"; }
+
+const char *Mid::name() const { return "Mid::name"; }
+const char *Mid::sealed() const { return "Mid::sealed"; }
+
+Leaf::~Leaf() { destroyed++; }
+const char *Leaf::name() const { return "Leaf::name"; }
+
+Pad::~Pad() { destroyed++; }
+const char *Pad::pad() const { return "Pad::pad"; }
+
+Other::~Other() { destroyed++; }
+const char *Other::pad() const { return "Other::pad"; }
@@ -0,0 +1,41 @@
+#ifndef __CLASSES_H__
+#define __CLASSES_H__
+
+// calls that SafeDispatch makes directly because the target is the final overrider:
+// a final method, a method of a final class, and a call through a final static type
+// that does not override the method (Other, whose Base is not its primary base)
+
+struct Base {
+  virtual ~Base();
+  virtual const char *name() const;
+  virtual const char *sealed() const;
+  int b;
+};
+
+struct Mid: public Base {
+  const char *name() const override;
+  const char *sealed() const final;
+  int m;
+};
+
+struct Leaf final: public Mid {
+  ~Leaf();
+  const char *name() const override;
+  int l;
+};
+
+struct Pad {
+  virtual ~Pad();
+  virtual const char *pad() const;
+  int p;
+};
+
+struct Other final: public Pad, public Base {
+  ~Other();
+  const char *pad() const override;
+  int o;
+};
+
+extern int destroyed;
+
+#endif
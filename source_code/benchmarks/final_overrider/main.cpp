@@ -0,0 +1,40 @@
+#include "classes.h"
+#include <cstdio>
+
+// out of line, so that the calls see only the static types
+__attribute__((noinline)) static const char *callSealed(const Mid *m) { return m->sealed(); }
+__attribute__((noinline)) static const char *callName(const Leaf *l) { return l->name(); }
+__attribute__((noinline)) static const char *callOther(const Other *o) { return o->name(); }
+__attribute__((noinline)) static const char *callOtherSealed(const Other *o) { return o->sealed(); }
+__attribute__((noinline)) static const char *callBase(const Base *b) { return b->name(); }
+__attribute__((noinline)) static void deleteLeaf(Leaf *l) { delete l; }
+__attribute__((noinline)) static void deleteOther(Other *o) { delete o; }
+
+int main(int argc, char *argv[])
+{
+  Mid *mid = new Mid();
+  Leaf *leaf = new Leaf();
+  Other *other = new Other();
+
+  // final method, on a Mid and on a Leaf
+  printf("%s\n", callSealed(mid));
+  printf("%s\n", callSealed(leaf));
+  // final class
+  printf("%s\n", callName(leaf));
+  // final static type that does not override the method, Base at an offset
+  printf("%s\n", callOther(other));
+  printf("%s\n", callOtherSealed(other));
+  // still virtual and checked
+  printf("%s\n", callBase(mid));
+  printf("%s\n", callBase(leaf));
+  printf("%s\n", callBase(other));
+
+  // virtual destructors of final classes
+  deleteLeaf(leaf);
+  printf("destroyed %d\n", destroyed);
+  deleteOther(other);
+  printf("destroyed %d\n", destroyed);
+  delete mid;
+  printf("destroyed %d\n", destroyed);
+  return 0;
+}
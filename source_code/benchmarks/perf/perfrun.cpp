@@ -0,0 +1,194 @@
+// Times a program and counts its hardware events with perf_event_open:
+//
+//   perfrun [-w warmups] [-r runs] -- program [args ...]
+//
+// The program runs warmups times untimed (page cache, branch predictors, CPU frequency)
+// and then runs times timed, with its output thrown away. Every run is a fresh process,
+// the counters are attached to it before the exec (enable_on_exec), so they count the
+// program but not perfrun, and they are inherited by the threads and children of the
+// program. Only user space is counted.
+//
+// The result is a single line for run_perf_benchmarks.sh:
+//
+//   wall_ms=<median> min_ms=<min> instructions=<avg> branch_misses=<avg> l1i_misses=<avg> dtlb_misses=<avg>
+//
+// A counter that the kernel or the CPU does not offer (e.g. with a perf_event_paranoid
+// above 2, or in a VM) is printed as "-". The counts are scaled by the time the counter
+// was actually scheduled when the PMU has to multiplex them.
+
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+struct Counter {
+  const char *name;
+  unsigned type;
+  unsigned long long config;
+  int fd;
+  double total;                                   // over the timed runs
+  bool available;
+};
+
+#define CACHE_READ_MISS(cache) \
+  ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static Counter counters[] = {
+  { "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, -1, 0, true },
+  { "branch_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, -1, 0, true },
+  { "l1i_misses", PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_L1I), -1, 0, true },
+  { "dtlb_misses", PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_DTLB), -1, 0, true },
+};
+
+#define NUM_COUNTERS (sizeof(counters) / sizeof(counters[0]))
+
+static void usage(const char *argv0) {
+  fprintf(stderr, "usage: %s [-w warmups] [-r runs] -- program [args ...]\n", argv0);
+  exit(1);
+}
+
+static int openCounter(const Counter &c, pid_t pid) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = c.type;
+  attr.config = c.config;
+  attr.disabled = 1;
+  attr.enable_on_exec = 1;
+  attr.inherit = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  return syscall(__NR_perf_event_open, &attr, pid, -1, -1, 0);
+}
+
+// the count scaled to the whole run, or -1 when the counter never ran
+static double readCounter(int fd) {
+  unsigned long long v[3];
+  if (read(fd, v, sizeof(v)) != sizeof(v) || v[2] == 0)
+    return -1;
+  return (double) v[0] * v[1] / v[2];
+}
+
+// runs the program once, returns its wall time in ms; counts into the counters if timed
+static double runOnce(char **argv, bool timed) {
+  int go[2];
+  if (pipe(go)) {
+    perror("perfrun: pipe");
+    exit(1);
+  }
+
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("perfrun: fork");
+    exit(1);
+  }
+  if (pid == 0) {
+    // wait until the counters are attached
+    char c;
+    close(go[1]);
+    if (read(go[0], &c, 1) != 1)
+      _exit(127);
+    close(go[0]);
+    int null = open("/dev/null", O_WRONLY);
+    if (null >= 0) {
+      dup2(null, 1);
+      close(null);
+    }
+    execvp(argv[0], argv);
+    fprintf(stderr, "perfrun: cannot run %s: %s\n", argv[0], strerror(errno));
+    _exit(127);
+  }
+
+  close(go[0]);
+  for (unsigned i = 0; i < NUM_COUNTERS; i++) {
+    counters[i].fd = -1;
+    if (timed && counters[i].available) {
+      counters[i].fd = openCounter(counters[i], pid);
+      if (counters[i].fd < 0)
+        counters[i].available = false;
+    }
+  }
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  if (write(go[1], "x", 1) != 1) {
+    perror("perfrun: write");
+    exit(1);
+  }
+  close(go[1]);
+
+  int status;
+  while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+    ;
+  std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    fprintf(stderr, "perfrun: %s failed\n", argv[0]);
+    exit(1);
+  }
+
+  for (unsigned i = 0; i < NUM_COUNTERS; i++) {
+    if (counters[i].fd < 0)
+      continue;
+    double count = readCounter(counters[i].fd);
+    if (count < 0)
+      counters[i].available = false;
+    else
+      counters[i].total += count;
+    close(counters[i].fd);
+  }
+
+  return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+int main(int argc, char *argv[])
+{
+  int warmups = 1, runs = 5;
+
+  int i = 1;
+  for (; i < argc; i++) {
+    if (!strcmp(argv[i], "--")) {
+      i++;
+      break;
+    }
+    if (i + 1 == argc)
+      usage(argv[0]);
+    if (!strcmp(argv[i], "-w"))
+      warmups = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-r"))
+      runs = atoi(argv[++i]);
+    else
+      usage(argv[0]);
+  }
+  if (i >= argc || warmups < 0 || runs < 1)
+    usage(argv[0]);
+  char **program = argv + i;
+
+  for (int n = 0; n < warmups; n++)
+    runOnce(program, false);
+
+  std::vector<double> times;
+  for (int n = 0; n < runs; n++)
+    times.push_back(runOnce(program, true));
+  std::sort(times.begin(), times.end());
+
+  double median = runs % 2 ? times[runs / 2] : (times[runs / 2 - 1] + times[runs / 2]) / 2;
+  printf("wall_ms=%.3f min_ms=%.3f", median, times[0]);
+  for (unsigned c = 0; c < NUM_COUNTERS; c++) {
+    if (counters[c].available)
+      printf(" %s=%.0f", counters[c].name, counters[c].total / runs);
+    else
+      printf(" %s=-", counters[c].name);
+  }
+  printf("\n");
+  return 0;
+}
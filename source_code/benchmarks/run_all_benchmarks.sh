@@ -12,7 +12,6 @@ run_benchmarks() {
   local CUR_DIR=$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)
 
 
-  # TODO: Add  'dyn_link1'
   local -a benchmarks2=('abi_ex'
                        'multiple_secondary'
                        'my_ex1'
@@ -48,17 +47,46 @@ run_benchmarks() {
                        'simp0'
                        'virtual_diamond'
                        'virtual_with_virtual_primary_base'
-                       'shrink_wrap_paper_example')
-
-  local -a benchmarks=('shrink_wrap_paper_example')
-                       #'shrink_wrap_paper_example_overwrite')
+                       'shrink_wrap_paper_example'
+                       'final_overrider'
+                       'dyncast_cache'
+                       'dyncast_range'
+                       'dyn_link1'
+                       'split_codegen')
+
+  # an entry may add gold plugin options for the sd build after a colon, separated
+  # by commas: 'virtual_diamond:-sd-partition-min-cloud=2,-sd-verify-layouts'. Items
+  # in capitals are make variables of Makefile.default instead: 'dyncast_range:NO_LAYOUT=OK'
+  local -a benchmarks=('shrink_wrap_paper_example'
+                       #'shrink_wrap_paper_example_overwrite'
+                       # partition every cloud, not only the giant ones
+                       'virtual_diamond:-sd-partition-min-cloud=2,-sd-verify-layouts'
+                       'double_virtual_diamond:-sd-partition-min-cloud=2,-sd-verify-layouts'
+                       'quaternary_diamond:-sd-partition-min-cloud=2,-sd-verify-layouts'
+                       'multiple_secondary_diamond:-sd-partition-min-cloud=2,-sd-verify-layouts'
+                       'multiple_secondary_virtual_diamond:-sd-partition-min-cloud=2,-sd-verify-layouts'
+                       'non_virtual_diamond_with_virtual_ancestor:-sd-partition-min-cloud=2,-sd-verify-layouts'
+                       # SD features with an expected_output.txt
+                       'final_overrider'
+                       'dyncast_cache'
+                       'dyncast_range'
+                       # no layout: SDCleanup lowers the dynamic_cast range checks to false
+                       'dyncast_range:NO_LAYOUT=OK'
+                       'bad_dyncast_range'
+                       # cross-DSO checks: libT.so passes vptr_safe, a heap vtable traps
+                       'dyn_link1'
+                       'bad_dyn_link1'
+                       # code generation of three partitions on threads of their own
+                       'split_codegen:jobs=3')
 
   local -a neg_benchs=('bad_cast'
                        'bad_multiple_inheritnace_cast'
                        'bad_mult_inh_sibling_cast'
                        'bad_shrinkwrap_ex' #this contains an invalid cast
                        'bad_sibling_cast_parent_method_call'
-                       'bad_cast_info')
+                       'bad_cast_info'
+                       'bad_dyncast_range'
+                       'bad_dyn_link1')
 
   # add the negative benchmarks as well
   #local -a benchmarks=("${benchmarks[@]}" "${neg_benchs[@]}")
@@ -69,8 +97,17 @@ run_benchmarks() {
     local -a benchmarks=($@)
   fi
 
-  local b
-  for b in ${benchmarks[@]}; do
+  local entry b item opts vars
+  for entry in ${benchmarks[@]}; do
+    b=${entry%%:*}
+    opts=""
+    vars=""
+    if [[ $entry == *:* ]]; then
+      for item in $(echo "${entry#*:}" | tr ',' ' '); do
+        if [[ $item =~ ^[A-Z_]+= ]]; then vars="$vars $item"; else opts="$opts $item"; fi
+      done
+    fi
+
     if [[ -d $b ]]; then
       pushd $b > /dev/null
 
@@ -87,19 +124,24 @@ run_benchmarks() {
       if [[ $? -ne 0 ]]; then echo "g++ run fail"; continue; fi
 
       echo "############################################################"
-      echo "sd compiling $b"
+      echo "sd compiling $b$vars$opts"
 
-      make clean all > /dev/null
+      env $vars SD_PLUGIN_OPTS="$opts" make clean all > /dev/null
       if [[ $? -ne 0 ]]; then echo "sd compilation fail"; continue; fi
 
       echo "############################################################"
-      echo "sd running $b"
+      echo "sd running $b$vars$opts"
 
       containsElement "$b" "${neg_benchs[@]}"
       local isNeg=$?
       if [[ $isNeg -eq 0 ]]; then
-        ./main 2>&1 > /dev/null
+        ./main 2>&1 > /tmp/sd_run.txt
         if [[ $? -eq 0 ]]; then echo "neg bench $b should fail!"; continue; fi
+        # what the program printed before it was stopped
+        if [[ -f expected_output.txt ]] && ! cmp -s expected_output.txt /tmp/sd_run.txt; then
+          echo "sd output of $b differs from expected_output.txt"
+          diff expected_output.txt /tmp/sd_run.txt | head -20
+        fi
         python3 analyseEFI.py -w -o analysis.txt main
         popd > /dev/null
         continue
@@ -108,11 +150,22 @@ run_benchmarks() {
       ./main 2>&1 > /tmp/sd_run.txt
       if [[ $? -ne 0 ]]; then echo "sd run fail"; continue; fi
 
+      # programs of SD features that g++ does not have check their output themselves
+      if [[ -f expected_output.txt ]] && ! cmp -s expected_output.txt /tmp/sd_run.txt; then
+        echo "sd output of $b differs from expected_output.txt"
+        diff expected_output.txt /tmp/sd_run.txt | head -20
+        popd > /dev/null
+        continue
+      fi
+
       python3 ../analyseELF.py -w -o analysis.txt main
 
       rm -f /tmp/{normal,sd}_run.txt
 
-      if [[ $("$CUR_DIR/../scripts/config.py" ENABLE_SD) == "True" ]]; then
+      if [[ $vars == *NO_LAYOUT=OK* ]]; then
+        # without a layout the original vtables stay
+        :
+      elif [[ $("$CUR_DIR/../scripts/config.py" ENABLE_SD) == "True" ]]; then
         if [[ `readelf -sW main | grep -vP ' _ZT(V|C)(S|N10__cxxabiv)' | grep -P ' _ZT(V|C)' | wc -l` != "0" ]]; then
             echo "Original vtables remain !!!"
             continue
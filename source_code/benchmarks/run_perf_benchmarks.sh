@@ -0,0 +1,135 @@
+#!/bin/bash
+# Runtime overhead of the CFI schemes on the virtual call kernels of vcall_kernels:
+#
+#   ./run_perf_benchmarks.sh [kernel ...]
+#
+# Every kernel (all of them by default) is built at -O2 in each configuration of
+# Makefile.default:
+#
+#   gcc        g++, no LTO (NO_LTO=OK)
+#   vtv        g++-4.9 -fvtable-verify=std (VTV=OK)
+#   clang      clang++ -flto without any checks (CLANG=OK)
+#   llvmcfi    clang++ -flto -fsanitize=cfi-vcall (LLVMCFI=OK)
+#   sd-ivtbl   SafeDispatch, interleaved vtables (the default)
+#   sd-ovtbl   SafeDispatch, ordered vtables (OVTBL=OK)
+#
+# and run by perf/perfrun, WARMUPS times untimed and then RUNS times timed. The output
+# of every configuration is checked against the one of the first (gcc). perf_results.csv
+# gets one line per kernel and configuration, the table at the end shows the median time, the
+# overhead of vtv over gcc and of llvmcfi and SD over clang (the same compiler and LTO
+# pipeline without the checks), and the hardware counters per run.
+#
+#   ITERATIONS  passes of a kernel over its objects, 20000 by default
+#   WARMUPS     untimed runs, 1 by default
+#   RUNS        timed runs, 5 by default
+#   CONFIGS     the configurations to build, e.g. "clang sd-ivtbl sd-ovtbl"
+#
+# LLVM_BUILD_DIR, BINUTILS_BUILD_DIR and LLVM_DIR come from Makefile.config as for
+# run_all_benchmarks.sh.
+
+CUR_DIR=$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)
+
+ITERATIONS=${ITERATIONS:-20000}
+WARMUPS=${WARMUPS:-1}
+RUNS=${RUNS:-5}
+CONFIGS=${CONFIGS:-"gcc vtv clang llvmcfi sd-ivtbl sd-ovtbl"}
+
+kernels=("$@")
+if [[ ${#kernels[@]} -eq 0 ]]; then
+  kernels=(mono poly deep multiple virtual dyncast)
+fi
+
+config_vars() {
+  case $1 in
+    gcc)      echo "NO_LTO=OK" ;;
+    vtv)      echo "VTV=OK" ;;
+    clang)    echo "CLANG=OK" ;;
+    llvmcfi)  echo "LLVMCFI=OK" ;;
+    sd-ivtbl) echo "" ;;
+    sd-ovtbl) echo "OVTBL=OK" ;;
+    *)        return 1 ;;
+  esac
+}
+
+make -C "$CUR_DIR/perf" perfrun > /dev/null || exit 1
+perfrun="$CUR_DIR/perf/perfrun"
+
+results="$CUR_DIR/perf_results.csv"
+echo "kernel,config,wall_ms,min_ms,instructions,branch_misses,l1i_misses,dtlb_misses" > "$results"
+
+expected=$(mktemp -d)
+trap "rm -rf $expected" EXIT
+
+pushd "$CUR_DIR/vcall_kernels" > /dev/null
+for config in $CONFIGS; do
+  vars=$(config_vars $config)
+  if [[ $? -ne 0 ]]; then echo "unknown configuration $config"; continue; fi
+
+  echo "############################################################"
+  echo "$config compiling vcall_kernels"
+
+  env $vars make clean all OPT=-O2 > /dev/null
+  if [[ $? -ne 0 ]]; then echo "$config compilation fail"; continue; fi
+  # keep the binary, the next configuration cleans the directory
+  cp main "$expected/main.$config"
+
+  for k in ${kernels[@]}; do
+    echo "$config running $k"
+
+    "$expected/main.$config" $k $ITERATIONS > "$expected/out.$config"
+    if [[ $? -ne 0 ]]; then echo "$config run of $k fail"; continue; fi
+    if [[ -f "$expected/out.$k" ]]; then
+      if ! cmp -s "$expected/out.$k" "$expected/out.$config"; then
+        echo "$config output of $k differs from the first configuration"
+        continue
+      fi
+    else
+      cp "$expected/out.$config" "$expected/out.$k"
+    fi
+
+    line=$("$perfrun" -w $WARMUPS -r $RUNS -- "$expected/main.$config" $k $ITERATIONS)
+    if [[ $? -ne 0 ]]; then echo "$config perfrun of $k fail"; continue; fi
+    echo "  $line"
+
+    echo "$k,$config,$(echo "$line" | sed -e 's/[a-z0-9_]*=//g' -e 's/ /,/g')" >> "$results"
+  done
+done
+make clean > /dev/null
+popd > /dev/null
+
+echo
+echo "############################################################"
+echo "median ms over $RUNS runs, overhead and counters per run"
+echo "############################################################"
+python3 - "$results" <<'EOF'
+import csv, sys
+rows, kernels, configs = {}, [], []
+for row in csv.DictReader(open(sys.argv[1])):
+    rows[(row["kernel"], row["config"])] = row
+    if row["kernel"] not in kernels:
+        kernels.append(row["kernel"])
+    if row["config"] not in configs:
+        configs.append(row["config"])
+
+# vtv is measured against g++, everything else against clang without checks
+def baseline(kernel, config):
+    base = "gcc" if config in ("gcc", "vtv") else "clang"
+    if (kernel, base) not in rows:
+        base = "gcc"
+    return rows.get((kernel, base)), base
+
+counters = ["instructions", "branch_misses", "l1i_misses", "dtlb_misses"]
+for k in kernels:
+    print()
+    print("%-10s %10s %16s" % (k, "ms", "overhead") + "".join("%16s" % c for c in counters))
+    for c in configs:
+        row = rows.get((k, c))
+        if row is None:
+            continue
+        base, name = baseline(k, c)
+        overhead = "-"
+        if base is not None and base is not row and float(base["wall_ms"]) > 0:
+            overhead = "%+.1f%% (%s)" % ((float(row["wall_ms"]) / float(base["wall_ms"]) - 1) * 100, name)
+        print("%-10s %10.2f %16s" % (c, float(row["wall_ms"]), overhead) +
+              "".join("%16s" % row[n] for n in counters))
+EOF
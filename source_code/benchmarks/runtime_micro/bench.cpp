@@ -0,0 +1,284 @@
+// Microbenchmarks of the SafeDispatch runtime entry points:
+//
+//   bench [-t max threads] [-n iterations] [-f filter] libsdbench0.so ...
+//
+// findRange and vptr_safe (libdlcfi) run against the range maps and white lists of the
+// synthetic DSOs, __ivtbl_dynamic_cast (libdyncast) against their class chains, with
+// its cache bypassed and enabled. The DSOs are used round robin.
+//
+// Every entry point runs with 1, 2, 4, ... threads up to the maximum. ns/op is the
+// average time of an operation in one thread, Mops/s the throughput of all threads
+// together and p99 the 99th percentile of individually timed operations (minus the
+// cost of reading the clock), measured in a second, shorter run.
+
+#include "sdbench.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <dlfcn.h>
+#include <unistd.h>
+
+// libdlcfi
+RangeMapElement_t *findRange(RangeMap_t *rMap, const char *className);
+bool vptr_safe(const void *vptr, const char *className);
+
+// libdyncast, the offsets of the rtti and offset-to-top entries are the ones of the
+// regular Itanium vtables the host compiler gives the synthetic classes
+extern "C" void *__ivtbl_dynamic_cast(const void *src_ptr, const void *src_type,
+                                      const void *dst_type, ptrdiff_t src2dst,
+                                      ptrdiff_t rttiOff, ptrdiff_t ottOff);
+extern "C" int __ivtbl_dynamic_cast_cache_enable(int enable);
+
+#define RTTI_OFF (-(ptrdiff_t) sizeof(void *))
+#define OTT_OFF  (-2 * (ptrdiff_t) sizeof(void *))
+
+// individually timed operations per thread, relative to the iterations
+#define LATENCY_RUN_DIVISOR 4
+
+static std::vector<const sdbench_dso *> dsos;
+
+// prevent the compiler from dropping the calls
+static std::atomic<long> sink(0);
+
+typedef long (*op_t)(long i);
+
+static inline const sdbench_dso *dsoOf(long i) {
+  return dsos[i % dsos.size()];
+}
+
+static long findRangeHit(long i) {
+  const sdbench_dso *d = dsoOf(i);
+  RangeMap_t *map = d->rangeMap;
+  return (long) findRange(map, map->elements[(i / dsos.size()) % map->nelements].name);
+}
+
+static long findRangeMiss(long i) {
+  return (long) findRange(dsoOf(i)->rangeMap, "sdbench.missing");
+}
+
+static long vptrSafeRange(long i) {
+  const sdbench_dso *d = dsoOf(i);
+  long r = (i / dsos.size()) % d->rangeMap->nelements;
+  return vptr_safe(d->inRange[r], d->rangeMap->elements[r].name);
+}
+
+static long vptrSafeWhiteList(long i) {
+  const sdbench_dso *d = dsoOf(i);
+  long w = (i / dsos.size()) % d->whiteList->nelements;
+  return vptr_safe(d->whiteListed[w], d->whiteList->elements[w].name);
+}
+
+static long vptrSafeFail(long i) {
+  const sdbench_dso *d = dsoOf(i);
+  return vptr_safe(d->outside, d->rangeMap->elements[0].name);
+}
+
+static inline long dyncast(const sdbench_cast *casts, long i) {
+  const sdbench_cast &c = casts[(i / dsos.size()) % dsoOf(i)->families];
+  return (long) __ivtbl_dynamic_cast(c.src, c.srcType, c.dstType, c.src2dst, RTTI_OFF, OTT_OFF);
+}
+
+static long dyncastDown(long i) { return dyncast(dsoOf(i)->down, i); }
+static long dyncastCross(long i) { return dyncast(dsoOf(i)->cross, i); }
+static long dyncastFailing(long i) { return dyncast(dsoOf(i)->failing, i); }
+
+struct Benchmark {
+  const char *name;
+  op_t op;
+  int dyncastCache;                               // -1: does not use __ivtbl_dynamic_cast
+  bool succeeds;                                  // expected result, checked before timing
+};
+
+static const Benchmark benchmarks[] = {
+  { "findRange hit",                     findRangeHit,      -1, true  },
+  { "findRange miss",                    findRangeMiss,     -1, false },
+  { "vptr_safe range",                   vptrSafeRange,     -1, true  },
+  { "vptr_safe white list",              vptrSafeWhiteList, -1, true  },
+  { "vptr_safe fail",                    vptrSafeFail,      -1, false },
+  { "ivtbl_dynamic_cast down",           dyncastDown,        0, true  },
+  { "ivtbl_dynamic_cast cross",          dyncastCross,       0, true  },
+  { "ivtbl_dynamic_cast failing",        dyncastFailing,     0, false },
+  { "ivtbl_dynamic_cast down cached",    dyncastDown,        1, true  },
+  { "ivtbl_dynamic_cast cross cached",   dyncastCross,       1, true  },
+  { "ivtbl_dynamic_cast failing cached", dyncastFailing,     1, false },
+};
+
+typedef std::chrono::steady_clock bench_clock;
+
+static double nsSince(bench_clock::time_point start) {
+  return std::chrono::duration<double, std::nano>(bench_clock::now() - start).count();
+}
+
+// median cost of reading the clock twice, subtracted from the timed operations
+static double timerOverhead() {
+  std::vector<double> samples;
+  for (int i = 0; i < 10001; i++) {
+    bench_clock::time_point start = bench_clock::now();
+    samples.push_back(nsSince(start));
+  }
+  std::nth_element(samples.begin(), samples.begin() + samples.size() / 2, samples.end());
+  return samples[samples.size() / 2];
+}
+
+// starts all threads at the same time
+class StartLine {
+public:
+  explicit StartLine(int threads) : waiting(threads) {}
+
+  void wait() {
+    waiting.fetch_sub(1);
+    while (waiting.load() > 0)
+      ;
+  }
+
+private:
+  std::atomic<int> waiting;
+};
+
+struct Result {
+  double nsPerOp;
+  double mopsPerSec;
+  double p99;
+};
+
+static Result run(op_t op, int threads, long iterations, double overhead) {
+  std::vector<std::thread> workers;
+  std::vector<double> threadNs(threads);
+  std::vector<std::vector<double> > latencies(threads);
+
+  // throughput
+  StartLine throughputStart(threads);
+  bench_clock::time_point wallStart;
+  for (int t = 0; t < threads; t++) {
+    workers.push_back(std::thread([&, t]() {
+      long first = t * iterations, sum = 0;
+      for (long i = first; i < first + iterations / 16; i++)  // warm up
+        sum += op(i);
+      throughputStart.wait();
+      if (t == 0)
+        wallStart = bench_clock::now();
+      bench_clock::time_point start = bench_clock::now();
+      for (long i = first; i < first + iterations; i++)
+        sum += op(i);
+      threadNs[t] = nsSince(start);
+      sink += sum;
+    }));
+  }
+  for (std::thread &w : workers)
+    w.join();
+  double wallNs = nsSince(wallStart);
+  workers.clear();
+
+  // latency
+  StartLine latencyStart(threads);
+  long timed = std::max(iterations / LATENCY_RUN_DIVISOR, 1L);
+  for (int t = 0; t < threads; t++) {
+    workers.push_back(std::thread([&, t]() {
+      std::vector<double> &samples = latencies[t];
+      samples.reserve(timed);
+      long first = t * iterations, sum = 0;
+      latencyStart.wait();
+      for (long i = first; i < first + timed; i++) {
+        bench_clock::time_point start = bench_clock::now();
+        sum += op(i);
+        samples.push_back(std::max(nsSince(start) - overhead, 0.0));
+      }
+      sink += sum;
+    }));
+  }
+  for (std::thread &w : workers)
+    w.join();
+
+  std::vector<double> all;
+  double totalNs = 0;
+  for (int t = 0; t < threads; t++) {
+    all.insert(all.end(), latencies[t].begin(), latencies[t].end());
+    totalNs += threadNs[t];
+  }
+  size_t p99 = all.size() * 99 / 100;
+  std::nth_element(all.begin(), all.begin() + p99, all.end());
+
+  Result r;
+  r.nsPerOp = totalNs / threads / iterations;
+  r.mopsPerSec = (double) threads * iterations / wallNs * 1000;
+  r.p99 = all[p99];
+  return r;
+}
+
+static void usage(const char *argv0) {
+  fprintf(stderr, "usage: %s [-t max threads] [-n iterations] [-f filter] <dso> ...\n", argv0);
+  exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+  int maxThreads = std::max(1u, std::thread::hardware_concurrency());
+  long iterations = 200000;
+  const char *filter = NULL;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "t:n:f:")) != -1) {
+    switch (opt) {
+    case 't': maxThreads = atoi(optarg); break;
+    case 'n': iterations = atol(optarg); break;
+    case 'f': filter = optarg; break;
+    default:  usage(argv[0]);
+    }
+  }
+  if (optind == argc || maxThreads < 1 || iterations < 1)
+    usage(argv[0]);
+
+  for (int i = optind; i < argc; i++) {
+    void *handle = dlopen(argv[i], RTLD_NOW | RTLD_LOCAL);
+    if (!handle) {
+      fprintf(stderr, "%s\n", dlerror());
+      return 1;
+    }
+    const sdbench_dso *dso = (const sdbench_dso *) dlsym(handle, "sdbench_dso_info");
+    if (!dso) {
+      fprintf(stderr, "%s: not a synthetic DSO (no sdbench_dso_info)\n", argv[i]);
+      return 1;
+    }
+    dsos.push_back(dso);
+  }
+
+  const sdbench_dso *d = dsos[0];
+  printf("%zu DSOs, %d class chains of depth %d, %lld ranges, %lld white list entries each\n",
+         dsos.size(), d->families, d->depth, (long long) d->rangeMap->nelements,
+         (long long) d->whiteList->nelements);
+
+  double overhead = timerOverhead();
+  printf("%ld iterations per thread, clock overhead %.1f ns\n\n", iterations, overhead);
+  printf("%-36s %7s %10s %10s %10s\n", "entry point", "threads", "ns/op", "p99 ns", "Mops/s");
+
+  for (const Benchmark &b : benchmarks) {
+    if (filter && !strstr(b.name, filter))
+      continue;
+    if (b.dyncastCache >= 0)
+      __ivtbl_dynamic_cast_cache_enable(b.dyncastCache);
+
+    // a benchmark of the wrong path is worse than none
+    for (long i = 0; i < 1024; i++) {
+      if ((b.op(i) != 0) != b.succeeds) {
+        fprintf(stderr, "%s: unexpected result for operation %ld\n", b.name, i);
+        return 1;
+      }
+    }
+
+    for (int threads = 1; ; threads = std::min(threads * 2, maxThreads)) {
+      Result r = run(b.op, threads, iterations, overhead);
+      printf("%-36s %7d %10.1f %10.1f %10.2f\n", b.name, threads, r.nsPerOp, r.p99, r.mopsPerSec);
+      fflush(stdout);
+      if (threads == maxThreads)
+        break;
+    }
+  }
+  return 0;
+}
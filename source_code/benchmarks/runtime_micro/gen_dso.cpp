@@ -0,0 +1,130 @@
+// Writes the source of one synthetic DSO for the runtime microbenchmarks:
+//
+//   gen_dso -id N [-classes C] [-depth D] [-ranges R] [-whitelist W]
+//
+// The DSO has C classes in chains of D classes. The last class of every chain also
+// derives from a side class, so that the chains have down casts, cross casts and
+// failing casts of depth D. Its range map has R ranges over a block of fake vtables
+// and its white list W entries, patch_dynamic points the libdlcfi dynamic tags at them.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+static void usage(const char *argv0) {
+  fprintf(stderr, "usage: %s -id N [-classes C] [-depth D] [-ranges R] [-whitelist W]\n", argv0);
+  exit(1);
+}
+
+// vtable slots covered by every range
+#define SLOTS_PER_RANGE 4
+
+int main(int argc, char *argv[])
+{
+  int id = -1, classes = 64, depth = 4, ranges = 64, whitelist = 16;
+
+  for (int i = 1; i < argc; i++) {
+    if (i + 1 == argc)
+      usage(argv[0]);
+    int value = atoi(argv[i + 1]);
+    if (!strcmp(argv[i], "-id"))
+      id = value;
+    else if (!strcmp(argv[i], "-classes"))
+      classes = value;
+    else if (!strcmp(argv[i], "-depth"))
+      depth = value;
+    else if (!strcmp(argv[i], "-ranges"))
+      ranges = value;
+    else if (!strcmp(argv[i], "-whitelist"))
+      whitelist = value;
+    else
+      usage(argv[0]);
+    i++;
+  }
+  if (id < 0 || depth < 1 || ranges < 1 || whitelist < 1)
+    usage(argv[0]);
+
+  // a chain has depth classes, the side class and the leaf
+  int families = classes / (depth + 2);
+  if (families < 1)
+    families = 1;
+
+  printf("// generated by gen_dso -id %d -classes %d -depth %d -ranges %d -whitelist %d\n\n",
+         id, classes, depth, ranges, whitelist);
+  printf("#include \"sdbench.h\"\n\n#include <typeinfo>\n\n");
+
+  printf("namespace sdbench%d {\n\n", id);
+  for (int f = 0; f < families; f++) {
+    printf("struct C%d_0 {\n  virtual ~C%d_0() {}\n  virtual int f() { return 0; }\n  long m0;\n};\n",
+           f, f);
+    for (int d = 1; d < depth; d++)
+      printf("struct C%d_%d : C%d_%d {\n  int f() { return %d; }\n  long m%d;\n};\n",
+             f, d, f, d - 1, d, d);
+    printf("struct S%d {\n  virtual ~S%d() {}\n  virtual int g() { return 0; }\n  long s;\n};\n",
+           f, f);
+    printf("struct L%d : C%d_%d, S%d {\n  int f() { return %d; }\n  int g() { return 1; }\n};\n\n",
+           f, f, depth - 1, f, depth);
+    printf("static L%d leaf%d;\nstatic C%d_%d mid%d;\n\n", f, f, f, depth - 1, f);
+  }
+  printf("}\n\nusing namespace sdbench%d;\n\n", id);
+
+  // down: root of a leaf to the leaf, cross: side of a leaf to the root of its chain,
+  // failing: root of the deepest chain class to the leaf
+  const char *kinds[] = { "down", "cross", "failing" };
+  for (int k = 0; k < 3; k++) {
+    printf("static const sdbench_cast %s[] = {\n", kinds[k]);
+    for (int f = 0; f < families; f++) {
+      if (k == 0)
+        printf("  { static_cast<C%d_0*>(&leaf%d), &typeid(C%d_0), &typeid(L%d), 0 },\n",
+               f, f, f, f);
+      else if (k == 1)
+        printf("  { static_cast<S%d*>(&leaf%d), &typeid(S%d), &typeid(C%d_0), -2 },\n",
+               f, f, f, f);
+      else
+        printf("  { static_cast<C%d_0*>(&mid%d), &typeid(C%d_0), &typeid(L%d), 0 },\n",
+               f, f, f, f);
+    }
+    printf("};\n\n");
+  }
+
+  // the fake vtables: every range covers SLOTS_PER_RANGE slots, the white listed vptrs
+  // and the one outside of everything follow the ranges
+  printf("static const void *vtables[%d] __attribute__((aligned(64)));\n",
+         ranges * SLOTS_PER_RANGE + whitelist + 1);
+
+  printf("\nstatic const void *const inRange[] = {\n");
+  for (int r = 0; r < ranges; r++)
+    printf("  &vtables[%d],\n", r * SLOTS_PER_RANGE + 1);
+  printf("};\n\nstatic const void *const whiteListed[] = {\n");
+  for (int w = 0; w < whitelist; w++)
+    printf("  &vtables[%d],\n", ranges * SLOTS_PER_RANGE + w);
+  printf("};\n\n");
+
+  printf("struct sdbench_range_map_t {\n  int64_t nelements;\n  RangeMapElement_t elements[%d];\n};\n",
+         ranges);
+  printf("struct sdbench_white_list_t {\n  int64_t nelements;\n  WhiteListElement_t elements[%d];\n};\n\n",
+         whitelist);
+
+  printf("extern \"C\" {\n\n");
+  printf("sdbench_range_map_t sdbench_range_map = { %d, {\n", ranges);
+  for (int r = 0; r < ranges; r++)
+    printf("  { (char *) \"sdbench%d.range%d\", (int64_t) &vtables[%d], %d, sizeof(void *) },\n",
+           id, r, r * SLOTS_PER_RANGE, SLOTS_PER_RANGE);
+  printf("} };\n\n");
+
+  printf("sdbench_white_list_t sdbench_white_list = { %d, {\n", whitelist);
+  for (int w = 0; w < whitelist; w++)
+    printf("  { (char *) \"sdbench%d.white%d\", (int64_t) &vtables[%d] },\n",
+           id, w, ranges * SLOTS_PER_RANGE + w);
+  printf("} };\n\n");
+
+  printf("sdbench_dso sdbench_dso_info = {\n"
+         "  %d, %d, %d,\n"
+         "  (RangeMap_t *) &sdbench_range_map,\n"
+         "  (WhiteList_t *) &sdbench_white_list,\n"
+         "  inRange, whiteListed, &vtables[%d],\n"
+         "  down, cross, failing\n"
+         "};\n\n}\n",
+         id, families, depth, ranges * SLOTS_PER_RANGE + whitelist);
+  return 0;
+}
@@ -0,0 +1,90 @@
+// Points the libdlcfi dynamic tags of a synthetic DSO at its range map and white list:
+//
+//   patch_dynamic libsdbenchN.so
+//
+// The linker does not know about the tags, so the DSO is linked with spare dynamic
+// entries (--spare-dynamic-tags) and two of them are rewritten in place. The values are
+// the addresses of the sdbench_range_map and sdbench_white_list symbols, vptr_safe adds
+// the load address of the DSO to them.
+
+#include "sdbench.h"
+
+#include <elf.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+static void fail(const char *file, const char *msg) {
+  fprintf(stderr, "patch_dynamic: %s: %s\n", file, msg);
+  exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s <dso>\n", argv[0]);
+    return 1;
+  }
+  const char *file = argv[1];
+
+  FILE *f = fopen(file, "r+b");
+  if (!f)
+    fail(file, "cannot open");
+  std::vector<char> image;
+  char buf[65536];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    image.insert(image.end(), buf, buf + n);
+
+  const Elf64_Ehdr *ehdr = (const Elf64_Ehdr *) image.data();
+  if (image.size() < sizeof(Elf64_Ehdr) || memcmp(ehdr->e_ident, ELFMAG, SELFMAG) ||
+      ehdr->e_ident[EI_CLASS] != ELFCLASS64)
+    fail(file, "not a 64-bit ELF file");
+
+  const Elf64_Shdr *shdrs = (const Elf64_Shdr *) (image.data() + ehdr->e_shoff);
+  const Elf64_Shdr *dynsym = NULL, *dynamic = NULL;
+  for (int i = 0; i < ehdr->e_shnum; i++) {
+    if (shdrs[i].sh_type == SHT_DYNSYM)
+      dynsym = &shdrs[i];
+    else if (shdrs[i].sh_type == SHT_DYNAMIC)
+      dynamic = &shdrs[i];
+  }
+  if (!dynsym || !dynamic)
+    fail(file, "no dynamic symbols or no dynamic section");
+
+  // addresses of the tables
+  const Elf64_Sym *syms = (const Elf64_Sym *) (image.data() + dynsym->sh_offset);
+  const char *strtab = image.data() + shdrs[dynsym->sh_link].sh_offset;
+  Elf64_Addr rangeMap = 0, whiteList = 0;
+  for (size_t i = 0; i < dynsym->sh_size / sizeof(Elf64_Sym); i++) {
+    if (!strcmp(strtab + syms[i].st_name, "sdbench_range_map"))
+      rangeMap = syms[i].st_value;
+    else if (!strcmp(strtab + syms[i].st_name, "sdbench_white_list"))
+      whiteList = syms[i].st_value;
+  }
+  if (!rangeMap || !whiteList)
+    fail(file, "sdbench_range_map or sdbench_white_list is not exported");
+
+  // rewrite the first spare entries, keeping the last DT_NULL as the terminator
+  Elf64_Dyn *dyn = (Elf64_Dyn *) (image.data() + dynamic->sh_offset);
+  size_t count = dynamic->sh_size / sizeof(Elf64_Dyn);
+  size_t first = 0;
+  while (first < count && dyn[first].d_tag != DT_NULL) {
+    if (dyn[first].d_tag == DT_SD_RANGE_MAP || dyn[first].d_tag == DT_SD_WHITE_LIST)
+      fail(file, "already patched");
+    first++;
+  }
+  if (count - first < 3)
+    fail(file, "not enough spare dynamic entries, link with --spare-dynamic-tags");
+
+  dyn[first].d_tag = DT_SD_RANGE_MAP;
+  dyn[first].d_un.d_ptr = rangeMap;
+  dyn[first + 1].d_tag = DT_SD_WHITE_LIST;
+  dyn[first + 1].d_un.d_ptr = whiteList;
+
+  if (fseek(f, dynamic->sh_offset + first * sizeof(Elf64_Dyn), SEEK_SET) ||
+      fwrite(&dyn[first], sizeof(Elf64_Dyn), 2, f) != 2 || fclose(f))
+    fail(file, "cannot write the dynamic section");
+  return 0;
+}
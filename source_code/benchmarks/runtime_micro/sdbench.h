@@ -0,0 +1,33 @@
+#ifndef __SDBENCH_H__
+#define __SDBENCH_H__
+
+#include <cstddef>
+#include <cstdint>
+
+// the range map and white list layouts and their dynamic tags
+#include "../../libdlcfi/dlcfi.h"
+
+// the arguments of one __ivtbl_dynamic_cast call
+struct sdbench_cast {
+  const void *src;
+  const void *srcType;                            // std::type_info of the static types
+  const void *dstType;
+  ptrdiff_t src2dst;
+};
+
+// what a synthetic DSO (written by gen_dso) exports as sdbench_dso_info
+struct sdbench_dso {
+  int id;
+  int families;                                   // independent class chains
+  int depth;                                      // classes in each chain
+  RangeMap_t *rangeMap;
+  WhiteList_t *whiteList;
+  const void *const *inRange;                     // one vptr inside each range
+  const void *const *whiteListed;                 // the vptr of each white list entry
+  const void *outside;                            // in no range and not white listed
+  const sdbench_cast *down;                       // one of each per family
+  const sdbench_cast *cross;
+  const sdbench_cast *failing;
+};
+
+#endif
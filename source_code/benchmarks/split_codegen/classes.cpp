@@ -0,0 +1,26 @@
+#include "classes.h"
+
+static int Registrations = 0;
+
+void registerShape() { ++Registrations; }
+
+namespace {
+struct Registrar {
+  Registrar() { registerShape(); }
+} TheRegistrar;
+}
+
+__attribute__((constructor)) static void registerEarly() { registerShape(); }
+
+extern "C" int registrationsImpl() { return Registrations; }
+extern "C" int registrations() __attribute__((alias("registrationsImpl")));
+
+// shapes.cpp has an internal scale as well
+static int scale(int n) { return n * 10; }
+
+int Triangle::sides() const { return 3; }
+const char *Triangle::name() const { return "triangle"; }
+
+Shape *makeTriangle() { return new Triangle(); }
+
+int scaledSides(const Shape *s) { return scale(s->sides()); }
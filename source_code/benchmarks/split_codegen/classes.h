@@ -0,0 +1,49 @@
+#ifndef __CLASSES_H__
+#define __CLASSES_H__
+
+// Globals of every linkage that SplitModule has to keep together or rename:
+// internal functions of the same name in two files, comdat template members,
+// an alias, global constructors and an extern_weak declaration. Run with
+// jobs=3.
+
+class Shape {
+public:
+  virtual ~Shape() {}
+  virtual int sides() const = 0;
+  virtual const char *name() const { return "shape"; }
+};
+
+// the members of the instantiations are linkonce_odr in comdats
+template <typename T> class Counted : public Shape {
+public:
+  static int live;
+  Counted() { ++live; }
+  virtual ~Counted() { --live; }
+};
+template <typename T> int Counted<T>::live = 0;
+
+class Triangle : public Counted<Triangle> {
+public:
+  virtual int sides() const;
+  virtual const char *name() const;
+};
+
+class Square : public Counted<Square> {
+public:
+  virtual int sides() const;
+};
+
+Shape *makeTriangle();
+Shape *makeSquare();
+
+void registerShape();
+// the number of global constructors run, defined through an alias
+extern "C" int registrations();
+int scaledSides(const Shape *s);
+int scaledSquareSides(const Shape *s);
+
+// never defined: the partitions that do not own the declaration must keep the
+// reference weak, or the link fails
+extern "C" void sdNeverDefined() __attribute__((weak));
+
+#endif
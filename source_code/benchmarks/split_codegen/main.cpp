@@ -0,0 +1,22 @@
+#include "classes.h"
+
+#include <iostream>
+
+int main(int argc, char *argv[])
+{
+  Shape *shapes[] = { makeTriangle(), makeSquare(), makeTriangle() };
+
+  std::cout << "registrations " << registrations() << std::endl;
+  std::cout << (sdNeverDefined ? "hook" : "no hook") << std::endl;
+  for (Shape *s : shapes)
+    std::cout << s->name() << " " << s->sides() << " " << scaledSides(s)
+              << " " << scaledSquareSides(s) << std::endl;
+  std::cout << "live " << Counted<Triangle>::live << " "
+            << Counted<Square>::live << std::endl;
+
+  for (Shape *s : shapes)
+    delete s;
+  std::cout << "live " << Counted<Triangle>::live << " "
+            << Counted<Square>::live << std::endl;
+  return 0;
+}
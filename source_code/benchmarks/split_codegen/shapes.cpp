@@ -0,0 +1,20 @@
+#include "classes.h"
+
+// the same internal names as in classes.cpp
+namespace {
+struct Registrar {
+  Registrar() { registerShape(); }
+} TheRegistrar;
+}
+
+static int scale(int n) { return n * 100; }
+
+int Square::sides() const { return 4; }
+
+Shape *makeSquare() { return new Square(); }
+
+int scaledSquareSides(const Shape *s) {
+  if (sdNeverDefined)
+    sdNeverDefined();
+  return scale(s->sides());
+}
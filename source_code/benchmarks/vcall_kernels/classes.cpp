@@ -0,0 +1,37 @@
+#include "classes.h"
+
+Shape::~Shape() {}
+long Shape::area(long x) const { return w * x; }
+
+long S0::area(long x) const { return w + x; }
+long S1::area(long x) const { return w - x; }
+long S2::area(long x) const { return w ^ x; }
+long S3::area(long x) const { return w * 3 + x; }
+long S4::area(long x) const { return (w + x) >> 1; }
+long S5::area(long x) const { return w | x; }
+long S6::area(long x) const { return w & x; }
+long S7::area(long x) const { return x * x - w; }
+
+L0::~L0() {}
+long L0::step(long x) const { return v + x; }
+long L1::step(long x) const { return v + x + 1; }
+long L2::step(long x) const { return v + x + 2; }
+long L3::step(long x) const { return v + x + 3; }
+long L4::step(long x) const { return v + x + 4; }
+long L5::step(long x) const { return v + x + 5; }
+long L6::step(long x) const { return v + x + 6; }
+long L7::step(long x) const { return v + x + 7; }
+
+Left::~Left() {}
+long Left::left(long x) const { return l + x; }
+Right::~Right() {}
+long Right::right(long x) const { return r + x; }
+long M::left(long x) const { return l - x; }
+long M::right(long x) const { return r - x + l; }
+
+VBase::~VBase() {}
+long VBase::get(long x) const { return b + x; }
+long VLeft::lget(long x) const { return vl + x; }
+long VRight::rget(long x) const { return vr + x; }
+long VBottom::get(long x) const { return b - x; }
+long VBottom::rget(long x) const { return vr - x + b; }
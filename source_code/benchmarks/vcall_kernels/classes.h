@@ -0,0 +1,83 @@
+#ifndef __CLASSES_H__
+#define __CLASSES_H__
+
+// the hierarchies of the virtual call kernels in main.cpp, the functions are defined
+// out of line in classes.cpp
+
+// mono, poly and dyncast: single inheritance, 8 shapes
+struct Shape {
+  virtual ~Shape();
+  virtual long area(long x) const;
+  long w;
+};
+
+#define SHAPE(N) \
+  struct S##N : public Shape { \
+    long area(long x) const; \
+  };
+
+SHAPE(0) SHAPE(1) SHAPE(2) SHAPE(3) SHAPE(4) SHAPE(5) SHAPE(6) SHAPE(7)
+
+// deep: a chain of 8 classes, the calls go through the root to every level
+struct L0 {
+  virtual ~L0();
+  virtual long step(long x) const;
+  long v;
+};
+
+#define LEVEL(N, P) \
+  struct L##N : public L##P { \
+    long step(long x) const; \
+  };
+
+LEVEL(1, 0) LEVEL(2, 1) LEVEL(3, 2) LEVEL(4, 3) LEVEL(5, 4) LEVEL(6, 5) LEVEL(7, 6)
+
+// multiple: the calls go through the secondary base, i.e. through a this-adjusting thunk
+struct Left {
+  virtual ~Left();
+  virtual long left(long x) const;
+  long l;
+};
+
+struct Right {
+  virtual ~Right();
+  virtual long right(long x) const;
+  long r;
+};
+
+struct M : public Left, public Right {
+  long left(long x) const;
+  long right(long x) const;
+};
+
+/*
+   virtual: the calls go through the virtual base of a diamond
+
+      VBase
+      /   \
+   VLeft VRight
+      \   /
+     VBottom
+*/
+struct VBase {
+  virtual ~VBase();
+  virtual long get(long x) const;
+  long b;
+};
+
+struct VLeft : virtual public VBase {
+  virtual long lget(long x) const;
+  long vl;
+};
+
+struct VRight : virtual public VBase {
+  virtual long rget(long x) const;
+  long vr;
+};
+
+struct VBottom : public VLeft, public VRight {
+  long get(long x) const;
+  long rget(long x) const;
+};
+
+#endif
@@ -0,0 +1,162 @@
+// Virtual call kernels for the runtime overhead comparison of run_perf_benchmarks.sh:
+//
+//   main [kernel] [iterations]
+//
+// Every kernel walks an array of OBJECTS objects iterations times, with one virtual
+// call (or dynamic_cast) per object, and prints a checksum that is the same in every
+// configuration. Without arguments all kernels run a few iterations, so that
+// run_all_benchmarks.sh vcall_kernels checks them like the other benchmarks.
+
+#include "classes.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#define OBJECTS 1024
+
+static Shape *sameShapes[OBJECTS];   // mono: all S3
+static Shape *shapes[OBJECTS];       // poly, dyncast: the 8 shapes in a pseudo random order
+static L0 *levels[OBJECTS];          // deep: the 8 levels of the chain
+static Right *rights[OBJECTS];       // multiple: M objects through their secondary base
+static VBase *vbases[OBJECTS];       // virtual: VBottom objects through their virtual base
+static VRight *vrights[OBJECTS];     // virtual: and through the base that has it
+
+// a pseudo random sequence, so that the order is the same in every run
+static unsigned next(unsigned &seed) {
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 16) & 0x7fff;
+}
+
+static void setup() {
+  unsigned seed = 1;
+  for (int i = 0; i < OBJECTS; i++) {
+    Shape *s;
+    switch (next(seed) % 8) {
+    case 0: s = new S0(); break;
+    case 1: s = new S1(); break;
+    case 2: s = new S2(); break;
+    case 3: s = new S3(); break;
+    case 4: s = new S4(); break;
+    case 5: s = new S5(); break;
+    case 6: s = new S6(); break;
+    default: s = new S7(); break;
+    }
+    s->w = i;
+    shapes[i] = s;
+
+    sameShapes[i] = new S3();
+    sameShapes[i]->w = i;
+
+    L0 *l;
+    switch (i % 8) {
+    case 0: l = new L0(); break;
+    case 1: l = new L1(); break;
+    case 2: l = new L2(); break;
+    case 3: l = new L3(); break;
+    case 4: l = new L4(); break;
+    case 5: l = new L5(); break;
+    case 6: l = new L6(); break;
+    default: l = new L7(); break;
+    }
+    l->v = i;
+    levels[i] = l;
+
+    M *m = new M();
+    m->l = i;
+    m->r = 2 * i;
+    rights[i] = m;
+
+    VBottom *v = new VBottom();
+    v->b = i;
+    v->vl = i + 1;
+    v->vr = i + 2;
+    vbases[i] = v;
+    vrights[i] = v;
+  }
+}
+
+static long mono(long iterations) {
+  long sum = 0;
+  for (long n = 0; n < iterations; n++)
+    for (int i = 0; i < OBJECTS; i++)
+      sum += sameShapes[i]->area(n);
+  return sum;
+}
+
+static long poly(long iterations) {
+  long sum = 0;
+  for (long n = 0; n < iterations; n++)
+    for (int i = 0; i < OBJECTS; i++)
+      sum += shapes[i]->area(n);
+  return sum;
+}
+
+static long deep(long iterations) {
+  long sum = 0;
+  for (long n = 0; n < iterations; n++)
+    for (int i = 0; i < OBJECTS; i++)
+      sum += levels[i]->step(n);
+  return sum;
+}
+
+static long multiple(long iterations) {
+  long sum = 0;
+  for (long n = 0; n < iterations; n++)
+    for (int i = 0; i < OBJECTS; i++)
+      sum += rights[i]->right(n);
+  return sum;
+}
+
+static long virtualBase(long iterations) {
+  long sum = 0;
+  for (long n = 0; n < iterations; n++)
+    for (int i = 0; i < OBJECTS; i++)
+      sum += vbases[i]->get(n) + vrights[i]->rget(n);
+  return sum;
+}
+
+static long dyncast(long iterations) {
+  long sum = 0;
+  for (long n = 0; n < iterations; n++)
+    for (int i = 0; i < OBJECTS; i++)
+      if (S3 *s = dynamic_cast<S3 *>(shapes[i]))
+        sum += s->w + n;
+  return sum;
+}
+
+struct Kernel {
+  const char *name;
+  long (*run)(long iterations);
+};
+
+static const Kernel kernels[] = {
+  { "mono", mono },
+  { "poly", poly },
+  { "deep", deep },
+  { "multiple", multiple },
+  { "virtual", virtualBase },
+  { "dyncast", dyncast },
+};
+
+int main(int argc, char *argv[])
+{
+  const char *only = argc > 1 ? argv[1] : NULL;
+  long iterations = argc > 2 ? atol(argv[2]) : 10;
+
+  setup();
+
+  bool found = false;
+  for (unsigned k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+    if (only && strcmp(only, kernels[k].name))
+      continue;
+    printf("%s %ld\n", kernels[k].name, kernels[k].run(iterations));
+    found = true;
+  }
+
+  if (!found) {
+    fprintf(stderr, "usage: %s [mono|poly|deep|multiple|virtual|dyncast] [iterations]\n", argv[0]);
+    return 1;
+  }
+  return 0;
+}
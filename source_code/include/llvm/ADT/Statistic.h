@@ -164,8 +164,9 @@ protected:
 #define STATISTIC(VARNAME, DESC) \
   static llvm::Statistic VARNAME = { DEBUG_TYPE, DESC, 0, 0 }
 
-/// \brief Enable the collection and printing of statistics.
-void EnableStatistics();
+/// \brief Enable the collection and printing of statistics. If PrintOnExit is
+/// false, they are only printed on request, not when the program exits.
+void EnableStatistics(bool PrintOnExit = true);
 
 /// \brief Check if statistics are enabled.
 bool AreStatisticsEnabled();
@@ -176,6 +177,10 @@ void PrintStatistics();
 /// \brief Print statistics to the given output stream.
 void PrintStatistics(raw_ostream &OS);
 
+/// \brief Print statistics to the given output stream as a JSON array of
+/// {"type": ..., "desc": ..., "value": ...} objects.
+void PrintStatisticsJSON(raw_ostream &OS);
+
 } // End llvm namespace
 
 #endif
@@ -0,0 +1,62 @@
+#ifndef LLVM_IR_SAFEDISPATCH_MD_H
+#define LLVM_IR_SAFEDISPATCH_MD_H
+
+#include "llvm/ADT/Hashing.h"
+#include "llvm/IR/Metadata.h"
+
+/**
+ * name of the replacement function for __dynamic_cast
+ */
+#define SD_DYNCAST_FUNC_NAME "__ivtbl_dynamic_cast"
+
+/**
+ * metadata names used for the SafeDispatch project.
+ * This meta data names are added to the new metadata
+ * nodes which are added to the source code during analysis
+ */
+#define SD_MD_CAST_FROM  "sd.cast.from"   // used to identify casts
+#define SD_MD_TYPEID     "sd.typeid"      // used to annotate the type id 
+#define SD_MD_VCALL      "sd.vcall"       // used to annotate the virtual call 
+#define SD_MD_VBASE      "sd.vbase"       // class name, original vbase offset
+#define SD_MD_MEMPTR     "sd.memptr"      // class name, annotate the member pointer 1
+#define SD_MD_MEMPTR2    "sd.memptr2"     // class name, annotate the member pointer 2 
+#define SD_MD_MEMPTR_OPT "sd.memptr3"     // class name, annotate the member pointer 3
+#define SD_MD_CHECK      "sd.check"       // class name, annotate the check 
+
+/**
+ * named md used to store the vtable info
+ */
+#define SD_MD_CLASSINFO  "sd.class_info." 
+
+/**
+ * named md used to store the class hierarchy summary (SafeDispatchClassInfo.h), one
+ * record per class: !{!"<class name>", !"<blob>", !{<vtables referenced by the blob>}}
+ */
+#define SD_MD_CLASSHIERARCHY "sd.class_hierarchy"
+
+namespace llvm {
+
+/**
+ * Key the IR linker uses to keep every SD_MD_CLASSHIERARCHY record once: the class name
+ * and a hash of the content. Returns false if the node is not a well-formed record.
+ */
+inline bool getSDClassRecordKey(const MDNode *Record, StringRef &ClassName,
+                                hash_code &ContentHash) {
+  if (Record->getNumOperands() != 3)
+    return false;
+  auto *Name = dyn_cast_or_null<MDString>(Record->getOperand(0).get());
+  auto *Blob = dyn_cast_or_null<MDString>(Record->getOperand(1).get());
+  auto *VTables = dyn_cast_or_null<MDNode>(Record->getOperand(2).get());
+  if (!Name || !Blob || !VTables)
+    return false;
+
+  // the vtable list is uniqued, so its address stands for its content
+  ClassName = Name->getString();
+  ContentHash = hash_combine(Blob->getString(), VTables);
+  return true;
+}
+
+}
+
+#endif
+
@@ -81,6 +81,18 @@ struct LTOCodeGenerator {
 
   void setShouldInternalize(bool Value) { ShouldInternalize = Value; }
 
+  // Run the SafeDispatch passes in optimize(), like the sd-ivtbl, sd-ovtbl and
+  // sd-return options of the gold plugin.
+  void setSafeDispatch(bool IVTBLs, bool OVTBLs, bool ReturnChecks) {
+    EmitIVTBLs = IVTBLs;
+    EmitOVTBLs = OVTBLs;
+    EmitReturnChecks = ReturnChecks;
+  }
+
+  // The name the SafeDispatch output files (SDOutput/<name>-...) are derived
+  // from, the file name of the linker output. Defaults to "a.out".
+  void setSDOutputName(const char *Name) { SDOutputName = Name; }
+
   void addMustPreserveSymbol(const char *sym) { MustPreserveSymbols[sym] = 1; }
 
   // To pass options to the driver and optimization passes. These options are
@@ -177,6 +189,10 @@ private:
   void *DiagContext;
   LTOModule *OwnedModule;
   bool ShouldInternalize;
+  bool EmitIVTBLs;
+  bool EmitOVTBLs;
+  bool EmitReturnChecks;
+  std::string SDOutputName;
 };
 }
 #endif
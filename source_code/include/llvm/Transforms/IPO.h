@@ -16,6 +16,8 @@
 #define LLVM_TRANSFORMS_IPO_H
 
 #include "llvm/ADT/ArrayRef.h"
+#include <string>
+#include <vector>
 
 namespace llvm {
 
@@ -24,6 +26,8 @@ class Pass;
 class Function;
 class BasicBlock;
 class GlobalValue;
+class Module;
+class StringRef;
 
 //===----------------------------------------------------------------------===//
 //
@@ -216,6 +220,24 @@ ModulePass* createSDMoveBasicBlocksPass();
 ModulePass* createSDSubstModulePass();
 ModulePass* createSDAnalysisPass();
 
+// with -sd-async-analysis the SDAnalysis pass only snapshots the CHA, the
+// functions and the call sites and analyses them on a background thread;
+// waitForSDAnalysis joins that thread (it is also joined at exit). Join it
+// before llvm_shutdown, the analysis uses managed statics.
+void setAsyncSDAnalysis(bool Enabled);
+void waitForSDAnalysis();
+
+// names the files written by the SD passes (SDAnalysis CSVs, statistics) after
+// the linker output: adds the sd_filename metadata and, when the SDOutput
+// directory can be created, the sd_output metadata
+void addSDOutputMetadata(Module &M, StringRef OutputName);
+
+// the SD passes record every file they write with noteSDOutputFile;
+// takeSDOutputFiles returns the recorded paths and forgets them, so that the
+// LTO cache of the gold plugin only keeps the files of its own link
+void noteSDOutputFile(StringRef Path);
+std::vector<std::string> takeSDOutputFiles();
+
 } // End llvm namespace
 
 #endif
@@ -1,7 +1,7 @@
 #ifndef LLVM_TRANSFORMS_IPO_SAFEDISPATCH_H
 #define LLVM_TRANSFORMS_IPO_SAFEDISPATCH_H
 
-#include "SafeDispatchMD.h"
+#include "llvm/IR/SafeDispatchMD.h"
 
 //bit cast opcode 
 #define BITCAST_OPCODE  44
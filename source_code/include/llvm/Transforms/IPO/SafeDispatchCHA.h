@@ -16,6 +16,7 @@
 #include "llvm/IR/CallSite.h"
 
 #include "llvm/Transforms/IPO/SafeDispatchLog.h"
+#include "llvm/Transforms/IPO/SafeDispatchStats.h"
 
 #include "llvm/Transforms/Utils/ValueMapper.h"
 #include "llvm/Transforms/Utils/Cloning.h"
@@ -177,8 +178,14 @@ namespace llvm {
     */
     void printClouds(const std::string &suffix);
 
+    /**
+     * Extract the vtable info from the per-module class hierarchy summaries
+     */
+    std::vector<nmd_t> static extractClassHierarchy(Module &M);
+
     /**
      * Extract the vtable info from the metadata and put it into a struct
+     * (one named node per class, as emitted before SD_MD_CLASSHIERARCHY)
      */
     std::vector<nmd_t> static extractMetadata(NamedMDNode* md);
 
@@ -218,6 +225,7 @@ namespace llvm {
       The executed code resides than in the corresponding .cpp file
       */
       sd_print("\nP2. Started building CHA ...\n");
+      sdStats::PassTimer timer("SDBuildCHA");
 
       vcallMDId = M.getMDKindID(SD_MD_VCALL);
 
@@ -439,6 +447,19 @@ namespace llvm {
     get the sub vtable index*/
     int64_t getSubVTableIndex(const vtbl_name_t& derived, const vtbl_name_t &base);
 
+    /**
+     * The (sub-)vtable whose range a sd.get.checked.vptr site with the given class name
+     * and more precise class name is checked against.
+     */
+    vtbl_t getCheckedVTable(const vtbl_name_t& className, const vtbl_name_t& preciseName);
+
+    /**
+     * Split giant clouds (at least minCloudSize sub-vtables): every primary vtable that is
+     * referenced (checked) while none of its ancestors is, and whose subtree has no parents
+     * outside of it, becomes the root of a cloud of its own. Returns the number of new clouds.
+     */
+    uint64_t partitionClouds(const vtbl_set_t& referenced, uint64_t minCloudSize);
+
     void buildFunctionInfo();
 
     std::deque<vtbl_name_t> topoSort();
@@ -0,0 +1,62 @@
+#ifndef LLVM_TRANSFORMS_IPO_SAFEDISPATCH_CALLSITES_H
+#define LLVM_TRANSFORMS_IPO_SAFEDISPATCH_CALLSITES_H
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Metadata.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Call-site descriptors of the checked virtual calls, written by clang (ItaniumCXXABI.cpp)
+ * and read back by the SD passes.
+ *
+ * Each module has one descriptor table, a tuple of
+ *   !{<class name tuple>, <precise class name tuple>, !"<function name>"}
+ * where the class name tuples are the ones of sd_getClassNameMetadata. A check only refers
+ * to the table of its module and to the index of its descriptor:
+ *   sd.get.checked.vptr(vptr, !table, i64 id)
+ * so that the IR linker maps every table (and the vtables in it) once per module.
+ */
+namespace sdCallSites {
+
+struct Descriptor {
+  std::string className;                          // the vtable name if the vtable is defined
+  std::string preciseName;
+  std::string functionName;
+};
+
+/**
+ * Interns the descriptors of a module during code generation. The calls refer to a
+ * placeholder table which emit() replaces with the final one.
+ */
+class TableBuilder {
+public:
+  llvm::MDNode *getTable(llvm::LLVMContext &C);
+
+  uint64_t getID(llvm::MDNode *classMD, llvm::MDNode *preciseMD, llvm::StringRef functionName);
+
+  void emit();
+
+private:
+  llvm::TempMDTuple placeholder;
+  std::vector<llvm::Metadata*> entries;
+  llvm::DenseMap<llvm::MDNode*, uint64_t> ids;
+};
+
+/**
+ * Decodes every table the first time one of its calls is looked at.
+ */
+class Resolver {
+public:
+  const Descriptor &get(const llvm::CallInst *CI);
+
+private:
+  llvm::DenseMap<const llvm::MDNode*, std::vector<Descriptor>> tables;
+};
+
+}
+
+#endif
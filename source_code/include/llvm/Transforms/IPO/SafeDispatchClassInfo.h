@@ -0,0 +1,76 @@
+#ifndef LLVM_TRANSFORMS_IPO_SAFEDISPATCH_CLASSINFO_H
+#define LLVM_TRANSFORMS_IPO_SAFEDISPATCH_CLASSINFO_H
+
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/ValueHandle.h"
+
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * Summary of the class hierarchy, written by clang (SafeDispatchVtblMD.h) and read back by
+ * SDBuildCHA.
+ *
+ * Each class of a module is one operand in the SD_MD_CLASSHIERARCHY named metadata:
+ *   !{!"<class name>", !"<blob>", !{<vtable of name 0 or null>, <vtable of name 1 or null>, ...}}
+ * The blob holds an interned name table followed by the sub-vtable records (the format is
+ * described in SafeDispatchClassInfo.cpp). The vtables stay real metadata references so that
+ * the IR linker keeps them pointing to the (possibly renamed) global variables. The IR linker
+ * keeps a record once per class name and content (getSDClassRecordKey).
+ */
+namespace sdClassInfo {
+
+typedef std::pair<std::string, uint64_t> name_and_number_t;
+
+struct SubVTable {
+  uint64_t order = 0;
+  uint64_t start = 0;                             // range boundaries are inclusive
+  uint64_t end = 0;
+  uint64_t addressPoint = 0;
+  std::vector<name_and_number_t> parents;         // (vtable, order), ("", 0) if there is none
+  std::vector<name_and_number_t> functions;       // (function, offset in the sub-vtable)
+};
+
+struct ClassInfo {
+  std::string className;
+  std::vector<SubVTable> subVTables;
+};
+
+/**
+ * Collects the classes of a module during code generation and emits the summary.
+ */
+class Writer {
+public:
+  /**
+   * Returns false (and records nothing) if the class was already added.
+   */
+  bool addClass(const std::string &className, llvm::GlobalVariable *VTable,
+                std::vector<SubVTable> subVTables);
+
+  bool empty() const { return classes.empty(); }
+
+  /**
+   * Add one SD_MD_CLASSHIERARCHY operand per recorded class and forget them.
+   */
+  void emit(llvm::Module &M);
+
+private:
+  std::vector<ClassInfo> classes;
+  std::set<std::string> classNames;
+  std::map<std::string, llvm::WeakVH> vtables;    // vtables given by the caller, others are looked up by name
+};
+
+/**
+ * Decode all summaries in the module. Class and parent names are replaced by the names of
+ * their vtables when those are defined. Reports a fatal error on malformed or unknown versions.
+ */
+std::vector<ClassInfo> read(const llvm::Module &M);
+
+}
+
+#endif
@@ -8,6 +8,7 @@
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/Support/Casting.h"
 #include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/Transforms/IPO/SafeDispatchTools.h"
 
 #include <utility>
 
@@ -81,5 +82,35 @@ static sd_class_md_t sd_getClassNameMetadataPair(const std::string& className,
   return sd_class_md_t(classNameMd, classVtblMd);
 }
 
+/**
+ * Inverse of sd_getClassNameMetadata: read the class name from the given operand of the
+ * tuple, or the name of the vtable global variable if one was emitted.
+ * Used by the SD passes for the metadata arguments of the sd.* intrinsics.
+ */
+static std::string sd_getClassNameFromMD(llvm::MDNode* mdNode, unsigned operandNo = 0) {
+  llvm::MDTuple* mdTuple = llvm::cast<llvm::MDTuple>(mdNode);
+  assert(mdTuple->getNumOperands() > operandNo + 1);
+
+  llvm::MDNode* nameMdNode = llvm::cast<llvm::MDNode>(mdTuple->getOperand(operandNo).get());
+  llvm::MDString* mdStr = llvm::cast<llvm::MDString>(nameMdNode->getOperand(0));
+
+  llvm::StringRef strRef = mdStr->getString();
+  assert(sd_isVtableName_ref(strRef));
+
+  // note that the global variable isn't always emitted
+  llvm::MDNode* gvMd = llvm::cast<llvm::MDNode>(mdTuple->getOperand(operandNo+1).get());
+  llvm::ConstantAsMetadata* vtblConsMd = llvm::dyn_cast_or_null<llvm::ConstantAsMetadata>(gvMd->getOperand(0).get());
+  if (vtblConsMd == NULL) {
+    return strRef.str();
+  }
+
+  llvm::GlobalVariable* vtbl = llvm::cast<llvm::GlobalVariable>(vtblConsMd->getValue());
+
+  llvm::StringRef vtblNameRef = vtbl->getName();
+  assert(vtblNameRef.startswith(strRef));
+
+  return vtblNameRef.str();
+}
+
 #endif
 
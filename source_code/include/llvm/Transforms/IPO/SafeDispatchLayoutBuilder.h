@@ -1,4 +1,5 @@
 #include "llvm/Support/raw_ostream.h"
+#include "llvm/ADT/ArrayRef.h"
 #include "llvm/Transforms/IPO/SafeDispatch.h"
 #include "llvm/Transforms/IPO/SafeDispatchCHA.h"
 #include "llvm/Transforms/IPO.h"
@@ -17,6 +18,7 @@
 #include "llvm/IR/CallSite.h"
 
 #include "llvm/Transforms/IPO/SafeDispatchLog.h"
+#include "llvm/Transforms/IPO/SafeDispatchStats.h"
 
 #include "llvm/Transforms/Utils/ValueMapper.h"
 #include "llvm/Transforms/Utils/Cloning.h"
@@ -51,13 +53,11 @@ namespace llvm {
     typedef SDBuildCHA::range_t                             range_t;    //Paul: pair of uint64_t and uint64_t
     
     typedef std::pair<Constant*, uint64_t>                  mem_range_t;
-    typedef std::map<vtbl_t, std::vector<uint64_t>>         new_layout_inds_t;
     typedef std::map<vtbl_t, std::map<uint64_t, uint64_t>>  new_layout_inds_map_t;
 
     typedef std::pair<vtbl_t, uint64_t>       					    interleaving_t;
-    typedef std::list<interleaving_t>                       interleaving_list_t;
     typedef std::vector<interleaving_t>                     interleaving_vec_t;
-    typedef std::map<vtbl_name_t, interleaving_list_t>      interleaving_map_t;
+    typedef std::map<vtbl_name_t, interleaving_vec_t>       interleaving_map_t;
 
     typedef std::map<vtbl_t, Constant*>                     vtbl_start_map_t;
     typedef std::map<vtbl_name_t, GlobalVariable*>          cloud_start_map_t;
@@ -65,7 +65,6 @@ namespace llvm {
     typedef std::map<vtbl_t, std::vector<mem_range_t> >     mem_range_map_t;
     typedef std::map<vtbl_t, uint64_t>                      pad_map_t;
 
-    new_layout_inds_t newLayoutInds;                        // (vtbl,ind) -> [new ind inside interleaved vtbl]
     interleaving_map_t interleavingMap;                     // root -> new layouts map
     vtbl_start_map_t newVTableStartAddrMap;                 // Starting addresses of all new vtables
     cloud_start_map_t cloudStartMap;                        // Mapping from new vtable names to their corresponding cloud starts
@@ -74,9 +73,30 @@ namespace llvm {
     range_map_t rangeMap;                                   // Map of ranges for vptrs in terms of preorder indices
     mem_range_map_t memRangeMap;                            // this is the memory range map for each of the nodes in a cloud
     pad_map_t prePadMap;
+
+    /**
+     * A cloud in the order of SDBuildCHA::preorder. The position of a node in nodes is its
+     * dense index, everything else refers to the nodes by it. The interleaving or ordering
+     * of the cloud fills layoutNodes next to interleavingMap, calculateNewLayoutInds fills
+     * the new indices of the entries of every node.
+     */
+    struct cloud_index_t {
+      order_t nodes;
+      std::vector<uint64_t> childBegin;                     // CSR children lists
+      std::vector<uint64_t> children;
+      std::vector<int64_t> layoutNodes;                     // new layout entry -> node, -1 for padding
+      std::vector<uint64_t> indsBegin;                      // CSR new indices of the entries of each node
+      std::vector<uint64_t> inds;
+    };
+    typedef std::pair<cloud_index_t*, uint64_t>             dense_node_t;
+
+    std::map<vtbl_name_t, cloud_index_t> cloudIndexMap;     // root -> dense index of its cloud
+    std::map<vtbl_t, dense_node_t> denseNodeMap;            // the only lookup by name, filled by indexCloud
     bool interleave;                                        // this is a flag used to decide if we interleave or order the cloud 
 
-    SDLayoutBuilder(bool interl = false) : ModulePass(ID), interleave(interl) {
+    SDLayoutBuilder(bool interl = false) : ModulePass(ID), interleave(interl),
+        numVthunksCloned(0), numVthunksShared(0), numVthunksSharedAcross(0),
+        numVthunkInstsSaved(0) {
       std::cerr << "SDLayoutBuilder(" << interl << ")\n";
       initializeSDLayoutBuilderPass(*PassRegistry::getPassRegistry());
       dummyVtable = vtbl_t("DUMMY_VTBL", 0); //this v tables are used during padding 
@@ -86,6 +106,7 @@ namespace llvm {
 
     bool runOnModule(Module &M) {
       sd_print("\nP3. Started building layout ...\n");
+      sdStats::PassTimer timer("SDLayoutBuilder");
 
       /**Paul:
       first, pass the results from the CHA pass
@@ -104,10 +125,11 @@ namespace llvm {
       on the used interleaving flag. 
       */
       
+      partitionClouds(M);
       buildNewLayouts(M);
 
       //after building the new layout verify them according to some imposed conditions 
-      assert(verifyNewLayouts(M));
+      checkNewLayouts(M);
 
       sd_print("\nP3. Finished building layout ...\n");
       return 1;
@@ -129,6 +151,18 @@ namespace llvm {
     verify the analysis results of interleave and order*/
     virtual bool verifyNewLayouts(Module &M);
 
+    /**
+     * Linear verifier over flattened copies of the layouts and vptr ranges,
+     * checks the clouds in parallel. Used instead of the above with -sd-verify-layouts.
+     */
+    bool verifyNewLayoutsFast();
+
+    /**
+     * Run the fast verifier if -sd-verify-layouts is given (fatal error on failure),
+     * otherwise verifyNewLayouts under assert.
+     */
+    void checkNewLayouts(Module &M);
+
     /*Paul:
     remove the analysis results of interleave and order*/
     virtual void removeOldLayouts(Module &M);
@@ -163,6 +197,11 @@ namespace llvm {
     Value* newVtblAddress(Module& M, const vtbl_name_t& name, Instruction* inst);
     Constant* newVtblAddressConst(Module& M, const vtbl_t& vtbl);
 
+    /**
+     * Split giant clouds at subtrees no check refers above (see -sd-partition-min-cloud)
+     */
+    void partitionClouds(Module& M);
+
     /**
      * Order and pad the cloud given by the root element.
      */
@@ -179,6 +218,17 @@ namespace llvm {
     void interleaveCloudNew(vtbl_name_t& vtbl);
 
 
+    /**
+     * Number the nodes of the cloud given by the root densely, see cloud_index_t
+     */
+    void indexCloud(const vtbl_name_t& vtbl);
+
+    /**
+     * The new indices of the entries of vtbl inside its interleaved or ordered cloud,
+     * empty if vtbl has no new layout
+     */
+    ArrayRef<uint64_t> getNewLayoutInds(const vtbl_t& vtbl);
+
     /**
      * Calculate the new layout indices for each vtable inside the given cloud
      */
@@ -192,13 +242,19 @@ namespace llvm {
     /** Paul
      * helper for the above function
      */
-    void calculateVPtrRangesHelper(const vtbl_t& vtbl, std::map<vtbl_t, uint64_t> &indMap);
+    void calculateVPtrRangesHelper(const cloud_index_t& index, uint64_t node,
+                                   std::vector<std::vector<range_t>>& ranges);
 
      /** Paul
      * after calculating the ranges, see method above, these will be checked
      */
     void verifyVPtrRanges(vtbl_name_t& vtbl);
 
+    /**
+     * Record size, padding and range statistics of the finished cloud
+     */
+    void recordCloudStats(const vtbl_name_t& vtbl);
+
     /**
      * Interleave the actual vtable elements inside the cloud and
      * create a new global variable
@@ -209,11 +265,13 @@ namespace llvm {
      * This method is used for filling the both (negative and positive) parts of an
      * interleaved vtable of a cloud.
      *
-     * @param part        : A list reference to record the <vtbl_t, element index> pairs
+     * @param part        : The new layout, the <vtbl_t, element index> pairs are appended to it
+     * @param partNodes   : The dense index of the vtable of every appended entry
      * @param order       : A list that contains the preorder traversal
      * @param positiveOff : true if we're filling the positive (function pointers) part
      */
-    void fillVtablePart(interleaving_list_t& part, const order_t& order, bool positiveOff);
+    void fillVtablePart(interleaving_vec_t& part, std::vector<int64_t>& partNodes,
+                        const order_t& order, bool positiveOff);
 
     /**
      * These functions and variables used to deal with duplication
@@ -222,6 +280,17 @@ namespace llvm {
     unsigned vcallMDId;
     std::set<Function*> vthunksToRemove;
 
+    // body of the vthunk with its translated vcall offsets (see sd_vthunkKey) -> clone,
+    // clones with the same key are identical so they are shared across sub-vtables, clouds
+    // and different original vthunks
+    typedef std::vector<uint64_t>                           vthunk_key_t;
+    std::map<vthunk_key_t, std::pair<Function*, Function*>> vthunkCloneMap; // -> (original, clone)
+    std::map<std::string, Function*> vthunkNameMap;         // NEW_VTHUNK_NAME -> clone used for it
+    uint64_t numVthunksCloned;
+    uint64_t numVthunksShared;
+    uint64_t numVthunksSharedAcross;                        // shared with a clone of another original
+    uint64_t numVthunkInstsSaved;                           // IR instructions not emitted thanks to sharing
+
     void createThunkFunctions(Module&, const vtbl_name_t& rootName);
     Function* getVthunkFunction(Constant* vtblElement);
     
@@ -9,10 +9,25 @@ namespace sdLog {
 
 typedef llvm::raw_string_ostream stream_t;
 
+/**
+ * Where the functions below write to on the calling thread, errs() unless it is set.
+ * The SDAnalysis running in the background collects its log here. Like the rest of
+ * this header it is per translation unit.
+ */
+static inline llvm::raw_ostream *&threadStream() {
+  static LLVM_THREAD_LOCAL llvm::raw_ostream *Stream = nullptr;
+  return Stream;
+}
+
+static inline llvm::raw_ostream &out() {
+  llvm::raw_ostream *Stream = threadStream();
+  return Stream ? *Stream : llvm::errs();
+}
+
 static inline llvm::raw_ostream &log() {
 #ifdef SD_STREAM_DEBUG
-  llvm::errs() << "SD] ";
-  return llvm::errs();
+  out() << "SD] ";
+  return out();
 #else
   return llvm::nulls();
 #endif
@@ -20,8 +35,8 @@ static inline llvm::raw_ostream &log() {
 
 static inline llvm::raw_ostream &stream() {
 #if defined(SD_STREAM_DEBUG) || defined(SD_NORMAL)
-  llvm::errs() << "SD] ";
-  return llvm::errs();
+  out() << "SD] ";
+  return out();
 #else
   return llvm::nulls();
 #endif
@@ -29,21 +44,21 @@ static inline llvm::raw_ostream &stream() {
 
 static inline llvm::raw_ostream &warn() {
 #if defined(SD_STREAM_DEBUG) || defined(SD_NORMAL)
-  llvm::errs() << "SD WARNING] ";
-  return llvm::errs();
+  out() << "SD WARNING] ";
+  return out();
 #else
   return llvm::nulls();
 #endif
 }
 
 static inline llvm::raw_ostream &errs() {
-  llvm::errs() << "SD ERROR] ";
-  return llvm::errs();
+  out() << "SD ERROR] ";
+  return out();
 }
 
 static inline llvm::raw_ostream &logNoToken() {
 #ifdef SD_STREAM_DEBUG
-  return llvm::errs();
+  return out();
 #else
   return llvm::nulls();
 #endif
@@ -51,7 +66,7 @@ static inline llvm::raw_ostream &logNoToken() {
 
 static void blankLine() {
 #if defined(SD_STREAM_DEBUG) || defined(SD_NORMAL)
-  llvm::errs() << "\n";
+  out() << "\n";
   return;
 #endif
 }
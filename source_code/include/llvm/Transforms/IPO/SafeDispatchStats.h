@@ -0,0 +1,99 @@
+#ifndef LLVM_TRANSFORMS_IPO_SAFEDISPATCH_STATS_H
+#define LLVM_TRANSFORMS_IPO_SAFEDISPATCH_STATS_H
+
+#include "llvm/IR/Module.h"
+#include "llvm/Support/Timer.h"
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * Structured statistics of the SD pipeline.
+ *
+ * The passes record into a single report while they run, SDMoveBasicBlocks (the last SD
+ * pass) writes it as <sd_output>-stats.json next to the SDAnalysis CSVs and resets it.
+ *
+ * With the time report (sd-time-report) each pass also runs under a NamedRegionTimer of the
+ * "SafeDispatch" timer group, records its user and system time and its RSS before and after,
+ * and the report includes the LLVM statistics of the link.
+ */
+namespace sdStats {
+
+struct CloudStats {
+  std::string root;
+  uint64_t numVTables = 0;                        // vtables in the preorder of the cloud
+  uint64_t alignment = 0;                         // in bytes
+  uint64_t interleavedSize = 0;                   // in bytes, padding included
+  uint64_t paddingBytes = 0;                      // bytes taken by DUMMY_VTBL entries
+  std::map<std::string, uint64_t> rangesPerVTable; // "vtbl,order" -> number of vptr ranges
+};
+
+struct PassStats {
+  std::string name;
+  double wallSeconds = 0;
+  uint64_t peakRSSKBytes = 0;                     // peak RSS of the process at the end of the pass
+
+  // time report only
+  double userSeconds = 0;
+  double systemSeconds = 0;
+  uint64_t rssBeforeKBytes = 0;                   // current RSS at the start of the pass
+  uint64_t rssAfterKBytes = 0;                    // current RSS at the end of the pass
+  uint64_t peakRSSBeforeKBytes = 0;               // peak RSS at the start of the pass
+};
+
+struct Report {
+  std::vector<CloudStats> clouds;
+  std::vector<PassStats> passes;
+
+  uint64_t thunksCloned = 0;
+  uint64_t thunksShared = 0;
+  uint64_t thunksSharedAcross = 0;                // shared with a clone of another original vthunk
+
+  uint64_t indexSubst = 0;
+  uint64_t rangeChecks = 0;
+  uint64_t eqChecks = 0;
+  uint64_t constPtrChecks = 0;
+  std::map<int64_t, uint64_t> widthHistogram;     // range width -> number of checks
+
+  void clear() { *this = Report(); }
+};
+
+Report &report();
+
+/**
+ * Turn on the time report, set by the sd-time-report plugin-opt of the gold plugin and by
+ * -sd-time-report elsewhere (llvm-lto, libLTO, opt).
+ */
+void setTimeReport(bool enabled);
+bool timeReportEnabled();
+
+/**
+ * Records wall time and peak RSS of a pass into the report, either when stop() is called
+ * or when it goes out of scope.
+ */
+class PassTimer {
+public:
+  explicit PassTimer(const std::string &name);
+  ~PassTimer() { stop(); }
+  void stop();
+
+private:
+  std::string name;
+  llvm::TimeRecord start;
+  uint64_t rssBefore;
+  uint64_t peakRSSBefore;
+  std::unique_ptr<llvm::NamedRegionTimer> region; // time report only
+  bool stopped;
+};
+
+/**
+ * Write the report as JSON for the given module and reset it.
+ */
+void writeReport(llvm::Module &M);
+
+}
+
+#endif
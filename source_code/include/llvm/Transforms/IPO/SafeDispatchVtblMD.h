@@ -8,8 +8,9 @@
 
 #include "llvm/Transforms/IPO/SafeDispatchLog.h"
 #include "llvm/Transforms/IPO/SafeDispatchTools.h"
-#include "llvm/Transforms/IPO/SafeDispatchMD.h"
+#include "llvm/IR/SafeDispatchMD.h"
 #include "llvm/Transforms/IPO/SafeDispatchGVMd.h"
+#include "llvm/Transforms/IPO/SafeDispatchClassInfo.h"
 
 #include <iostream>
 #include <string>
@@ -26,8 +27,8 @@ typedef std::set<std::pair<std::string, uint64_t>> function_set_t;
    * This class contains the information needed for each sub-vtable
    * to properly interleave them, the v table information is added
    * using the sd_insertVtableMD() function during compiler code 
-   * generation phase and attached to a new node which will store this
-   * additional information for the next passes.
+   * generation phase and recorded in the module's class hierarchy
+   * summary which will store this additional information for the next passes.
    */
 class SD_VtableMD
 {
@@ -55,37 +56,17 @@ public:
   {
   }
 
-  //returns the MDNode
-  llvm::MDNode *getMDNode(llvm::Module &M, llvm::LLVMContext &C)
+  //returns the record stored in the class hierarchy summary
+  sdClassInfo::SubVTable getSubVTable() const
   {
-    std::vector<llvm::Metadata *> tuple;
-    std::vector<llvm::Metadata *> parentsTuple;
-    std::vector<llvm::Metadata *> functionsTuple;
-
-    parentsTuple.push_back(sd_getMDNumber(C, parents.size()));
-
-    for (auto it : parents)
-    {
-      parentsTuple.push_back(sd_getMDString(C, it.first));
-      parentsTuple.push_back(sd_getMDNumber(C, it.second));
-      parentsTuple.push_back(sd_getClassVtblGVMD(it.first, M));
-    }
-
-    functionsTuple.push_back(sd_getMDNumber(C, functions.size()));
-
-    for (auto it : functions) {
-      functionsTuple.push_back(sd_getMDString(C, it.first));
-      functionsTuple.push_back(sd_getMDNumber(C, it.second));
-    }
-
-    tuple.push_back(sd_getMDNumber(C, order));
-    tuple.push_back(sd_getMDNumber(C, start));
-    tuple.push_back(sd_getMDNumber(C, end));
-    tuple.push_back(sd_getMDNumber(C, addressPoint));
-    tuple.push_back(llvm::MDNode::get(C, parentsTuple));
-    tuple.push_back(llvm::MDNode::get(C, functionsTuple));
-
-    return llvm::MDNode::get(C, tuple);
+    sdClassInfo::SubVTable sub;
+    sub.order = order;
+    sub.start = start;
+    sub.end = end;
+    sub.addressPoint = addressPoint;
+    sub.parents.assign(parents.begin(), parents.end());
+    sub.functions.assign(functions.begin(), functions.end());
+    return sub;
   }
 
   void dump(std::ostream &out)
@@ -365,12 +346,13 @@ static std::vector<SD_VtableMD> sd_generateSubvtableInfo(clang::CodeGen::CodeGen
 }
 
 /**
- * Given a vtable layout, insert a NamedMDNode that contains the information about the
- * vtable that is required for interleaving. This function is called from CGVTables.cpp
+ * Given a vtable layout, record the information about the vtable that is required
+ * for interleaving in the class hierarchy summary of the module (SafeDispatchClassInfo.h).
+ * This function is called from CGVTables.cpp
  * locate in the code generation part of the compiler.
  * This information will be generated for each v table.
- * Each v table and its parents are added in the 
- * new node and added to the name metadata node SD_MD_CLASSINFO. 
+ * Each v table and its parents are added to the summary,
+ * which is written to SD_MD_CLASSHIERARCHY when the module is released.
  *
  * This function is called during code generation. Before any of our passes starts.
  */
@@ -384,6 +366,13 @@ static void sd_insertVtableMD(clang::CodeGen::CodeGenModule *CGM,
   //std::cerr << " CGM: " << CGM << " VTLayout: " << VTLayout << " RD: " << RD << " RD->getQualifiedNameAsString() (class name): " << RD->getQualifiedNameAsString() << "\n";
   assert(CGM && VTLayout && RD);
 
+  // every class is handled once per module, bases are reached again from each derived class
+  // (no need to mangle its name, rebuild the sub-vtable info and look up the named metadata)
+  if (!CGM->markSDClassInfoEmitted(RD, Base))
+  {
+    return;
+  }
+
   clang::CodeGen::CGCXXABI *ABI = &CGM->getCXXABI();
 
   //this is the class name in which we insert the new named meta data
@@ -405,40 +394,17 @@ static void sd_insertVtableMD(clang::CodeGen::CodeGenModule *CGM,
     return;
   }
 
-  //our named metadata SD_MD_CLASSINFO will be inserted as a new NamedMDNode
-  llvm::NamedMDNode *classInfo = CGM->getModule().getOrInsertNamedMetadata(SD_MD_CLASSINFO + className);
-
-  // don't produce any duplicate md
-  if (classInfo->getNumOperands() > 0)
+  //add the class with one record per sub-vtable to the summary of the module
+  std::vector<sdClassInfo::SubVTable> subVTableInfo;
+  for (const SD_VtableMD &subVtable : subVtables)
   {
-    std::set<uint64_t> aps;
-    for (auto &&AP : VTLayout->getAddressPoints())
-    {
-      aps.insert(AP.second);
-    }
-
-    // last 1 is for class vtable
-    //assert(classInfo->getNumOperands() == (2 + aps.size() + 1));
-    return;
+    subVTableInfo.push_back(subVtable.getSubVTable());
   }
 
-  llvm::LLVMContext &C = CGM->getLLVMContext();
-
-  llvm::Module &M = CGM->getModule();
-
-  // first put the class name
-  classInfo->addOperand(llvm::MDNode::get(C, sd_getMDString(C, className)));
-
-  // second put the vtable global variable as a new MDNode into classInfo
-  classInfo->addOperand(sd_getClassVtblGVMD(className, M, VTable));
-
-  // third put the size of the tuple
-  classInfo->addOperand(llvm::MDNode::get(C, sd_getMDNumber(C, subVtables.size())));
-
-  // then add md for each sub-vtable
-  for (unsigned i = 0; i < subVtables.size(); ++i)
+  // don't produce any duplicate md
+  if (!CGM->getSDClassInfo().addClass(className, VTable, std::move(subVTableInfo)))
   {
-    classInfo->addOperand(subVtables[i].getMDNode(M, C));
+    return;
   }
 
   // make sure parent class' metadata is added too
@@ -447,8 +413,8 @@ static void sd_insertVtableMD(clang::CodeGen::CodeGenModule *CGM,
     const clang::BaseSubobject *subObj = &(AP.first);
     const clang::CXXRecordDecl *subRD = subObj->getBase();
 
-    //do recursive call if subRD != RD "CXXRecordDecl"
-    if (subRD != RD)
+    //do recursive call if subRD != RD "CXXRecordDecl" and it was not handled yet
+    if (subRD != RD && !CGM->isSDClassInfoEmitted(subRD))
     {
       //std::cerr << "Recursively calling sd_insertVtableMD for " << subRD->getQualifiedNameAsString() << "\n";
       sd_insertVtableMD(CGM,
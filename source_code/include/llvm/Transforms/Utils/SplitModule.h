@@ -0,0 +1,47 @@
+//===- SplitModule.h - Split a module into partitions -----------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file defines the function llvm::SplitModule, which splits a module
+// into multiple linkable partitions. It can be used to implement parallel code
+// generation for link-time optimization.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_TRANSFORMS_UTILS_SPLITMODULE_H
+#define LLVM_TRANSFORMS_UTILS_SPLITMODULE_H
+
+#include <functional>
+#include <memory>
+
+namespace llvm {
+
+class Module;
+
+/// Splits the module M into N linkable partitions. The function ModuleCallback
+/// is called N times passing each individual partition as the MPart argument.
+///
+/// Every global definition ends up in exactly one partition, the other
+/// partitions refer to it through an external declaration. Declarations keep
+/// their linkage in every partition, so extern_weak stays weak. Members of a
+/// comdat and aliases stay with their comdat and aliasee, and the module inline
+/// asm is only kept in the first partition.
+///
+/// FIXME: This function does not deal with the somewhat subtle symbol
+/// visibility issues around module splitting, including (but not limited to):
+///
+/// - Internal symbols with the same name in different partitions, which are
+///   externalized here and may then clash with native symbols at link time.
+/// - Symbols referenced from module inline asm, which only the first partition
+///   defines.
+void SplitModule(Module &M, unsigned N,
+                 std::function<void(std::unique_ptr<Module> MPart)> ModuleCallback);
+
+} // End llvm namespace
+
+#endif
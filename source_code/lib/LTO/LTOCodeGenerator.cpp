@@ -83,6 +83,10 @@ void LTOCodeGenerator::initialize() {
   DiagContext = nullptr;
   OwnedModule = nullptr;
   ShouldInternalize = true;
+  EmitIVTBLs = false;
+  EmitOVTBLs = false;
+  EmitReturnChecks = false;
+  SDOutputName = "a.out";
 
   initializeLTOPasses();
 }
@@ -544,6 +548,11 @@ bool LTOCodeGenerator::optimize(bool DisableInline,
   // Add an appropriate DataLayout instance for this module...
   mergedModule->setDataLayout(*TargetMach->getDataLayout());
 
+  // Name the SafeDispatch output files, as the gold plugin does in codegen().
+  bool RunSafeDispatch = EmitIVTBLs || EmitOVTBLs || EmitReturnChecks;
+  if (RunSafeDispatch && !mergedModule->getNamedMetadata("sd_filename"))
+    addSDOutputMetadata(*mergedModule, SDOutputName);
+
   passes.add(
       createTargetTransformInfoWrapperPass(TargetMach->getTargetIRAnalysis()));
 
@@ -558,6 +567,9 @@ bool LTOCodeGenerator::optimize(bool DisableInline,
   PMB.OptLevel = OptLevel;
   PMB.VerifyInput = true;
   PMB.VerifyOutput = true;
+  PMB.EmitIVTBLs = EmitIVTBLs;
+  PMB.EmitOVTBLs = EmitOVTBLs;
+  PMB.EmitReturnChecks = EmitReturnChecks;
 
   PMB.populateLTOPassManager(passes);
 
@@ -25,12 +25,14 @@
 #include "llvm/IR/DiagnosticPrinter.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Module.h"
+#include "llvm/IR/SafeDispatchMD.h"
 #include "llvm/IR/TypeFinder.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Transforms/Utils/Cloning.h"
 #include <cctype>
+#include <map>
 #include <tuple>
 using namespace llvm;
 
@@ -1260,10 +1262,34 @@ void ModuleLinker::linkNamedMDNodes() {
     // Don't link module flags here. Do them separately.
     if (&*I == SrcModFlags) continue;
     NamedMDNode *DestNMD = DstM->getOrInsertNamedMetadata(I->getName());
+
+    // SafeDispatch class hierarchy records are kept once per class and
+    // content, every module that uses a class carries the same record.
+    // Records are uniqued nodes, so equal keys are confirmed by identity.
+    std::map<std::pair<StringRef, size_t>, SmallVector<MDNode *, 1>> Existing;
+    bool Dedup = I->getName() == SD_MD_CLASSHIERARCHY;
+    auto isNewRecord = [&](MDNode *Op) {
+      StringRef ClassName;
+      hash_code ContentHash;
+      if (!getSDClassRecordKey(Op, ClassName, ContentHash))
+        return true;
+      auto &Records = Existing[std::make_pair(ClassName, size_t(ContentHash))];
+      if (std::find(Records.begin(), Records.end(), Op) != Records.end())
+        return false;
+      Records.push_back(Op);
+      return true;
+    };
+    if (Dedup)
+      for (MDNode *Op : DestNMD->operands())
+        isNewRecord(Op);
+
     // Add Src elements into Dest node.
-    for (unsigned i = 0, e = I->getNumOperands(); i != e; ++i)
-      DestNMD->addOperand(MapMetadata(I->getOperand(i), ValueMap, RF_None,
-                                      &TypeMap, &ValMaterializer));
+    for (unsigned i = 0, e = I->getNumOperands(); i != e; ++i) {
+      MDNode *Op = MapMetadata(I->getOperand(i), ValueMap, RF_None, &TypeMap,
+                               &ValMaterializer);
+      if (!Dedup || isNewRecord(Op))
+        DestNMD->addOperand(Op);
+    }
   }
 }
 
@@ -28,6 +28,7 @@
 #include "llvm/Support/Format.h"
 #include "llvm/Support/ManagedStatic.h"
 #include "llvm/Support/Mutex.h"
+#include "llvm/Support/YAMLParser.h"
 #include "llvm/Support/raw_ostream.h"
 #include <algorithm>
 #include <cstring>
@@ -44,6 +45,10 @@ Enabled(
     "stats",
     cl::desc("Enable statistics output from program (available with Asserts)"));
 
+/// Whether the statistics are printed when the program exits. Only false if
+/// they were enabled by EnableStatistics(false) and not by -stats.
+static bool PrintOnExit;
+
 
 namespace {
 /// StatisticInfo - This class is used in a ManagedStatic so that it is created
@@ -53,6 +58,10 @@ class StatisticInfo {
   std::vector<const Statistic*> Stats;
   friend void llvm::PrintStatistics();
   friend void llvm::PrintStatistics(raw_ostream &OS);
+  friend void llvm::PrintStatisticsJSON(raw_ostream &OS);
+
+  /// Sort statistics by name, then by description.
+  void sort();
 public:
   ~StatisticInfo();
 
@@ -86,11 +95,24 @@ void Statistic::RegisterStatistic() {
 
 // Print information when destroyed, iff command line option is specified.
 StatisticInfo::~StatisticInfo() {
-  llvm::PrintStatistics();
+  if (Enabled.getNumOccurrences() || PrintOnExit)
+    llvm::PrintStatistics();
+}
+
+void StatisticInfo::sort() {
+  std::stable_sort(Stats.begin(), Stats.end(),
+                   [](const Statistic *LHS, const Statistic *RHS) {
+    if (int Cmp = std::strcmp(LHS->getName(), RHS->getName()))
+      return Cmp < 0;
+
+    // Secondary key is the description.
+    return std::strcmp(LHS->getDesc(), RHS->getDesc()) < 0;
+  });
 }
 
-void llvm::EnableStatistics() {
+void llvm::EnableStatistics(bool PrintOnExit) {
   Enabled.setValue(true);
+  ::PrintOnExit |= PrintOnExit;
 }
 
 bool llvm::AreStatisticsEnabled() {
@@ -110,14 +132,7 @@ void llvm::PrintStatistics(raw_ostream &OS) {
   }
 
   // Sort the fields by name.
-  std::stable_sort(Stats.Stats.begin(), Stats.Stats.end(),
-                   [](const Statistic *LHS, const Statistic *RHS) {
-    if (int Cmp = std::strcmp(LHS->getName(), RHS->getName()))
-      return Cmp < 0;
-
-    // Secondary key is the description.
-    return std::strcmp(LHS->getDesc(), RHS->getDesc()) < 0;
-  });
+  Stats.sort();
 
   // Print out the statistics header...
   OS << "===" << std::string(73, '-') << "===\n"
@@ -136,6 +151,25 @@ void llvm::PrintStatistics(raw_ostream &OS) {
 
 }
 
+void llvm::PrintStatisticsJSON(raw_ostream &OS) {
+  StatisticInfo &Stats = *StatInfo;
+
+  Stats.sort();
+
+  // The escaping of YAML double-quoted scalars is valid JSON for the ASCII
+  // names and descriptions used by statistics.
+  OS << "[";
+  const char *Delim = "\n";
+  for (const Statistic *Stat : Stats.Stats) {
+    OS << Delim << "  {\"type\": \"" << yaml::escape(Stat->getName())
+       << "\", \"desc\": \"" << yaml::escape(Stat->getDesc())
+       << "\", \"value\": " << Stat->getValue() << "}";
+    Delim = ",\n";
+  }
+  OS << (Stats.Stats.empty() ? "]" : "\n]");
+  OS.flush();
+}
+
 void llvm::PrintStatistics() {
 #if !defined(NDEBUG) || defined(LLVM_ENABLE_STATS)
   StatisticInfo &Stats = *StatInfo;
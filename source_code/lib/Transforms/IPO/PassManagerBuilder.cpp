@@ -16,6 +16,7 @@
 #include "llvm/Transforms/IPO/PassManagerBuilder.h"
 #include "llvm-c/Transforms/PassManagerBuilder.h"
 #include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
 #include "llvm/Analysis/Passes.h"
 #include "llvm/IR/DataLayout.h"
 #include "llvm/IR/Verifier.h"
@@ -25,6 +26,7 @@
 #include "llvm/Analysis/TargetLibraryInfo.h"
 #include "llvm/Target/TargetMachine.h"
 #include "llvm/Transforms/IPO.h"
+#include "llvm/Transforms/IPO/SafeDispatchStats.h"
 #include "llvm/Transforms/Scalar.h"
 #include "llvm/Transforms/Vectorize.h"
 
@@ -533,6 +535,11 @@ void PassManagerBuilder::populateLTOPassManager(legacy::PassManagerBase &PM) {
   //Paul: emit interleaved or ordered v tables
   if (EmitIVTBLs || EmitOVTBLs || EmitReturnChecks) {
     // Lets get the sd passes out of the way
+    // The time report includes the statistics, they have to be enabled before the first
+    // counter is bumped. They only go into the report, not to stderr at exit
+    if (sdStats::timeReportEnabled())
+      EnableStatistics(/*PrintOnExit=*/false);
+
     // Remove unused vtables (pure virtual or unrereferenced) before interleaving
     PM.add(createGlobalDCEPass());
 
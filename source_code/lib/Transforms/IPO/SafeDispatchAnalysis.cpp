@@ -13,40 +13,25 @@
 
 #include "llvm/Demangle/Demangle.h"
 #include "llvm/IR/DebugInfo.h"
+#include "llvm/Transforms/IPO/SafeDispatchCallSites.h"
 #include "llvm/Transforms/IPO/SafeDispatchLayoutBuilder.h"
 #include "llvm/Transforms/IPO/SafeDispatchLogStream.h"
 #include "llvm/Transforms/IPO/SafeDispatchTools.h"
+#include "llvm/Transforms/IPO.h"
 
+#include <llvm/Support/CommandLine.h>
 #include <llvm/Support/FileSystem.h>
 #include <llvm/Support/Path.h>
+#include <llvm/Support/Threading.h>
+#include <llvm/Support/TimeValue.h>
 #include <fstream>
 #include <sstream>
+#include <thread>
 
 using namespace llvm;
 
 static const std::string itaniumConstructorTokens[3] = {"C0Ev", "C1Ev", "C2Ev"};
 
-static StringRef sd_getClassNameFromMD(llvm::MDNode *MDNode, unsigned operandNo = 0) {
-    llvm::MDTuple *mdTuple = cast<llvm::MDTuple>(MDNode);
-    assert(mdTuple->getNumOperands() > operandNo + 1);
-
-    llvm::MDNode *nameMdNode = cast<llvm::MDNode>(mdTuple->getOperand(operandNo).get());
-    llvm::MDString *mdStr = cast<llvm::MDString>(nameMdNode->getOperand(0));
-
-    StringRef strRef = mdStr->getString();
-    assert(sd_isVtableName_ref(strRef));
-    return strRef;
-}
-
-static StringRef sd_getFunctionNameFromMD(llvm::MDNode *MDNode, unsigned operandNo = 0) {
-    assert(MDNode->getNumOperands() > operandNo);
-
-    llvm::MDString *mdStr = cast<llvm::MDString>(MDNode->getOperand(operandNo));
-
-    StringRef strRef = mdStr->getString();
-    return strRef;
-}
-
 static std::stringstream writeDebugLocToStream(const DebugLoc* Loc) {
     assert(Loc);
     auto *Scope = cast<MDScope>(Loc->getScope());
@@ -151,82 +136,206 @@ public:
     }
 };
 
-class SDAnalysis : public ModulePass {
+static bool AsyncAnalysis;
+
+static cl::opt<bool, true>
+SDAsyncAnalysis("sd-async-analysis", cl::location(AsyncAnalysis),
+                cl::desc("Run the SDAnalysis on a background thread, off the link "
+                         "critical path (see waitForSDAnalysis)"));
+
+void llvm::setAsyncSDAnalysis(bool Enabled) {
+    AsyncAnalysis = Enabled;
+}
+
+namespace {
+
+/** CallSiteInfo encapsulates all analysis data for a single CallSite.
+ *  Iff isVirtual == false:
+ *    FunctionName, ClassName, PreciseName
+ *    and SubHierarchyMatches, PreciseSubHierarchyMatches, HierarchyIslandMatches
+ *    will not contain meaningful data.
+ * */
+struct CallSiteInfo {
 public:
-    static char ID;
+    explicit CallSiteInfo(const int _Params, const bool _isVirtual = false) :
+            Params(_Params),
+            isVirtual(_isVirtual) {}
+
+    CallSiteInfo(const std::string &_FunctionName,
+                 const std::string &_ClassName,
+                 const std::string &_PreciseName,
+                 int _Params) : CallSiteInfo(_Params, true) {
+        FunctionName = _FunctionName;
+        PreciseName = _PreciseName;
+        ClassName = _ClassName;
+    }
 
-    SDAnalysis() : ModulePass(ID) {
-        sdLog::stream() << "initializing SDAnalysis pass ...\n";
-        initializeSDAnalysisPass(*PassRegistry::getPassRegistry());
+    const bool isVirtual;
+    std::string FunctionName = "";
+    std::string ClassName = "";
+    std::string PreciseName = "";
+    std::string DisplayName = "";
+
+    const int Params;
+    std::string Dwarf = "";
+    Encodings Encoding{};
+
+    int64_t TargetSignatureMatches = -1;
+    int64_t ShortTargetSignatureMatches = -1;
+    int64_t PreciseTargetSignatureMatches= -1;
+    int64_t NumberOfParamMatches = -1;
+
+    int64_t TargetSignatureMatches_virtual = -1;
+    int64_t ShortTargetSignatureMatches_virtual = -1;
+    int64_t PreciseTargetSignatureMatches_virtual = -1;
+    int64_t NumberOfParamMatches_virtual = -1;
+
+    int64_t SubHierarchyMatches = -1;
+    int64_t PreciseSubHierarchyMatches = -1;
+    int64_t HierarchyIslandMatches = -1;
+};
+
+/** FunctionSummary is what the analysis needs to know about a function of the module */
+struct FunctionSummary {
+    std::string Name;
+    unsigned NumParams;                 // at most 7
+    Encodings Encoding;
+};
+
+/**
+ * CHASnapshot is a copy of the parts of SDBuildCHA read by the analysis, with the same
+ * accessors, so that the analysis does not depend on the CHA pass (or the module) staying alive.
+ */
+class CHASnapshot {
+public:
+    explicit CHASnapshot(SDBuildCHA &CHA) : Roots(CHA.roots_begin(), CHA.roots_end()) {
+        TopologicalOrder = CHA.topoSort();
+        for (auto &className : TopologicalOrder) {
+            if (CHA.isUndefined(className))
+                Undefined.insert(className);
+
+            auto &vTableList = SubVTables[className] = CHA.getSubVTables(className);
+            for (uint64_t vTableIndex = 0; vTableIndex < vTableList.size(); vTableIndex++) {
+                auto vTable = SDBuildCHA::vtbl_t(className, vTableIndex);
+                FunctionEntries[vTable] = CHA.getFunctionEntries(vTable);
+                Children[vTable].insert(CHA.children_begin(vTable), CHA.children_end(vTable));
+            }
+        }
     }
 
-    ~SDAnalysis() override {
-        sdLog::stream() << "deleting SDAnalysis pass\n";
+    const std::deque<SDBuildCHA::vtbl_name_t> &topoSort() const {
+        return TopologicalOrder;
     }
 
-    void getAnalysisUsage(AnalysisUsage &AU) const override {
-        AU.addRequired<SDBuildCHA>();
-        AU.addPreserved<SDBuildCHA>();
+    const std::vector<SDBuildCHA::vtbl_name_t> &getSubVTables(const SDBuildCHA::vtbl_name_t &name) {
+        return SubVTables[name];
+    }
+
+    const std::vector<SDBuildCHA::FunctionEntry> &getFunctionEntries(const SDBuildCHA::vtbl_t &vtbl) {
+        return FunctionEntries[vtbl];
+    }
+
+    bool isDefined(const SDBuildCHA::vtbl_name_t &vtbl) const {
+        return Undefined.find(vtbl) == Undefined.end();
+    }
+
+    bool isDefined(const SDBuildCHA::vtbl_t &vtbl) const {
+        return isDefined(vtbl.first);
+    }
+
+    SDBuildCHA::vtbl_set_t::const_iterator children_begin(const SDBuildCHA::vtbl_t &v) {
+        return Children[v].begin();
+    }
+
+    SDBuildCHA::vtbl_set_t::const_iterator children_end(const SDBuildCHA::vtbl_t &v) {
+        return Children[v].end();
+    }
+
+    SDBuildCHA::roots_t::const_iterator roots_begin() const {
+        return Roots.cbegin();
+    }
+
+    SDBuildCHA::roots_t::const_iterator roots_end() const {
+        return Roots.cend();
+    }
+
+    // same traversal as SDBuildCHA::preorder
+    SDBuildCHA::order_t preorder(const SDBuildCHA::vtbl_t &root) {
+        SDBuildCHA::order_t nodes;
+        SDBuildCHA::vtbl_set_t visited;
+        preorderHelper(nodes, root, visited);
+        return nodes;
     }
 
 private:
+    std::deque<SDBuildCHA::vtbl_name_t> TopologicalOrder;
+    SDBuildCHA::subvtbl_map_t SubVTables;
+    SDBuildCHA::vtbl_function_map_t FunctionEntries;
+    SDBuildCHA::cloud_map_t Children;
+    SDBuildCHA::roots_t Roots;
+    std::set<SDBuildCHA::vtbl_name_t> Undefined;
+
+    void preorderHelper(SDBuildCHA::order_t &nodes, const SDBuildCHA::vtbl_t &root,
+                        SDBuildCHA::vtbl_set_t &visited) {
+        if (visited.find(root) != visited.end())
+            return;
+
+        nodes.push_back(root);
+        visited.insert(root);
 
-    /** CallSiteInfo encapsulates all analysis data for a single CallSite.
-     *  Iff isVirtual == false:
-     *    FunctionName, ClassName, PreciseName
-     *    and SubHierarchyMatches, PreciseSubHierarchyMatches, HierarchyIslandMatches
-     *    will not contain meaningful data.
-     * */
-    struct CallSiteInfo {
-    public:
-        explicit CallSiteInfo(const int _Params, const bool _isVirtual = false) :
-                Params(_Params),
-                isVirtual(_isVirtual) {}
-
-        CallSiteInfo(const std::string &_FunctionName,
-                     const std::string &_ClassName,
-                     const std::string &_PreciseName,
-                     int _Params) : CallSiteInfo(_Params, true) {
-            FunctionName = _FunctionName;
-            PreciseName = _PreciseName;
-            ClassName = _ClassName;
+        auto entry = Children.find(root);
+        if (entry != Children.end()) {
+            for (const SDBuildCHA::vtbl_t &n : entry->second) {
+                preorderHelper(nodes, n, visited);
+            }
         }
+    }
+};
 
-        const bool isVirtual;
-        std::string FunctionName = "";
-        std::string ClassName = "";
-        std::string PreciseName = "";
-        std::string DisplayName = "";
-
-        const int Params;
-        std::string Dwarf = "";
-        Encodings Encoding{};
-
-        int64_t TargetSignatureMatches = -1;
-        int64_t ShortTargetSignatureMatches = -1;
-        int64_t PreciseTargetSignatureMatches= -1;
-        int64_t NumberOfParamMatches = -1;
-
-        int64_t TargetSignatureMatches_virtual = -1;
-        int64_t ShortTargetSignatureMatches_virtual = -1;
-        int64_t PreciseTargetSignatureMatches_virtual = -1;
-        int64_t NumberOfParamMatches_virtual = -1;
-
-        int64_t SubHierarchyMatches = -1;
-        int64_t PreciseSubHierarchyMatches = -1;
-        int64_t HierarchyIslandMatches = -1;
-    };
+/**
+ * SDAnalysisData holds the snapshot of the module taken by the SDAnalysis pass (the CHA,
+ * the function summaries and the CallSites) and does the analysis on it. It does not touch
+ * the IR, so it can run on a background thread while the rest of the pipeline changes the module.
+ */
+class SDAnalysisData {
+public:
+    explicit SDAnalysisData(SDBuildCHA &_CHA) : CHA(_CHA) {}
 
     typedef std::set<SDBuildCHA::func_name_t> func_name_set;
     typedef std::map<uint64_t, SDBuildCHA::func_name_t> offset_to_func_name;
     typedef std::map<uint64_t, std::set<SDBuildCHA::func_name_t>> offset_to_func_name_set;
     typedef std::pair<std::string, uint64_t> preciseFunctionSignature_t;
 
-    SDBuildCHA *CHA{};
+    /** the snapshot */
 
-    std::set<CallSite> VirtualCallSites{};  // analysed vcall (used to filter the remaining indirect calls)
-    int64_t CallSiteCount = 0;              // counts analysed CallSites
-    std::vector<CallSiteInfo> Data{};       // info for every analysed CallSite
+    CHASnapshot CHA;
+    std::vector<FunctionSummary> Functions{};   // every function that is not black listed
+    std::vector<CallSiteInfo> Data{};           // info for every analysed CallSite, matches filled in by run()
+    int64_t CallSiteCount = 0;                  // counts analysed CallSites
+    std::string ModuleName;
+    std::string OutputPath;                     // from the sd_output or sd_filename metadata
+
+    void run() {
+        analyseCHA();
+        computeVTableIslands();
+        findAllVFunctions();
+
+        // setup callee and callee signature info
+        analyseCallees();
+
+        // match the CallSites
+        for (auto &Info : Data) {
+            analyseCall(Info);
+        }
+        sdLog::stream() << "Total number of CallSites: " << CallSiteCount << "\n";
+
+        // apply the metric to the CallSiteInfo's in order to sort them
+        applyCallSiteMetric();
+        // store the analysis data
+        storeData();
+    }
+
+private:
 
     // metric results (used for sorting CallSiteInfo)
     std::map<float, std::vector<CallSiteInfo>> MetricVirtual{};
@@ -266,34 +375,6 @@ private:
     std::array<int64_t, 8> NumberOfParameters_virtual{};
     std::array<func_name_set, 8> NumberOfParametersList_virtual{};
 
-    bool runOnModule(Module &M) override {
-        sdLog::blankLine();
-        sdLog::stream() << "P7a. Started running the SDAnalysis pass ..." << sdLog::newLine << "\n";
-
-        // setup CHA info
-        CHA = &getAnalysis<SDBuildCHA>();
-        analyseCHA();
-        computeVTableIslands();
-        findAllVFunctions();
-
-        // setup callee and callee signature info
-        analyseCallees(M);
-
-        // process the CallSites
-        processVirtualCallSites(M);
-        processIndirectCallSites(M);
-        sdLog::stream() << "Total number of CallSites: " << CallSiteCount << "\n";
-
-        // apply the metric to the CallSiteInfo's in order to sort them
-        applyCallSiteMetric();
-        // store the analysis data
-        storeData(M);
-
-        sdLog::stream() << sdLog::newLine << "P7a. Finished running the SDAnalysis pass ..." << "\n";
-        sdLog::blankLine();
-        return false;
-    }
-
     /** hierarchy analysis functions */
 
     void analyseCHA() {
@@ -325,9 +406,9 @@ private:
     }
 
     void buildSubHierarchies() {
-        auto topologicalOrder = CHA->topoSort();
+        auto topologicalOrder = CHA.topoSort();
         for (auto className = topologicalOrder.rbegin(); className != topologicalOrder.rend(); ++className) {
-            auto vTableList = CHA->getSubVTables(*className);
+            auto vTableList = CHA.getSubVTables(*className);
             sdLog::log() << "\t" << *className << " with " << vTableList.size() << " vTables:\n";
 
             std::set<SDBuildCHA::vtbl_name_t> classChildren;
@@ -337,18 +418,18 @@ private:
                 auto vTable = SDBuildCHA::vtbl_t(*className, vTableIndex);
                 sdLog::log() << "\t(" << vTable.first << ", " << vTable.second << ") of type " << vTableType << "\n";
 
-                for (auto functionEntry : CHA->getFunctionEntries(vTable)) {
+                for (auto functionEntry : CHA.getFunctionEntries(vTable)) {
                     sdLog::log() << "\t\t" << functionEntry.functionName << "@" << functionEntry.offsetInVTable << "\n";
                     FunctionNameInVTableAtOffset[vTable][functionEntry.offsetInVTable] = functionEntry.functionName;
                     FunctionNamesInClassAtOffset[vTable.first][functionEntry.offsetInVTable].insert(functionEntry.functionName);
                 }
 
                 std::set<SDBuildCHA::vtbl_t> vTableChildren;
-                if (CHA->isDefined(vTable)) {
+                if (CHA.isDefined(vTable)) {
                     vTableChildren.insert(vTable);
                 }
 
-                for (auto child = CHA->children_begin(vTable); child != CHA->children_end(vTable); child++) {
+                for (auto child = CHA.children_begin(vTable); child != CHA.children_end(vTable); child++) {
                     assert(VTableSubHierarchy.find(*child) != VTableSubHierarchy.end());
                     vTableChildren.insert(VTableSubHierarchy[*child].begin(), VTableSubHierarchy[*child].end());
                 }
@@ -373,7 +454,7 @@ private:
 
                 std::set<SDBuildCHA::func_name_t> functionNames;
                 for (auto &vTable : subHierarchy.second) {
-                    if (CHA->isDefined(vTable.first)) {
+                    if (CHA.isDefined(vTable.first)) {
                         functionNames.insert(FunctionNameInVTableAtOffset[vTable][offsetInVTable]);
                     }
                 }
@@ -396,7 +477,7 @@ private:
 
                 std::set<SDBuildCHA::func_name_t> functionNames;
                 for (auto &className : subHierarchy.second) {
-                    if (CHA->isDefined(className)) {
+                    if (CHA.isDefined(className)) {
                         auto &functionNamesInChild  = FunctionNamesInClassAtOffset[className][offsetInVTable];
                         functionNames.insert(functionNamesInChild.begin(), functionNamesInChild.end());
                     }
@@ -411,7 +492,7 @@ private:
 
     void findAllVFunctions() {
         for (auto &classEntries : FunctionNamesInClassAtOffset) {
-            if (CHA->isDefined(classEntries.first)) {
+            if (CHA.isDefined(classEntries.first)) {
                 for (auto &functionEntries : classEntries.second) {
                     AllVFunctions.insert(functionEntries.second.begin(), functionEntries.second.end());
                 }
@@ -424,13 +505,13 @@ private:
         std::map<SDBuildCHA::vtbl_name_t, std::set<SDBuildCHA::vtbl_name_t>> islands;
         std::map<SDBuildCHA::vtbl_name_t, SDBuildCHA::vtbl_name_t> classToIslandRoot;
 
-        for (auto itr = CHA->roots_begin(); itr != CHA->roots_end(); ++itr) {
+        for (auto itr = CHA.roots_begin(); itr != CHA.roots_end(); ++itr) {
             auto root = SDBuildCHA::vtbl_t(*itr, 0);
             std::set<SDBuildCHA::vtbl_name_t> island;
             bool isNewIsland = true;
             auto islandRoot = root.first;
 
-            for (auto &vTable : CHA->preorder(root)) {
+            for (auto &vTable : CHA.preorder(root)) {
                 if (classToIslandRoot.find(vTable.first) == classToIslandRoot.end()) {
                     classToIslandRoot[vTable.first] = islandRoot;
                     island.insert(vTable.first);
@@ -448,7 +529,7 @@ private:
         std::map<SDBuildCHA::vtbl_name_t, offset_to_func_name_set> islandToFunctionsAtOffset;
         for(auto &island : islands) {
             for (auto &className : island.second) {
-                if (CHA->isDefined(className)) {
+                if (CHA.isDefined(className)) {
                     for (auto &entry : FunctionNamesInClassAtOffset[className]) {
                         islandToFunctionsAtOffset[island.first][entry.first].insert(entry.second.begin(), entry.second.end());
                     }
@@ -470,46 +551,39 @@ private:
 
     /** function type matching functions */
 
-    void analyseCallees(Module &M) {
+    void analyseCallees() {
         sdLog::stream() << "\n";
         sdLog::stream() << "Processing functions...\n";
 
-        for (auto &F : M) {
-            if (isBlackListed(F))
-                continue;
-
-            auto NumOfParams = F.getFunctionType()->getNumParams();
-            if (NumOfParams > 7)
-                NumOfParams = 7;
-
-            auto Encode = Encodings::encode(F.getFunctionType());
-            std::string FunctionName = F.getName();
+        for (auto &F : Functions) {
+            auto NumOfParams = F.NumParams;
+            auto &Encode = F.Encoding;
 
-            std::string DemangledFunctionName = FunctionName;
+            std::string DemangledFunctionName = F.Name;
             int Status = 0;
-            if (F.getName().startswith("_")) {
-                auto DemangledPair = itaniumDemanglePair(F.getName(), Status);
+            if (StringRef(F.Name).startswith("_")) {
+                auto DemangledPair = itaniumDemanglePair(F.Name, Status);
                 if (Status == 0 && DemangledPair.second != "") {
                     DemangledFunctionName = DemangledPair.second;
                 }
             }
 
-            AllFunctions.insert(F.getName());
+            AllFunctions.insert(F.Name);
             NumberOfParameters[NumOfParams]++;
-            NumberOfParametersList[NumOfParams].insert(F.getName());
-            TargetSignature[Encode.Normal].insert(F.getName());
-            ShortTargetSignature[Encode.Short].insert(F.getName());
+            NumberOfParametersList[NumOfParams].insert(F.Name);
+            TargetSignature[Encode.Normal].insert(F.Name);
+            ShortTargetSignature[Encode.Short].insert(F.Name);
             PreciseTargetSignature[preciseFunctionSignature_t(DemangledFunctionName, Encode.Precise)]
-                    .insert(FunctionName);
+                    .insert(F.Name);
 
-            if (isVirtualFunction(F)) {
-                AllVFunctions.insert(F.getName());
+            if (isVirtualFunction(F.Name)) {
+                AllVFunctions.insert(F.Name);
                 NumberOfParameters_virtual[NumOfParams]++;
-                NumberOfParametersList_virtual[NumOfParams].insert(F.getName());
-                TargetSignature_virtual[Encode.Normal].insert(F.getName());
-                ShortTargetSignature_virtual[Encode.Short].insert(F.getName());
+                NumberOfParametersList_virtual[NumOfParams].insert(F.Name);
+                TargetSignature_virtual[Encode.Normal].insert(F.Name);
+                ShortTargetSignature_virtual[Encode.Short].insert(F.Name);
                 PreciseTargetSignature_virtual[preciseFunctionSignature_t(DemangledFunctionName, Encode.Precise)]
-                        .insert(FunctionName);
+                        .insert(F.Name);
             }
         }
 
@@ -525,117 +599,12 @@ private:
 
     /** CallSite analysis functions */
 
-    void processIndirectCallSites(Module &M) {
-        int64_t countIndirect = 0;
-
-        sdLog::stream() << "\n";
-        sdLog::stream() << "Processing indirect CallSites...\n";
-        for (auto &F : M) {
-            for(auto &MBB : F) {
-                for (auto &I : MBB) {
-                    CallSite Call(&I);
-                    // Try to use I as a CallInst or a InvokeInst
-                    if (Call.getInstruction()) {
-                        if (CallSite(Call).isIndirectCall() && VirtualCallSites.find(Call) == VirtualCallSites.end()) {
-                            CallSiteInfo Info(Call.getFunctionType()->getNumParams(), false);
-                            analyseCall(Call, Info);
-                            ++countIndirect;
-                        }
-                    }
-                }
-            }
-        }
-        sdLog::stream() << "Found indirect CallSites: " << countIndirect << "\n";
-        sdLog::stream() << "\n";
-    }
-
-    void processVirtualCallSites(Module &M) {
-        Function *IntrinsicFunction = M.getFunction(Intrinsic::getName(Intrinsic::sd_get_checked_vptr));
-
-        if (IntrinsicFunction == nullptr) {
-            sdLog::warn() << "Intrinsic not found.\n";
-            return;
-        }
-
-        sdLog::stream() << "\n";
-        sdLog::stream() << "Processing virtual CallSites...\n";
-        int count = 0;
-        for (const Use &U : IntrinsicFunction->uses()) {
-
-            // get the intrinsic call instruction
-            CallInst *IntrinsicCall = dyn_cast<CallInst>(U.getUser());
-            assert(IntrinsicCall && "Intrinsic was not wrapped in a CallInst?");
-
-            // Find the CallSite that is associated with the intrinsic call.
-            User *User = *(IntrinsicCall->users().begin());
-            CallSite *VCall = nullptr;
-            for (int i = 0; i < 4; ++i) {
-                // User was not found, this should not happen...
-                VCall = new CallSite(User);
-                if (VCall->getInstruction()) {
-                    break;
-                }
-
-                for (auto *NextUser : User->users()) {
-                    User = NextUser;
-                    break;
-                }
-            }
-
-            if (VCall != nullptr && VCall->getInstruction()) {
-                // valid CallSite
-                extractVirtualCallSiteInfo(IntrinsicCall, *VCall);
-                VirtualCallSites.insert(*VCall);
-            } else {
-                sdLog::warn() << "CallSite for intrinsic was not found.\n";
-                IntrinsicCall->getParent()->dump();
-            }
-            ++count;
-        }
-        sdLog::stream() << "Found virtual CallSites: " << count << "\n";
-    }
-
-    void extractVirtualCallSiteInfo(const CallInst *IntrinsicCall, CallSite CallSite) {
-        // Extract Metadata from Intrinsic.
-        MetadataAsValue *Arg2 = dyn_cast<MetadataAsValue>(IntrinsicCall->getArgOperand(1));
-        assert(Arg2);
-        MDNode *ClassNameNode = dyn_cast<MDNode>(Arg2->getMetadata());
-        assert(ClassNameNode);
-
-        MetadataAsValue *Arg3 = dyn_cast<MetadataAsValue>(IntrinsicCall->getArgOperand(2));
-        assert(Arg3);
-        MDNode *PreciseNameNode = dyn_cast<MDNode>(Arg2->getMetadata());
-        assert(PreciseNameNode);
-
-        MetadataAsValue *Arg4 = dyn_cast<MetadataAsValue>(IntrinsicCall->getArgOperand(3));
-        assert(Arg4);
-        MDNode *FunctionNameNode = dyn_cast<MDNode>(Arg4->getMetadata());
-        assert(FunctionNameNode);
-
-        const StringRef ClassName = sd_getClassNameFromMD(ClassNameNode);
-        const StringRef PreciseName = sd_getClassNameFromMD(PreciseNameNode);
-        const StringRef FunctionName = sd_getFunctionNameFromMD(FunctionNameNode);
-
-        CallSiteInfo Info(FunctionName, ClassName, PreciseName, CallSite.getFunctionType()->getNumParams());
-        analyseCall(CallSite, Info);
-    }
-
-    void analyseCall(CallSite CallSite, CallSiteInfo Info) {
-        CallSiteCount++;
-        const DebugLoc &Loc = CallSite.getInstruction()->getDebugLoc();
-        std::string Dwarf;
-        if (Loc) {
-            std::stringstream Stream = writeDebugLocToStream(&Loc);
-            Dwarf = Stream.str();
-        }
-        Info.Dwarf = Dwarf;
-
-        auto NumberOfParam = CallSite.getFunctionType()->getNumParams();
+    void analyseCall(CallSiteInfo &Info) {
+        auto NumberOfParam = Info.Params;
         if (NumberOfParam >= 7)
             NumberOfParam = 7;
 
-        auto Encode = Encodings::encode(CallSite.getFunctionType());
-        Info.Encoding = Encode;
+        auto &Encode = Info.Encoding;
         Info.TargetSignatureMatches = TargetSignature[Encode.Normal].size();
         Info.ShortTargetSignatureMatches = ShortTargetSignature[Encode.Short].size();
 
@@ -672,11 +641,7 @@ private:
 
             Info.PreciseTargetSignatureMatches_virtual =
                     PreciseTargetSignature_virtual[preciseFunctionSignature_t(DemangledFunctionName,Encode.Precise)].size();
-        } else {
-            Info.DisplayName = CallSite.getCaller()->getName();
         }
-
-        Data.push_back(Info);
     }
 
     /** Helper functions */
@@ -696,14 +661,14 @@ private:
         }
     }
 
-    void storeData(Module &M) {
+    void storeData() {
         if (Data.empty()) {
             sdLog::stream() << "Nothing to store...\n";
             return;
         }
-        sdLog::stream() << "Store all CallSites for Module: " << M.getName() << "\n";
+        sdLog::stream() << "Store all CallSites for Module: " << ModuleName << "\n";
 
-        auto FileNames = findOutputFileName(M);
+        auto FileNames = findOutputFileName();
 
         // write general analysis data
 
@@ -714,6 +679,8 @@ private:
             sdLog::errs() << "Failed to write to " << FileNames.first << ", " << FileNames.second << "!\n";
             return;
         }
+        noteSDOutputFile(FileNames.first);
+        noteSDOutputFile(FileNames.second);
         sdLog::stream() << "Writing " << Data.size() << " lines to "
                         << FileNames.first << ", " << FileNames.second << ".\n";
 
@@ -730,6 +697,8 @@ private:
             sdLog::errs() << "Failed to write to " << MetricFileNameVirtual << ", " << MetricFileNameIndirect << "!\n";
             return;
         }
+        noteSDOutputFile(MetricFileNameVirtual);
+        noteSDOutputFile(MetricFileNameIndirect);
         sdLog::stream() << "Writing metric results to "
                         << MetricFileNameVirtual << ", " << MetricFileNameIndirect << ".\n";
 
@@ -1124,21 +1093,12 @@ private:
         }
     }
 
-    std::pair<std::string, std::string> findOutputFileName(Module &M) {
-        auto SDOutputMD = M.getNamedMetadata("sd_output");
-        auto SDFilenameMD = M.getNamedMetadata("sd_filename");
-
-        StringRef OutputPath;
-        if (SDOutputMD != nullptr)
-            OutputPath = dyn_cast_or_null<MDString>(SDOutputMD->getOperand(0)->getOperand(0))->getString();
-        else if (SDFilenameMD != nullptr)
-            OutputPath = ("./" + dyn_cast_or_null<MDString>(SDFilenameMD->getOperand(0)->getOperand(0))->getString()).str();
-
+    std::pair<std::string, std::string> findOutputFileName() {
         std::string VirtualFileName = "./SDAnalysis-Virtual";
         std::string IndirectFileName = "./SDAnalysis-Indirect";
         if (OutputPath != "") {
-            VirtualFileName = (OutputPath + "-Virtual").str();
-            IndirectFileName = (OutputPath + "-Indirect").str();
+            VirtualFileName = OutputPath + "-Virtual";
+            IndirectFileName = OutputPath + "-Indirect";
         }
 
         std::string VirtualFileNameExtended = (Twine(VirtualFileName) + ".csv").str();
@@ -1156,8 +1116,236 @@ private:
         return {VirtualFileNameExtended, IndirectFileNameExtended};
     };
 
-    bool isVirtualFunction(const Function &F) {
-        return AllVFunctions.find(F.getName()) != AllVFunctions.end() || F.getName().startswith("_ZTh");
+    bool isVirtualFunction(const std::string &FunctionName) {
+        return AllVFunctions.find(FunctionName) != AllVFunctions.end() || StringRef(FunctionName).startswith("_ZTh");
+    }
+
+};
+
+/**
+ * The analysis running on a background thread and what the sdLog functions wrote on that
+ * thread, which goes to errs() when the thread is joined instead of interleaving with the
+ * log of the pipeline. Not a ManagedStatic, llvm_shutdown must not destroy it under the
+ * running analysis: the callers join (waitForSDAnalysis) before llvm_shutdown.
+ */
+struct BackgroundAnalysis {
+    std::thread Thread;
+    std::string Log;
+
+    ~BackgroundAnalysis() {
+        join();
+    }
+
+    void join() {
+        if (!Thread.joinable())
+            return;
+
+        Thread.join();
+        llvm::errs() << Log;
+        Log.clear();
+    }
+};
+
+BackgroundAnalysis &background() {
+    static BackgroundAnalysis Background;
+    return Background;
+}
+
+void runInBackground(std::unique_ptr<SDAnalysisData> Analysis) {
+    BackgroundAnalysis &Background = background();
+    // one analysis at a time, a second LTO run in this process waits for the first one
+    Background.join();
+
+    SDAnalysisData *Data = Analysis.release();
+    Background.Thread = std::thread([Data, &Background]() {
+        std::unique_ptr<SDAnalysisData> Analysis(Data);
+        sdLog::stream_t Log(Background.Log);
+        sdLog::threadStream() = &Log;
+
+        sys::TimeValue Start = sys::TimeValue::now();
+        Analysis->run();
+        sdLog::stream() << "Finished the SDAnalysis in the background after "
+                        << (sys::TimeValue::now() - Start).msec() << " ms\n";
+
+        sdLog::threadStream() = nullptr;
+        Log.flush();
+    });
+}
+
+} // end anonymous namespace
+
+class SDAnalysis : public ModulePass {
+public:
+    static char ID;
+
+    SDAnalysis() : ModulePass(ID) {
+        sdLog::stream() << "initializing SDAnalysis pass ...\n";
+        initializeSDAnalysisPass(*PassRegistry::getPassRegistry());
+    }
+
+    ~SDAnalysis() override {
+        sdLog::stream() << "deleting SDAnalysis pass\n";
+    }
+
+    void getAnalysisUsage(AnalysisUsage &AU) const override {
+        AU.addRequired<SDBuildCHA>();
+        AU.addPreserved<SDBuildCHA>();
+    }
+
+private:
+
+    sdCallSites::Resolver CallSites{};
+    std::set<CallSite> VirtualCallSites{};  // analysed vcall (used to filter the remaining indirect calls)
+    std::unique_ptr<SDAnalysisData> Analysis{};
+
+    bool runOnModule(Module &M) override {
+        sdLog::blankLine();
+        sdLog::stream() << "P7a. Started running the SDAnalysis pass ..." << sdLog::newLine << "\n";
+        sdStats::PassTimer Timer("SDAnalysis");
+
+        // snapshot the CHA, the functions and the CallSites, the analysis only reads these
+        Analysis.reset(new SDAnalysisData(getAnalysis<SDBuildCHA>()));
+        Analysis->ModuleName = M.getName();
+        Analysis->OutputPath = findOutputPath(M);
+        summariseFunctions(M);
+        processVirtualCallSites(M);
+        processIndirectCallSites(M);
+        VirtualCallSites.clear();
+
+        if (AsyncAnalysis && llvm_is_multithreaded()) {
+            // layout, check emission and codegen go on while the analysis runs
+            runInBackground(std::move(Analysis));
+            sdLog::stream() << sdLog::newLine << "P7a. Continuing the SDAnalysis pass in the background ..." << "\n";
+        } else {
+            Analysis->run();
+            Analysis.reset();
+            sdLog::stream() << sdLog::newLine << "P7a. Finished running the SDAnalysis pass ..." << "\n";
+        }
+        sdLog::blankLine();
+        return false;
+    }
+
+    /** snapshot functions */
+
+    void summariseFunctions(Module &M) {
+        for (auto &F : M) {
+            if (isBlackListed(F))
+                continue;
+
+            auto NumOfParams = F.getFunctionType()->getNumParams();
+            if (NumOfParams > 7)
+                NumOfParams = 7;
+
+            Analysis->Functions.push_back({F.getName(), NumOfParams, Encodings::encode(F.getFunctionType())});
+        }
+    }
+
+    void processIndirectCallSites(Module &M) {
+        int64_t countIndirect = 0;
+
+        sdLog::stream() << "\n";
+        sdLog::stream() << "Processing indirect CallSites...\n";
+        for (auto &F : M) {
+            for(auto &MBB : F) {
+                for (auto &I : MBB) {
+                    CallSite Call(&I);
+                    // Try to use I as a CallInst or a InvokeInst
+                    if (Call.getInstruction()) {
+                        if (CallSite(Call).isIndirectCall() && VirtualCallSites.find(Call) == VirtualCallSites.end()) {
+                            CallSiteInfo Info(Call.getFunctionType()->getNumParams(), false);
+                            summariseCall(Call, Info);
+                            ++countIndirect;
+                        }
+                    }
+                }
+            }
+        }
+        sdLog::stream() << "Found indirect CallSites: " << countIndirect << "\n";
+        sdLog::stream() << "\n";
+    }
+
+    void processVirtualCallSites(Module &M) {
+        Function *IntrinsicFunction = M.getFunction(Intrinsic::getName(Intrinsic::sd_get_checked_vptr));
+
+        if (IntrinsicFunction == nullptr) {
+            sdLog::warn() << "Intrinsic not found.\n";
+            return;
+        }
+
+        sdLog::stream() << "\n";
+        sdLog::stream() << "Processing virtual CallSites...\n";
+        int count = 0;
+        for (const Use &U : IntrinsicFunction->uses()) {
+
+            // get the intrinsic call instruction
+            CallInst *IntrinsicCall = dyn_cast<CallInst>(U.getUser());
+            assert(IntrinsicCall && "Intrinsic was not wrapped in a CallInst?");
+
+            // Find the CallSite that is associated with the intrinsic call.
+            User *User = *(IntrinsicCall->users().begin());
+            CallSite *VCall = nullptr;
+            for (int i = 0; i < 4; ++i) {
+                // User was not found, this should not happen...
+                VCall = new CallSite(User);
+                if (VCall->getInstruction()) {
+                    break;
+                }
+
+                for (auto *NextUser : User->users()) {
+                    User = NextUser;
+                    break;
+                }
+            }
+
+            if (VCall != nullptr && VCall->getInstruction()) {
+                // valid CallSite
+                extractVirtualCallSiteInfo(IntrinsicCall, *VCall);
+                VirtualCallSites.insert(*VCall);
+            } else {
+                sdLog::warn() << "CallSite for intrinsic was not found.\n";
+                sdLog::log() << *IntrinsicCall->getParent() << "\n";
+            }
+            ++count;
+        }
+        sdLog::stream() << "Found virtual CallSites: " << count << "\n";
+    }
+
+    void extractVirtualCallSiteInfo(const CallInst *IntrinsicCall, CallSite CallSite) {
+        // Look the names up in the call-site table of the module.
+        const sdCallSites::Descriptor &Descriptor = CallSites.get(IntrinsicCall);
+
+        CallSiteInfo Info(Descriptor.functionName, Descriptor.className, Descriptor.preciseName,
+                          CallSite.getFunctionType()->getNumParams());
+        summariseCall(CallSite, Info);
+    }
+
+    void summariseCall(CallSite CallSite, CallSiteInfo Info) {
+        Analysis->CallSiteCount++;
+        const DebugLoc &Loc = CallSite.getInstruction()->getDebugLoc();
+        std::string Dwarf;
+        if (Loc) {
+            std::stringstream Stream = writeDebugLocToStream(&Loc);
+            Dwarf = Stream.str();
+        }
+        Info.Dwarf = Dwarf;
+        Info.Encoding = Encodings::encode(CallSite.getFunctionType());
+
+        if (!Info.isVirtual) {
+            Info.DisplayName = CallSite.getCaller()->getName();
+        }
+
+        Analysis->Data.push_back(Info);
+    }
+
+    std::string findOutputPath(Module &M) {
+        auto SDOutputMD = M.getNamedMetadata("sd_output");
+        auto SDFilenameMD = M.getNamedMetadata("sd_filename");
+
+        if (SDOutputMD != nullptr)
+            return dyn_cast_or_null<MDString>(SDOutputMD->getOperand(0)->getOperand(0))->getString();
+        if (SDFilenameMD != nullptr)
+            return ("./" + dyn_cast_or_null<MDString>(SDFilenameMD->getOperand(0)->getOperand(0))->getString()).str();
+        return "";
     }
 
     bool isBlackListed(const Function &F) {
@@ -1172,4 +1360,8 @@ INITIALIZE_PASS(SDAnalysis, "sdAnalysis", "Build return ranges", false, false)
 
 ModulePass *llvm::createSDAnalysisPass() {
     return new SDAnalysis();
+}
+
+void llvm::waitForSDAnalysis() {
+    background().join();
 }
\ No newline at end of file
@@ -18,6 +18,7 @@
 
 #include "llvm/Transforms/IPO/SafeDispatchLog.h"
 #include "llvm/Transforms/IPO/SafeDispatchLogStream.h"
+#include "llvm/Transforms/IPO/SafeDispatchClassInfo.h"
 
 #include "llvm/Transforms/Utils/ValueMapper.h"
 #include "llvm/Transforms/Utils/Cloning.h"
@@ -29,6 +30,7 @@
 #include <math.h>
 #include <algorithm>
 #include <deque>
+#include <functional>
 
 // you have to modify the following 4 files for each additional LLVM pass
 // 1. include/llvm/IPO.h
@@ -201,123 +203,125 @@ void SDBuildCHA::buildClouds(Module &M) {
   // this set is used for checking if a parent class is defined or not
   std::set<vtbl_t> build_undefinedVtables;
 
+  // the class hierarchy summaries of all linked modules, added inside SafeDispatchVtblMD.h
+  // during code generation
+  std::vector<nmd_t> infoVec = extractClassHierarchy(M);
+
   for(auto itr = M.getNamedMDList().begin(); itr != M.getNamedMDList().end(); itr++) {
     
     //Paul: get all metadata of this module
     NamedMDNode* md = itr;
 
-    // only look at the modules we created and in 
-    // which we added our class metadata. 
+    // bitcode from before SD_MD_CLASSHIERARCHY has one named node per class
     if(! md->getName().startswith(SD_MD_CLASSINFO))
       continue;
 
     sd_print("\nGOT METADATA: %s\n", md->getName().data());
 
     // Paul: extractMetadata() extracts the metadata from each module
-    // and puts it into this vector, this metadata was previously added 
-    // inside SafeDispatchVtblMD.h, in: sd_insertVtableMD() function
-    // this function is called for each generated v table, during code generation  
-    std::vector<nmd_t> infoVec = extractMetadata(md);
-
-    //nmd_t is the main top root node type, now iterate through the info vector   
-    for (const nmd_t& info : infoVec) {
-     
-      // record the old vtable array
-      /* Paul:
-      this GlobalVariable holds the metadata for each module.
-      Inside the metadata the v tables are contained.
-      */
-      GlobalVariable* oldVtable = M.getGlobalVariable(info.className, true);
-
-      sd_print("class %s with %d subtables\n", info.className.c_str(), info.subVTables.size());
-
-      sd_print("oldvtables: %p, %d, class %s\n",
-               oldVtable,
-               oldVtable ? oldVtable->hasInitializer() : -1,
-               info.className.c_str());
-      
-      if (oldVtable && oldVtable->hasInitializer()) {
-        ConstantArray* vtable = dyn_cast<ConstantArray>(oldVtable->getInitializer());
-        assert(vtable);
-        oldVTables[info.className] = vtable;
-      } else {
-        undefinedVTables.insert(info.className);
-      }
-      
-      //Paul: iterate trough the sub v tables of the metadata vector
-      // and build the roots, parents, addres pointer and the range maps
-      // for each root node 
-      for(unsigned ind = 0; ind < info.subVTables.size(); ind++) {
-        const nmd_sub_t* subInfo = & info.subVTables[ind];
-        vtbl_t name(info.className, ind);
-        
-        sd_print("SubVtable: %d Order: %d clossest Parents count: %d ",
-          ind, 
-          subInfo->order,
-          subInfo->parents.size());
+    // and puts it into this vector
+    std::vector<nmd_t> classInfoVec = extractMetadata(md);
+    infoVec.insert(infoVec.end(), classInfoVec.begin(), classInfoVec.end());
+  }
 
-        for (auto it : subInfo->parents) {
-          sd_print("subInfo parents (%s, %d),", it.first.c_str(), it.second);
-        }
+  //nmd_t is the main top root node type, now iterate through the info vector   
+  for (const nmd_t& info : infoVec) {
+   
+    // record the old vtable array
+    /* Paul:
+    this GlobalVariable holds the metadata for each module.
+    Inside the metadata the v tables are contained.
+    */
+    GlobalVariable* oldVtable = M.getGlobalVariable(info.className, true);
 
-        for (auto &entry : subInfo->functions) {
-          sd_print("subInfo functions (%s @ %d),", entry.functionName.c_str(), entry.offsetInVTable);
-        }
-        vTableFunctionMap[name] = subInfo->functions;
+    sd_print("class %s with %d subtables\n", info.className.c_str(), info.subVTables.size());
 
-        sd_print("subInfo start-end [%d-%d] AddrPt: %d\n",
-          subInfo->start,
-          subInfo->end,
-          subInfo->addressPoint);
-        
+    sd_print("oldvtables: %p, %d, class %s\n",
+             oldVtable,
+             oldVtable ? oldVtable->hasInitializer() : -1,
+             info.className.c_str());
+    
+    if (oldVtable && oldVtable->hasInitializer()) {
+      ConstantArray* vtable = dyn_cast<ConstantArray>(oldVtable->getInitializer());
+      assert(vtable);
+      oldVTables[info.className] = vtable;
+    } else {
+      undefinedVTables.insert(info.className);
+    }
+    
+    //Paul: iterate trough the sub v tables of the metadata vector
+    // and build the roots, parents, addres pointer and the range maps
+    // for each root node 
+    for(unsigned ind = 0; ind < info.subVTables.size(); ind++) {
+      const nmd_sub_t* subInfo = & info.subVTables[ind];
+      vtbl_t name(info.className, ind);
+      
+      sd_print("SubVtable: %d Order: %d clossest Parents count: %d ",
+        ind, 
+        subInfo->order,
+        subInfo->parents.size());
 
-        if (build_undefinedVtables.find(name) != build_undefinedVtables.end()) {
-          //sd_print("Removing %s,%d from build_udnefinedVtables\n", name.first.c_str(), name.second);
-          build_undefinedVtables.erase(name);
-        }
+      for (auto it : subInfo->parents) {
+        sd_print("subInfo parents (%s, %d),", it.first.c_str(), it.second);
+      }
 
-        if (cloudMap.find(name) == cloudMap.end()){
-          //sd_print("Inserting vtable: %s, order: %d in cloudMap\n", name.first.c_str(), name.second);
-          //Paul: here the cloudMap is filled for the first time 
-          cloudMap[name] = std::set<vtbl_t>(); //empty set
-        }
+      for (auto &entry : subInfo->functions) {
+        sd_print("subInfo functions (%s @ %d),", entry.functionName.c_str(), entry.offsetInVTable);
+      }
+      vTableFunctionMap[name] = subInfo->functions;
 
-        vtbl_set_t parents;
-        
-        //Paul: interate now through each subinfo and get the parents
-        for (auto it : subInfo->parents) {
-          if (it.first != "") {
-            vtbl_t &parent = it;
-            parents.insert(parent); // parent is a pair of <vtbl_name_t, uint64_t> 
-
-            // if the parent class is not defined yet, add it to the
-            // undefined vtable set
-            if (cloudMap.find(parent) == cloudMap.end()) {
-              //sd_print("Inserting %s, %d in cloudMap - undefined parent\n", parent.first.c_str(), parent.second);
-              cloudMap[parent] = std::set<vtbl_t>();
-              build_undefinedVtables.insert(parent);
-            }
+      sd_print("subInfo start-end [%d-%d] AddrPt: %d\n",
+        subInfo->start,
+        subInfo->end,
+        subInfo->addressPoint);
+      
+
+      if (build_undefinedVtables.find(name) != build_undefinedVtables.end()) {
+        //sd_print("Removing %s,%d from build_udnefinedVtables\n", name.first.c_str(), name.second);
+        build_undefinedVtables.erase(name);
+      }
 
-            // add the current class to the parent's children set
-            sd_print("root: %s in cloudMap insert vtable: %s, \n",  parent.first.c_str(), name.first.c_str());
-            cloudMap[parent].insert(name);
-          } else {
-            assert(ind == 0); // make sure secondary vtables have a direct parent
-            
-            // add the class to the root set
-            roots.insert(info.className);
+      if (cloudMap.find(name) == cloudMap.end()){
+        //sd_print("Inserting vtable: %s, order: %d in cloudMap\n", name.first.c_str(), name.second);
+        //Paul: here the cloudMap is filled for the first time 
+        cloudMap[name] = std::set<vtbl_t>(); //empty set
+      }
+
+      vtbl_set_t parents;
+      
+      //Paul: interate now through each subinfo and get the parents
+      for (auto it : subInfo->parents) {
+        if (it.first != "") {
+          vtbl_t &parent = it;
+          parents.insert(parent); // parent is a pair of <vtbl_name_t, uint64_t> 
+
+          // if the parent class is not defined yet, add it to the
+          // undefined vtable set
+          if (cloudMap.find(parent) == cloudMap.end()) {
+            //sd_print("Inserting %s, %d in cloudMap - undefined parent\n", parent.first.c_str(), parent.second);
+            cloudMap[parent] = std::set<vtbl_t>();
+            build_undefinedVtables.insert(parent);
           }
+
+          // add the current class to the parent's children set
+          sd_print("root: %s in cloudMap insert vtable: %s, \n",  parent.first.c_str(), name.first.c_str());
+          cloudMap[parent].insert(name);
+        } else {
+          assert(ind == 0); // make sure secondary vtables have a direct parent
+          
+          // add the class to the root set
+          roots.insert(info.className);
         }
-        
-        // Paul: record the parents for each class 
-        parentMap[info.className].push_back(parents); //parents set 
+      }
+      
+      // Paul: record the parents for each class 
+      parentMap[info.className].push_back(parents); //parents set 
 
-        // record the original address points for each class 
-        addrPtMap[info.className].push_back(subInfo->addressPoint);
+      // record the original address points for each class 
+      addrPtMap[info.className].push_back(subInfo->addressPoint);
 
-        // record the sub-vtable ends for each class
-        rangeMap[info.className].push_back(range_t(subInfo->start, subInfo->end));
-      }
+      // record the sub-vtable ends for each class
+      rangeMap[info.className].push_back(range_t(subInfo->start, subInfo->end));
     }
   }
 
@@ -562,6 +566,44 @@ static llvm::GlobalVariable* sd_mdnodeToGV(Metadata* vtblMd) {
   return vtblGV;
 }
 
+/**
+ * Decode the SD_MD_CLASSHIERARCHY summaries, the first summary of a class wins
+ */
+std::vector<SDBuildCHA::nmd_t> SDBuildCHA::extractClassHierarchy(Module &M) {
+  std::set<vtbl_name_t> classes;
+  std::vector<SDBuildCHA::nmd_t> infoVec;
+
+  for (sdClassInfo::ClassInfo &classInfo : sdClassInfo::read(M)) {
+    if (!classes.insert(classInfo.className).second)
+      continue;
+
+    SDBuildCHA::nmd_t info;
+    info.className = classInfo.className;
+
+    for (const sdClassInfo::SubVTable &sub : classInfo.subVTables) {
+      SDBuildCHA::nmd_sub_t subInfo;
+      subInfo.order        = sub.order;
+      subInfo.start        = sub.start;
+      subInfo.end          = sub.end;
+      subInfo.addressPoint = sub.addressPoint;
+      subInfo.parents.insert(sub.parents.begin(), sub.parents.end());
+
+      for (const sdClassInfo::name_and_number_t &function : sub.functions)
+        subInfo.functions.push_back(FunctionEntry(function.first, vtbl_t(info.className, subInfo.order), function.second));
+
+      bool currRangeCheck = (subInfo.start <= subInfo.addressPoint && subInfo.addressPoint <= subInfo.end);
+      bool prevVtblCheck = (info.subVTables.empty() || info.subVTables.back().end < subInfo.start);
+      assert(currRangeCheck && prevVtblCheck);
+
+      info.subVTables.push_back(std::move(subInfo));
+    }
+
+    infoVec.push_back(std::move(info));
+  }
+
+  return infoVec;
+}
+
 /* Paul:
 this method extracts the metadata for each module.
 This is used in the buildClouds method from above.
@@ -846,3 +888,97 @@ int64_t SDBuildCHA::getSubVTableIndex(const vtbl_name_t& derived, const vtbl_nam
   }
   return res;
 }
+
+SDBuildCHA::vtbl_t SDBuildCHA::getCheckedVTable(const vtbl_name_t& className, const vtbl_name_t& preciseName) {
+  vtbl_t vtbl(className, 0);
+
+  if (!knowsAbout(vtbl) || preciseName == className)
+    return vtbl;
+
+  int64_t ind = getSubVTableIndex(preciseName, className);
+  vtbl_name_t n = preciseName;
+
+  if (ind == -1) {
+    //className is the derived and the preciseName is the base class
+    ind = getSubVTableIndex(className, preciseName);
+    n = className;
+  }
+
+  if (ind != -1)
+    vtbl = vtbl_t(n, ind);
+
+  return vtbl;
+}
+
+uint64_t SDBuildCHA::partitionClouds(const vtbl_set_t& referenced, uint64_t minCloudSize) {
+  std::vector<std::pair<vtbl_t, vtbl_t>> cuts; // (parent, new root)
+  std::set<vtbl_name_t> changedRoots;
+
+  for (const vtbl_name_t& rootName : roots) {
+    vtbl_t root(rootName, 0);
+    order_t pre = preorder(root);
+    if (pre.size() < minCloudSize)
+      continue;
+
+    std::map<vtbl_t, std::vector<vtbl_t>> parents;
+    for (const vtbl_t& v : pre)
+      for (const vtbl_t& child : cloudMap[v])
+        parents[child].push_back(v);
+
+    // unchecked[v]: neither v nor any of its ancestors is referenced
+    // (in a preorder the parents that lead to v come before it, other parents are rechecked)
+    std::map<vtbl_t, bool> unchecked;
+    std::function<bool(const vtbl_t&)> isUnchecked = [&](const vtbl_t& v) -> bool {
+      auto it = unchecked.find(v);
+      if (it != unchecked.end())
+        return it->second;
+      bool res = referenced.count(v) == 0;
+      unchecked[v] = res; // breaks cycles, there should be none
+      for (const vtbl_t& pt : parents[v])
+        res = res && isUnchecked(pt);
+      return unchecked[v] = res;
+    };
+
+    for (const vtbl_t& v : pre) {
+      if (v == root || v.second != 0 || isUndefined(v) || !referenced.count(v))
+        continue;
+      if (parents[v].size() != 1 || !isUnchecked(parents[v][0]))
+        continue;
+
+      // the subtree must be closed: no node in it has a parent outside of it
+      order_t sub = preorder(v);
+      std::set<vtbl_t> subSet(sub.begin(), sub.end());
+      bool closed = true;
+      for (const vtbl_t& n : sub) {
+        if (ancestorMap[n] != rootName)
+          closed = false;
+        if (n == v)
+          continue;
+        for (const vtbl_t& pt : parents[n])
+          closed = closed && subSet.count(pt);
+      }
+
+      if (closed)
+        cuts.push_back(std::make_pair(parents[v][0], v));
+    }
+  }
+
+  for (auto& cut : cuts) {
+    const vtbl_t& newRoot = cut.second;
+    changedRoots.insert(ancestorMap[newRoot]);
+
+    cloudMap[cut.first].erase(newRoot);
+    roots.insert(newRoot.first);
+    for (const vtbl_t& n : preorder(newRoot))
+      ancestorMap[n] = newRoot.first;
+
+    sd_print("Partitioned (%s,%d) off cloud %s\n", newRoot.first.c_str(), newRoot.second,
+             ancestorMap[cut.first].c_str());
+  }
+
+  // the children counts above the cuts changed
+  for (const vtbl_name_t& rootName : changedRoots)
+    calculateChildrenCounts(vtbl_t(rootName, 0));
+
+  return cuts.size();
+}
@@ -0,0 +1,75 @@
+#include "llvm/Transforms/IPO/SafeDispatchCallSites.h"
+#include "llvm/Transforms/IPO/SafeDispatchGVMd.h"
+
+#include "llvm/IR/Constants.h"
+#include "llvm/Support/ErrorHandling.h"
+
+using namespace llvm;
+
+namespace sdCallSites {
+
+static void sd_malformedTable() {
+  report_fatal_error("malformed sd.get.checked.vptr call-site table");
+}
+
+MDNode *TableBuilder::getTable(LLVMContext &C) {
+  if (!placeholder)
+    placeholder = MDTuple::getTemporary(C, None);
+  return placeholder.get();
+}
+
+uint64_t TableBuilder::getID(MDNode *classMD, MDNode *preciseMD, StringRef functionName) {
+  LLVMContext &C = classMD->getContext();
+  MDNode *entry = MDNode::get(C, {classMD, preciseMD, MDString::get(C, functionName)});
+
+  auto it = ids.insert(std::make_pair(entry, (uint64_t) entries.size()));
+  if (it.second)
+    entries.push_back(entry);
+  return it.first->second;
+}
+
+void TableBuilder::emit() {
+  if (!placeholder)
+    return;
+
+  placeholder->replaceAllUsesWith(MDNode::get(placeholder->getContext(), entries));
+  placeholder.reset();
+  entries.clear();
+  ids.clear();
+}
+
+const Descriptor &Resolver::get(const CallInst *CI) {
+  auto tableMD = dyn_cast<MetadataAsValue>(CI->getArgOperand(1));
+  auto idConst = dyn_cast<ConstantInt>(CI->getArgOperand(2));
+  if (!tableMD || !idConst || !isa<MDTuple>(tableMD->getMetadata()))
+    sd_malformedTable();
+
+  const MDTuple *table = cast<MDTuple>(tableMD->getMetadata());
+  auto it = tables.find(table);
+  if (it == tables.end()) {
+    std::vector<Descriptor> descriptors(table->getNumOperands());
+    for (unsigned i = 0; i < table->getNumOperands(); i++) {
+      MDNode *entry = dyn_cast_or_null<MDNode>(table->getOperand(i).get());
+      if (!entry || entry->getNumOperands() != 3)
+        sd_malformedTable();
+
+      MDNode *classMD = dyn_cast_or_null<MDNode>(entry->getOperand(0).get());
+      MDNode *preciseMD = dyn_cast_or_null<MDNode>(entry->getOperand(1).get());
+      MDString *functionMD = dyn_cast_or_null<MDString>(entry->getOperand(2).get());
+      if (!classMD || !preciseMD || !functionMD)
+        sd_malformedTable();
+
+      descriptors[i].className = sd_getClassNameFromMD(classMD);
+      descriptors[i].preciseName = sd_getClassNameFromMD(preciseMD);
+      descriptors[i].functionName = functionMD->getString();
+    }
+    it = tables.insert(std::make_pair(table, std::move(descriptors))).first;
+  }
+
+  uint64_t id = idConst->getZExtValue();
+  if (id >= it->second.size())
+    sd_malformedTable();
+  return it->second[id];
+}
+
+}
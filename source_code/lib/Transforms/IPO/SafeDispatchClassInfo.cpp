@@ -0,0 +1,267 @@
+#include "llvm/Transforms/IPO/SafeDispatchClassInfo.h"
+#include "llvm/IR/SafeDispatchMD.h"
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/LEB128.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+/**
+ * Blob layout of one class record, every number is ULEB128 and every name an index into
+ * the name table of the record:
+ *
+ *   "SDCH" version
+ *   #names   { length bytes }*
+ *   name #subvtables { order start end addrPt
+ *                      #parents   { name order }*
+ *                      #functions { name offset }* }*
+ *
+ * Bump the version whenever the layout changes.
+ */
+#define SD_CLASSINFO_MAGIC   "SDCH"
+#define SD_CLASSINFO_VERSION 2
+
+namespace sdClassInfo {
+
+namespace {
+
+/**
+ * Interned names of one module, vtable names also get their global variable
+ */
+class NameTable {
+public:
+  uint64_t intern(const std::string &name, bool isVTable) {
+    auto it = ids.insert(std::make_pair(name, (uint64_t) names.size()));
+    if (it.second) {
+      names.push_back(name);
+      vtableNames.push_back(false);
+    }
+    uint64_t id = it.first->second;
+    if (isVTable && !name.empty())
+      vtableNames[id] = true;
+    return id;
+  }
+
+  StringMap<uint64_t> ids;
+  std::vector<std::string> names;
+  std::vector<bool> vtableNames;
+};
+
+static void sd_malformedBlob() {
+  report_fatal_error("malformed " SD_MD_CLASSHIERARCHY " metadata");
+}
+
+class BlobReader {
+public:
+  BlobReader(StringRef blob) : cur(blob.bytes_begin()), end(blob.bytes_end()) {}
+
+  uint64_t number() {
+    uint64_t val = 0;
+    unsigned shift = 0;
+    uint8_t byte;
+    do {
+      if (cur == end || shift > 63)
+        sd_malformedBlob();
+      byte = *cur++;
+      val |= uint64_t(byte & 0x7f) << shift;
+      shift += 7;
+    } while (byte & 0x80);
+    return val;
+  }
+
+  /**
+   * Number of elements that follow, each takes at least one byte
+   */
+  uint64_t count() {
+    uint64_t val = number();
+    if (val > (uint64_t) (end - cur))
+      sd_malformedBlob();
+    return val;
+  }
+
+  StringRef bytes(uint64_t length) {
+    if (length > (uint64_t) (end - cur))
+      sd_malformedBlob();
+    StringRef str((const char*) cur, length);
+    cur += length;
+    return str;
+  }
+
+  bool atEnd() const { return cur == end; }
+
+private:
+  const uint8_t *cur;
+  const uint8_t *end;
+};
+
+}
+
+bool Writer::addClass(const std::string &className, GlobalVariable *VTable,
+                      std::vector<SubVTable> subVTables) {
+  if (!classNames.insert(className).second)
+    return false;
+
+  ClassInfo info;
+  info.className = className;
+  info.subVTables = std::move(subVTables);
+  classes.push_back(std::move(info));
+
+  if (VTable)
+    vtables[className] = VTable;
+  return true;
+}
+
+void Writer::emit(Module &M) {
+  if (classes.empty())
+    return;
+
+  LLVMContext &C = M.getContext();
+  NamedMDNode *hierarchyMD = M.getOrInsertNamedMetadata(SD_MD_CLASSHIERARCHY);
+
+  // one record per class, so the IR linker can keep every class once
+  for (const ClassInfo &info : classes) {
+    NameTable table;
+    std::string body;
+    raw_string_ostream out(body);
+
+    encodeULEB128(table.intern(info.className, true), out);
+    encodeULEB128(info.subVTables.size(), out);
+
+    for (const SubVTable &sub : info.subVTables) {
+      encodeULEB128(sub.order, out);
+      encodeULEB128(sub.start, out);
+      encodeULEB128(sub.end, out);
+      encodeULEB128(sub.addressPoint, out);
+
+      encodeULEB128(sub.parents.size(), out);
+      for (const name_and_number_t &parent : sub.parents) {
+        encodeULEB128(table.intern(parent.first, true), out);
+        encodeULEB128(parent.second, out);
+      }
+
+      encodeULEB128(sub.functions.size(), out);
+      for (const name_and_number_t &function : sub.functions) {
+        encodeULEB128(table.intern(function.first, false), out);
+        encodeULEB128(function.second, out);
+      }
+    }
+    out.flush();
+
+    std::string blob;
+    raw_string_ostream blobOut(blob);
+    blobOut << SD_CLASSINFO_MAGIC;
+    encodeULEB128(SD_CLASSINFO_VERSION, blobOut);
+    encodeULEB128(table.names.size(), blobOut);
+    for (const std::string &name : table.names) {
+      encodeULEB128(name.size(), blobOut);
+      blobOut << name;
+    }
+    blobOut << body;
+    blobOut.flush();
+
+    std::vector<Metadata*> gvs;
+    gvs.reserve(table.names.size());
+    for (uint64_t i = 0; i < table.names.size(); i++) {
+      GlobalVariable *gv = nullptr;
+      if (table.vtableNames[i]) {
+        auto it = vtables.find(table.names[i]);
+        if (it != vtables.end())
+          gv = dyn_cast_or_null<GlobalVariable>((Value*) it->second);
+        if (!gv)
+          gv = M.getGlobalVariable(table.names[i], true);
+      }
+      gvs.push_back(gv ? ConstantAsMetadata::get(gv) : nullptr);
+    }
+
+    hierarchyMD->addOperand(MDNode::get(C, {MDString::get(C, info.className),
+                                            MDString::get(C, blob), MDNode::get(C, gvs)}));
+  }
+
+  classes.clear();
+  classNames.clear();
+  vtables.clear();
+}
+
+std::vector<ClassInfo> read(const Module &M) {
+  std::vector<ClassInfo> infos;
+  const NamedMDNode *hierarchyMD = M.getNamedMetadata(SD_MD_CLASSHIERARCHY);
+  if (!hierarchyMD)
+    return infos;
+
+  for (const MDNode *recordMD : hierarchyMD->operands()) {
+    if (recordMD->getNumOperands() != 3)
+      sd_malformedBlob();
+    const MDString *blobMD = dyn_cast_or_null<MDString>(recordMD->getOperand(1).get());
+    const MDNode *gvsMD = dyn_cast_or_null<MDNode>(recordMD->getOperand(2).get());
+    if (!blobMD || !gvsMD)
+      sd_malformedBlob();
+
+    BlobReader in(blobMD->getString());
+    if (in.bytes(sizeof(SD_CLASSINFO_MAGIC) - 1) != SD_CLASSINFO_MAGIC)
+      sd_malformedBlob();
+
+    uint64_t version = in.number();
+    if (version != SD_CLASSINFO_VERSION)
+      report_fatal_error("unsupported " SD_MD_CLASSHIERARCHY " version " + Twine(version));
+
+    // names, replaced by the name of the vtable they refer to
+    uint64_t numNames = in.count();
+    if (numNames != gvsMD->getNumOperands())
+      sd_malformedBlob();
+
+    std::vector<std::string> names(numNames);
+    for (uint64_t i = 0; i < numNames; i++) {
+      names[i] = in.bytes(in.count()).str();
+
+      auto gvMD = dyn_cast_or_null<ConstantAsMetadata>(gvsMD->getOperand(i).get());
+      if (gvMD) {
+        auto gv = dyn_cast<GlobalVariable>(gvMD->getValue()->stripPointerCasts());
+        if (gv)
+          names[i] = gv->getName();
+      }
+    }
+
+    auto name = [&]() -> const std::string& {
+      uint64_t id = in.number();
+      if (id >= numNames)
+        sd_malformedBlob();
+      return names[id];
+    };
+
+    ClassInfo info;
+    info.className = name();
+    info.subVTables.resize(in.count());
+
+    for (SubVTable &sub : info.subVTables) {
+      sub.order = in.number();
+      sub.start = in.number();
+      sub.end = in.number();
+      sub.addressPoint = in.number();
+
+      sub.parents.resize(in.count());
+      for (name_and_number_t &parent : sub.parents) {
+        parent.first = name();
+        parent.second = in.number();
+      }
+
+      sub.functions.resize(in.count());
+      for (name_and_number_t &function : sub.functions) {
+        function.first = name();
+        function.second = in.number();
+      }
+    }
+
+    infos.push_back(std::move(info));
+
+    if (!in.atEnd())
+      sd_malformedBlob();
+  }
+
+  return infos;
+}
+
+}
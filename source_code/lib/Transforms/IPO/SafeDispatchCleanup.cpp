@@ -1,6 +1,7 @@
 #include "llvm/IR/MDBuilder.h"
 #include "llvm/Transforms/IPO/SafeDispatchLayoutBuilder.h"
 #include "llvm/Transforms/IPO/SafeDispatchLogStream.h"
+#include "llvm/Transforms/IPO/SafeDispatchStats.h"
 
 using namespace llvm;
 
@@ -15,9 +16,11 @@ namespace {
 
     bool runOnModule(Module &M) override {
       sdLog::stream() << "Started SDCleanup pass ...\n";
+      sdStats::PassTimer timer("SDCleanup");
 
       handleSDGetVtblIndex(&M);
       handleSDGetCheckedVtbl(&M);
+      handleSDDyncastInRange(&M);
       handleRemainingSDGetVcallIndex(&M);
       sdLog::stream() << "Finished SDCleanup pass ...\n";
       return true;
@@ -26,6 +29,7 @@ namespace {
   private:
     void handleSDGetVtblIndex(Module* M);
     void handleSDGetCheckedVtbl(Module* M);
+    void handleSDDyncastInRange(Module* M);
     void handleRemainingSDGetVcallIndex(Module* M);
   };
 } // namespace
@@ -68,6 +72,24 @@ void SDCleanup::handleSDGetCheckedVtbl(Module* M) {
   sdLog::stream() << "Replaced " << counter << " sd.get.checked.vptr intrinsics.\n";
 }
 
+// without ranges every dynamic_cast goes through __ivtbl_dynamic_cast
+void SDCleanup::handleSDDyncastInRange(Module* M) {
+  Function *inRangeF = M->getFunction(Intrinsic::getName(Intrinsic::sd_dyncast_in_range));
+
+  if (!inRangeF){
+   return;
+  }
+
+  int counter = 0;
+  for (auto UI = inRangeF->user_begin(), UE = inRangeF->user_end(); UI != UE;) {
+    llvm::CallInst* CI = cast<CallInst>(*UI++);
+    CI->replaceAllUsesWith(llvm::ConstantInt::getFalse(M->getContext()));
+    CI->eraseFromParent();
+    counter++;
+  }
+  sdLog::stream() << "Replaced " << counter << " sd.dyncast.in.range intrinsics.\n";
+}
+
 void SDCleanup::handleRemainingSDGetVcallIndex(Module* M) {
   Function *sd_vcall_indexF = M->getFunction(Intrinsic::getName(Intrinsic::sd_get_vcall_index));
 
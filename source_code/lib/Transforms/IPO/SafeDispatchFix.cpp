@@ -15,6 +15,7 @@
 
 #include "llvm/Transforms/IPO/SafeDispatchLog.h"
 #include "llvm/Transforms/IPO/SafeDispatchTools.h"
+#include "llvm/Transforms/IPO/SafeDispatchStats.h"
 
 #include "llvm/Transforms/Utils/ValueMapper.h"
 #include "llvm/Transforms/Utils/Cloning.h"
@@ -98,6 +99,7 @@ namespace {
       module = &M;
 
       sd_print("P1. Started running fix pass...\nn");
+      sdStats::PassTimer timer("SDFix");
 
       bool isChanged = fixDestructors2();
 
@@ -14,10 +14,15 @@
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/CallSite.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/ErrorHandling.h"
 
 #include "llvm/Transforms/IPO/SafeDispatchLayoutBuilder.h"
+#include "llvm/Transforms/IPO/SafeDispatchCallSites.h"
 #include "llvm/Transforms/IPO/SafeDispatchLog.h"
 #include "llvm/Transforms/IPO/SafeDispatchTools.h"
+#include "llvm/Transforms/IPO/SafeDispatchGVMd.h"
 
 #include "llvm/Transforms/Utils/ValueMapper.h"
 #include "llvm/Transforms/Utils/Cloning.h"
@@ -27,8 +32,13 @@
 #include <set>
 #include <map>
 #include <algorithm>
+#include <atomic>
 #include <llvm/Transforms/IPO/SafeDispatchLogStream.h>
 
+#if LLVM_ENABLE_THREADS
+#include <thread>
+#endif
+
 // you have to modify the following 4 files for each additional LLVM pass
 // 1. include/llvm/IPO.h
 // 2. lib/Transforms/IPO/IPO.cpp
@@ -43,6 +53,16 @@ using namespace llvm;
 #define NEW_VTHUNK_NAME(fun,parent) ("_SVT" + parent + fun->getName().str())
 #define GEP_OPCODE      29
 
+// Linear verifier over flattened layouts, usable in builds without asserts
+// (pass -plugin-opt=-sd-verify-layouts to the gold plugin)
+static cl::opt<bool> SDVerifyLayouts("sd-verify-layouts", cl::init(false), cl::Hidden,
+    cl::desc("Verify the SafeDispatch vtable layouts and vptr ranges with the fast verifier"));
+
+// Clouds with at least this many sub-vtables are split at subtrees that are not
+// checked from above, 0 disables the partitioning
+static cl::opt<unsigned> SDPartitionMinCloud("sd-partition-min-cloud", cl::init(1024), cl::Hidden,
+    cl::desc("Minimum number of sub-vtables in a cloud before SafeDispatch partitions it"));
+
 char SDLayoutBuilder::ID = 0;
 
 INITIALIZE_PASS_BEGIN(SDLayoutBuilder, "sdovt", "Oredered VTable Layout Builder for SafeDispatch", false, false)
@@ -59,7 +79,7 @@ this function is used to dump the new layout.
 It is used 7 times in this pass in order to check if
 the new layout are ok, as expected)
 The check is done by printing the v table in the terminal*/
-static void dumpNewLayout(const SDLayoutBuilder::interleaving_list_t &interleaving) {
+static void dumpNewLayout(const SDLayoutBuilder::interleaving_vec_t &interleaving) {
   uint64_t ind = 0;
   std::cerr << "New vtable layout:\n";
   for (auto elem : interleaving) {
@@ -82,7 +102,7 @@ bool SDLayoutBuilder::verifyNewLayouts(Module &M) {
     vtbl_t root(vtbl, 0);
 
     //make a copy of the interleaving map obtained during interleaving or ordering
-    interleaving_list_t &interleaving = interleavingMap[vtbl];
+    interleaving_vec_t &interleaving = interleavingMap[vtbl];
     uint64_t i = 0;
 
     indMap.clear();
@@ -254,6 +274,364 @@ bool SDLayoutBuilder::verifyNewLayouts(Module &M) {
   return true;
 }
 
+/// ----------------------------------------------------------------------------
+/// Fast layout verification
+/// ----------------------------------------------------------------------------
+namespace {
+  /**
+   * Everything the verifier needs about one cloud, flattened into arrays indexed by the
+   * dense preorder index of the (sub-)vtables. Built sequentially, verified in parallel.
+   */
+  struct FlatCloud {
+    std::string root;
+    bool interleaved;
+
+    uint64_t n;                              // number of (sub-)vtables in the cloud
+    std::vector<char> defined;
+    std::vector<uint64_t> oldLo;             // first old index (prepadding included)
+    std::vector<uint64_t> oldSize;           // old size (prepadding included)
+    std::vector<uint64_t> oldAddrPt;
+    std::vector<uint64_t> slotBase;          // node -> first slot inside newPos
+
+    std::vector<uint64_t> childBegin;        // CSR children lists
+    std::vector<uint64_t> children;
+
+    std::vector<int64_t> layoutNode;         // new layout: node of each entry, -1 for padding
+    std::vector<uint64_t> layoutOldPos;
+
+    std::vector<uint64_t> rangeBegin;        // CSR vptr ranges in preorder indices, [first, second)
+    std::vector<SDBuildCHA::range_t> ranges;
+
+    std::string error;
+  };
+}
+
+static bool sd_verifyFlatCloud(FlatCloud& fc) {
+  raw_string_ostream err(fc.error);
+  const uint64_t n = fc.n;
+
+  // 1) every old element of every defined vtable is placed exactly once
+  std::vector<int64_t> newPos(fc.slotBase[n], -1);
+  for (uint64_t pos = 0; pos < fc.layoutNode.size(); pos++) {
+    int64_t node = fc.layoutNode[pos];
+    if (node < 0 || !fc.defined[node])
+      continue;
+
+    uint64_t slot = fc.layoutOldPos[pos] - fc.oldLo[node];
+    if (slot >= fc.oldSize[node]) {
+      err << "node " << node << " entry " << fc.layoutOldPos[pos] << " at " << pos << " is out of its old range";
+      return false;
+    }
+    if (newPos[fc.slotBase[node] + slot] != -1) {
+      err << "node " << node << " entry " << fc.layoutOldPos[pos] << " appears twice - at "
+          << newPos[fc.slotBase[node] + slot] << " and " << pos;
+      return false;
+    }
+    newPos[fc.slotBase[node] + slot] = pos;
+  }
+
+  for (uint64_t node = 0; node < n; node++) {
+    if (!fc.defined[node])
+      continue;
+    for (uint64_t s = fc.slotBase[node]; s < fc.slotBase[node + 1]; s++) {
+      if (newPos[s] == -1) {
+        err << "node " << node << " entry " << (fc.oldLo[node] + s - fc.slotBase[node]) << " is missing";
+        return false;
+      }
+    }
+  }
+
+  // 2) children contain their parents and keep the relative offsets of the parent entries
+  if (fc.interleaved) {
+    for (uint64_t pt = 0; pt < n; pt++) {
+      if (!fc.defined[pt])
+        continue;
+
+      int64_t ptNewAddrPt = newPos[fc.slotBase[pt] + fc.oldAddrPt[pt] - fc.oldLo[pt]];
+
+      for (uint64_t c = fc.childBegin[pt]; c < fc.childBegin[pt + 1]; c++) {
+        uint64_t ch = fc.children[c];
+        if (!fc.defined[ch] || ch < pt)
+          continue;
+
+        uint64_t ptPre = fc.oldAddrPt[pt] - fc.oldLo[pt];
+        uint64_t chPre = fc.oldAddrPt[ch] - fc.oldLo[ch];
+        if (ptPre > chPre || fc.oldSize[pt] - ptPre > fc.oldSize[ch] - chPre) {
+          err << "parent node " << pt << " is not contained in child node " << ch;
+          return false;
+        }
+
+        int64_t chNewAddrPt = newPos[fc.slotBase[ch] + chPre];
+        uint64_t chSlot = fc.slotBase[ch] + chPre - ptPre;
+        for (uint64_t s = fc.slotBase[pt]; s < fc.slotBase[pt + 1]; s++, chSlot++) {
+          if (newPos[s] - ptNewAddrPt != newPos[chSlot] - chNewAddrPt) {
+            err << "parent node " << pt << " old index " << (fc.oldLo[pt] + s - fc.slotBase[pt])
+                << " mismatches child node " << ch;
+            return false;
+          }
+        }
+      }
+    }
+  }
+
+  // 3) vptr ranges are sorted, disjoint and cover exactly the descendants of the node,
+  //    that is the node itself and the ranges of its children, which by induction from the
+  //    leaves are exact. With the ranges of the children of a node sorted by their start,
+  //    one sweep checks that they lie in the ranges of the node and measures their union,
+  //    whose size plus the node must be the width of the ranges of the node. The ranges of
+  //    the children of all nodes are sorted at once by two counting sorts, so the check is
+  //    linear in the nodes, the edges and the ranges.
+  std::vector<uint64_t> width(n, 0);
+  for (uint64_t node = 0; node < n; node++) {
+    int64_t lastEnd = -1;
+    bool self = false;
+    for (uint64_t r = fc.rangeBegin[node]; r < fc.rangeBegin[node + 1]; r++) {
+      const SDBuildCHA::range_t& range = fc.ranges[r];
+      if ((int64_t) range.first <= lastEnd || range.first >= range.second || range.second > n) {
+        err << "vptr ranges of node " << node << " are not sorted and disjoint";
+        return false;
+      }
+      lastEnd = range.second;
+      width[node] += range.second - range.first;
+      self |= (range.first <= node && node < range.second);
+    }
+
+    if (!self) {
+      err << "vptr ranges of node " << node << " do not contain the node";
+      return false;
+    }
+  }
+
+  // (parent, range of a child) by start, then stable by parent
+  typedef std::pair<uint64_t, SDBuildCHA::range_t> child_range_t;
+  std::vector<child_range_t> byStart, byParent;
+  std::vector<uint64_t> count(n + 1, 0);
+  for (uint64_t node = 0; node < n; node++)
+    for (uint64_t c = fc.childBegin[node]; c < fc.childBegin[node + 1]; c++)
+      for (uint64_t cr = fc.rangeBegin[fc.children[c]]; cr < fc.rangeBegin[fc.children[c] + 1]; cr++)
+        count[fc.ranges[cr].first + 1]++;
+  for (uint64_t i = 0; i < n; i++)
+    count[i + 1] += count[i];
+  byStart.resize(count[n]);
+  for (uint64_t node = 0; node < n; node++)
+    for (uint64_t c = fc.childBegin[node]; c < fc.childBegin[node + 1]; c++)
+      for (uint64_t cr = fc.rangeBegin[fc.children[c]]; cr < fc.rangeBegin[fc.children[c] + 1]; cr++)
+        byStart[count[fc.ranges[cr].first]++] = child_range_t(node, fc.ranges[cr]);
+
+  std::vector<uint64_t> childRangeBegin(n + 1, 0);
+  for (const child_range_t& cr : byStart)
+    childRangeBegin[cr.first + 1]++;
+  for (uint64_t i = 0; i < n; i++)
+    childRangeBegin[i + 1] += childRangeBegin[i];
+  byParent.resize(byStart.size());
+  std::vector<uint64_t> fill(childRangeBegin.begin(), childRangeBegin.end() - 1);
+  for (const child_range_t& cr : byStart)
+    byParent[fill[cr.first]++] = cr;
+
+  for (uint64_t node = 0; node < n; node++) {
+    uint64_t r = fc.rangeBegin[node];
+    uint64_t unionWidth = 0, unionEnd = 0;
+    bool self = false;
+    for (uint64_t i = childRangeBegin[node]; i < childRangeBegin[node + 1]; i++) {
+      const SDBuildCHA::range_t& range = byParent[i].second;
+      while (r < fc.rangeBegin[node + 1] && fc.ranges[r].second <= range.first)
+        r++;
+      if (r == fc.rangeBegin[node + 1] ||
+          fc.ranges[r].first > range.first || fc.ranges[r].second < range.second) {
+        err << "vptr ranges of a child of node " << node << " are not included in the ones of the node";
+        return false;
+      }
+
+      if (range.first >= unionEnd) {
+        unionWidth += range.second - range.first;
+        unionEnd = range.second;
+      } else if (range.second > unionEnd) {
+        unionWidth += range.second - unionEnd;
+        unionEnd = range.second;
+      }
+      self |= (range.first <= node && node < range.second);
+    }
+
+    if (width[node] != unionWidth + (self ? 0 : 1)) {
+      err << "vptr ranges of node " << node << " cover " << width[node]
+          << " nodes, but it has " << (unionWidth + (self ? 0 : 1)) << " descendants";
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool SDLayoutBuilder::verifyNewLayoutsFast() {
+  std::vector<FlatCloud> clouds;
+
+  // flatten sequentially, the CHA accessors are not thread safe
+  for (auto rootIt = cha->roots_begin(); rootIt != cha->roots_end(); rootIt++) {
+    const vtbl_name_t& rootName = *rootIt;
+    assert(cloudIndexMap.count(rootName));
+    const cloud_index_t& index = cloudIndexMap[rootName];
+    const order_t& pre = index.nodes;
+
+    clouds.push_back(FlatCloud());
+    FlatCloud& fc = clouds.back();
+    fc.root = rootName;
+    fc.interleaved = interleave;
+    fc.n = pre.size();
+
+    fc.childBegin = index.childBegin;
+    fc.children = index.children;
+
+    fc.slotBase.push_back(0);
+    fc.rangeBegin.push_back(0);
+    for (const vtbl_t& v : pre) {
+      bool defined = cha->isDefined(v);
+      fc.defined.push_back(defined);
+
+      uint64_t lo = 0, size = 0, addrPt = 0;
+      if (defined) {
+        const range_t& r = cha->getRange(v);
+        lo = r.first - prePadMap[v];
+        size = r.second - lo + 1;
+        addrPt = cha->addrPt(v);
+      }
+      fc.oldLo.push_back(lo);
+      fc.oldSize.push_back(size);
+      fc.oldAddrPt.push_back(addrPt);
+      fc.slotBase.push_back(fc.slotBase.back() + size);
+
+      for (const range_t& r : rangeMap[v])
+        fc.ranges.push_back(r);
+      fc.rangeBegin.push_back(fc.ranges.size());
+    }
+
+    // the nodes of the entries were recorded with the layout, only check they match
+    const interleaving_vec_t& interleaving = interleavingMap[rootName];
+    if (index.layoutNodes.size() != interleaving.size())
+      fc.error = "the layout has no node for every entry";
+    for (uint64_t pos = 0; pos < interleaving.size() && fc.error.empty(); pos++) {
+      int64_t node = index.layoutNodes[pos];
+      const vtbl_t& entry = interleaving[pos].first;
+      if (node < 0 ? entry != dummyVtable : entry != pre[node])
+        fc.error = "entry of " + entry.first + " at " + std::to_string(pos) + " does not belong to its node";
+      fc.layoutNode.push_back(node);
+      fc.layoutOldPos.push_back(interleaving[pos].second);
+    }
+  }
+
+  std::atomic<unsigned> next(0);
+  auto worker = [&]() {
+    for (unsigned i = next++; i < clouds.size(); i = next++) {
+      if (clouds[i].error.empty())
+        sd_verifyFlatCloud(clouds[i]);
+    }
+  };
+
+#if LLVM_ENABLE_THREADS
+  unsigned numThreads = std::min<unsigned>(std::max(1u, std::thread::hardware_concurrency()), clouds.size());
+  std::vector<std::thread> threads;
+  for (unsigned i = 1; i < numThreads; i++)
+    threads.push_back(std::thread(worker));
+  worker();
+  for (std::thread& t : threads)
+    t.join();
+#else
+  worker();
+#endif
+
+  bool valid = true;
+  for (const FlatCloud& fc : clouds) {
+    if (fc.error.empty())
+      continue;
+    sdLog::errs() << "Invalid layout for cloud " << fc.root << ": " << fc.error << "\n";
+    dumpNewLayout(interleavingMap[fc.root]);
+    valid = false;
+  }
+
+  sdLog::stream() << "Verified " << clouds.size() << " clouds " << (valid ? "" : "un") << "successfully\n";
+  return valid;
+}
+
+void SDLayoutBuilder::checkNewLayouts(Module &M) {
+  if (SDVerifyLayouts) {
+    if (!verifyNewLayoutsFast())
+      report_fatal_error("SafeDispatch: the new vtable layouts are invalid");
+    return;
+  }
+
+  assert(verifyNewLayouts(M));
+}
+
+/*
+ * Collect the sub-vtables the checks (and, when interleaving, the index translations)
+ * refer to, and let the CHA split the giant clouds below them.
+ */
+void SDLayoutBuilder::partitionClouds(Module& M) {
+  if (SDPartitionMinCloud == 0)
+    return;
+
+  SDBuildCHA::vtbl_set_t referenced;
+
+  // sd.get.checked.vptr(vptr, call-site table, id)
+  Function* checkedF = M.getFunction(Intrinsic::getName(Intrinsic::sd_get_checked_vptr));
+  if (checkedF) {
+    sdCallSites::Resolver callSites;
+    for (const Use &U : checkedF->uses()) {
+      const sdCallSites::Descriptor& callSite = callSites.get(cast<CallInst>(U.getUser()));
+      referenced.insert(cha->getCheckedVTable(callSite.className, callSite.preciseName));
+    }
+  }
+
+  // sd.dyncast.in.range(vptr, source class, destination class)
+  Function* dyncastF = M.getFunction(Intrinsic::getName(Intrinsic::sd_dyncast_in_range));
+  if (dyncastF) {
+    for (const Use &U : dyncastF->uses()) {
+      CallInst* CI = cast<CallInst>(U.getUser());
+      MDNode* srcMD = cast<MDNode>(cast<MetadataAsValue>(CI->getArgOperand(1))->getMetadata());
+      MDNode* dstMD = cast<MDNode>(cast<MetadataAsValue>(CI->getArgOperand(2))->getMetadata());
+      std::string srcName = sd_getClassNameFromMD(srcMD);
+      std::string dstName = sd_getClassNameFromMD(dstMD);
+
+      int64_t ind = cha->knowsAbout(vtbl_t(srcName, 0)) ? cha->getSubVTableIndex(dstName, srcName) : -1;
+      if (ind != -1)
+        referenced.insert(vtbl_t(dstName, ind));
+    }
+  }
+
+  // sd.check.vtbl(vptr, class, precise class)
+  Function* checkF = M.getFunction(Intrinsic::getName(Intrinsic::sd_check_vtbl));
+  if (checkF) {
+    for (const Use &U : checkF->uses()) {
+      CallInst* CI = cast<CallInst>(U.getUser());
+      MDNode* classMD = cast<MDNode>(cast<MetadataAsValue>(CI->getArgOperand(1))->getMetadata());
+      MDNode* preciseMD = cast<MDNode>(cast<MetadataAsValue>(CI->getArgOperand(2))->getMetadata());
+      std::string className = sd_getClassNameFromMD(classMD);
+      std::string preciseName = sd_getClassNameFromMD(preciseMD);
+
+      vtbl_t vtbl(className, 0);
+      if (cha->knowsAbout(vtbl) && preciseName != className) {
+        int64_t ind = cha->getSubVTableIndex(preciseName, className);
+        if (ind != -1)
+          vtbl = vtbl_t(preciseName, ind);
+      }
+      referenced.insert(vtbl);
+    }
+  }
+
+  // the interleaved layout of a partition doesn't keep the offsets of the classes
+  // above it, so the vtable indices must not be translated for them either
+  Function* indexF = M.getFunction(Intrinsic::getName(Intrinsic::sd_get_vtbl_index));
+  if (interleave && indexF) {
+    for (const Use &U : indexF->uses()) {
+      CallInst* CI = cast<CallInst>(U.getUser());
+      MDNode* classMD = cast<MDNode>(cast<MetadataAsValue>(CI->getArgOperand(1))->getMetadata());
+      referenced.insert(vtbl_t(sd_getClassNameFromMD(classMD), 0));
+    }
+  }
+
+  uint64_t numPartitions = cha->partitionClouds(referenced, SDPartitionMinCloud);
+  sdLog::stream() << "Partitioned giant clouds into " << numPartitions << " additional clouds\n";
+}
+
 ModulePass* llvm::createSDLayoutBuilderPass(bool interleave) {
   return new SDLayoutBuilder(interleave);
 }
@@ -287,6 +665,95 @@ Function* SDLayoutBuilder::getVthunkFunction(Constant* vtblElement) {
   return NULL;
 }
 
+/**
+ * Key of the clone of a vthunk whose sd_get_vcall_index calls return newIndices: the
+ * body of the thunk with those calls replaced by the new indices. Constants and globals
+ * are recorded by identity, arguments, blocks and instructions by their position, so
+ * two thunks get the same key only if their clones compute the same, whatever original
+ * they come from (only the dead sd_get_vcall_index calls may differ). Thunks with instructions not handled here get a key made of the
+ * original and the new indices, they are only shared with clones of the same original.
+ */
+static std::vector<uint64_t> sd_vthunkKey(Function* thunkF, Function* sd_vcall_indexF,
+                                           const std::vector<int64_t>& newIndices) {
+  std::vector<uint64_t> key;
+  std::map<const Value*, uint64_t> local;
+  for (const Argument& A : thunkF->args())
+    local.insert(std::make_pair(&A, local.size()));
+  for (const BasicBlock& BB : *thunkF) {
+    local.insert(std::make_pair(&BB, local.size()));
+    for (const Instruction& I : BB)
+      local.insert(std::make_pair(&I, local.size()));
+  }
+
+  auto value = [&](const Value* V) {
+    auto it = local.find(V);
+    if (it != local.end()) {
+      key.push_back(0);
+      key.push_back(it->second);
+    } else {
+      key.push_back(1);
+      key.push_back((uint64_t) V);
+    }
+  };
+
+  key.push_back(1); // structural key
+  key.push_back((uint64_t) thunkF->getFunctionType());
+  key.push_back((uint64_t) thunkF->getAttributes().getRawPointer());
+  key.push_back(thunkF->getCallingConv());
+  key.push_back(thunkF->getAlignment());
+  key.push_back(thunkF->getLinkage());
+  key.push_back(thunkF->getVisibility());
+
+  bool known = !thunkF->hasSection() && !thunkF->hasGC();
+  unsigned k = 0;
+  for (const BasicBlock& BB : *thunkF) {
+    key.push_back(BB.size());
+    for (const Instruction& I : BB) {
+      key.push_back(I.getOpcode());
+      key.push_back((uint64_t) I.getType());
+      key.push_back(I.getRawSubclassOptionalData());
+
+      if (const CallInst* CI = dyn_cast<CallInst>(&I)) {
+        if (CI->getCalledFunction() == sd_vcall_indexF) {
+          assert(k < newIndices.size());
+          key.push_back((uint64_t) newIndices[k++]);
+          continue;
+        }
+        key.push_back(CI->getCallingConv());
+        key.push_back((uint64_t) CI->getAttributes().getRawPointer());
+        key.push_back(CI->getTailCallKind());
+      } else if (const LoadInst* LI = dyn_cast<LoadInst>(&I)) {
+        key.push_back(LI->isVolatile());
+        key.push_back(LI->getAlignment());
+        key.push_back(LI->getOrdering());
+        key.push_back(LI->getSynchScope());
+      } else if (const CmpInst* CI = dyn_cast<CmpInst>(&I)) {
+        key.push_back(CI->getPredicate());
+      } else if (const PHINode* PN = dyn_cast<PHINode>(&I)) {
+        for (unsigned i = 0; i < PN->getNumIncomingValues(); i++)
+          value(PN->getIncomingBlock(i));
+      } else if (!isa<GetElementPtrInst>(I) && !isa<CastInst>(I) && !isa<BinaryOperator>(I) &&
+                 !isa<SelectInst>(I) && !isa<BranchInst>(I) && !isa<ReturnInst>(I) &&
+                 !isa<UnreachableInst>(I)) {
+        known = false;
+      }
+
+      key.push_back(I.getNumOperands());
+      for (const Use& U : I.operands())
+        value(U.get());
+    }
+  }
+
+  if (known)
+    return key;
+
+  key.clear();
+  key.push_back(0); // key of the original
+  key.push_back((uint64_t) thunkF);
+  key.insert(key.end(), newIndices.begin(), newIndices.end());
+  return key;
+}
+
 //Paul: replace the old v call index with a new one using Intrinsic::sd_get_vcall_index
 //this is necessary since the layout of the v tables is changed 
 //This are the placeholders which will be filled with values of the ranges and widths 
@@ -295,7 +762,7 @@ void SDLayoutBuilder::createThunkFunctions(Module& M, const vtbl_name_t& rootNam
   vtbl_t root(rootName,0);
 
   //Paul: preorder traversal of the whole cloud tree 
-  order_t vtbls_preorder = cha->preorder(root);
+  const order_t& vtbls_preorder = cloudIndexMap[rootName].nodes;
 
   LLVMContext& C = M.getContext();
 
@@ -338,11 +805,45 @@ void SDLayoutBuilder::createThunkFunctions(Module& M, const vtbl_name_t& rootNam
       std::string newThunkName(NEW_VTHUNK_NAME(thunkF, parentClass));
       
       //if allready exists than skip 
-      if (M.getFunction(newThunkName)) {
+      if (vthunkNameMap.count(newThunkName)) {
         // we already created such function, will use that later
         continue;
       }
 
+      // collect the translated vcall offsets of this thunk first. Thunks with the same
+      // body once the offsets are translated get identical clones, so a single clone
+      // can serve every (sub-)vtable that needs one, also across clouds and originals.
+      std::vector<int64_t> newIndices;
+
+      if (sd_vcall_indexF) {
+        for (inst_iterator I = inst_begin(thunkF), E = inst_end(thunkF); I != E; ++I) {
+          CallInst* CI = dyn_cast<CallInst>(&*I);
+          if (!CI || CI->getCalledFunction() != sd_vcall_indexF)
+            continue;
+
+          llvm::ConstantInt* oldVal = dyn_cast<ConstantInt>(CI->getArgOperand(0));
+          assert(oldVal);
+
+          // extract the old index and translate it (relative is always on)
+          int64_t oldIndex = oldVal->getSExtValue() / WORD_WIDTH;
+          newIndices.push_back(translateVtblInd(vtbl_t(vtbl,order), oldIndex, true));
+        }
+      }
+
+      vthunk_key_t key = sd_vthunkKey(thunkF, sd_vcall_indexF, newIndices);
+      auto sharedIt = vthunkCloneMap.find(key);
+      if (sharedIt != vthunkCloneMap.end()) {
+        sd_print("Reusing thunk function %s for %s\n",
+                 sharedIt->second.second->getName().data(), newThunkName.c_str());
+        vthunkNameMap[newThunkName] = sharedIt->second.second;
+        numVthunksShared++;
+        if (sharedIt->second.first != thunkF)
+          numVthunksSharedAcross++;
+        for (const BasicBlock& BB : *thunkF)
+          numVthunkInstsSaved += BB.size();
+        continue;
+      }
+
       // duplicate the function and rename it
       ValueToValueMapTy VMap;
 
@@ -355,53 +856,31 @@ void SDLayoutBuilder::createThunkFunctions(Module& M, const vtbl_name_t& rootNam
       //insert the new thunk function into the module function list 
       M.getFunctionList().push_back(newThunkF);
 
-      //start replacing the old index in the instruction witht the new index 
-      CallInst* CI = NULL; //declare a new call instruction 
-      
+      vthunkCloneMap[key] = std::make_pair(thunkF, newThunkF);
+      vthunkNameMap[newThunkName] = newThunkF;
+      numVthunksCloned++;
+
       //if the function is null than skip loop iteration 
       if(sd_vcall_indexF == NULL)
         continue;
 
-      // go over its instructions and replace the one with the metadata
-      // go over each function 
-      for(Function:: iterator bb_itr = newThunkF->begin(); bb_itr != newThunkF->end(); bb_itr++) {
-        
-        //go over each bb inside the function
-        for(BasicBlock:: iterator i_itr = bb_itr->begin(); i_itr != bb_itr->end(); i_itr++) {
-          Instruction* inst = i_itr;
-          
-          //cast to CallInstrunction and assign the instruction to CI 
-          //check that the called function by thic call instrunction equals  sd_vcall_indexF
-          //Function *sd_vcall_indexF = M.getFunction(Intrinsic::getName(Intrinsic::sd_get_vcall_index));
-          //basically we filter for the instrunction which is calling our function which gets the v call index 
-          if ((CI = dyn_cast<CallInst>(inst)) && CI->getCalledFunction() == sd_vcall_indexF) {
-            
-            // get the first argument, this is the v pointer 
-            llvm::ConstantInt* oldVal = dyn_cast<ConstantInt>(CI->getArgOperand(0));
-
-            //assert there is one 
-            assert(oldVal);
-
-            // extract the old index
-            int64_t oldIndex = oldVal->getSExtValue() / WORD_WIDTH;
-
-            // calculate the new index
-            sd_print("NEW_VTHUNK_NAME(fun,parent) (_SVT + parent + fun->getName().str()) \n");
-            sd_print("Create thunk function %s\n", newThunkName.c_str());
-
-            //compute new index based on the fact that it is relative or not
-            //in our case relative is always on  
-            int64_t newIndex = translateVtblInd(vtbl_t(vtbl,order), oldIndex, true);
-            
-            //multiply with word_width == 8
-            Value* newValue = ConstantInt::get(IntegerType::getInt64Ty(C), newIndex * WORD_WIDTH);
-            
-            //set the new index value in the call instrunction 
-            //set the new value of the v pointer 
-            CI->replaceAllUsesWith(newValue);
+      sd_print("Create thunk function %s\n", newThunkName.c_str());
 
-          }
-        }
+      // go over the clone's instructions (same order as in the original) and
+      // replace each old vcall index with its translated one
+      unsigned k = 0;
+      for (inst_iterator I = inst_begin(newThunkF), E = inst_end(newThunkF); I != E; ++I) {
+        CallInst* CI = dyn_cast<CallInst>(&*I);
+        if (!CI || CI->getCalledFunction() != sd_vcall_indexF)
+          continue;
+
+        assert(k < newIndices.size());
+
+        //multiply with word_width == 8
+        Value* newValue = ConstantInt::get(IntegerType::getInt64Ty(C), newIndices[k++] * WORD_WIDTH);
+
+        //set the new value of the v pointer 
+        CI->replaceAllUsesWith(newValue);
       }
 
       // this function should have a metadata
@@ -425,8 +904,10 @@ void SDLayoutBuilder::orderCloud(SDLayoutBuilder::vtbl_name_t& vtbl) {
   // create a temporary list for the positive part
   interleaving_vec_t orderedVtbl;
 
-  vtbl_t root(vtbl,0);
-  order_t pre = cha->preorder(root);
+  cloud_index_t& index = cloudIndexMap[vtbl];
+  const order_t& pre = index.nodes;
+  std::vector<int64_t>& orderedNodes = index.layoutNodes;
+  orderedNodes.clear();
   uint64_t max = 0;
 
   for(const vtbl_t child : pre) {
@@ -453,7 +934,8 @@ void SDLayoutBuilder::orderCloud(SDLayoutBuilder::vtbl_name_t& vtbl) {
 
   //sd_print("ALIGNMENT: %s, %u\n", vtbl.data(), max*WORD_WIDTH);
 
-  for(const vtbl_t child : pre) {
+  for(uint64_t n = 0; n < pre.size(); n++) {
+    const vtbl_t& child = pre[n];
     if(cha->isUndefined(child.first))
       continue;
 
@@ -468,15 +950,17 @@ void SDLayoutBuilder::orderCloud(SDLayoutBuilder::vtbl_name_t& vtbl) {
         std::cerr << "dummy entry is " << max << " aligned in cloud " << vtbl << std::endl;
       }
       orderedVtbl.push_back(interleaving_t(dummyVtable,0));
+      orderedNodes.push_back(-1);
     }
 
     for(unsigned i=0; i<size; i++) {
       orderedVtbl.push_back(interleaving_t(child, r.first + i));
+      orderedNodes.push_back(n);
     }
   }
 
   // store the new ordered vtable
-  interleavingMap[vtbl] = interleaving_list_t(orderedVtbl.begin(), orderedVtbl.end());
+  interleavingMap[vtbl] = std::move(orderedVtbl);
   
   sd_print("Finishing ordering for vtable: %s ...\n", vtbl.c_str());
 }
@@ -508,26 +992,21 @@ void SDLayoutBuilder::interleaveCloudNew(SDLayoutBuilder::vtbl_name_t& vtbl) {
   */
   assert(cha->isRoot(vtbl));
 
-  // create a temporary list for the positive part
-  interleaving_list_t positive_list_Part;
-
   //Paul: this is a a vector of all the nodes in the sub-tree having as root the vtbl 
   vtbl_t root(vtbl,0);
   
   //Paul: return the nodes of the sub tree having 
   // as root vtbl in preorder 
-  order_t preorderNodeSet = cha->preorder(root);  
+  cloud_index_t& index = cloudIndexMap[vtbl];
+  const order_t& preorderNodeSet = index.nodes;
   sd_print("Root node: %s has %d nodes in preoder \n", vtbl.c_str(), preorderNodeSet.size());
-  
-  std::map<vtbl_t, uint64_t> indMap;
-  for (uint64_t i = 0; i < preorderNodeSet.size(); i++)
-    indMap[preorderNodeSet[i]] = i;
 
   // First check if any vtable needs pre-padding. (All vtables must contain their parents).
   int numParent =0;
 
   //Paul: iterate through all the nodes in this sub tree 
-  for (auto parent : preorderNodeSet) {
+  for (uint64_t p = 0; p < preorderNodeSet.size(); p++) {
+    const vtbl_t& parent = preorderNodeSet[p];
     if (cha->isUndefined(parent))
       continue; 
       
@@ -538,18 +1017,19 @@ void SDLayoutBuilder::interleaveCloudNew(SDLayoutBuilder::vtbl_name_t& vtbl) {
     //Paul: search only in the children of the current node 
     // the definition of the children should take into account
     // both the inheritance between classes and between v tables 
-    for (auto child = cha->children_begin(parent); child != cha->children_end(parent); child++) {
+    for (uint64_t c = index.childBegin[p]; c < index.childBegin[p + 1]; c++) {
+        const vtbl_t& child = preorderNodeSet[index.children[c]];
         if (cha->isUndefined(parent))
           continue; 
         
         numChildrenPerParent++;
 
-        if (indMap[*child] < indMap[parent])
+        if (index.children[c] < p)
           continue; // Earlier in the preorder traversal - visited from a different node.
         
         //Paul: get the ranges of the parent and child
         const range_t &parentRange = cha->getRange(parent);
-        const range_t &childRange = cha->getRange(*child);
+        const range_t &childRange = cha->getRange(child);
 
         //Paul: get the ranges of the parent 
         uint64_t parentStart  = parentRange.first;
@@ -559,33 +1039,32 @@ void SDLayoutBuilder::interleaveCloudNew(SDLayoutBuilder::vtbl_name_t& vtbl) {
         //Paul: get the ranges of the child 
         uint64_t childStart  = childRange.first;
         uint64_t childEnd    = childRange.second;
-        uint64_t childAddrPt = cha->addrPt(*child);
+        uint64_t childAddrPt = cha->addrPt(child);
 
         uint64_t parentPreAddrPt = parentAddrPt - parentStart + prePadMap[parent];
-        uint64_t childPreAddrPt  = childAddrPt  - childStart  + prePadMap[*child];
+        uint64_t childPreAddrPt  = childAddrPt  - childStart  + prePadMap[child];
 
         //Paul: the prepad value for the child is eath the 
         //difference between parent (prepad address point) and of the child (prepad address point) 
         // or the old value contained in the child 
-        prePadMap[*child] = (parentPreAddrPt > childPreAddrPt ?
-                             parentPreAddrPt - childPreAddrPt : prePadMap[*child]);
+        prePadMap[child] = (parentPreAddrPt > childPreAddrPt ?
+                            parentPreAddrPt - childPreAddrPt : prePadMap[child]);
     }
     sd_print("Parent %d name: %s has %d children ...\n", numParent, parent.first.c_str(), numChildrenPerParent);
   }
 
   sd_print("Total number of parents %d...\n", numParent);
 
-  // initialize the cloud's interleaving list
-  interleavingMap[vtbl] = interleaving_list_t();
+  // initialize the cloud's interleaving
+  interleaving_vec_t& interleaving = interleavingMap[vtbl];
+  interleaving.clear();
+  index.layoutNodes.clear();
 
   // fill the negative part of the interleaving map 
-  fillVtablePart(interleavingMap[vtbl], preorderNodeSet, false); //Paul: one time with false, negative part
+  fillVtablePart(interleaving, index.layoutNodes, preorderNodeSet, false); //Paul: one time with false, negative part
   
-  // fill the positive part of the interleaving map 
-  fillVtablePart(positive_list_Part, preorderNodeSet, true);     //Paul: one time with true , positive part
-
   // append the positive part to the negative part in the interleaving map 
-  interleavingMap[vtbl].insert(interleavingMap[vtbl].end(), positive_list_Part.begin(), positive_list_Part.end());
+  fillVtablePart(interleaving, index.layoutNodes, preorderNodeSet, true);  //Paul: one time with true , positive part
   alignmentMap[vtbl] = WORD_WIDTH;
   
   sd_print("Finishing Interleaving for v table %s...\n", vtbl.c_str());
@@ -607,26 +1086,21 @@ void SDLayoutBuilder::interleaveCloud(SDLayoutBuilder::vtbl_name_t& vtbl) {
   */
   assert(cha->isRoot(vtbl)); 
 
-  // create a temporary list for the positive part
-  interleaving_list_t positive_list_Part;
-
   //Paul: this is a a vector of all the nodes in the sub-tree having as root the vtbl 
   vtbl_t root(vtbl,0);
   
   //Paul: return the nodes of the sub tree having 
   // as root vtbl in preorder 
-  order_t preorderNodeSet = cha->preorder(root);  
+  cloud_index_t& index = cloudIndexMap[vtbl];
+  const order_t& preorderNodeSet = index.nodes;
   sd_print("Root node: %s has %d nodes in preoder \n", vtbl.c_str(), preorderNodeSet.size());
-  
-  std::map<vtbl_t, uint64_t> indMap;
-  for (uint64_t i = 0; i < preorderNodeSet.size(); i++)
-    indMap[preorderNodeSet[i]] = i;
 
   // First check if any vtable needs pre-padding. (All vtables must contain their parents).
   int numParent =0;
 
   //Paul: iterate through all the nodes in this sub tree 
-  for (auto parent : preorderNodeSet) {
+  for (uint64_t p = 0; p < preorderNodeSet.size(); p++) {
+    const vtbl_t& parent = preorderNodeSet[p];
     if (cha->isUndefined(parent))
       continue; 
       
@@ -637,18 +1111,19 @@ void SDLayoutBuilder::interleaveCloud(SDLayoutBuilder::vtbl_name_t& vtbl) {
     //Paul: search only in the children of the current node 
     // the definition of the children should take into account
     // both the inheritance between classes and between v tables 
-    for (auto child = cha->children_begin(parent); child != cha->children_end(parent); child++) {
+    for (uint64_t c = index.childBegin[p]; c < index.childBegin[p + 1]; c++) {
+        const vtbl_t& child = preorderNodeSet[index.children[c]];
         if (cha->isUndefined(parent))
           continue; 
         
         numChildrenPerParent++;
 
-        if (indMap[*child] < indMap[parent])
+        if (index.children[c] < p)
           continue; // Earlier in the preorder traversal - visited from a different node.
         
         //Paul: get the ranges of the parent and child
         const range_t &parentRange = cha->getRange(parent);
-        const range_t &childRange = cha->getRange(*child);
+        const range_t &childRange = cha->getRange(child);
 
         //Paul: get the ranges of the parent 
         uint64_t parentStart  = parentRange.first;
@@ -658,33 +1133,32 @@ void SDLayoutBuilder::interleaveCloud(SDLayoutBuilder::vtbl_name_t& vtbl) {
         //Paul: get the ranges of the child 
         uint64_t childStart  = childRange.first;
         uint64_t childEnd    = childRange.second;
-        uint64_t childAddrPt = cha->addrPt(*child);
+        uint64_t childAddrPt = cha->addrPt(child);
 
         uint64_t parentPreAddrPt = parentAddrPt - parentStart + prePadMap[parent];
-        uint64_t childPreAddrPt  = childAddrPt  - childStart  + prePadMap[*child];
+        uint64_t childPreAddrPt  = childAddrPt  - childStart  + prePadMap[child];
 
         //Paul: the prepad value for the child is eath the 
         //difference between parent (prepad address point) and of the child (prepad address point) 
         // or the old value contained in the child 
-        prePadMap[*child] = (parentPreAddrPt > childPreAddrPt ?
-                             parentPreAddrPt - childPreAddrPt : prePadMap[*child]);
+        prePadMap[child] = (parentPreAddrPt > childPreAddrPt ?
+                            parentPreAddrPt - childPreAddrPt : prePadMap[child]);
     }
     sd_print("Parent %d has %d children ...\n", numParent, numChildrenPerParent);
   }
 
   sd_print("Total number of parents %d...\n", numParent);
 
-  // initialize the cloud's interleaving list
-  interleavingMap[vtbl] = interleaving_list_t();
+  // initialize the cloud's interleaving
+  interleaving_vec_t& interleaving = interleavingMap[vtbl];
+  interleaving.clear();
+  index.layoutNodes.clear();
 
   // fill the negative part of the interleaving map 
-  fillVtablePart(interleavingMap[vtbl], preorderNodeSet, false); //Paul: one time with false, negative part
+  fillVtablePart(interleaving, index.layoutNodes, preorderNodeSet, false); //Paul: one time with false, negative part
   
-  // fill the positive part of the interleaving map 
-  fillVtablePart(positive_list_Part, preorderNodeSet, true);     //Paul: one time with true , positive part
-
   // append the positive part to the negative part in the interleaving map 
-  interleavingMap[vtbl].insert(interleavingMap[vtbl].end(), positive_list_Part.begin(), positive_list_Part.end());
+  fillVtablePart(interleaving, index.layoutNodes, preorderNodeSet, true);  //Paul: one time with true , positive part
   alignmentMap[vtbl] = WORD_WIDTH;
   
   sd_print("Finishing Interleaving for v table %s...\n", vtbl.c_str());
@@ -701,45 +1175,105 @@ void SDLayoutBuilder::calculateNewLayoutInds(SDLayoutBuilder::vtbl_name_t& vtbl)
   sd_print("v table: %s has in the interleaving map: %d v tables \n", 
   vtbl.c_str(), interleavingMap.count(vtbl));
 
-  uint64_t currentIndex = 0;
- 
-  //Paul: the interleaving map was computed in the ordering or interleaving algoritm 
-  for (const interleaving_t& ivtbl : interleavingMap[vtbl]) {
-    
-    sd_print("NewLayoutInds for vtable (%s, %d)\n", ivtbl.first.first.c_str(), ivtbl.first.second);
-    if(ivtbl.first != dummyVtable) {//Paul: do not count dummy v tables
-      // record the new index of the vtable element coming from the current vtable
-      newLayoutInds[ivtbl.first].push_back(currentIndex++);
-    } else {
-      currentIndex++;
-    }
+  // counting sort of the entries by their vtable, stable so every vtable lists
+  // its new indices in the order of the interleaving
+  cloud_index_t& index = cloudIndexMap[vtbl];
+  const std::vector<int64_t>& layoutNodes = index.layoutNodes;
+  assert(layoutNodes.size() == interleavingMap[vtbl].size());
+
+  index.indsBegin.assign(index.nodes.size() + 1, 0);
+  for (int64_t n : layoutNodes)
+    if (n >= 0) //Paul: do not count dummy v tables
+      index.indsBegin[n + 1]++;
+  for (uint64_t i = 0; i < index.nodes.size(); i++)
+    index.indsBegin[i + 1] += index.indsBegin[i];
+
+  std::vector<uint64_t> cursor(index.indsBegin.begin(), index.indsBegin.end() - 1);
+  index.inds.resize(index.indsBegin.back());
+  for (uint64_t currentIndex = 0; currentIndex < layoutNodes.size(); currentIndex++) {
+    int64_t n = layoutNodes[currentIndex];
+    if (n >= 0)
+      index.inds[cursor[n]++] = currentIndex;
+  }
+}
+
+/**
+ * Walks the cloud below v in the order of SDBuildCHA::preorderHelper. A node gets its
+ * dense index on the first visit, the dense node map entries of the cloud double as the
+ * visited set. The edges are collected as (parent, child) dense indices.
+ */
+static void sd_indexCloudHelper(SDBuildCHA* cha, const SDLayoutBuilder::vtbl_t& v,
+                                SDLayoutBuilder::cloud_index_t& index,
+                                std::map<SDLayoutBuilder::vtbl_t, SDLayoutBuilder::dense_node_t>& denseNodeMap,
+                                std::vector<std::pair<uint64_t, uint64_t>>& edges) {
+  uint64_t pos = index.nodes.size();
+  denseNodeMap[v] = SDLayoutBuilder::dense_node_t(&index, pos);
+  index.nodes.push_back(v);
+
+  for (auto it = cha->children_begin(v); it != cha->children_end(v); it++) {
+    auto found = denseNodeMap.find(*it);
+    if (found == denseNodeMap.end() || found->second.first != &index)
+      sd_indexCloudHelper(cha, *it, index, denseNodeMap, edges);
+    edges.push_back(std::make_pair(pos, denseNodeMap[*it].second));
   }
 }
 
+void SDLayoutBuilder::indexCloud(const SDLayoutBuilder::vtbl_name_t& vtbl) {
+  cloud_index_t& index = cloudIndexMap[vtbl];
+  index = cloud_index_t();
+
+  std::vector<std::pair<uint64_t, uint64_t>> edges;
+  sd_indexCloudHelper(cha, vtbl_t(vtbl, 0), index, denseNodeMap, edges);
+
+  // children lists in the order of cha->children_begin, as the callers iterated them
+  index.childBegin.assign(index.nodes.size() + 1, 0);
+  for (auto& e : edges)
+    index.childBegin[e.first + 1]++;
+  for (uint64_t i = 0; i < index.nodes.size(); i++)
+    index.childBegin[i + 1] += index.childBegin[i];
+
+  std::vector<uint64_t> cursor(index.childBegin.begin(), index.childBegin.end() - 1);
+  index.children.resize(edges.size());
+  for (auto& e : edges)
+    index.children[cursor[e.first]++] = e.second;
+}
+
+ArrayRef<uint64_t> SDLayoutBuilder::getNewLayoutInds(const SDLayoutBuilder::vtbl_t& vtbl) {
+  auto it = denseNodeMap.find(vtbl);
+  if (it == denseNodeMap.end())
+    return ArrayRef<uint64_t>();
+
+  const cloud_index_t& index = *it->second.first;
+  uint64_t n = it->second.second;
+  if (index.indsBegin.size() <= n + 1)
+    return ArrayRef<uint64_t>();
+  return ArrayRef<uint64_t>(index.inds.data() + index.indsBegin[n],
+                            index.indsBegin[n + 1] - index.indsBegin[n]);
+}
+
 /*Paul:
 this is a helper function for the v pointer range calculator 
 Here the v pointer ranges get coalesced 
 */
-void SDLayoutBuilder::calculateVPtrRangesHelper(const SDLayoutBuilder::vtbl_t& vtbl, std::map<vtbl_t, uint64_t> &indMap){
-  // Already computed
-  if (rangeMap.find(vtbl) != rangeMap.end())
+void SDLayoutBuilder::calculateVPtrRangesHelper(const SDLayoutBuilder::cloud_index_t& index, uint64_t node,
+                                                std::vector<std::vector<range_t>>& nodeRanges){
+  // Already computed, every node's ranges contain at least the node itself
+  if (!nodeRanges[node].empty())
     return;
   
   //iterate trough all children of this v table and do recursive call 
-  for (auto childIt = cha->children_begin(vtbl); childIt != cha->children_end(vtbl); childIt++) {
-    const vtbl_t &child = *childIt;
-    calculateVPtrRangesHelper(child, indMap);
-  }
+  for (uint64_t c = index.childBegin[node]; c < index.childBegin[node + 1]; c++)
+    calculateVPtrRangesHelper(index, index.children[c], nodeRanges);
   
   //declare a range vector 
   std::vector<range_t> ranges;
 
-  ranges.push_back(range_t(indMap[vtbl], indMap[vtbl]+1));
+  ranges.push_back(range_t(node, node+1));
   
   //iterate trough all children of this v table and append each range at the end in ranges 
-  for (auto childIt = cha->children_begin(vtbl); childIt != cha->children_end(vtbl); childIt++) {
-    const vtbl_t &child = *childIt;
-    ranges.insert(ranges.end(), rangeMap[child].begin(), rangeMap[child].end());
+  for (uint64_t c = index.childBegin[node]; c < index.childBegin[node + 1]; c++) {
+    const std::vector<range_t>& childRanges = nodeRanges[index.children[c]];
+    ranges.insert(ranges.end(), childRanges.begin(), childRanges.end());
   }
 
   //sort the ranges 
@@ -771,6 +1305,7 @@ void SDLayoutBuilder::calculateVPtrRangesHelper(const SDLayoutBuilder::vtbl_t& v
     coalesced_ranges.push_back(range_t(start,end));
   
   //print the ranges 
+  const vtbl_t& vtbl = index.nodes[node];
   sdLog::log() << "Range for: {" << vtbl.first << "," << vtbl.second << "} From ranges [";
   for (auto it : ranges)
     sdLog::log() << "(" << it.first << "," << it.second << "),";
@@ -781,7 +1316,7 @@ void SDLayoutBuilder::calculateVPtrRangesHelper(const SDLayoutBuilder::vtbl_t& v
 
   sdLog::log() << "]\n";
   
-  rangeMap[vtbl] = coalesced_ranges;
+  nodeRanges[node] = std::move(coalesced_ranges);
 }
 
 /*Paul:
@@ -855,21 +1390,19 @@ void SDLayoutBuilder::calculateVPtrRanges(Module& M, SDLayoutBuilder::vtbl_name_
   SDLayoutBuilder::vtbl_t root(vtbl, 0); // Paul: declare a v table with name vtbl and index 0
 
   //Paul: nodes in preorder for one each root node one by one
-  order_t preorderV = cha->preorder(root); 
+  const cloud_index_t& index = cloudIndexMap[vtbl];
+  const order_t& preorderV = index.nodes;
 
   //print preorder nodes of one root node 
   sd_print("\ncalculateVPtrRanges: Preorder nodes of root %s are: \n", vtbl.c_str());
   for (uint64_t i= 0; i < preorderV.size(); i++)
     sdLog::log() << "first: " << preorderV[i].first << ", second: " << preorderV[i].second << "\n";
 
-  std::map<vtbl_t, uint64_t> indMap;
-
-  //set the indices in the indices map
-  for (uint64_t i = 0; i < preorderV.size(); i++) 
-      indMap[preorderV[i]] = i;
-  
   //coalesce ranges, mix them together 
-  calculateVPtrRangesHelper(root, indMap);
+  std::vector<std::vector<range_t>> nodeRanges(preorderV.size());
+  calculateVPtrRangesHelper(index, 0, nodeRanges);
+  for (uint64_t i = 0; i < preorderV.size(); i++)
+    rangeMap[preorderV[i]] = std::move(nodeRanges[i]);
  
   //Paul: iterate through all the nodes for this root 
   //and print the ranges 
@@ -922,7 +1455,7 @@ The new constant will replace the old one in the end of this method.
 void SDLayoutBuilder::createNewVTable(Module& M, SDLayoutBuilder::vtbl_name_t& vtbl){
   
   // get the new v table from the interleaving map (interleaving or ordering)
-  interleaving_list_t& newVtbl = interleavingMap[vtbl];
+  interleaving_vec_t& newVtbl = interleavingMap[vtbl];
 
   // get the size
   uint64_t newSize = newVtbl.size();
@@ -967,8 +1500,10 @@ void SDLayoutBuilder::createNewVTable(Module& M, SDLayoutBuilder::vtbl_name_t& v
       if (thunk) {
 
         //create a new thunk function with a new name based on thunk and the parent class name 
-        Function* newThunk = M.getFunction(NEW_VTHUNK_NAME(thunk, cha->getLayoutClassName(ivtbl.first)));
-        assert(newThunk);
+        //(possibly shared with other sub-vtables, see createThunkFunctions)
+        auto newThunkIt = vthunkNameMap.find(NEW_VTHUNK_NAME(thunk, cha->getLayoutClassName(ivtbl.first)));
+        assert(newThunkIt != vthunkNameMap.end());
+        Function* newThunk = newThunkIt->second;
         
         //create a new bit cast constant using the newthunk and the context Context
         Constant* newC = ConstantExpr::getBitCast(newThunk, IntegerType::getInt8PtrTy(Context));
@@ -1021,7 +1556,7 @@ void SDLayoutBuilder::createNewVTable(Module& M, SDLayoutBuilder::vtbl_name_t& v
   // these are all the nodes associated to a root node contained
   // in the roots vector. Get the nodes in preorder traversal
   // for the root node vtbl 
-  order_t cloudPreorderNodes = cha->preorder(vtbl_t(vtbl, 0));
+  const order_t& cloudPreorderNodes = cloudIndexMap[vtbl].nodes;
   
   //declare a new zero constant 
   Constant* zero = ConstantInt::get(M.getContext(), APInt(64, 0));
@@ -1079,7 +1614,9 @@ void SDLayoutBuilder::createNewVTable(Module& M, SDLayoutBuilder::vtbl_name_t& v
 
       // find the new offset corresponding to the relative offset
       // inside the interleaved vtable
-      int64_t newAddrPt = newLayoutInds[vnode][addrInsideBlock];
+      ArrayRef<uint64_t> newInds = getNewLayoutInds(vnode);
+      assert(addrInsideBlock < (int) newInds.size());
+      int64_t newAddrPt = newInds[addrInsideBlock];
       
       //declare a new offset constant 
       Constant* newOffsetConstant  = ConstantInt::getSigned(Type::getInt64Ty(M.getContext()), newAddrPt);
@@ -1117,59 +1654,83 @@ void SDLayoutBuilder::createNewVTable(Module& M, SDLayoutBuilder::vtbl_name_t& v
   }
 }
 
-/*Paul:
-check if lhs (left hand side) it is less equal rhs (right hand side)*/
-static bool sd_isLE(int64_t lhs, int64_t rhs) { return lhs <= rhs; }
-
-/*Paul:
-check if lhs (left hand side) it is greather equal rhs (right hand side)*/
-static bool sd_isGE(int64_t lhs, int64_t rhs) { return lhs >= rhs; }
-
 //Paul: this is used to fill (with positive and negative part) the interleaving map with the rest of the component
 //after the interleaving was performed 
-void SDLayoutBuilder::fillVtablePart(SDLayoutBuilder::interleaving_list_t& vtblPartList, 
-                                              const SDLayoutBuilder::order_t& nodesInPreorder, 
-                                                                    bool positivePartOn_Off) {
-  std::map<vtbl_t, int64_t> posMap;     // current position
-  std::map<vtbl_t, int64_t> lastPosMap; // last possible position
- 
-  //Paul: traverse only the ones from this child 
-  // This is ok. 
-  for(const vtbl_t& n : nodesInPreorder) {
-    uint64_t addrPt = cha->addrPt(n);  // get the address point of the vtable
+//
+// Round k takes the k-th element (counting away from the address point) of every defined
+// vtable in preorder that still has one. The negative part lists the rounds from the last
+// one down to round 0, the positive part from round 0 up. The number of vtables taking part
+// in each round gives every round's offset inside the part, so each element is written
+// straight to its final slot: O(nodes + elements) instead of one scan of all nodes per round.
+// The dense index of the vtable of every slot goes to the same slot of partNodes.
+void SDLayoutBuilder::fillVtablePart(SDLayoutBuilder::interleaving_vec_t& vtblPart, 
+                                     std::vector<int64_t>& partNodes,
+                                     const SDLayoutBuilder::order_t& nodesInPreorder, 
+                                                           bool positivePartOn_Off) {
+  assert(partNodes.size() == vtblPart.size());
+  const uint64_t numNodes = nodesInPreorder.size();
+  std::vector<int64_t> firstPos(numNodes, 0); // old position taken in round 0
+  std::vector<uint64_t> length(numNodes, 0);  // number of rounds the vtable takes part in
+  uint64_t maxLength = 0;
+  uint64_t total = 0;
+
+  for (uint64_t i = 0; i < numNodes; i++) {
+    const vtbl_t& n = nodesInPreorder[i];
+    if (cha->isUndefined(n.first))
+      continue;
+
+    int64_t addrPt = cha->addrPt(n);     // get the address point of the vtable
     const range_t &r = cha->getRange(n); // get the range (start & end address) of that particular v table 
-    posMap[n]     = positivePartOn_Off ? addrPt : (addrPt - 1); // position map = addrPt or addrPt - 1
-    lastPosMap[n] = positivePartOn_Off ? r.second : (r.first - prePadMap[n]); //set last position map 
-  }
 
-  interleaving_list_t current; // interleaving of one element
-  bool (*check)(int64_t,int64_t) = positivePartOn_Off ? sd_isLE : sd_isGE;//Paul: use one or the other check 
-  int increment = positivePartOn_Off ? 1 : -1; //use either 1 or -1
-  int64_t pos;
-
-  // while we have an element to insert to the vtable, continue looping
-  while(true) {
-    // traverse all the nodes from the hierarchy 
-    for (const vtbl_t& n : nodesInPreorder) {
-      pos = posMap[n];
-      if (!cha->isUndefined(n.first) && check(pos, lastPosMap[n])) {
-        //Paul: add all the nodes from this hierarchy n == node == v table to a certain position 
-        current.push_back(interleaving_t(n, pos));
-        posMap[n] += increment; // this adds 1 or substract -1 from the position map for each of the nodes 
-      }
+    if (positivePartOn_Off) {
+      int64_t lastPos = r.second;
+      firstPos[i] = addrPt;
+      length[i] = lastPos >= addrPt ? lastPos - addrPt + 1 : 0;
+    } else {
+      int64_t lastPos = (int64_t) (r.first - prePadMap[n]);
+      firstPos[i] = addrPt - 1;
+      length[i] = addrPt - 1 >= lastPos ? addrPt - lastPos : 0;
     }
 
-    if (current.size() == 0)
-      break;
+    maxLength = std::max(maxLength, length[i]);
+    total += length[i];
+  }
+
+  // roundSize[k] = number of vtables with more than k elements in this part
+  std::vector<uint64_t> roundSize(maxLength + 1, 0);
+  for (uint64_t i = 0; i < numNodes; i++)
+    roundSize[length[i]]++;
+  uint64_t longer = 0;
+  for (uint64_t k = maxLength + 1; k-- > 0; ) {
+    uint64_t atK = roundSize[k];
+    roundSize[k] = longer;
+    longer += atK;
+  }
 
-    // declare an interator to the interleaving list pointing at the beginning or the end of the interleaving list 
-    interleaving_list_t::iterator itr = positivePartOn_Off ? vtblPartList.end() : vtblPartList.begin();
+  // slot where the next element of each round goes
+  std::vector<uint64_t> cursor(maxLength, 0);
+  uint64_t offset = vtblPart.size();
+  if (positivePartOn_Off) {
+    for (uint64_t k = 0; k < maxLength; k++) {
+      cursor[k] = offset;
+      offset += roundSize[k];
+    }
+  } else {
+    for (uint64_t k = maxLength; k-- > 0; ) {
+      cursor[k] = offset;
+      offset += roundSize[k];
+    }
+  }
 
-    //Paul: in the end add the results contained in current interleaving list baset on the iterator itr
-    // (at the end or beginning) of the final interleaving list 
-    vtblPartList.insert(itr, current.begin(), current.end());
+  int64_t increment = positivePartOn_Off ? 1 : -1; //use either 1 or -1
+  vtblPart.resize(vtblPart.size() + total);
+  partNodes.resize(vtblPart.size());
 
-    current.clear();
+  for (uint64_t i = 0; i < numNodes; i++) {
+    for (uint64_t k = 0; k < length[i]; k++) {
+      partNodes[cursor[k]] = i;
+      vtblPart[cursor[k]++] = interleaving_t(nodesInPreorder[i], firstPos[i] + increment * (int64_t) k);
+    }
   }
 }
 
@@ -1180,13 +1741,16 @@ int64_t SDLayoutBuilder::translateVtblInd(SDLayoutBuilder::vtbl_t vname, int64_t
     vname = cha->getFirstDefinedChild(vname);
   }
 
-  if (!newLayoutInds.count(vname)) {
+  //get new layouts indices for this new v table name 
+  ArrayRef<uint64_t> newInds = getNewLayoutInds(vname);
+
+  if (newInds.empty()) {
     sd_print("Vtbl %s %d, undefined: %d.\n",
         vname.first.c_str(), vname.second, cha->isUndefined(vname));
     sd_print("has first child %d.\n", cha->hasFirstDefinedChild(vname));
     
     if (cha->knowsAbout(vname) && cha->hasFirstDefinedChild(vname)) {
-      sd_print("class: (%s, %lu) doesn't belong to newLayoutInds\n", vname.first.c_str(), vname.second);
+      sd_print("class: (%s, %lu) has no new layout indices\n", vname.first.c_str(), vname.second);
       sd_print("%s has %u address points\n", vname.first.c_str(), cha->getNumAddrPts(vname.first));
       
       for (uint64_t i = 0; i < cha->getNumAddrPts(vname.first); i++)
@@ -1201,9 +1765,6 @@ int64_t SDLayoutBuilder::translateVtblInd(SDLayoutBuilder::vtbl_t vname, int64_t
   //there exists a range for the v table name 
   assert(cha->hasRange(vname));
 
-  //get new layouts indices for this new v table name 
-  std::vector<uint64_t>& newInds = newLayoutInds[vname];
-
   //get the range for the v table v name 
   const range_t& subVtableRange = cha->getRange(vname);
   
@@ -1224,7 +1785,8 @@ int64_t SDLayoutBuilder::translateVtblInd(SDLayoutBuilder::vtbl_t vname, int64_t
     }
     
     //return the new index as the difference between the fullIndex and old address point 
-    return ((int64_t) newInds.at(fullIndex)) - ((int64_t) newInds.at(oldAddrPt));
+    assert(fullIndex < (int64_t) newInds.size() && oldAddrPt < (int64_t) newInds.size());
+    return ((int64_t) newInds[fullIndex]) - ((int64_t) newInds[oldAddrPt]);
 
     //if not relative 
   } else {
@@ -1246,8 +1808,11 @@ as usual, after the analysis is done clear all the
 used data structures*/
 void SDLayoutBuilder::clearAnalysisResults() {
   cha->clearAnalysisResults();
-  newLayoutInds.clear();
+  cloudIndexMap.clear();
+  denseNodeMap.clear();
   interleavingMap.clear();
+  vthunkCloneMap.clear();
+  vthunkNameMap.clear();
 
   sd_print("Cleared SDLayoutBuilder analysis results \n");
 }
@@ -1304,8 +1869,9 @@ void SDLayoutBuilder::removeOldLayouts(Module &M) {
  */
 uint64_t SDLayoutBuilder::newVtblAddressPoint(const vtbl_name_t& name) {
   vtbl_t vtbl(name,0);
-  assert(newLayoutInds.count(vtbl));
-  return newLayoutInds[vtbl][0];
+  ArrayRef<uint64_t> newInds = getNewLayoutInds(vtbl);
+  assert(!newInds.empty());
+  return newInds[0];
 }
 
 /**
@@ -1333,8 +1899,9 @@ Value* SDLayoutBuilder::newVtblAddress(Module& M, const vtbl_name_t& name, Instr
   unsigned addrPt = cha->addrPt(name, 0);
 
   // now find its new index
-  assert(newLayoutInds.count(vtbl));
-  uint64_t addrPtOff = newLayoutInds[vtbl][addrPt];
+  ArrayRef<uint64_t> newInds = getNewLayoutInds(vtbl);
+  assert(addrPt < newInds.size());
+  uint64_t addrPtOff = newInds[addrPt];
 
   // this should exist already
   GlobalVariable* gv = M.getGlobalVariable(rootName);
@@ -1379,8 +1946,9 @@ Constant* SDLayoutBuilder::newVtblAddressConst(Module& M, const vtbl_t& vtbl) {
   unsigned addrPt = cha->addrPt(vtbl) - cha->getRange(vtbl).first;
 
   // now find its new index
-  assert(newLayoutInds.count(vtbl));
-  uint64_t addrPtOff = newLayoutInds[vtbl][addrPt];
+  ArrayRef<uint64_t> newInds = getNewLayoutInds(vtbl);
+  assert(addrPt < newInds.size());
+  uint64_t addrPtOff = newInds[addrPt];
 
   // this should exist already
   GlobalVariable* gv = cloudStartMap[rootName];
@@ -1410,6 +1978,7 @@ void SDLayoutBuilder::buildNewLayouts(Module &M) {
   for (auto itr = cha->roots_begin(); itr != cha->roots_end(); itr++) {
    
     vtbl_name_t vtbl = *itr;         // get the v table name as string
+    indexCloud(vtbl);                // dense node numbering used by all the steps below
  
     //Paul: interleave or order for each v table separatelly 
     if (interleave){
@@ -1454,6 +2023,13 @@ void SDLayoutBuilder::buildNewLayouts(Module &M) {
     createNewVTable(M, vtbl);        
   }
 
+  sdStats::report().thunksCloned = numVthunksCloned;
+  sdStats::report().thunksShared = numVthunksShared;
+  sdStats::report().thunksSharedAcross = numVthunksSharedAcross;
+  sdLog::stream() << "vthunks: " << numVthunksCloned << " cloned, " << numVthunksShared
+                  << " shared (" << numVthunksSharedAcross << " with a clone of another original, "
+                  << numVthunkInstsSaved << " IR instructions not emitted)\n";
+
   // 3: we iterate through all roots contained in the cloud and 
   // calculate v pointer ranges and than verify the v pointer ranges
   for (auto itr = cha->roots_begin(); itr != cha->roots_end(); itr++) {
@@ -1468,7 +2044,33 @@ void SDLayoutBuilder::buildNewLayouts(Module &M) {
     //Check that the ranges of the descendants are disjoint:
     //1.This means they do not overlap at all.
     //2.Check that each descendent is in one of the ranges. 
-    verifyVPtrRanges(vtbl);         
+#ifndef NDEBUG
+    if (!SDVerifyLayouts)
+      verifyVPtrRanges(vtbl);         
+#endif
+
+    recordCloudStats(vtbl);
   }
 }
 
+void SDLayoutBuilder::recordCloudStats(const vtbl_name_t& vtbl) {
+  sdStats::CloudStats stats;
+  stats.root = vtbl;
+  stats.alignment = alignmentMap[vtbl];
+
+  for (const interleaving_t& ivtbl : interleavingMap[vtbl]) {
+    stats.interleavedSize += WORD_WIDTH;
+    if (ivtbl.first == dummyVtable)
+      stats.paddingBytes += WORD_WIDTH;
+  }
+
+  const order_t& cloud = cloudIndexMap[vtbl].nodes;
+  stats.numVTables = cloud.size();
+  for (const vtbl_t& v : cloud) {
+    if (hasMemRange(v))
+      stats.rangesPerVTable[v.first + "," + std::to_string(v.second)] = getMemRange(v).size();
+  }
+
+  sdStats::report().clouds.push_back(stats);
+}
+
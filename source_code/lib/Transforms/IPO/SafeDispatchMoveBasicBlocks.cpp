@@ -18,6 +18,7 @@
 
 #include "llvm/Transforms/IPO/SafeDispatchLog.h"
 #include "llvm/Transforms/IPO/SafeDispatchTools.h"
+#include "llvm/Transforms/IPO/SafeDispatchStats.h"
 
 #include "llvm/Transforms/Utils/ValueMapper.h"
 #include "llvm/Transforms/Utils/Cloning.h"
@@ -61,6 +62,7 @@ namespace {
       sd_print("P6. 2. remove bb from the bbs list (Function::BasicBlockListType &bbs) and insert it at the end ...\n");
       sd_print("P6. 3. so basically all bb blocks are reshufled at the end of the bbs list ...\n");
       sd_print("P6. 4. this improves runtime overhead ...\n");
+      sdStats::PassTimer timer("SDMoveBasicBlocks");
 
       for (auto fIt = M.begin(); fIt != M.end(); fIt++) {
         std::vector<BasicBlock*> toMove; 
@@ -89,6 +91,10 @@ namespace {
       }
       
       sd_print("P6. Finished Removing thunks finished (SDMoveBasicsBlocks pass) ...\n");
+
+      // this is the last SD pass, dump the statistics collected by the pipeline
+      timer.stop();
+      sdStats::writeReport(M);
       return true;
     }
     
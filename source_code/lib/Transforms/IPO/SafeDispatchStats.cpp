@@ -0,0 +1,225 @@
+#include "llvm/Transforms/IPO/SafeDispatchStats.h"
+#include "llvm/Transforms/IPO/SafeDispatchLogStream.h"
+#include "llvm/Transforms/IPO.h"
+
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Config/config.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/Timer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <cstdio>
+
+#ifdef HAVE_SYS_RESOURCE_H
+#include <sys/resource.h>
+#endif
+
+using namespace llvm;
+
+namespace sdStats {
+
+Report &report() {
+  static Report R;
+  return R;
+}
+
+static bool TimeReport;
+
+static cl::opt<bool, true>
+SDTimeReport("sd-time-report", cl::location(TimeReport),
+             cl::desc("Time the SafeDispatch passes, sample their RSS and add the "
+                      "statistics to the SD statistics report"));
+
+void setTimeReport(bool enabled) {
+  TimeReport = enabled;
+}
+
+bool timeReportEnabled() {
+  return TimeReport;
+}
+
+static uint64_t sd_peakRSSKBytes() {
+#if defined(HAVE_GETRUSAGE) && defined(HAVE_SYS_RESOURCE_H)
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0)
+    return usage.ru_maxrss; // KB on linux
+#endif
+  return 0;
+}
+
+/**
+ * Resident set size right now, from the second field of /proc/self/statm (in pages).
+ * 0 where there is no procfs.
+ */
+static uint64_t sd_currentRSSKBytes() {
+  // procfs reports a size of 0, so MemoryBuffer would read nothing
+  FILE *statm = fopen("/proc/self/statm", "r");
+  if (!statm)
+    return 0;
+
+  unsigned long size, resident;
+  int fields = fscanf(statm, "%lu %lu", &size, &resident);
+  fclose(statm);
+  if (fields != 2)
+    return 0;
+  return (uint64_t) resident * sys::Process::getPageSize() / 1024;
+}
+
+PassTimer::PassTimer(const std::string &name) :
+  name(name), start(TimeRecord::getCurrentTime(true)), rssBefore(0), peakRSSBefore(0),
+  stopped(false) {
+  if (!TimeReport)
+    return;
+
+  rssBefore = sd_currentRSSKBytes();
+  peakRSSBefore = sd_peakRSSKBytes();
+  region.reset(new NamedRegionTimer(name, StringRef("SafeDispatch")));
+  start = TimeRecord::getCurrentTime(true);
+}
+
+void PassTimer::stop() {
+  if (stopped)
+    return;
+  stopped = true;
+
+  TimeRecord end = TimeRecord::getCurrentTime(false);
+  region.reset();
+
+  PassStats P;
+  P.name = name;
+  P.wallSeconds = end.getWallTime() - start.getWallTime();
+  P.peakRSSKBytes = sd_peakRSSKBytes();
+  if (TimeReport) {
+    P.userSeconds = end.getUserTime() - start.getUserTime();
+    P.systemSeconds = end.getSystemTime() - start.getSystemTime();
+    P.rssBeforeKBytes = rssBefore;
+    P.rssAfterKBytes = sd_currentRSSKBytes();
+    P.peakRSSBeforeKBytes = peakRSSBefore;
+  }
+  report().passes.push_back(P);
+}
+
+/**
+ * Same naming scheme as the SDAnalysis output: <sd_output> or ./<sd_filename>
+ */
+static std::string sd_getStatsFileName(Module &M) {
+  auto SDOutputMD = M.getNamedMetadata("sd_output");
+  auto SDFilenameMD = M.getNamedMetadata("sd_filename");
+
+  std::string OutputPath;
+  if (SDOutputMD != nullptr)
+    OutputPath = cast<MDString>(SDOutputMD->getOperand(0)->getOperand(0))->getString().str();
+  else if (SDFilenameMD != nullptr)
+    OutputPath = "./" + cast<MDString>(SDFilenameMD->getOperand(0)->getOperand(0))->getString().str();
+
+  if (OutputPath.empty())
+    return "./SDStats.json";
+  return OutputPath + "-stats.json";
+}
+
+static void sd_writeString(raw_ostream &out, StringRef str) {
+  out << '"';
+  for (char c : str) {
+    if (c == '"' || c == '\\')
+      out << '\\' << c;
+    else if ((unsigned char) c < 0x20)
+      out << ' ';
+    else
+      out << c;
+  }
+  out << '"';
+}
+
+void writeReport(Module &M) {
+  Report &R = report();
+  std::string fileName = sd_getStatsFileName(M);
+
+  std::error_code EC;
+  raw_fd_ostream out(fileName, EC, sys::fs::OpenFlags::F_Text);
+  if (EC) {
+    sdLog::errs() << "Failed to write to " << fileName << "!\n";
+    R.clear();
+    return;
+  }
+  noteSDOutputFile(fileName);
+
+  out << "{\n";
+
+  out << "  \"clouds\": [";
+  for (unsigned i = 0; i < R.clouds.size(); i++) {
+    const CloudStats &C = R.clouds[i];
+    out << (i ? ",\n" : "\n") << "    {\"root\": ";
+    sd_writeString(out, C.root);
+    out << ", \"vtables\": " << C.numVTables
+        << ", \"alignment\": " << C.alignment
+        << ", \"size\": " << C.interleavedSize
+        << ", \"padding\": " << C.paddingBytes
+        << ", \"ranges\": {";
+    bool first = true;
+    for (auto &it : C.rangesPerVTable) {
+      out << (first ? "" : ", ");
+      sd_writeString(out, it.first);
+      out << ": " << it.second;
+      first = false;
+    }
+    out << "}}";
+  }
+  out << "\n  ],\n";
+
+  out << "  \"thunks\": {\"cloned\": " << R.thunksCloned << ", \"shared\": " << R.thunksShared
+      << ", \"shared_across_originals\": " << R.thunksSharedAcross << "},\n";
+
+  out << "  \"checks\": {\"index\": " << R.indexSubst
+      << ", \"range\": " << R.rangeChecks
+      << ", \"eq\": " << R.eqChecks
+      << ", \"const\": " << R.constPtrChecks << "},\n";
+
+  out << "  \"width_histogram\": {";
+  bool first = true;
+  for (auto &it : R.widthHistogram) {
+    out << (first ? "" : ", ") << "\"" << it.first << "\": " << it.second;
+    first = false;
+  }
+  out << "},\n";
+
+  double totalSeconds = 0;
+  for (const PassStats &P : R.passes)
+    totalSeconds += P.wallSeconds;
+
+  out << "  \"passes\": [";
+  for (unsigned i = 0; i < R.passes.size(); i++) {
+    const PassStats &P = R.passes[i];
+    out << (i ? ",\n" : "\n") << "    {\"name\": ";
+    sd_writeString(out, P.name);
+    out << ", \"seconds\": " << format("%.6f", P.wallSeconds)
+        << ", \"peak_rss_kb\": " << P.peakRSSKBytes;
+    if (TimeReport)
+      out << ", \"user_seconds\": " << format("%.6f", P.userSeconds)
+          << ", \"system_seconds\": " << format("%.6f", P.systemSeconds)
+          << ", \"rss_before_kb\": " << P.rssBeforeKBytes
+          << ", \"rss_after_kb\": " << P.rssAfterKBytes
+          << ", \"peak_rss_before_kb\": " << P.peakRSSBeforeKBytes;
+    out << "}";
+  }
+  out << "\n  ]";
+
+  // the counters bumped so far in this link, by all passes and not only the SD ones
+  if (TimeReport) {
+    out << ",\n  \"total_seconds\": " << format("%.6f", totalSeconds);
+    out << ",\n  \"statistics\": ";
+    PrintStatisticsJSON(out);
+  }
+  out << "\n";
+
+  out << "}\n";
+
+  sdLog::stream() << "Wrote SD statistics to " << fileName << ".\n";
+  R.clear();
+}
+
+}
@@ -0,0 +1,49 @@
+#include "llvm/Transforms/IPO.h"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+
+#include <mutex>
+
+using namespace llvm;
+
+/**
+ * Shared by the gold plugin and LTOCodeGenerator, so that both write the SD output
+ * files under the same names.
+ */
+void llvm::addSDOutputMetadata(Module &M, StringRef OutputName) {
+  LLVMContext &C = M.getContext();
+  SmallString<128> FileName = sys::path::filename(OutputName);
+
+  NamedMDNode *SDFileName = M.getOrInsertNamedMetadata("sd_filename");
+  SDFileName->addOperand(MDNode::get(C, MDString::get(C, FileName)));
+
+  auto EC = sys::fs::create_directory("SDOutput", true);
+  if (!EC && sys::fs::can_write("SDOutput")) {
+    SmallString<128> Model;
+    sys::path::append(Model, "SDOutput", FileName);
+    NamedMDNode *SDOutput = M.getOrInsertNamedMetadata("sd_output");
+    SDOutput->addOperand(MDNode::get(C, MDString::get(C, Model)));
+  }
+}
+
+static std::mutex SDOutputFilesLock;
+static std::vector<std::string> SDOutputFiles;
+
+/**
+ * SDAnalysis may write its files on a background thread.
+ */
+void llvm::noteSDOutputFile(StringRef Path) {
+  std::lock_guard<std::mutex> Guard(SDOutputFilesLock);
+  SDOutputFiles.push_back(Path.str());
+}
+
+std::vector<std::string> llvm::takeSDOutputFiles() {
+  std::lock_guard<std::mutex> Guard(SDOutputFilesLock);
+  std::vector<std::string> Files;
+  Files.swap(SDOutputFiles);
+  return Files;
+}
@@ -16,9 +16,14 @@
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/CallSite.h"
 #include "llvm/IR/MDBuilder.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/ErrorHandling.h"
 
 #include "llvm/Transforms/IPO/SafeDispatchLog.h"
 #include "llvm/Transforms/IPO/SafeDispatchTools.h"
+#include "llvm/Transforms/IPO/SafeDispatchCallSites.h"
+#include "llvm/Transforms/IPO/SafeDispatchGVMd.h"
+#include "llvm/Transforms/IPO/SafeDispatchStats.h"
 
 #include "llvm/Transforms/Utils/ValueMapper.h"
 #include "llvm/Transforms/Utils/Cloning.h"
@@ -41,6 +46,15 @@
 
 using namespace llvm;
 
+// Cross-DSO objects fail the range checks of this module. With this option the failed
+// checks call vptr_safe (libdlcfi) before trapping, instead of trapping right away.
+static cl::opt<bool> SDCrossDSOCheck("sd-cross-dso-check", cl::init(false), cl::Hidden,
+    cl::desc("Validate vptrs outside of the SafeDispatch ranges with libdlcfi's vptr_safe"));
+
+// Number of validated vptrs cached at each call site of the slow path, 0 disables the cache
+static cl::opt<unsigned> SDCrossDSOCacheEntries("sd-cross-dso-cache-entries", cl::init(2), cl::Hidden,
+    cl::desc("Number of vptrs validated by vptr_safe that are cached per call site (0-2)"));
+
 namespace {
   /**
    * Pass for updating the annotated instructions with the new indices
@@ -61,6 +75,8 @@ namespace {
     }
 
     bool runOnModule(Module &M) override {
+      sdStats::PassTimer timer("SDUpdateIndices");
+
       //Paul: first get the results from the previous layout builder pass 
       layoutBuilder = &getAnalysis<SDLayoutBuilder>();
       assert(layoutBuilder);
@@ -82,6 +98,10 @@ namespace {
       //Intrinsic::sd_get_checked_vptr ->  Intrinsic::sd_subst_check_range             
       handleSDGetCheckedVtbl(&M);            
 
+      //Paul: the range checks of the dynamic_cast fast path
+      //Intrinsic::sd_dyncast_in_range -> Intrinsic::sd_subst_check_range (or false)
+      handleSDDyncastInRange(&M);
+
       //Paul: this are for the additional v pointer which are not checked based on ranges 
       //Intrinsic::sd_get_vcall_index -> null (there is no substitution function used here)
       handleRemainingSDGetVcallIndex(&M);    
@@ -109,6 +129,7 @@ namespace {
     void handleSDGetVtblIndex(Module* M);
     void handleSDCheckVtbl(Module* M);
     void handleSDGetCheckedVtbl(Module* M);
+    void handleSDDyncastInRange(Module* M);
     void handleRemainingSDGetVcallIndex(Module* M);
   };
 }
@@ -117,51 +138,6 @@ namespace {
 /// SDUpdateIndices implementation, this are executed inside P4. Next, P5 is executed.
 /// ----------------------------------------------------------------------------
 
-static std::string sd_getClassNameFromMD(llvm::MDNode* mdNode, unsigned operandNo = 0) {
-//  llvm::MDTuple* mdTuple = dyn_cast<llvm::MDTuple>(mdNode);
-//  assert(mdTuple);
-
-  llvm::MDTuple* mdTuple = cast<llvm::MDTuple>(mdNode);
-  assert(mdTuple->getNumOperands() > operandNo + 1);
-
-//  llvm::MDNode* nameMdNode = dyn_cast<llvm::MDNode>(mdTuple->getOperand(operandNo).get());
-//  assert(nameMdNode);
-  llvm::MDNode* nameMdNode = cast<llvm::MDNode>(mdTuple->getOperand(operandNo).get());
-
-//  llvm::MDString* mdStr = dyn_cast<llvm::MDString>(nameMdNode->getOperand(0));
-//  assert(mdStr);
-  llvm::MDString* mdStr = cast<llvm::MDString>(nameMdNode->getOperand(0));
-
-  StringRef strRef = mdStr->getString();
-  assert(sd_isVtableName_ref(strRef));
-
-//  llvm::MDNode* gvMd = dyn_cast<llvm::MDNode>(mdTuple->getOperand(operandNo+1).get());
-  llvm::MDNode* gvMd = cast<llvm::MDNode>(mdTuple->getOperand(operandNo+1).get());
-
-//  SmallString<256> OutName;
-//  llvm::raw_svector_ostream Out(OutName);
-//  gvMd->print(Out, CURR_MODULE);
-//  Out.flush();
-
-  llvm::ConstantAsMetadata* vtblConsMd = dyn_cast_or_null<ConstantAsMetadata>(gvMd->getOperand(0).get());
-  if (vtblConsMd == NULL) {
-//    llvm::MDNode* tmpnode = dyn_cast<llvm::MDNode>(gvMd);
-//    llvm::MDString* tmpstr = dyn_cast<llvm::MDString>(tmpnode->getOperand(0));
-//    assert(tmpstr->getString() == "NO_VTABLE");
-
-    return strRef.str();
-  }
-
-//  llvm::GlobalVariable* vtbl = dyn_cast<llvm::GlobalVariable>(vtblConsMd->getValue());
-//  assert(vtbl);
-  llvm::GlobalVariable* vtbl = cast<llvm::GlobalVariable>(vtblConsMd->getValue());
-
-  StringRef vtblNameRef = vtbl->getName();
-  assert(vtblNameRef.startswith(strRef));
-
-  return vtblNameRef.str();
-}
-
 //Paul: this returns the v table index and puts it in a function 
 // it uses this functions to get the old v table index and to substitute it 
 //Intrinsic::sd_get_vtbl_index -> Intrinsic::sd_subst_vtbl_index
@@ -413,10 +389,73 @@ void SDUpdateIndices::handleSDCheckVtbl(Module* M) {
   }
 }
 
+//Paul: dynamic_cast fast path, the vptr of the source subobject has to be in one of the
+//memory ranges of the source sub-vtable of the destination class. Anything the CHA
+//doesn't know precisely becomes false, the cast then goes through __ivtbl_dynamic_cast.
+//it uses:
+// Intrinsic::sd_dyncast_in_range -> Intrinsic::sd_subst_check_range
+void SDUpdateIndices::handleSDDyncastInRange(Module* M) {
+  Function *inRangeF = M->getFunction(Intrinsic::getName(Intrinsic::sd_dyncast_in_range));
+  if (!inRangeF)
+    return;
+
+  const DataLayout &DL = M->getDataLayout();
+  llvm::LLVMContext& C = M->getContext();
+  Type *IntPtrTy = DL.getIntPtrType(C, 0);
+  Function *checkRangeF = Intrinsic::getDeclaration(M, Intrinsic::sd_subst_check_range);
+
+  uint64_t numFastPaths = 0, numLibraryOnly = 0;
+  for (auto UI = inRangeF->user_begin(), UE = inRangeF->user_end(); UI != UE;) {
+    llvm::CallInst* CI = cast<CallInst>(*UI++);
+
+    MDNode* srcMD = cast<MDNode>(cast<MetadataAsValue>(CI->getArgOperand(1))->getMetadata());
+    MDNode* dstMD = cast<MDNode>(cast<MetadataAsValue>(CI->getArgOperand(2))->getMetadata());
+    std::string srcName = sd_getClassNameFromMD(srcMD);
+    std::string dstName = sd_getClassNameFromMD(dstMD);
+
+    // unlike getCheckedVTable, don't fall back to the source vtable itself:
+    // its range also contains objects that aren't destination objects
+    int64_t ind = cha->knowsAbout(SDLayoutBuilder::vtbl_t(srcName, 0)) ?
+                  cha->getSubVTableIndex(dstName, srcName) : -1;
+    SDLayoutBuilder::vtbl_t vtbl(dstName, ind);
+
+    llvm::Value* inRange = nullptr;
+    if (ind != -1 && layoutBuilder->hasMemRange(vtbl)) {
+      SDLayoutBuilder::vtbl_name_t root = cha->getAncestor(vtbl);
+      assert(layoutBuilder->alignmentMap.count(root));
+      llvm::Constant* alignment = llvm::ConstantInt::get(IntPtrTy, layoutBuilder->alignmentMap[root]);
+
+      IRBuilder<> builder(CI);
+      llvm::Value *castVptr = builder.CreateBitCast(CI->getArgOperand(0), IntegerType::getInt8PtrTy(C));
+
+      for (const SDLayoutBuilder::mem_range_t& range : layoutBuilder->getMemRange(vtbl)) {
+        llvm::Value *Args[] = {castVptr, range.first, llvm::ConstantInt::get(IntPtrTy, range.second), alignment};
+        llvm::Value *check = builder.CreateCall(checkRangeF, Args);
+        inRange = inRange ? builder.CreateOr(inRange, check) : check;
+      }
+      numFastPaths++;
+    } else {
+      sd_print("dynamic_cast from %s to %s: no range, using the library\n", srcName.c_str(), dstName.c_str());
+      numLibraryOnly++;
+    }
+
+    CI->replaceAllUsesWith(inRange ? inRange : llvm::ConstantInt::getFalse(C));
+    CI->eraseFromParent();
+  }
+
+  sd_print("dynamic_cast range checks: %lu fast paths, %lu library only\n",
+           numFastPaths, numLibraryOnly);
+}
+
 //Paul: add the range checks, success, failed path, the trap and replace the terminator 
 //add checked v table pointer, add subst range and the trap if failed
 //it uses:  
 // Intrinsic::sd_get_checked_vptr ->  Intrinsic::sd_subst_check_range
+//
+// With -sd-cross-dso-check the failed checks ask vptr_safe with the static class name of
+// the call site only. The dynamic class is not known here without reading the RTTI of the
+// object, so vptr_safe accepts any vptr inside the range of the static class in the range
+// map of the DSO that holds it, and cannot report which class the object really has.
 void SDUpdateIndices::handleSDGetCheckedVtbl(Module* M) {
   //in ItaniumCXXABI.CPP there was a call inserted to sd_get_checked_vptr which contains the class name 
   //of the object making the virtual function call
@@ -430,6 +469,14 @@ void SDUpdateIndices::handleSDGetCheckedVtbl(Module* M) {
    return;
   }
 
+  // class names of the call sites, each table is decoded once
+  sdCallSites::Resolver callSites;
+
+  // call sites with a vptr_safe slow path
+  unsigned crossDSOChecks = 0;
+  if (SDCrossDSOCacheEntries > 2)
+    report_fatal_error("-sd-cross-dso-cache-entries must be 0, 1 or 2");
+
   // Paul: iterate through all function uses
   for (const Use &U : sd_vtbl_indexF->uses()) {
     
@@ -440,29 +487,11 @@ void SDUpdateIndices::handleSDGetCheckedVtbl(Module* M) {
     llvm::Value* vptr = CI->getArgOperand(0);
     assert(vptr);//assert not null
  
-    //Paul: get second operand
-    llvm::MetadataAsValue* arg2 = dyn_cast<MetadataAsValue>(CI->getArgOperand(1));
-    assert(arg2);//assert not null
-
-    //Paul: get the metadata of the second param
-    MDNode* mdNode = dyn_cast<MDNode>(arg2->getMetadata());
-    assert(mdNode);//assert not null
-    
-    //Paul: get the third parameter
-    llvm::MetadataAsValue* arg3 = dyn_cast<MetadataAsValue>(CI->getArgOperand(2));
-    assert(arg3);//assert not null
-
-    //Paul: get the metadata of the third param 
-    MDNode* mdNode1 = dyn_cast<MDNode>(arg3->getMetadata());
-    assert(mdNode1);//assert not null
-
-    // second one is the tuple that contains the class name and the corresponding global var.
-    // note that the global variable isn't always emitted
-    //get the class name class name from argument 1
-    std::string className = sd_getClassNameFromMD(mdNode, 0);       
-
-    //get a more precise class name from argument 2
-    std::string preciseClassName = sd_getClassNameFromMD(mdNode1,0);
+    //Paul: the class name and the more precise class name of the call site,
+    //the second and third operands point into the call-site table of the module
+    const sdCallSites::Descriptor& callSite = callSites.get(CI);
+    const std::string& className = callSite.className;
+    const std::string& preciseClassName = callSite.preciseName;
     SDLayoutBuilder::vtbl_t vtbl(className, 0);
     llvm::Constant *start;
     int64_t rangeWidth;
@@ -474,26 +503,9 @@ void SDUpdateIndices::handleSDGetCheckedVtbl(Module* M) {
                                                                           cha->knowsAbout(vtbl));
   
     //Paul: check if the class hierarchy analysis knows about the v table 
-    if (cha->knowsAbout(vtbl)) {
-      if (preciseClassName != className) {
-        sd_print("C3: More precise class name (base class) = %s\n", preciseClassName.c_str());
-        int64_t ind = cha->getSubVTableIndex(preciseClassName, className);
-        SDLayoutBuilder::vtbl_name_t n = preciseClassName;
-
-        if (ind == -1) {
-          //className is the derive and the preciseClassName is the base class 
-          ind = cha->getSubVTableIndex(className, preciseClassName);
-          n = className;
-        }
-
-        if (ind != -1) {
-          vtbl = SDLayoutBuilder::vtbl_t(n, ind);
-        }
-        sd_print("Index = %d \n", ind);
-      } else{
-        sd_print("There is no base class for this call site \n");
-      }
-    }
+    //and use the sub-vtable of the more precise class name if there is one
+    vtbl = cha->getCheckedVTable(className, preciseClassName);
+    sd_print("C3: checked vtable (%s, %d) \n", vtbl.first.c_str(), vtbl.second);
     sd_print("\n"); //just add a gap in the printings 
 
     LLVMContext& C = CI->getContext();                    //Paul: get call inst. context 
@@ -581,25 +593,89 @@ void SDUpdateIndices::handleSDGetCheckedVtbl(Module* M) {
       }
     }
 
-    /*
-    llvm::BasicBlock *checkFailed = llvm::BasicBlock::Create(F->getContext(), "sd.check.fail", F);
-    llvm::Type* argTs[] = { Int8PtrTy, Int8PtrTy };
-    llvm::FunctionType *vptr_safeT = llvm::FunctionType::get(llvm::Type::getInt1Ty(C), argTs, false);
-    llvm::Constant *vptr_safeF = M->getOrInsertFunction("_Z9vptr_safePKvPKc", vptr_safeT);
-    llvm::Value* slowPathSuccess = builder.CreateCall2(
-                vptr_safeF,
-                castVptr,
-                builder.CreateGlobalStringPtr(className));
-                // TODO: Add dynamic class name to _vptr_safe as well
-
-    BranchInst *BI = builder.CreateCondBr(slowPathSuccess, SuccessBB, checkFailed);
-    llvm::MDBuilder MDB(BI->getContext());
-    BI->setMetadata(LLVMContext::MD_prof, MDB.createBranchWeights(
-      std::numeric_limits<uint32_t>::max(),
-      std::numeric_limits<uint32_t>::min()));
-
-    builder.SetInsertPoint(checkFailed);
-    */
+    //Paul: objects of other DSOs are outside of the ranges of this module, ask libdlcfi
+    //about them before trapping. The last validated vptrs of the call site are kept in
+    //a small cache next to it, so that only the first object of each type pays for the call.
+    if (SDCrossDSOCheck) {
+      llvm::ArrayType* cacheTy = llvm::ArrayType::get(Int8PtrTy, SDCrossDSOCacheEntries);
+
+      //Paul: empty entries hold a misaligned address, which is never a vptr
+      llvm::Constant* emptyEntry = llvm::ConstantExpr::getIntToPtr(
+        llvm::ConstantInt::get(IntPtrTy, (uint64_t) -1), Int8PtrTy);
+      std::vector<llvm::Constant*> emptyEntries(SDCrossDSOCacheEntries, emptyEntry);
+
+      std::vector<llvm::Value*> cacheEntries;
+      if (SDCrossDSOCacheEntries > 0) {
+        //Paul: private, writable data (never in an executable section)
+        llvm::GlobalVariable* cache = new llvm::GlobalVariable(
+          *M, cacheTy, false, llvm::GlobalValue::PrivateLinkage,
+          llvm::ConstantArray::get(cacheTy, emptyEntries), "sd.vptr_cache");
+        cache->setAlignment(DL.getPointerABIAlignment());
+
+        for (unsigned e = 0; e < SDCrossDSOCacheEntries; e++)
+          cacheEntries.push_back(builder.CreateConstInBoundsGEP2_32(cacheTy, cache, 0, e));
+      }
+
+      //Paul: the entries are read and written with unordered atomics, the cache is shared
+      //by all threads and a torn or stale entry must not validate a vptr
+      for (unsigned e = 0; e < cacheEntries.size(); e++) {
+        llvm::LoadInst* cached = builder.CreateLoad(cacheEntries[e], "sd.vptr_cache.entry");
+        cached->setAlignment(DL.getPointerABIAlignment());
+        cached->setAtomic(Unordered);
+
+        char blockName[256];
+        snprintf(blockName, sizeof(blockName), "sd.vptr_cache.miss.%u", e);
+        llvm::BasicBlock *cacheMiss = llvm::BasicBlock::Create(F->getContext(), blockName, F);
+
+        llvm::BranchInst *BI = builder.CreateCondBr(builder.CreateICmpEQ(castVptr, cached),
+                                                    SuccessBB, cacheMiss);
+        llvm::MDBuilder MDB(BI->getContext());
+        BI->setMetadata(LLVMContext::MD_prof, MDB.createBranchWeights(
+                                              std::numeric_limits<uint32_t>::max(),
+                                              std::numeric_limits<uint32_t>::min()));
+        builder.SetInsertPoint(cacheMiss);
+      }
+
+      llvm::BasicBlock *checkFailed = llvm::BasicBlock::Create(F->getContext(), "sd.check.fail", F);
+      llvm::BasicBlock *slowPathSuccess = SuccessBB;
+      if (!cacheEntries.empty())
+        slowPathSuccess = llvm::BasicBlock::Create(F->getContext(), "sd.vptr_cache.fill", F);
+
+      llvm::Type* argTs[] = { Int8PtrTy, Int8PtrTy };
+      llvm::FunctionType *vptr_safeT = llvm::FunctionType::get(llvm::Type::getInt1Ty(C), argTs, false);
+      llvm::Constant *vptr_safeF = M->getOrInsertFunction("_Z9vptr_safePKvPKc", vptr_safeT);
+      llvm::Value* vptrSafe = builder.CreateCall2(
+                  vptr_safeF,
+                  castVptr,
+                  builder.CreateGlobalStringPtr(className));
+
+      BranchInst *BI = builder.CreateCondBr(vptrSafe, slowPathSuccess, checkFailed);
+      llvm::MDBuilder MDB(BI->getContext());
+      BI->setMetadata(LLVMContext::MD_prof, MDB.createBranchWeights(
+        std::numeric_limits<uint32_t>::max(),
+        std::numeric_limits<uint32_t>::min()));
+
+      //Paul: fill the cache, the most recent vptr goes first and the others move down
+      if (!cacheEntries.empty()) {
+        builder.SetInsertPoint(slowPathSuccess);
+        for (unsigned e = cacheEntries.size() - 1; e > 0; e--) {
+          llvm::LoadInst* older = builder.CreateLoad(cacheEntries[e - 1]);
+          older->setAlignment(DL.getPointerABIAlignment());
+          older->setAtomic(Unordered);
+          llvm::StoreInst* moved = builder.CreateStore(older, cacheEntries[e]);
+          moved->setAlignment(DL.getPointerABIAlignment());
+          moved->setAtomic(Unordered);
+        }
+        llvm::StoreInst* filled = builder.CreateStore(castVptr, cacheEntries[0]);
+        filled->setAlignment(DL.getPointerABIAlignment());
+        filled->setAtomic(Unordered);
+        builder.CreateBr(SuccessBB);
+      }
+
+      builder.SetInsertPoint(checkFailed);
+      crossDSOChecks++;
+    }
+
     // Insert Check Failure
     builder.CreateCall(Intrinsic::getDeclaration(M, Intrinsic::trap)); //Paul: insert the check failure trap 
    
@@ -611,6 +687,10 @@ void SDUpdateIndices::handleSDGetCheckedVtbl(Module* M) {
     CI->replaceAllUsesWith(vptr);//Paul: replace all uses with the new v pointer
     CI->eraseFromParent();
   } //end of all uses for loop.
+
+  if (SDCrossDSOCheck)
+    sd_print("C3: %u checked call site(s) with a vptr_safe slow path (%u cache entries)\n",
+             crossDSOChecks, (unsigned) SDCrossDSOCacheEntries);
 }
 
 //Paul: read the v call index and add replace all uses with this new value 
@@ -659,6 +739,7 @@ void SDUpdateIndices::handleRemainingSDGetVcallIndex(Module* M) {
     bool runOnModule(Module &M) {
       sd_print("\nP5. Started running SDSubstModule pass ...\n");
       sd_print("P5. Starting final range checks additions ...\n");
+      sdStats::PassTimer timer("SDSubstModule");
       
       //Paul: count the number of indexes substituted
       int64_t indexSubst = 0;
@@ -746,6 +827,7 @@ void SDUpdateIndices::handleRemainingSDGetVcallIndex(Module* M) {
           //Paul: sum up all the ranges widths which will be substituted 
           //this is just for statistics relevant
           sumWidth = sumWidth + widthInt;
+          sdStats::report().widthHistogram[widthInt]++;
 
           //check if vptr is constant
           if (validConstVptr(rootVtbl, startOff->getSExtValue(), widthInt, DL, vptr, 0)) {
@@ -817,6 +899,12 @@ void SDUpdateIndices::handleRemainingSDGetVcallIndex(Module* M) {
       sd_print(" Total const_ptr % d \n", constPtr);
       sd_print(" Average width % lf \n", sumWidth * 1.0 / (rangeSubst + eqSubst + constPtr));
 
+      sdStats::Report &stats = sdStats::report();
+      stats.indexSubst += indexSubst;
+      stats.rangeChecks += rangeSubst;
+      stats.eqChecks += eqSubst;
+      stats.constPtrChecks += constPtr;
+
       //one of these values has to be > than 0 
       return indexSubst > 0 || rangeSubst > 0 || eqSubst > 0 || constPtr > 0;
     }
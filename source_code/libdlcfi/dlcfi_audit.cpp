@@ -0,0 +1,210 @@
+// rtld-audit module of libdlcfi:
+//
+//   LD_AUDIT=libdlcfi_audit.so ./program
+//
+// Reads the SD dynamic tags of every object when it is loaded and publishes them
+// in the registry of dlcfi.h, and removes the object again when it is unloaded.
+
+#include "dlcfi.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <pthread.h>
+#include <link.h>
+#include <sys/auxv.h>
+
+static DlcfiRegistry_t registry;
+
+// serializes the writers, the loader already does but the audit interface does not promise it
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * The loader adjusts the addresses of the dynamic entries it knows about in place
+ * (DT_SYMTAB, DT_GNU_HASH, ...) unless the dynamic section is read-only, but it never
+ * touches the SD tags.
+ */
+static uintptr_t dyn_address(struct link_map *map, const ElfW(Dyn) *dyn, bool adjusted) {
+  uintptr_t ptr = dyn->d_un.d_ptr;
+  if (adjusted && ptr >= map->l_addr)
+    return ptr;
+  return ptr + map->l_addr;
+}
+
+static uint32_t gnu_hash(const char *name) {
+  uint32_t h = 5381;
+  for (; *name; name++)
+    h = h * 33 + (unsigned char) *name;
+  return h;
+}
+
+static uint32_t elf_hash(const char *name) {
+  uint32_t h = 0, g;
+  for (; *name; name++) {
+    h = (h << 4) + (unsigned char) *name;
+    if ((g = h & 0xf0000000))
+      h ^= g >> 24;
+    h &= ~g;
+  }
+  return h;
+}
+
+// looks up a defined dynamic symbol of the object without going through the loader,
+// which holds its lock while it calls us
+static void *lookup_symbol(struct link_map *map, const char *name) {
+  const ElfW(Sym) *symtab = NULL;
+  const char *strtab = NULL;
+  const uint32_t *hash = NULL, *gnuHash = NULL;
+
+  for (const ElfW(Dyn) *d = map->l_ld; d->d_tag != DT_NULL; d++) {
+    switch (d->d_tag) {
+    case DT_SYMTAB:   symtab = (const ElfW(Sym) *) dyn_address(map, d, true); break;
+    case DT_STRTAB:   strtab = (const char *) dyn_address(map, d, true); break;
+    case DT_HASH:     hash = (const uint32_t *) dyn_address(map, d, true); break;
+    case DT_GNU_HASH: gnuHash = (const uint32_t *) dyn_address(map, d, true); break;
+    }
+  }
+  if (!symtab || !strtab)
+    return NULL;
+
+  const ElfW(Sym) *sym = NULL;
+  if (gnuHash) {
+    uint32_t nbuckets = gnuHash[0], symoffset = gnuHash[1], bloomSize = gnuHash[2];
+    const uint32_t *buckets = (const uint32_t *) ((const ElfW(Addr) *) &gnuHash[4] + bloomSize);
+    const uint32_t *chain = buckets + nbuckets;
+    uint32_t h = gnu_hash(name);
+
+    for (uint32_t i = buckets[h % nbuckets]; i >= symoffset; i++) {
+      uint32_t h2 = chain[i - symoffset];
+      if ((h | 1) == (h2 | 1) && !strcmp(name, strtab + symtab[i].st_name)) {
+        sym = &symtab[i];
+        break;
+      }
+      if (h2 & 1)
+        break;
+    }
+  } else if (hash) {
+    uint32_t nbuckets = hash[0];
+    const uint32_t *buckets = &hash[2], *chain = buckets + nbuckets;
+    for (uint32_t i = buckets[elf_hash(name) % nbuckets]; i != STN_UNDEF; i = chain[i]) {
+      if (!strcmp(name, strtab + symtab[i].st_name)) {
+        sym = &symtab[i];
+        break;
+      }
+    }
+  }
+
+  if (!sym || sym->st_shndx == SHN_UNDEF)
+    return NULL;
+  return (void *) (map->l_addr + sym->st_value);
+}
+
+// the extent of the loadable segments, false if the program headers cannot be found
+static bool object_extent(struct link_map *map, uintptr_t *start, uintptr_t *end) {
+  const ElfW(Phdr) *phdrs;
+  size_t phnum;
+
+  if (!map->l_name || !map->l_name[0]) {
+    // the main program, mapped by the kernel
+    phdrs = (const ElfW(Phdr) *) getauxval(AT_PHDR);
+    phnum = getauxval(AT_PHNUM);
+  } else {
+    // a DSO, its first segment maps the ELF header at the load address
+    const ElfW(Ehdr) *ehdr = (const ElfW(Ehdr) *) map->l_addr;
+    if (!ehdr || memcmp(ehdr->e_ident, ELFMAG, SELFMAG))
+      return false;
+    phdrs = (const ElfW(Phdr) *) (map->l_addr + ehdr->e_phoff);
+    phnum = ehdr->e_phnum;
+  }
+  if (!phdrs)
+    return false;
+
+  *start = UINTPTR_MAX;
+  *end = 0;
+  for (size_t i = 0; i < phnum; i++) {
+    if (phdrs[i].p_type != PT_LOAD)
+      continue;
+    if (map->l_addr + phdrs[i].p_vaddr < *start)
+      *start = map->l_addr + phdrs[i].p_vaddr;
+    if (map->l_addr + phdrs[i].p_vaddr + phdrs[i].p_memsz > *end)
+      *end = map->l_addr + phdrs[i].p_vaddr + phdrs[i].p_memsz;
+  }
+  return *start < *end;
+}
+
+/*
+ * Publishes a copy of the current snapshot with obj added (if not NULL) and the
+ * object of map removed (if not NULL). The old snapshot is not freed: readers do
+ * not announce themselves, so there is no grace period after which it would be
+ * safe. It costs one small allocation per dlopen and dlclose.
+ */
+static void publish(const DlcfiObject_t *obj, const void *removed) {
+  pthread_mutex_lock(&registry_lock);
+
+  DlcfiSnapshot_t *old = __atomic_load_n(&registry.snapshot, __ATOMIC_RELAXED);
+  int64_t n = old ? old->nobjects : 0;
+  DlcfiSnapshot_t *snapshot = (DlcfiSnapshot_t *) malloc(
+    sizeof(DlcfiSnapshot_t) + (n + 1) * sizeof(DlcfiObject_t));
+  if (!snapshot) {
+    fprintf(stderr, "libdlcfi_audit: out of memory\n");
+    abort();
+  }
+
+  int64_t m = 0;
+  bool inserted = !obj;
+  for (int64_t i = 0; i < n; i++) {
+    const DlcfiObject_t &cur = old->objects[i];
+    if (cur.map == removed || (obj && cur.map == obj->map))
+      continue;
+    if (!inserted && obj->start < cur.start) {
+      snapshot->objects[m++] = *obj;
+      inserted = true;
+    }
+    snapshot->objects[m++] = cur;
+  }
+  if (!inserted)
+    snapshot->objects[m++] = *obj;
+  snapshot->nobjects = m;
+
+  __atomic_store_n(&registry.snapshot, snapshot, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&registry_lock);
+}
+
+extern "C" {
+
+unsigned int la_version(unsigned int version) {
+  return version < LAV_CURRENT ? version : LAV_CURRENT;
+}
+
+unsigned int la_objopen(struct link_map *map, Lmid_t lmid __attribute__((unused)), uintptr_t *cookie) {
+  *cookie = (uintptr_t) map;
+
+  // libdlcfi.so, or a program linked with it statically
+  DlcfiRegistry_t **reader = (DlcfiRegistry_t **) lookup_symbol(map, "__dlcfi_registry");
+  if (reader)
+    *reader = &registry;
+
+  DlcfiObject_t obj;
+  if (!object_extent(map, &obj.start, &obj.end))
+    return 0;                                     // vptr_safe falls back to dladdr
+  obj.rangeMap = NULL;
+  obj.whiteList = NULL;
+  obj.map = map;
+  for (const ElfW(Dyn) *d = map->l_ld; d->d_tag != DT_NULL; d++) {
+    if (d->d_tag == DT_SD_RANGE_MAP)
+      obj.rangeMap = (RangeMap_t *) dyn_address(map, d, false);
+    else if (d->d_tag == DT_SD_WHITE_LIST)
+      obj.whiteList = (WhiteList_t *) dyn_address(map, d, false);
+  }
+  publish(&obj, NULL);
+
+  // no symbol binding callbacks
+  return 0;
+}
+
+unsigned int la_objclose(uintptr_t *cookie) {
+  publish(NULL, (const void *) *cookie);
+  return 0;
+}
+
+}
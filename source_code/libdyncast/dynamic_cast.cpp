@@ -23,6 +23,11 @@
 
 #include "tinfo.h"
 
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
 namespace __cxxabiv1 {
 
 static __class_type_info* __ivtbl_get_rtti(const void *vtable, const ptrdiff_t off) {
@@ -34,6 +39,187 @@ static ptrdiff_t __ivtbl_get_ott(const void *vtable, const ptrdiff_t off) {
   return *(adjust_pointer<ptrdiff_t>(vtable, off));
 }
 
+// Results cache of __ivtbl_dynamic_cast.
+//
+// The result of a cast only depends on the vptr of the source subobject (which
+// determines the whole object type and where the source sits inside it), the
+// static types, the src2dst hint and the rtti/ott offsets of the interleaved
+// vtable. The cache maps these to the offset from the source to the result, or
+// to a failure.
+//
+// It is a fixed-size set-associative table. Every entry is guarded by its own
+// sequence number: a reader treats an entry that is being written, or that
+// changed while it was read, as a miss, and a writer gives up if another writer
+// holds the entry. Neither ever waits, so the cache is lock-free.
+//
+// Define IVTBL_DYNCAST_NO_CACHE to build without it, or call
+// __ivtbl_dynamic_cast_cache_enable(0) to bypass it at run time.
+#ifndef IVTBL_DYNCAST_NO_CACHE
+
+#ifndef IVTBL_DYNCAST_CACHE_SETS
+#define IVTBL_DYNCAST_CACHE_SETS 256   // power of two
+#endif
+#define IVTBL_DYNCAST_CACHE_WAYS 4
+
+static_assert((IVTBL_DYNCAST_CACHE_SETS & (IVTBL_DYNCAST_CACHE_SETS - 1)) == 0,
+              "IVTBL_DYNCAST_CACHE_SETS must be a power of two");
+
+namespace {
+
+struct dyncast_key {
+  const void *vtable;
+  const __class_type_info *src_type;
+  const __class_type_info *dst_type;
+  ptrdiff_t src2dst;
+  ptrdiff_t rttiOff;
+  ptrdiff_t ottOff;
+};
+
+// offset stored for casts that fail, no object is that large
+const ptrdiff_t dyncast_failed = PTRDIFF_MIN;
+
+struct alignas(64) dyncast_entry {
+  std::atomic<uintptr_t> seq;          // odd while being written, 0 while empty
+  std::atomic<uintptr_t> key[6];
+  std::atomic<ptrdiff_t> offset;
+};
+
+struct dyncast_set {
+  dyncast_entry ways[IVTBL_DYNCAST_CACHE_WAYS];
+  std::atomic<unsigned> victim;
+};
+
+dyncast_set dyncast_cache[IVTBL_DYNCAST_CACHE_SETS];
+std::atomic<int> dyncast_cache_enabled(1);
+std::atomic<unsigned long> dyncast_cache_hits(0);
+std::atomic<unsigned long> dyncast_cache_misses(0);
+
+// per-thread counts, added to the above every DYNCAST_COUNT_BATCH events so that
+// a hit doesn't pay for a shared atomic increment (initial-exec, a -fPIC build
+// would otherwise call __tls_get_addr on every cast)
+#define DYNCAST_COUNT_BATCH 64
+__thread unsigned long pending_hits __attribute__((tls_model("initial-exec")));
+__thread unsigned long pending_misses __attribute__((tls_model("initial-exec")));
+
+inline void count_event(unsigned long &pending, std::atomic<unsigned long> &total) {
+  if (++pending == DYNCAST_COUNT_BATCH) {
+    total.fetch_add(pending, std::memory_order_relaxed);
+    pending = 0;
+  }
+}
+
+inline void key_words(const dyncast_key &key, uintptr_t words[6]) {
+  words[0] = reinterpret_cast<uintptr_t>(key.vtable);
+  words[1] = reinterpret_cast<uintptr_t>(key.src_type);
+  words[2] = reinterpret_cast<uintptr_t>(key.dst_type);
+  words[3] = static_cast<uintptr_t>(key.src2dst);
+  words[4] = static_cast<uintptr_t>(key.rttiOff);
+  words[5] = static_cast<uintptr_t>(key.ottOff);
+}
+
+inline dyncast_set &set_of(const uintptr_t words[6]) {
+  uint64_t h = 0;
+  for (int i = 0; i < 6; i++) {
+    h ^= words[i];
+    h *= 0x9e3779b97f4a7c15ULL;
+    h ^= h >> 29;
+  }
+  return dyncast_cache[h & (IVTBL_DYNCAST_CACHE_SETS - 1)];
+}
+
+bool cache_lookup(const uintptr_t words[6], ptrdiff_t &offset) {
+  dyncast_set &set = set_of(words);
+  for (dyncast_entry &entry : set.ways) {
+    uintptr_t seq = entry.seq.load(std::memory_order_acquire);
+    if (seq == 0 || (seq & 1))
+      continue;
+
+    bool match = true;
+    for (int i = 0; i < 6 && match; i++)
+      match = entry.key[i].load(std::memory_order_relaxed) == words[i];
+    ptrdiff_t found = entry.offset.load(std::memory_order_relaxed);
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (match && entry.seq.load(std::memory_order_relaxed) == seq) {
+      offset = found;
+      return true;
+    }
+  }
+  return false;
+}
+
+void cache_insert(const uintptr_t words[6], ptrdiff_t offset) {
+  dyncast_set &set = set_of(words);
+  unsigned way = set.victim.fetch_add(1, std::memory_order_relaxed) % IVTBL_DYNCAST_CACHE_WAYS;
+  dyncast_entry &entry = set.ways[way];
+
+  uintptr_t seq = entry.seq.load(std::memory_order_relaxed);
+  if ((seq & 1) ||
+      !entry.seq.compare_exchange_strong(seq, seq + 1, std::memory_order_acquire,
+                                         std::memory_order_relaxed))
+    return;
+  std::atomic_thread_fence(std::memory_order_release);
+
+  for (int i = 0; i < 6; i++)
+    entry.key[i].store(words[i], std::memory_order_relaxed);
+  entry.offset.store(offset, std::memory_order_relaxed);
+
+  entry.seq.store(seq + 2, std::memory_order_release);
+}
+
+// the totals plus the pending counts of the calling thread, counts still pending
+// in other threads are missing
+void cache_stats(unsigned long *hits, unsigned long *misses) {
+  *hits = dyncast_cache_hits.load(std::memory_order_relaxed) + pending_hits;
+  *misses = dyncast_cache_misses.load(std::memory_order_relaxed) + pending_misses;
+}
+
+void print_cache_stats() {
+  unsigned long hits, misses;
+  cache_stats(&hits, &misses);
+  fprintf(stderr, "__ivtbl_dynamic_cast cache: %lu hits, %lu misses\n", hits, misses);
+}
+
+// IVTBL_DYNCAST_STATS=1 prints the counters when the program exits
+__attribute__((constructor)) void register_cache_stats() {
+  const char *env = getenv("IVTBL_DYNCAST_STATS");
+  if (env && *env && *env != '0')
+    atexit(print_cache_stats);
+}
+
+}
+
+#endif
+
+extern "C" void
+__ivtbl_dynamic_cast_cache_stats (unsigned long *hits, unsigned long *misses)
+{
+#ifndef IVTBL_DYNCAST_NO_CACHE
+  cache_stats(hits, misses);
+#else
+  *hits = *misses = 0;
+#endif
+}
+
+// enable or bypass the cache, returns the previous setting
+extern "C" int
+__ivtbl_dynamic_cast_cache_enable (int enable)
+{
+#ifndef IVTBL_DYNCAST_NO_CACHE
+  return dyncast_cache_enabled.exchange(enable != 0);
+#else
+  return 0;
+#endif
+}
+
+static void *
+__ivtbl_do_dynamic_cast (const void *src_ptr,
+                         const __class_type_info *src_type,
+                         const __class_type_info *dst_type,
+                         ptrdiff_t src2dst,
+                         ptrdiff_t rttiOff,
+                         ptrdiff_t ottOff);
+
 // this is the external interface to the dynamic cast machinery
 /* sub: source address to be adjusted; nonnull, and since the
  *      source object is polymorphic, *(void**)sub is a virtual pointer.
@@ -57,6 +243,42 @@ __ivtbl_dynamic_cast (const void *src_ptr,    // object started from
                 ptrdiff_t rttiOff,
                 ptrdiff_t ottOff) // how src and dst are related
   {
+#ifndef IVTBL_DYNCAST_NO_CACHE
+  if (dyncast_cache_enabled.load(std::memory_order_relaxed)) {
+    const dyncast_key key = { *static_cast <const void *const *> (src_ptr),
+                              src_type, dst_type, src2dst, rttiOff, ottOff };
+    uintptr_t words[6];
+    key_words(key, words);
+
+    ptrdiff_t offset;
+    if (cache_lookup(words, offset)) {
+      count_event(pending_hits, dyncast_cache_hits);
+      if (offset == dyncast_failed)
+        return NULL;
+      return const_cast <void *> (adjust_pointer <void> (src_ptr, offset));
+    }
+
+    count_event(pending_misses, dyncast_cache_misses);
+    void *dst_ptr = __ivtbl_do_dynamic_cast(src_ptr, src_type, dst_type,
+                                            src2dst, rttiOff, ottOff);
+    cache_insert(words, dst_ptr ? static_cast <const char *> (dst_ptr)
+                                  - static_cast <const char *> (src_ptr)
+                                : dyncast_failed);
+    return dst_ptr;
+  }
+#endif
+  return __ivtbl_do_dynamic_cast(src_ptr, src_type, dst_type, src2dst, rttiOff, ottOff);
+}
+
+// the uncached hierarchy walk
+static void *
+__ivtbl_do_dynamic_cast (const void *src_ptr,
+                         const __class_type_info *src_type,
+                         const __class_type_info *dst_type,
+                         ptrdiff_t src2dst,
+                         ptrdiff_t rttiOff,
+                         ptrdiff_t ottOff)
+  {
   const void *vtable = *static_cast <const void *const *> (src_ptr);
 
   const void *whole_ptr =
@@ -1,5 +1,6 @@
 #!/usr/bin/python
 
+import os
 import sys
 import subprocess
 import re
@@ -311,13 +312,36 @@ class VTableExtractor(object):
     else:
       return int(s)
 
+def findCxxdump():
+  """
+  llvm-cxxdump -sd-vtables prints the same report natively and on several
+  threads, use it when it can be found (LLVM_CXXDUMP, LLVM_BUILD_DIR or PATH)
+  """
+  candidates = [os.environ.get("LLVM_CXXDUMP")]
+  if os.environ.get("LLVM_BUILD_DIR"):
+    candidates.append(os.path.join(os.environ["LLVM_BUILD_DIR"], "llvm-cxxdump"))
+  candidates += [os.path.join(d, "llvm-cxxdump")
+                 for d in os.environ.get("PATH", "").split(os.pathsep)]
+  for c in candidates:
+    if c and os.path.isfile(c) and os.access(c, os.X_OK):
+      # an llvm-cxxdump without the SafeDispatch options is of no use
+      if "-sd-vtables" in subprocess.check_output([c, "-help-hidden"]):
+        return c
+  return None
+
 if __name__ == '__main__':
   argCount = len(sys.argv)
 
   if argCount < 2:
     print "usage: extract_vtables <filename> [class name]*"
     sys.exit(-1)
-  else:
-    ve = VTableExtractor(sys.argv[1],names=sys.argv[2:])
+
+  cxxdump = findCxxdump()
+  if cxxdump is not None:
+    sys.exit(subprocess.call([cxxdump, "-sd-vtables"] +
+                             ["-sd-class=" + n for n in sys.argv[2:]] +
+                             [sys.argv[1]]))
+
+  ve = VTableExtractor(sys.argv[1],names=sys.argv[2:])
 
   ve.printVtableHexdump()
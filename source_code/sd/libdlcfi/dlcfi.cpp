@@ -6,27 +6,19 @@
 #include <dlfcn.h>
 #include <link.h>
 
-typedef struct _RangeMapElement {
-  char *name;
-  int64_t start;
-  int64_t size;
-  int64_t alignment;
-} RangeMapElement_t;
-
-typedef struct _RangeMap {
-  int64_t nelements;
-  RangeMapElement_t elements[1];
-} RangeMap_t;
-
-typedef struct _WhiteListElement {
-  char *name;
-  int64_t value;
-} WhiteListElement_t;
-
-typedef struct _WhiteList {
-  int64_t nelements;
-  WhiteListElement_t elements[1];
-} WhiteList_t;
+#include "dlcfi.h"
+
+// define DLCFI_DEBUG to trace every check on stdout
+#ifdef DLCFI_DEBUG
+#define dlcfi_log(...) printf(__VA_ARGS__)
+#else
+#define dlcfi_log(...)
+#endif
+
+// set by the rtld-audit module (dlcfi_audit.cpp) when the program runs with it
+extern "C" {
+DlcfiRegistry_t *__dlcfi_registry = NULL;
+}
 
 RangeMapElement_t *findRange(RangeMap_t *rMap, const char *className) {
   //printf("%lld entries in rMap:\n", (long long) rMap->nelements);
@@ -49,23 +41,46 @@ RangeMapElement_t *findRange(RangeMap_t *rMap, const char *className) {
   return NULL;
 }
 
-bool vptr_safe(const void *vptr, const char *className) {
-  Dl_info inf, inf1;
+// the object containing vptr in the registry of the audit module, NULL if the program
+// does not run with the module or the object is not in the registry
+static const DlcfiObject_t *findObject(const void *vptr) {
+  if (!__dlcfi_registry)
+    return NULL;
+  const DlcfiSnapshot_t *snapshot = __atomic_load_n(&__dlcfi_registry->snapshot, __ATOMIC_ACQUIRE);
+  if (!snapshot)
+    return NULL;
+
+  // the last object starting at or below vptr
+  int64_t lo = 0, hi = snapshot->nobjects;
+  while (lo < hi) {
+    int64_t mid = lo + (hi - lo) / 2;
+    if (snapshot->objects[mid].start <= (uintptr_t) vptr)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo == 0 || (uintptr_t) vptr >= snapshot->objects[lo - 1].end)
+    return NULL;
+  return &snapshot->objects[lo - 1];
+}
+
+// finds the tables of the object containing vptr through the loader, false if vptr
+// is in no object
+static bool findTablesLazily(const void *vptr, RangeMap_t **rMapOut, WhiteList_t **wListOut) {
+  Dl_info inf;
   RangeMap_t *rMap = NULL;
   WhiteList_t *wList = NULL;
   void *dlH;
 
-  printf("Checking %p for %s\n", vptr, className);
-
   if (!dladdr(vptr, &inf)) {
     return false;
   }
 
-  printf("Pointer lies in library %s loaded at %p", inf.dli_fname, inf.dli_fbase);
+  dlcfi_log("Pointer lies in library %s loaded at %p", inf.dli_fname, inf.dli_fbase);
   if (inf.dli_sname) {
-    printf(" in symbol %s at index %p\n", inf.dli_sname, ((intptr_t)vptr - (intptr_t)inf.dli_saddr)/8);
+    dlcfi_log(" in symbol %s at index %p\n", inf.dli_sname, ((intptr_t)vptr - (intptr_t)inf.dli_saddr)/8);
   } else {
-    printf("\n");
+    dlcfi_log("\n");
   }
 
   dlH = dlopen(inf.dli_fname, RTLD_NOLOAD | RTLD_LOCAL | RTLD_LAZY);
@@ -85,14 +100,33 @@ bool vptr_safe(const void *vptr, const char *className) {
 
   while (e->d_tag != DT_NULL) {
 //    printf("Tag: %d val: %p\n", e->d_tag, e->d_un.d_ptr);
-    if (e->d_tag == 0x70000035) {
+    if (e->d_tag == DT_SD_RANGE_MAP) {
       rMap = (RangeMap_t*) (((intptr_t)inf.dli_fbase) + ((intptr_t)e->d_un.d_ptr));
-    } else if (e->d_tag == 0x70000036) {
+    } else if (e->d_tag == DT_SD_WHITE_LIST) {
       wList = (WhiteList_t*) (((intptr_t)inf.dli_fbase) + ((intptr_t)e->d_un.d_ptr));
     }
     e++;
   }
 
+  *rMapOut = rMap;
+  *wListOut = wList;
+  return true;
+}
+
+bool vptr_safe(const void *vptr, const char *className) {
+  RangeMap_t *rMap = NULL;
+  WhiteList_t *wList = NULL;
+
+  dlcfi_log("Checking %p for %s\n", vptr, className);
+
+  const DlcfiObject_t *obj = findObject(vptr);
+  if (obj) {
+    rMap = obj->rangeMap;
+    wList = obj->whiteList;
+  } else if (!findTablesLazily(vptr, &rMap, &wList)) {
+    return false;
+  }
+
   if (rMap) {
     RangeMapElement_t *range = findRange(rMap, className);
     if (range) {
@@ -124,9 +158,9 @@ bool vptr_safe(const void *vptr, const char *className) {
 
 fail_l:
   if (wList) {
-    printf("wList->nelements=%d\n", wList->nelements);
+    dlcfi_log("wList->nelements=%lld\n", (long long) wList->nelements);
     for (int64_t i = 0; i < wList->nelements; i++) {
-      printf("Class %s\n", wList->elements[i].name);
+      dlcfi_log("Class %s\n", wList->elements[i].name);
       if (!strcmp(className, wList->elements[i].name)) {
         if (wList->elements[i].value == (intptr_t)vptr) {
           // printf("%s found\n", className);
@@ -135,6 +169,6 @@ fail_l:
       }
     }
   }
-  printf("%s not found\n", className);
+  dlcfi_log("%s not found\n", className);
   return false;
 }
@@ -0,0 +1,60 @@
+#ifndef __DLCFI_H__
+#define __DLCFI_H__
+
+#include <stdint.h>
+
+// the dynamic tags of the range map and the white list of a DSO
+#define DT_SD_RANGE_MAP  0x70000035
+#define DT_SD_WHITE_LIST 0x70000036
+
+typedef struct _RangeMapElement {
+  char *name;
+  int64_t start;
+  int64_t size;
+  int64_t alignment;
+} RangeMapElement_t;
+
+typedef struct _RangeMap {
+  int64_t nelements;
+  RangeMapElement_t elements[1];
+} RangeMap_t;
+
+typedef struct _WhiteListElement {
+  char *name;
+  int64_t value;
+} WhiteListElement_t;
+
+typedef struct _WhiteList {
+  int64_t nelements;
+  WhiteListElement_t elements[1];
+} WhiteList_t;
+
+/*
+ * The objects loaded by the program, published by the rtld-audit module
+ * (libdlcfi_audit.so, used with LD_AUDIT) so that vptr_safe does not have to
+ * call dladdr and dlinfo under the loader lock.
+ *
+ * The audit module runs in its own link namespace and owns the registry. When
+ * it sees an object that defines __dlcfi_registry (libdlcfi.so) it points that
+ * variable at the registry. A snapshot is never modified once published, every
+ * la_objopen and la_objclose publishes a new one, so readers only need an
+ * acquire load of the snapshot pointer.
+ */
+typedef struct _DlcfiObject {
+  uintptr_t start;                                // mapped extent of the object
+  uintptr_t end;
+  RangeMap_t *rangeMap;                           // NULL if it was not compiled by SD
+  WhiteList_t *whiteList;
+  const void *map;                                // link_map of the object
+} DlcfiObject_t;
+
+typedef struct _DlcfiSnapshot {
+  int64_t nobjects;
+  DlcfiObject_t objects[1];                       // sorted by start
+} DlcfiSnapshot_t;
+
+typedef struct _DlcfiRegistry {
+  DlcfiSnapshot_t *snapshot;                      // accessed with __atomic builtins
+} DlcfiRegistry_t;
+
+#endif
@@ -29,7 +29,7 @@
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/ADT/APInt.h"
-#include "llvm/Transforms/IPO/SafeDispatchMD.h"
+#include "llvm/IR/SafeDispatchMD.h"
 #include "llvm/Transforms/IPO/SafeDispatchTools.h"
 #include "llvm/Transforms/IPO/SafeDispatchVtblMD.h"
 
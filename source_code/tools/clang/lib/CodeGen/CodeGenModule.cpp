@@ -348,67 +348,87 @@ void InstrProfStats::reportDiagnostics(DiagnosticsEngine &Diags,
 #include "llvm/IR/Instruction.h"
 #include "llvm/IR/Instructions.h"
 
-#include "llvm/Transforms/IPO/SafeDispatchMD.h"
+#include "llvm/IR/SafeDispatchMD.h"
 #include "llvm/Transforms/IPO/SafeDispatchGVMd.h"
 
 #include <vector>
 
-template <class T>
-T sd_fold(llvm::User* u, T (*callback)(T, unsigned, llvm::Value*), T def, std::set<llvm::User*>& seenUsers) {
-  if(seenUsers.count(u))
-    return def;
-  seenUsers.insert(u);
+/**
+ * Constants that (transitively) contain a ConstantMemberPointer and the instructions
+ * that use them. Computed once per module by walking the use lists up from the member
+ * pointers CodeGen created, so shared constant subtrees are visited a single time.
+ */
+struct sd_memptr_users_t {
+  llvm::SmallPtrSet<llvm::Constant*, 32> constants;
+  llvm::SmallPtrSet<llvm::Instruction*, 32> instructions;
+  llvm::SmallPtrSet<llvm::Function*, 16> functions;
 
-  T next = def;
-  assert(u);
-  for(unsigned i=0; i < u->getNumOperands(); i++) {
-    llvm::Value* op = u->getOperand(i);
-    assert(op);
-
-    next = callback(next, i, op);
+  bool contains(llvm::Value* val) const {
+    llvm::Constant* c = llvm::dyn_cast_or_null<llvm::Constant>(val);
+    return c && constants.count(c);
+  }
+};
 
-    llvm::User* uOp = llvm::dyn_cast<llvm::User>(op);
-    if (uOp && ! llvm::dyn_cast<llvm::Instruction>(op)) {
-      next = sd_fold(uOp, callback, next, seenUsers);
+static void sd_collectMemptrUsers(llvm::Module& M, llvm::ArrayRef<llvm::WeakVH> memptrs,
+                                  sd_memptr_users_t& users) {
+  std::vector<llvm::Constant*> worklist;
+  for (llvm::Value* memptr : memptrs) {
+    llvm::Constant* c = llvm::dyn_cast_or_null<llvm::Constant>(memptr);
+    if (c && users.constants.insert(c).second)
+      worklist.push_back(c);
+  }
+
+  while (!worklist.empty()) {
+    llvm::Constant* c = worklist.back();
+    worklist.pop_back();
+
+    for (llvm::User* u : c->users()) {
+      if (llvm::Instruction* inst = llvm::dyn_cast<llvm::Instruction>(u)) {
+        llvm::Function* f = inst->getParent() ? inst->getParent()->getParent() : nullptr;
+        if (f && f->getParent() == &M) {
+          users.instructions.insert(inst);
+          users.functions.insert(f);
+        }
+      } else if (llvm::isa<llvm::GlobalValue>(u)) {
+        // global initializers are not rewritten, stop at the address of the global
+        continue;
+      } else if (llvm::Constant* uc = llvm::dyn_cast<llvm::Constant>(u)) {
+        if (users.constants.insert(uc).second)
+          worklist.push_back(uc);
+      }
     }
   }
-  return next;
 }
 
 template <class ArgT>
 using sd_map_callback_t = llvm::User* (*)(llvm::User* root, std::vector<llvm::Value*> children, ArgT);
 
+/**
+ * Rebuild u bottom-up with the callback, only descending into the children that
+ * contain a member pointer. The others are passed to the callback unchanged.
+ */
 template <class ArgT>
-llvm::User* sd_map(llvm::User* u, sd_map_callback_t<ArgT> callback, ArgT arg) {
+llvm::User* sd_map(llvm::User* u, sd_map_callback_t<ArgT> callback, ArgT arg,
+                   const sd_memptr_users_t& memptrUsers) {
   std::vector<llvm::Value*> children;
   for(unsigned i=0; i < u->getNumOperands(); i++) {
     llvm::Value* op = u->getOperand(i);
-    llvm::User* child = dyn_cast_or_null<llvm::User>(op);
 
-    if (!child) {
+    if (!memptrUsers.contains(op)) {
       children.push_back(op);
     } else {
-      children.push_back(sd_map<ArgT>(child, callback, arg));
+      children.push_back(sd_map<ArgT>(llvm::cast<llvm::User>(op), callback, arg, memptrUsers));
     }
   }
 
   return callback(u, children, arg);
 }
 
-bool sd_ismemptr(bool isMemptr, unsigned ind, llvm::Value* val) {
-  return isMemptr || (llvm::dyn_cast_or_null<llvm::ConstantMemberPointer>(val) != NULL);
-}
-
-bool sd_contains_memptr(llvm::User* c) {
-  std::set<llvm::User*> seenUsers;
-  return  ((llvm::dyn_cast_or_null<llvm::ConstantMemberPointer>(c) != NULL) ||
-          sd_fold<bool>(c, sd_ismemptr, false, seenUsers));
-}
-
 struct sd_unfold_map_cb_arg_t {
   llvm::Module &M;
   CodeGenModule &CGM;
   llvm::Instruction *insertPos;
+  const sd_memptr_users_t &memptrUsers;
 };
 
 //Paul: unfold the map of 
@@ -495,14 +515,10 @@ llvm::User* sd_unfold_map_cb(llvm::User* root,
         }
         }
     } else if (gv = dyn_cast<llvm::GlobalValue>(rootConst)) {
-      if (sd_contains_memptr(rootConst)) {
-        rootConst->dump();
-        return rootConst;
-      }
-      //assert(!sd_contains_memptr(rootConst) && "NYI Global Values");
+      // sd_collectMemptrUsers stops at global values, their initializers are left alone
       return rootConst;
     } else if (cv = dyn_cast<llvm::ConstantVector>(rootConst)) {
-      assert(!sd_contains_memptr(rootConst) && "NYI Constant Vector");
+      assert(!arg.memptrUsers.contains(rootConst) && "NYI Constant Vector");
       return rootConst;
     } else if (dyn_cast<llvm::ConstantStruct>(rootConst) ||
                dyn_cast<llvm::ConstantArray>(rootConst)) {
@@ -517,10 +533,10 @@ llvm::User* sd_unfold_map_cb(llvm::User* root,
       }
       return newStruct;
     } else if (cds = dyn_cast<llvm::ConstantDataSequential>(rootConst)) {
-      assert(!sd_contains_memptr(rootConst) && "ConstantDataSequentual NYI");
+      assert(!arg.memptrUsers.contains(rootConst) && "ConstantDataSequentual NYI");
       return rootConst;
     } else {
-      assert(!sd_contains_memptr(rootConst) && "Unkown Constant Type");
+      assert(!arg.memptrUsers.contains(rootConst) && "Unkown Constant Type");
       return rootConst;
     }
   } else {
@@ -534,20 +550,32 @@ llvm::User* sd_unfold_map_cb(llvm::User* root,
 }
 
 static void sd_rewriteMPtrToIntrinsics(llvm::Module& M, CodeGenModule &CGM) {
+  sd_memptr_users_t memptrUsers;
+  sd_collectMemptrUsers(M, CGM.getSDMemberPointers(), memptrUsers);
+
+  if (memptrUsers.instructions.empty())
+    return;
+
+  // revisit only the instructions found above, in module order
   for(llvm::Module::iterator f_itr = M.begin(); f_itr != M.end(); f_itr++) {
     llvm::Function* f = f_itr;
+    if (!memptrUsers.functions.count(f))
+      continue;
+
     for(llvm::Function::iterator bb_itr = f->begin(); bb_itr != f->end(); bb_itr++) {
       llvm::BasicBlock* bb = bb_itr;
       for(llvm::BasicBlock::iterator i_itr = bb->begin(); i_itr != bb->end(); i_itr++) {
         llvm::Instruction* inst = i_itr;
         assert(inst);
+        if (!memptrUsers.instructions.count(inst))
+          continue;
 
         for(unsigned i=0; i < inst->getNumOperands(); i++) {
-          llvm::User* arg = dyn_cast<llvm::User>(inst->getOperand(i));
-          if (arg && sd_contains_memptr(arg)) {
-            sd_unfold_map_cb_arg_t unfold_arg = {M, CGM, inst};
+          llvm::Constant* arg = dyn_cast<llvm::Constant>(inst->getOperand(i));
+          if (arg && memptrUsers.contains(arg)) {
+            sd_unfold_map_cb_arg_t unfold_arg = {M, CGM, inst, memptrUsers};
             //Paul: call the above function with the unfold arguments from above 
-            inst->setOperand(i, sd_map<sd_unfold_map_cb_arg_t&>(arg, sd_unfold_map_cb, unfold_arg));
+            inst->setOperand(i, sd_map<sd_unfold_map_cb_arg_t&>(arg, sd_unfold_map_cb, unfold_arg, memptrUsers));
           }
         }
       }
@@ -629,6 +657,12 @@ void CodeGenModule::Release() {
 
   assert(&TheModule);
 
+  // SafeDispatch class hierarchy of this module, see SafeDispatchVtblMD.h
+  SDClassInfo.emit(TheModule);
+
+  // call-site table of the checked virtual calls, see SafeDispatchCallSites.h
+  SDCallSites.emit();
+
   //Paul: during code generation also do the following rewrite
   if (getCodeGenOpts().EmitIVTBL)
     sd_rewriteMPtrToIntrinsics(TheModule, *this);//Paul: this is our function from above 
@@ -27,12 +27,15 @@
 #include "clang/Basic/Module.h"
 #include "clang/Basic/SanitizerBlacklist.h"
 #include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
 #include "llvm/ADT/SetVector.h"
 #include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/StringMap.h"
 #include "llvm/IR/CallingConv.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/ValueHandle.h"
+#include "llvm/Transforms/IPO/SafeDispatchCallSites.h"
+#include "llvm/Transforms/IPO/SafeDispatchClassInfo.h"
 
 namespace llvm {
 class Module;
@@ -348,6 +351,20 @@ private:
   std::vector<llvm::WeakVH> LLVMUsed;
   std::vector<llvm::WeakVH> LLVMCompilerUsed;
 
+  /// Member pointer constants created for virtual methods, -femit-ivtbl rewrites
+  /// the instructions using them when the module is released.
+  std::vector<llvm::WeakVH> SDMemberPointers;
+
+  /// Classes (and construction vtables) whose SafeDispatch class info metadata
+  /// was already emitted in this module.
+  llvm::DenseSet<std::pair<const CXXRecordDecl *, BaseSubobject>> SDClassInfoEmitted;
+
+  /// Class hierarchy summary of this module, emitted in Release().
+  sdClassInfo::Writer SDClassInfo;
+
+  /// Descriptors of the sd.get.checked.vptr calls of this module, emitted in Release().
+  sdCallSites::TableBuilder SDCallSites;
+
   /// Store the list of global constructors and their respective priorities to
   /// be emitted when the translation unit is complete.
   CtorList GlobalCtors;
@@ -874,6 +891,31 @@ public:
   /// Add a global to a list to be added to the llvm.compiler.used metadata.
   void addCompilerUsedGlobal(llvm::GlobalValue *GV);
 
+  /// Record a ConstantMemberPointer for the SafeDispatch member pointer rewrite.
+  void addSDMemberPointer(llvm::Constant *MemPtr) {
+    SDMemberPointers.push_back(MemPtr);
+  }
+
+  ArrayRef<llvm::WeakVH> getSDMemberPointers() const {
+    return SDMemberPointers;
+  }
+
+  /// Mark the SafeDispatch class info of RD (the construction vtable for Base if
+  /// given) as emitted. Returns false if it already was.
+  bool markSDClassInfoEmitted(const CXXRecordDecl *RD, const BaseSubobject *Base) {
+    return SDClassInfoEmitted.insert(std::make_pair(
+        RD, Base ? *Base : BaseSubobject(nullptr, CharUnits::Zero()))).second;
+  }
+
+  sdClassInfo::Writer &getSDClassInfo() { return SDClassInfo; }
+
+  sdCallSites::TableBuilder &getSDCallSites() { return SDCallSites; }
+
+  bool isSDClassInfoEmitted(const CXXRecordDecl *RD) const {
+    return SDClassInfoEmitted.count(
+        std::make_pair(RD, BaseSubobject(nullptr, CharUnits::Zero())));
+  }
+
   /// Add a destructor and object to add to the C++ global destructor function.
   void AddCXXDtorEntry(llvm::Constant *DtorFn, llvm::Constant *Object) {
     CXXGlobalDtors.push_back(std::make_pair(DtorFn, Object));
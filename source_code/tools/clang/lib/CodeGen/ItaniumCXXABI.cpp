@@ -37,7 +37,7 @@
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/Instructions.h"
 
-#include "llvm/Transforms/IPO/SafeDispatchMD.h"
+#include "llvm/IR/SafeDispatchMD.h"
 #include "llvm/Transforms/IPO/SafeDispatchTools.h"
 #include "llvm/Transforms/IPO/SafeDispatchVtblMD.h"
 #include <vector>
@@ -116,6 +116,33 @@ llvm::Value* sd_IsVPtrInRange(CodeGenModule& CGM,
               preciseMDValue); //this is the base class of the calling object.
 }
 
+//Paul: check if the vptr of the source subobject of a dynamic_cast is in the range of
+//the source sub-vtable of the destination class, i.e. if the object is a destination
+//class object (or derived from it) and the source subobject is its source base.
+//Intrinsics::sd_dyncast_in_range is lowered like sd_check_vtbl in SDUpdateIndices.
+llvm::Value* sd_IsDynCastInRange(CodeGenModule& CGM,
+                               CGBuilderTy& builder,
+                  llvm::GlobalVariable* srcVTableGV,
+                     const std::string& srcClassName,
+                  llvm::GlobalVariable* dstVTableGV,
+                     const std::string& dstClassName,
+                                 llvm::Value* vptr) {
+
+  llvm::Module& M = CGM.getModule();
+  llvm::LLVMContext& C = M.getContext();
+
+  llvm::Value* srcMDValue =
+      llvm::MetadataAsValue::get(C, sd_getClassNameMetadata(srcClassName, M, srcVTableGV));
+  llvm::Value* dstMDValue =
+      llvm::MetadataAsValue::get(C, sd_getClassNameMetadata(dstClassName, M, dstVTableGV));
+
+  return builder.CreateCall3(
+              CGM.getIntrinsic(llvm::Intrinsic::sd_dyncast_in_range), //Paul: see Intrinsics.td file
+              builder.CreatePointerCast(vptr, CGM.Int8PtrTy),
+              srcMDValue,
+              dstMDValue);
+}
+
 //Paul: get range start, this method adds the corresponding def contained
 // in the Intrinsic.td into the generated code during code genneration 
 // this function is used during pass 5, P5
@@ -827,7 +854,9 @@ llvm::Constant *ItaniumCXXABI::BuildMemberPointer(const CXXMethodDecl *MD,
                                          ThisAdjustment.getQuantity());
     }
     std::string className = GetClassMangledName(MD->getParent());
-    return llvm::ConstantMemberPointer::getAnon(MemPtr, className);
+    llvm::Constant *CMemPtr = llvm::ConstantMemberPointer::getAnon(MemPtr, className);
+    CGM.addSDMemberPointer(CMemPtr);
+    return CMemPtr;
   } else {
     const FunctionProtoType *FPT = MD->getType()->castAs<FunctionProtoType>();
     llvm::Type *Ty;
@@ -1256,9 +1285,9 @@ llvm::Value *ItaniumCXXABI::EmitDynamicCastCall(
   // Compute the offset hint.
   const CXXRecordDecl *SrcDecl = SrcRecordTy->getAsCXXRecordDecl();
   const CXXRecordDecl *DestDecl = DestRecordTy->getAsCXXRecordDecl();
+  CharUnits OffsetHintChars = computeOffsetHint(CGF.getContext(), SrcDecl, DestDecl);
   llvm::Value *OffsetHint = llvm::ConstantInt::get(
-      PtrDiffLTy,
-      computeOffsetHint(CGF.getContext(), SrcDecl, DestDecl).getQuantity());
+      PtrDiffLTy, OffsetHintChars.getQuantity());
 
   // Emit the call to __dynamic_cast.
   Value = CGF.EmitCastToVoidPtr(Value);
@@ -1314,8 +1343,52 @@ llvm::Value *ItaniumCXXABI::EmitDynamicCastCall(
     llvm::Value* newOTT = sd_getNewIndFromOld(CGM, CGF.Builder, VTableGV, className, -2);
     arguments.push_back(CGF.Builder.CreateMul(newOTT,wordWidth));
 
+    //Paul: the source is the unique public non-virtual base of the destination at a
+    //static offset. If the vptr is in the range of that sub-vtable the object is a
+    //destination object and the result is just the adjusted pointer, otherwise let
+    //the library look for e.g. a cross cast.
+    std::string destName = CGM.getCXXABI().GetClassMangledName(DestDecl);
+    bool inRangeFastPath = !OffsetHintChars.isNegative() &&
+                           DestDecl->getNumVBases() == 0 &&
+                           sd_isVtableName(destName);
+
+    llvm::BasicBlock *inRangeBB = nullptr, *libraryBB = nullptr, *doneBB = nullptr;
+    llvm::Value *inRangeValue = nullptr;
+    if (inRangeFastPath) {
+      llvm::GlobalVariable* DestVTableGV = sd_needGlobalVar(this, DestDecl) ?
+            this->getAddrOfVTable(DestDecl, CharUnits()) : NULL;
+      llvm::Value* vptr = CGF.GetVTablePtr(Value, CGM.Int8PtrTy);
+      llvm::Value* inRange = sd_IsDynCastInRange(CGM, CGF.Builder, VTableGV, className,
+                                                 DestVTableGV, destName, vptr);
+
+      inRangeBB = CGF.createBasicBlock("dynamic_cast.in_range");
+      libraryBB = CGF.createBasicBlock("dynamic_cast.library");
+      doneBB = CGF.createBasicBlock("dynamic_cast.done");
+      CGF.Builder.CreateCondBr(inRange, inRangeBB, libraryBB);
+
+      CGF.EmitBlock(inRangeBB);
+      inRangeValue = CGF.Builder.CreateConstInBoundsGEP1_64(
+          Value, -OffsetHintChars.getQuantity());
+      inRangeBB = CGF.Builder.GetInsertBlock();
+      CGF.Builder.CreateBr(doneBB);
+
+      CGF.EmitBlock(libraryBB);
+    }
+
     // call the new dynamic cast function
-    Value = CGF.EmitNounwindRuntimeCall(dyncastFun, arguments);
+    llvm::Value* libraryValue = CGF.EmitNounwindRuntimeCall(dyncastFun, arguments);
+
+    if (inRangeFastPath) {
+      libraryBB = CGF.Builder.GetInsertBlock();
+      CGF.EmitBlock(doneBB);
+
+      llvm::PHINode *phi = CGF.Builder.CreatePHI(CGM.Int8PtrTy, 2, "dynamic_cast.result");
+      phi->addIncoming(inRangeValue, inRangeBB);
+      phi->addIncoming(libraryValue, libraryBB);
+      Value = phi;
+    } else {
+      Value = libraryValue;
+    }
   
   //if no interleaving should be performed 
   } else {
@@ -1801,26 +1874,39 @@ static llvm::Value* sd_getCheckedVTable2(CodeGenModule &CGM,
     preciseMD = sd_getClassNameMetadata(PreciseName, M, NULL);
   }
 
-  llvm::Value* mdValue = llvm::MetadataAsValue::get(C, md);
   llvm::Value* castPointer = CGF.Builder.CreatePointerCast(VTableAP, CGM.Int8PtrTy);
 
-  //this is the name of the base class of the object making the call to a virtual funtion 
-  llvm::Value* preciseMDValue = llvm::MetadataAsValue::get(C, preciseMD);
+  //Paul: the class names and the function name go to the call-site table of the module,
+  //the check only carries the table and the index of its descriptor
+  sdCallSites::TableBuilder& callSites = CGM.getSDCallSites();
+  uint64_t id = callSites.getID(md, preciseMD, CGM.getCXXABI().GetFunctionMangledName(MD));
 
-  llvm::MDString* functionName = llvm::MDString::get(C, CGM.getCXXABI().GetFunctionMangledName(MD));
-  llvm::MDNode* functionMD = llvm::MDNode::get(C, functionName);
-  llvm::Value* functionMDValue = llvm::MetadataAsValue::get(C, functionMD);
+  llvm::Value* tableValue = llvm::MetadataAsValue::get(C, callSites.getTable(C));
+  llvm::Value* idValue = llvm::ConstantInt::get(CGM.Int64Ty, id);
 
-  llvm::Value* intr = CGF.Builder.CreateCall4(
+  llvm::Value* intr = CGF.Builder.CreateCall3(
               CGM.getIntrinsic(llvm::Intrinsic::sd_get_checked_vptr), //Paul: see Intrinsics.td file
               castPointer,
-              mdValue,
-              preciseMDValue,
-              functionMDValue);
+              tableValue,
+              idValue);
 
   return CGF.Builder.CreatePointerCast(intr, VTableAP->getType());
 }
 
+//Paul: true if MD is the final overrider for every object the call can be made on:
+//MD is final, its class is final, or the more precise type is final and doesn't override MD.
+//The this pointer already points to the class of MD, so MD can be called directly.
+static bool sd_isFinalOverrider(const CXXMethodDecl *MD,
+                                const CXXRecordDecl *preciseType) {
+  if (MD->hasAttr<FinalAttr>() || MD->getParent()->hasAttr<FinalAttr>())
+    return true;
+
+  if (!preciseType || !preciseType->hasDefinition() || !preciseType->hasAttr<FinalAttr>())
+    return false;
+
+  const CXXMethodDecl *overrider = MD->getCorrespondingMethodInClass(preciseType);
+  return overrider && overrider->getCanonicalDecl() == MD->getCanonicalDecl();
+}
 
 //Paul: get the virtual function pointer 
 llvm::Value *ItaniumCXXABI::getVirtualFunctionPointer(CodeGenFunction &CGF,
@@ -1829,12 +1915,25 @@ llvm::Value *ItaniumCXXABI::getVirtualFunctionPointer(CodeGenFunction &CGF,
                                                       llvm::Type *Ty,
                                                       const CXXRecordDecl *preciseType) {
   GD = GD.getCanonicalDecl();
-  Ty = Ty->getPointerTo()->getPointerTo();
-  llvm::Value *VTable = CGF.GetVTablePtr(This, Ty);
 
   // rkici : insert vfunptr check here
   const CXXMethodDecl *MD = cast<CXXMethodDecl>(GD.getDecl());
 
+  //Paul: the target is known statically, call it directly instead of loading and
+  //checking the vptr. Calls that still go through the vtable with a final precise type
+  //get a single legal vtable from the CHA, which SDSubstModule checks with an equality.
+  if ((CGM.getCodeGenOpts().EmitVTBLChecks || CGM.getCodeGenOpts().EmitIVTBL) &&
+      !CGM.getLangOpts().AppleKext && sd_isFinalOverrider(MD, preciseType)) {
+    llvm::FunctionType *FnTy = cast<llvm::FunctionType>(Ty);
+    if (const auto *Dtor = dyn_cast<CXXDestructorDecl>(MD))
+      return CGM.getAddrOfCXXStructor(Dtor, getFromDtorType(GD.getDtorType()),
+                                      nullptr, FnTy);
+    return CGM.GetAddrOfFunction(GD, FnTy);
+  }
+
+  Ty = Ty->getPointerTo()->getPointerTo();
+  llvm::Value *VTable = CGF.GetVTablePtr(This, Ty);
+
   // put mangled vtable name into a string
   const CXXRecordDecl* RD = MD->getParent();
   std::string Name = this->GetClassMangledName(RD);
@@ -13,7 +13,9 @@
 //===----------------------------------------------------------------------===//
 
 #include "llvm/Config/config.h" // plugin-api.h requires HAVE_STDINT_H
+#include "llvm/Config/llvm-config.h"
 #include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/StringExtras.h"
 #include "llvm/ADT/StringSet.h"
 #include "llvm/Analysis/TargetLibraryInfo.h"
 #include "llvm/Analysis/TargetTransformInfo.h"
@@ -33,18 +35,25 @@
 #include "llvm/Object/IRObjectFile.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/Host.h"
+#include "llvm/Support/MD5.h"
 #include "llvm/Support/ManagedStatic.h"
 #include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/TargetRegistry.h"
 #include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/Threading.h"
 #include "llvm/Transforms/IPO.h"
 #include "llvm/Transforms/IPO/PassManagerBuilder.h"
+#include "llvm/Transforms/IPO/SafeDispatchStats.h"
 #include "llvm/Transforms/Utils/GlobalStatus.h"
 #include "llvm/Transforms/Utils/ModuleUtils.h"
+#include "llvm/Transforms/Utils/SplitModule.h"
 #include "llvm/Transforms/Utils/ValueMapper.h"
+#include <algorithm>
+#include <dlfcn.h>
 #include <list>
 #include <plugin-api.h>
 #include <system_error>
+#include <thread>
 #include <vector>
 #include "llvm/Support/Path.h"
 
@@ -93,7 +102,13 @@ namespace options {
   static bool generate_api_file = false;
   static OutputType TheOutputType = OT_NORMAL;
   static unsigned OptLevel = 2;
+  // Number of partitions (and threads) of the code generation.
+  static unsigned Parallelism = 1;
   static std::string obj_path;
+  // Incremental LTO cache: directory of the cached objects and SD output, and
+  // the size in MiB above which the least recently used entries are removed.
+  static std::string cache_dir;
+  static uint64_t cache_max_size = 1024;
   static std::string extra_library_path;
   static std::string triple;
   static std::string mcpu;
@@ -122,8 +137,19 @@ namespace options {
       extra_library_path = opt.substr(strlen("extra_library_path="));
     } else if (opt.startswith("mtriple=")) {
       triple = opt.substr(strlen("mtriple="));
+    } else if (opt.startswith("jobs=")) {
+      if (opt.substr(strlen("jobs=")).getAsInteger(10, Parallelism) ||
+          Parallelism == 0)
+        report_fatal_error("Invalid parallelism level: " +
+                           opt.substr(strlen("jobs=")));
     } else if (opt.startswith("obj-path=")) {
       obj_path = opt.substr(strlen("obj-path="));
+    } else if (opt.startswith("cache-dir=")) {
+      cache_dir = opt.substr(strlen("cache-dir="));
+    } else if (opt.startswith("cache-max-size=")) {
+      if (opt.substr(strlen("cache-max-size=")).getAsInteger(10, cache_max_size))
+        report_fatal_error("Invalid cache size: " +
+                           opt.substr(strlen("cache-max-size=")));
     } else if (opt == "emit-llvm") {
       TheOutputType = OT_BC_ONLY;
     } else if (opt == "sd-ivtbl") {
@@ -132,6 +158,10 @@ namespace options {
       RunSDReturnPass = true;
     } else if (opt == "sd-ovtbl") {
       RunSDOVTBLPass = true;
+    } else if (opt == "sd-time-report") {
+      sdStats::setTimeReport(true);
+    } else if (opt == "sd-async-analysis") {
+      setAsyncSDAnalysis(true);
     } else if (opt == "save-temps") {
       TheOutputType = OT_SAVE_TEMPS;
     } else if (opt == "disable-output") {
@@ -289,11 +319,14 @@ static bool shouldSkip(uint32_t Symflags) {
   return false;
 }
 
-static void diagnosticHandler(const DiagnosticInfo &DI, void *Context) {
+/// Formats DI the way it is reported to gold. Returns false if DI is to be
+/// ignored.
+static bool formatDiagnostic(const DiagnosticInfo &DI, ld_plugin_level &Level,
+                             std::string &Msg) {
   if (const auto *BDI = dyn_cast<BitcodeDiagnosticInfo>(&DI)) {
     std::error_code EC = BDI->getError();
     if (EC == BitcodeError::InvalidBitcodeSignature)
-      return;
+      return false;
   }
 
   std::string ErrStorage;
@@ -302,12 +335,11 @@ static void diagnosticHandler(const DiagnosticInfo &DI, void *Context) {
     DiagnosticPrinterRawOStream DP(OS);
     DI.print(DP);
   }
-  ld_plugin_level Level;
   switch (DI.getSeverity()) {
   case DS_Error:
-    message(LDPL_FATAL, "LLVM gold plugin has failed to create LTO module: %s",
-            ErrStorage.c_str());
-    llvm_unreachable("Fatal doesn't return.");
+    Level = LDPL_FATAL;
+    Msg = "LLVM gold plugin has failed to create LTO module: " + ErrStorage;
+    return true;
   case DS_Warning:
     Level = LDPL_WARNING;
     break;
@@ -316,7 +348,44 @@ static void diagnosticHandler(const DiagnosticInfo &DI, void *Context) {
     Level = LDPL_INFO;
     break;
   }
-  message(Level, "LLVM gold plugin: %s",  ErrStorage.c_str());
+  Msg = "LLVM gold plugin: " + ErrStorage;
+  return true;
+}
+
+static void diagnosticHandler(const DiagnosticInfo &DI, void *Context) {
+  ld_plugin_level Level;
+  std::string Msg;
+  if (formatDiagnostic(DI, Level, Msg))
+    message(Level, "%s", Msg.c_str());
+}
+
+namespace {
+/// The errors and diagnostics of a worker thread. Gold may only be called on
+/// the main thread, so a worker keeps them here and the main thread reports
+/// them after the join.
+struct deferred_messages {
+  std::vector<std::pair<ld_plugin_level, std::string>> Messages;
+
+  void add(ld_plugin_level Level, std::string Msg) {
+    Messages.emplace_back(Level, std::move(Msg));
+  }
+
+  /// Reports the messages in order. A fatal one does not return.
+  void report() const {
+    for (const auto &M : Messages)
+      message(M.first, "%s", M.second.c_str());
+  }
+};
+}
+
+/// The diagnostic handler of the contexts of worker threads, Context is the
+/// deferred_messages of the thread.
+static void deferredDiagnosticHandler(const DiagnosticInfo &DI,
+                                      void *Context) {
+  ld_plugin_level Level;
+  std::string Msg;
+  if (formatDiagnostic(DI, Level, Msg))
+    static_cast<deferred_messages *>(Context)->add(Level, std::move(Msg));
 }
 
 /// Called by gold to see whether this file is one that our plugin can handle.
@@ -589,17 +658,42 @@ static void freeSymName(ld_plugin_symbol &Sym) {
   Sym.comdat_key = nullptr;
 }
 
-static std::unique_ptr<Module>
-getModuleForFile(LLVMContext &Context, claimed_file &F,
-                 ld_plugin_input_file &Info, raw_fd_ostream *ApiFile,
-                 StringSet<> &Internalize, StringSet<> &Maybe) {
+namespace {
+/// A claimed file with its symbol resolutions and contents, obtained from gold
+/// on the main thread.
+struct claimed_input {
+  claimed_file *F;
+  ld_plugin_input_file Info;
+  const void *View;
+};
+}
+
+static claimed_input getClaimedInput(claimed_file &F) {
+  claimed_input Input;
+  Input.F = &F;
+  if (get_input_file(F.handle, &Input.Info) != LDPS_OK)
+    message(LDPL_FATAL, "Failed to get file information");
 
   if (get_symbols(F.handle, F.syms.size(), &F.syms[0]) != LDPS_OK)
     message(LDPL_FATAL, "Failed to get symbol information");
 
-  const void *View;
-  if (get_view(F.handle, &View) != LDPS_OK)
+  if (get_view(F.handle, &Input.View) != LDPS_OK)
     message(LDPL_FATAL, "Failed to get a view of file");
+  return Input;
+}
+
+/// Reads the module of a claimed file and applies the symbol resolutions.
+/// Maybe maps the names of linkonce_odr symbols to whether they may still be
+/// internalized after the merge; the last file that mentions a name decides.
+/// Returns the error if the file cannot be read; the caller reports it, as
+/// this may run on a worker thread.
+static ErrorOr<std::unique_ptr<Module>>
+getModuleForFile(LLVMContext &Context, claimed_input &Input,
+                 raw_fd_ostream *ApiFile, StringSet<> &Internalize,
+                 StringMap<bool> &Maybe) {
+  claimed_file &F = *Input.F;
+  ld_plugin_input_file &Info = Input.Info;
+  const void *View = Input.View;
 
   MemoryBufferRef BufferRef(StringRef((const char *)View, Info.filesize),
                             Info.name);
@@ -607,8 +701,7 @@ getModuleForFile(LLVMContext &Context, claimed_file &F,
       object::IRObjectFile::create(BufferRef, Context);
 
   if (std::error_code EC = ObjOrErr.getError())
-    message(LDPL_FATAL, "Could not read bitcode from file : %s",
-            EC.message().c_str());
+    return EC;
 
   object::IRObjectFile &Obj = **ObjOrErr;
 
@@ -688,7 +781,7 @@ getModuleForFile(LLVMContext &Context, claimed_file &F,
       // Gold might have selected a linkonce_odr and preempted a weak_odr.
       // In that case we have to make sure we don't end up internalizing it.
       if (!GV->isDiscardableIfUnused())
-        Maybe.erase(GV->getName());
+        Maybe[GV->getName()] = false;
 
       // fall-through
     case LDPR_PREEMPTED_REG:
@@ -701,7 +794,7 @@ getModuleForFile(LLVMContext &Context, claimed_file &F,
       // and in that module the address might be significant, but that
       // copy will be LDPR_PREEMPTED_IR.
       if (GV->hasLinkOnceODRLinkage())
-        Maybe.insert(GV->getName());
+        Maybe[GV->getName()] = true;
       keepGlobalValue(*GV, KeptAliases);
       break;
     }
@@ -726,6 +819,107 @@ getModuleForFile(LLVMContext &Context, claimed_file &F,
   return Obj.takeModule();
 }
 
+static void setModuleTriple(Module &M, const std::string &DefaultTriple) {
+  if (!options::triple.empty())
+    M.setTargetTriple(options::triple.c_str());
+  else if (M.getTargetTriple().empty())
+    M.setTargetTriple(DefaultTriple);
+}
+
+namespace {
+/// A contiguous range of the claimed inputs, linked on a thread of its own.
+struct input_chunk {
+  unsigned Begin;
+  unsigned End;
+  SmallString<0> BC;
+  StringSet<> Internalize;
+  StringMap<bool> Maybe;
+  deferred_messages Msgs;
+};
+}
+
+/// Reads the claimed inputs on Threads threads and links them into L.
+///
+/// A module can only be linked into a module of the same context, so the
+/// inputs are split into contiguous ranges of about the same size. Each
+/// thread reads and links its range in a context of its own and writes the
+/// result to bitcode, the main thread then loads the partial modules lazily
+/// and links them in link order. The plugin interface is only used on the
+/// main thread, before and after: the errors and diagnostics of a thread are
+/// reported with its chunk.
+static void parallelLinkInputs(Linker &L, std::vector<claimed_input> &Inputs,
+                               unsigned Threads,
+                               const std::string &DefaultTriple,
+                               StringSet<> &Internalize,
+                               StringMap<bool> &Maybe) {
+  uint64_t TotalSize = 0;
+  for (claimed_input &Input : Inputs)
+    TotalSize += Input.Info.filesize;
+
+  std::vector<unsigned> Bounds(1, 0);
+  uint64_t Size = 0;
+  for (unsigned I = 0; I != Inputs.size(); ++I) {
+    Size += Inputs[I].Info.filesize;
+    if (Bounds.size() < Threads && Size * Threads >= TotalSize * Bounds.size())
+      Bounds.push_back(I + 1);
+  }
+  if (Bounds.back() != Inputs.size())
+    Bounds.push_back(Inputs.size());
+
+  std::vector<input_chunk> Chunks(Bounds.size() - 1);
+  std::vector<std::thread> Workers;
+  for (unsigned C = 0; C != Chunks.size(); ++C) {
+    input_chunk &Chunk = Chunks[C];
+    Chunk.Begin = Bounds[C];
+    Chunk.End = Bounds[C + 1];
+    Workers.emplace_back([&Chunk, &Inputs, &DefaultTriple]() {
+      LLVMContext Context;
+      Context.setDiagnosticHandler(deferredDiagnosticHandler, &Chunk.Msgs,
+                                   true);
+      Module Partial("ld-temp.o", Context);
+      Linker PL(&Partial);
+      for (unsigned I = Chunk.Begin; I != Chunk.End; ++I) {
+        ErrorOr<std::unique_ptr<Module>> MOrErr = getModuleForFile(
+            Context, Inputs[I], nullptr, Chunk.Internalize, Chunk.Maybe);
+        if (std::error_code EC = MOrErr.getError()) {
+          Chunk.Msgs.add(LDPL_FATAL, "Could not read bitcode from file : " +
+                                         EC.message());
+          return;
+        }
+        std::unique_ptr<Module> M = std::move(*MOrErr);
+        setModuleTriple(*M, DefaultTriple);
+        if (PL.linkInModule(M.get())) {
+          Chunk.Msgs.add(LDPL_FATAL, "Failed to link module");
+          return;
+        }
+      }
+      raw_svector_ostream OS(Chunk.BC);
+      WriteBitcodeToFile(&Partial, OS);
+    });
+  }
+  for (std::thread &T : Workers)
+    T.join();
+
+  for (input_chunk &Chunk : Chunks) {
+    Chunk.Msgs.report();
+    ErrorOr<Module *> MOrErr = getLazyBitcodeModule(
+        MemoryBuffer::getMemBuffer(Chunk.BC.str(), "ld-temp.o", false),
+        L.getModule()->getContext());
+    if (std::error_code EC = MOrErr.getError())
+      message(LDPL_FATAL, "Could not read a partially linked module: %s",
+              EC.message().c_str());
+    std::unique_ptr<Module> M(MOrErr.get());
+    if (L.linkInModule(M.get()))
+      message(LDPL_FATAL, "Failed to link module");
+
+    for (const auto &Name : Chunk.Internalize)
+      Internalize.insert(Name.first());
+    // later chunks override the decisions of earlier ones
+    for (const auto &Name : Chunk.Maybe)
+      Maybe[Name.first()] = Name.second;
+  }
+}
+
 static void runLTOPasses(Module &M, TargetMachine &TM) {
   legacy::PassManager passes;
   passes.add(createTargetTransformInfoWrapperPass(TM.getTargetIRAnalysis()));
@@ -753,7 +947,121 @@ static void saveBCFile(StringRef Path, Module &M) {
   WriteBitcodeToFile(&M, OS, /* ShouldPreserveUseListOrder */ true);
 }
 
-static void codegen(Module &M) {
+static CodeGenOpt::Level getCGOptLevel() {
+  switch (options::OptLevel) {
+  case 0:
+    return CodeGenOpt::None;
+  case 1:
+    return CodeGenOpt::Less;
+  case 2:
+    return CodeGenOpt::Default;
+  case 3:
+    return CodeGenOpt::Aggressive;
+  }
+  llvm_unreachable("Invalid optimization level");
+}
+
+static std::unique_ptr<TargetMachine>
+createTargetMachine(const Target *TheTarget, const std::string &TripleStr,
+                    const std::string &Features) {
+  TargetOptions Options = InitTargetOptionsFromCodeGenFlags();
+  return std::unique_ptr<TargetMachine>(TheTarget->createTargetMachine(
+      TripleStr, options::mcpu, Features, Options, RelocationModel,
+      CodeModel::Default, getCGOptLevel()));
+}
+
+/// Opens the object file of partition Part, a temporary file unless obj-path
+/// is given.
+static void openObjectFile(unsigned Part, SmallString<128> &Filename,
+                           int &FD) {
+  if (options::obj_path.empty()) {
+    std::error_code EC =
+        sys::fs::createTemporaryFile("lto-llvm", "o", FD, Filename);
+    if (EC)
+      message(LDPL_FATAL, "Could not create temporary file: %s",
+              EC.message().c_str());
+  } else {
+    Filename = options::obj_path;
+    if (options::Parallelism > 1)
+      Filename += "." + utostr(Part);
+    std::error_code EC =
+        sys::fs::openFileForWrite(Filename.c_str(), FD, sys::fs::F_None);
+    if (EC)
+      message(LDPL_FATAL, "Could not open file: %s", EC.message().c_str());
+  }
+}
+
+/// Generates the code of M into FD. Returns true if the target cannot emit
+/// object files.
+static bool emitObjectFile(Module &M, TargetMachine &TM, int FD) {
+  legacy::PassManager CodeGenPasses;
+  raw_fd_ostream OS(FD, true);
+
+  if (TM.addPassesToEmitFile(CodeGenPasses, OS,
+                             TargetMachine::CGFT_ObjectFile))
+    return true;
+  CodeGenPasses.run(M);
+  return false;
+}
+
+/// Splits M into options::Parallelism partitions and generates the code of
+/// each of them on its own thread. The SD passes have already run, so the
+/// partitions only refer to each other through symbols: every interleaved
+/// vtable is defined in one partition and the range checks of the others use
+/// its address.
+static void splitCodeGen(Module &M, const Target *TheTarget,
+                         const std::string &TripleStr,
+                         const std::string &Features,
+                         std::vector<std::string> &Filenames) {
+  // A context can only be used by one thread, so every partition is written
+  // to bitcode and read back into a context of its own.
+  std::list<SmallString<0>> BCs;
+  std::list<deferred_messages> Messages;
+  std::vector<std::thread> Threads;
+  SplitModule(M, options::Parallelism, [&](std::unique_ptr<Module> MPart) {
+    BCs.emplace_back();
+    SmallString<0> &BC = BCs.back();
+    Messages.emplace_back();
+    deferred_messages &Msgs = Messages.back();
+    {
+      raw_svector_ostream BCOS(BC);
+      WriteBitcodeToFile(MPart.get(), BCOS);
+    }
+
+    SmallString<128> Filename;
+    int FD;
+    openObjectFile(Filenames.size(), Filename, FD);
+    Filenames.push_back(Filename.str());
+
+    Threads.emplace_back([&BC, &Msgs, FD, TheTarget, &TripleStr,
+                          &Features]() {
+      LLVMContext Context;
+      Context.setDiagnosticHandler(deferredDiagnosticHandler, &Msgs, true);
+      ErrorOr<Module *> MOrErr =
+          parseBitcodeFile(MemoryBufferRef(BC.str(), "ld-temp.o"), Context);
+      if (std::error_code EC = MOrErr.getError()) {
+        Msgs.add(LDPL_FATAL,
+                 "Could not read a module partition: " + EC.message());
+        return;
+      }
+      std::unique_ptr<Module> MPart(MOrErr.get());
+
+      std::unique_ptr<TargetMachine> TM =
+          createTargetMachine(TheTarget, TripleStr, Features);
+      if (emitObjectFile(*MPart, *TM, FD))
+        Msgs.add(LDPL_FATAL, "Failed to setup codegen");
+    });
+  });
+
+  for (std::thread &T : Threads)
+    T.join();
+  for (const deferred_messages &Msgs : Messages)
+    Msgs.report();
+}
+
+/// Generates the code of M, adds the object files to the link and returns
+/// their names.
+static std::vector<std::string> codegen(Module &M) {
   const std::string &TripleStr = M.getTargetTriple();
   Triple TheTriple(TripleStr);
 
@@ -769,81 +1077,328 @@ static void codegen(Module &M) {
   Features.getDefaultSubtargetFeatures(TheTriple);
   for (const std::string &A : MAttrs)
     Features.AddFeature(A);
+  std::string FeaturesStr = Features.getString();
 
-  TargetOptions Options = InitTargetOptionsFromCodeGenFlags();
-  CodeGenOpt::Level CGOptLevel;
-  switch (options::OptLevel) {
-  case 0:
-    CGOptLevel = CodeGenOpt::None;
-    break;
-  case 1:
-    CGOptLevel = CodeGenOpt::Less;
-    break;
-  case 2:
-    CGOptLevel = CodeGenOpt::Default;
-    break;
-  case 3:
-    CGOptLevel = CodeGenOpt::Aggressive;
-    break;
-  }
-  std::unique_ptr<TargetMachine> TM(TheTarget->createTargetMachine(
-      TripleStr, options::mcpu, Features.getString(), Options, RelocationModel,
-      CodeModel::Default, CGOptLevel));
+  std::unique_ptr<TargetMachine> TM =
+      createTargetMachine(TheTarget, TripleStr, FeaturesStr);
 
   // Insert the sd_filename and sd_output metadata.
-  SmallString<128> FileName = llvm::sys::path::filename(output_name);
-  llvm::NamedMDNode *SDFileName = M.getOrInsertNamedMetadata("sd_filename");
-  SDFileName->addOperand(llvm::MDNode::get(M.getContext(),
-                                           llvm::MDString::get(M.getContext(), FileName.c_str())));
-
-  auto EC = sys::fs::create_directory("SDOutput", true);
-  if (!EC && sys::fs::can_write("SDOutput")) {
-    SmallString<128> Model;
-    sys::path::append(Model, "SDOutput", FileName);
-    NamedMDNode *SDFileName = M.getOrInsertNamedMetadata("sd_output");
-    SDFileName->addOperand(llvm::MDNode::get(M.getContext(),
-                                             llvm::MDString::get(M.getContext(), Model.c_str())));
-  }
+  addSDOutputMetadata(M, output_name);
 
   runLTOPasses(M, *TM);
 
   if (options::TheOutputType == options::OT_SAVE_TEMPS)
     saveBCFile(output_name + ".opt.bc", M);
 
-  legacy::PassManager CodeGenPasses;
+  if (options::Parallelism > 1 && !llvm_is_multithreaded()) {
+    message(LDPL_WARNING, "LLVM was built without threads, ignoring jobs=%u",
+            options::Parallelism);
+    options::Parallelism = 1;
+  }
 
-  SmallString<128> Filename;
-  int FD;
-  if (options::obj_path.empty()) {
-    std::error_code EC =
-        sys::fs::createTemporaryFile("lto-llvm", "o", FD, Filename);
-    if (EC)
-      message(LDPL_FATAL, "Could not create temporary file: %s",
-              EC.message().c_str());
+  std::vector<std::string> Filenames;
+  if (options::Parallelism == 1) {
+    SmallString<128> Filename;
+    int FD;
+    openObjectFile(0, Filename, FD);
+    if (emitObjectFile(M, *TM, FD))
+      message(LDPL_FATAL, "Failed to setup codegen");
+    Filenames.push_back(Filename.str());
   } else {
-    Filename = options::obj_path;
-    std::error_code EC =
-        sys::fs::openFileForWrite(Filename.c_str(), FD, sys::fs::F_None);
-    if (EC)
-      message(LDPL_FATAL, "Could not open file: %s", EC.message().c_str());
+    splitCodeGen(M, TheTarget, TripleStr, FeaturesStr, Filenames);
   }
 
-  {
-    raw_fd_ostream OS(FD, true);
+  for (const std::string &Filename : Filenames) {
+    if (add_input_file(Filename.c_str()) != LDPS_OK)
+      message(LDPL_FATAL,
+              "Unable to add .o file to the link. File left behind in: %s",
+              Filename.c_str());
 
-    if (TM->addPassesToEmitFile(CodeGenPasses, OS,
-                                TargetMachine::CGFT_ObjectFile))
-      message(LDPL_FATAL, "Failed to setup codegen");
-    CodeGenPasses.run(M);
+    if (options::obj_path.empty())
+      Cleanup.push_back(Filename);
+  }
+  return Filenames;
+}
+
+/// The incremental LTO cache (cache-dir=). An entry is a directory
+/// llvmcache-<key> holding the object files of codegen() (0.o, 1.o, ...), the
+/// files the SD passes wrote to SDOutput for this link, and a last-used stamp
+/// whose modification time orders the entries for eviction.
+static std::string getCacheEntryPath(StringRef Key) {
+  SmallString<128> Path(options::cache_dir);
+  sys::path::append(Path, "llvmcache-" + Key);
+  return Path.str();
+}
+
+/// Computes the cache key of this link from everything the output depends
+/// on: the plugin binary, the options, and the contents and symbol
+/// resolutions of the claimed files in link order.
+static std::string computeCacheKey() {
+  MD5 Hasher;
+  auto AddString = [&](StringRef S) {
+    Hasher.update(S);
+    Hasher.update(ArrayRef<uint8_t>((const uint8_t *)"", 1));
+  };
+  auto AddInt = [&](uint64_t V) { AddString(utostr(V)); };
+
+  // The SD passes change without a change of the LLVM version, so the plugin
+  // itself is identified by its size and modification time.
+  AddString(LLVM_VERSION_STRING);
+  Dl_info Plugin;
+  sys::fs::file_status Status;
+  if (dladdr((void *)&onload, &Plugin) && Plugin.dli_fname &&
+      !sys::fs::status(Plugin.dli_fname, Status)) {
+    AddInt(Status.getSize());
+    AddInt(Status.getLastModificationTime().toEpochTime());
+  }
+
+  AddInt(options::OptLevel);
+  AddInt(options::Parallelism);
+  AddInt(options::RunSDIVTBLPass);
+  AddInt(options::RunSDOVTBLPass);
+  AddInt(options::RunSDReturnPass);
+  AddInt(sdStats::timeReportEnabled());
+  AddString(options::mcpu);
+  AddString(options::triple);
+  AddInt(RelocationModel);
+  for (const std::string &A : MAttrs)
+    AddString(A);
+  for (const char *Opt : options::extra)
+    AddString(Opt);
+  // sd_filename names the SD output files
+  AddString(sys::path::filename(output_name));
+
+  for (claimed_file &F : Modules) {
+    ld_plugin_input_file File;
+    if (get_input_file(F.handle, &File) != LDPS_OK)
+      message(LDPL_FATAL, "Failed to get file information");
+    const void *View;
+    if (get_view(F.handle, &View) != LDPS_OK)
+      message(LDPL_FATAL, "Failed to get a view of file");
+    Hasher.update(ArrayRef<uint8_t>((const uint8_t *)View, File.filesize));
+
+    if (!F.syms.empty() &&
+        get_symbols(F.handle, F.syms.size(), &F.syms[0]) != LDPS_OK)
+      message(LDPL_FATAL, "Failed to get symbol information");
+    for (const ld_plugin_symbol &Sym : F.syms) {
+      AddString(Sym.name);
+      AddInt(Sym.resolution);
+    }
+    if (release_input_file(F.handle) != LDPS_OK)
+      message(LDPL_FATAL, "Failed to release file information");
+  }
+
+  MD5::MD5Result Result;
+  Hasher.final(Result);
+  SmallString<32> Key;
+  MD5::stringifyResult(Result, Key);
+  return Key.str();
+}
+
+static void touchCacheEntry(StringRef Entry) {
+  SmallString<128> Stamp(Entry);
+  sys::path::append(Stamp, "last-used");
+  int FD;
+  if (sys::fs::openFileForWrite(Stamp, FD, sys::fs::F_Append))
+    return;
+  sys::fs::setLastModificationAndAccessTime(FD, sys::TimeValue::now());
+  raw_fd_ostream Close(FD, true);
+}
+
+/// Removes an entry, or an unfinished one, with its SDOutput subdirectory.
+/// Returns the number of bytes it held.
+static uint64_t removeCacheEntry(StringRef Entry) {
+  uint64_t Size = 0;
+  std::error_code EC;
+  for (sys::fs::directory_iterator I(Entry, EC), E; I != E && !EC;
+       I.increment(EC)) {
+    uint64_t FileSize;
+    if (sys::path::filename(I->path()) == "SDOutput")
+      Size += removeCacheEntry(I->path());
+    else if (!sys::fs::file_size(I->path(), FileSize))
+      Size += FileSize;
+    sys::fs::remove(I->path());
+  }
+  sys::fs::remove(Entry);
+  return Size;
+}
+
+static uint64_t getCacheEntrySize(StringRef Entry) {
+  uint64_t Size = 0;
+  std::error_code EC;
+  for (sys::fs::directory_iterator I(Entry, EC), E; I != E && !EC;
+       I.increment(EC)) {
+    uint64_t FileSize;
+    if (sys::path::filename(I->path()) == "SDOutput")
+      Size += getCacheEntrySize(I->path());
+    else if (!sys::fs::file_size(I->path(), FileSize))
+      Size += FileSize;
+  }
+  return Size;
+}
+
+/// Removes the least recently used entries until the cache holds at most
+/// cache-max-size MiB, and the unfinished entries of links that died more
+/// than a day ago.
+static void pruneCache() {
+  std::vector<std::pair<sys::TimeValue, std::string>> Entries;
+  uint64_t TotalSize = 0;
+  sys::TimeValue Now = sys::TimeValue::now();
+
+  std::error_code EC;
+  for (sys::fs::directory_iterator I(options::cache_dir, EC), E; I != E && !EC;
+       I.increment(EC)) {
+    StringRef Name = sys::path::filename(I->path());
+    sys::fs::file_status Status;
+    if (Name.startswith("llvmcache-tmp-")) {
+      if (!I->status(Status) &&
+          Now.seconds() - Status.getLastModificationTime().seconds() > 86400)
+        removeCacheEntry(I->path());
+      continue;
+    }
+    if (!Name.startswith("llvmcache-"))
+      continue;
+
+    SmallString<128> Stamp(I->path());
+    sys::path::append(Stamp, "last-used");
+    sys::TimeValue LastUsed = sys::TimeValue::MinTime();
+    if (!sys::fs::status(Stamp, Status))
+      LastUsed = Status.getLastModificationTime();
+    Entries.push_back(std::make_pair(LastUsed, I->path()));
+    TotalSize += getCacheEntrySize(I->path());
   }
 
-  if (add_input_file(Filename.c_str()) != LDPS_OK)
-    message(LDPL_FATAL,
-            "Unable to add .o file to the link. File left behind in: %s",
-            Filename.c_str());
+  std::sort(Entries.begin(), Entries.end());
+  uint64_t MaxSize = options::cache_max_size * 1024 * 1024;
+  for (auto &Entry : Entries) {
+    if (TotalSize <= MaxSize)
+      break;
+    uint64_t Size = removeCacheEntry(Entry.second);
+    TotalSize -= std::min(Size, TotalSize);
+  }
+}
+
+/// On a cache hit, adds copies of the cached objects to the link and restores
+/// the SD output files of the entry. Returns false on a miss.
+static bool loadFromCache(StringRef Key) {
+  std::string Entry = getCacheEntryPath(Key);
+  bool IsDirectory;
+  if (sys::fs::is_directory(Entry, IsDirectory) || !IsDirectory)
+    return false;
+
+  // The entry can be evicted by a concurrent link, so read everything before
+  // touching the link.
+  std::vector<std::unique_ptr<MemoryBuffer>> Objects;
+  for (unsigned Part = 0;; ++Part) {
+    SmallString<128> Path(Entry);
+    sys::path::append(Path, utostr(Part) + ".o");
+    ErrorOr<std::unique_ptr<MemoryBuffer>> BufferOrErr =
+        MemoryBuffer::getFile(Path);
+    if (!BufferOrErr)
+      break;
+    Objects.push_back(std::move(*BufferOrErr));
+  }
+  if (Objects.empty())
+    return false;
+
+  SmallString<128> CachedSDOutput(Entry);
+  sys::path::append(CachedSDOutput, "SDOutput");
+  std::error_code EC;
+  for (sys::fs::directory_iterator I(CachedSDOutput, EC), E; I != E && !EC;
+       I.increment(EC)) {
+    if (sys::fs::create_directory("SDOutput", true))
+      break;
+    SmallString<128> Path("SDOutput");
+    sys::path::append(Path, sys::path::filename(I->path()));
+    if (std::error_code CopyEC = sys::fs::copy_file(I->path(), Path))
+      message(LDPL_WARNING, "Could not restore %s from the LTO cache: %s",
+              Path.c_str(), CopyEC.message().c_str());
+  }
+
+  for (unsigned Part = 0; Part < Objects.size(); ++Part) {
+    SmallString<128> Filename;
+    int FD;
+    openObjectFile(Part, Filename, FD);
+    {
+      raw_fd_ostream OS(FD, true);
+      OS << Objects[Part]->getBuffer();
+    }
+    if (add_input_file(Filename.c_str()) != LDPS_OK)
+      message(LDPL_FATAL,
+              "Unable to add .o file to the link. File left behind in: %s",
+              Filename.c_str());
+    if (options::obj_path.empty())
+      Cleanup.push_back(Filename.str());
+  }
 
-  if (options::obj_path.empty())
-    Cleanup.push_back(Filename.c_str());
+  touchCacheEntry(Entry);
+  return true;
+}
+
+/// The cache entry of this link: startCacheEntry copies the objects into a
+/// temporary directory, finishCacheEntry adds the SD output files once the
+/// SDAnalysis is done and publishes it.
+static std::string PendingCacheKey;
+static SmallString<128> PendingCacheEntry;
+
+/// Stores the objects of this link under Key in a temporary entry, so
+/// concurrent links never see a partial entry.
+static void startCacheEntry(StringRef Key,
+                            const std::vector<std::string> &Objects) {
+  // createUniqueDirectory puts relative paths into the temporary directory
+  SmallString<128> Prefix(options::cache_dir);
+  sys::path::append(Prefix, "llvmcache-tmp");
+  SmallString<128> TmpEntry;
+  if (sys::fs::make_absolute(Prefix) ||
+      sys::fs::createUniqueDirectory(Prefix, TmpEntry)) {
+    message(LDPL_WARNING, "Could not create an LTO cache entry in %s",
+            options::cache_dir.c_str());
+    return;
+  }
+
+  for (unsigned Part = 0; Part < Objects.size(); ++Part) {
+    SmallString<128> Path(TmpEntry);
+    sys::path::append(Path, utostr(Part) + ".o");
+    if (sys::fs::copy_file(Objects[Part], Path)) {
+      removeCacheEntry(TmpEntry);
+      return;
+    }
+  }
+
+  PendingCacheKey = Key;
+  PendingCacheEntry = TmpEntry;
+}
+
+/// Adds the files the SD passes wrote to SDOutput for this link to the pending
+/// entry, renames it into place and prunes the cache. The SDAnalysis must have
+/// been joined.
+static void finishCacheEntry() {
+  if (PendingCacheEntry.empty())
+    return;
+
+  // loadFromCache restores the files into SDOutput, the ones written next to
+  // the output without an SDOutput directory are not cached
+  bool Failed = false;
+  SmallString<128> CachedSDOutput(PendingCacheEntry);
+  sys::path::append(CachedSDOutput, "SDOutput");
+  for (const std::string &File : takeSDOutputFiles()) {
+    if (Failed || sys::path::parent_path(File) != "SDOutput")
+      continue;
+    SmallString<128> Path(CachedSDOutput);
+    sys::path::append(Path, sys::path::filename(File));
+    Failed = sys::fs::create_directory(CachedSDOutput, true) ||
+             sys::fs::copy_file(File, Path);
+  }
+
+  touchCacheEntry(PendingCacheEntry);
+  // Another link with the same key may have won the race.
+  if (Failed ||
+      sys::fs::rename(PendingCacheEntry, getCacheEntryPath(PendingCacheKey)))
+    removeCacheEntry(PendingCacheEntry);
+  PendingCacheKey.clear();
+  PendingCacheEntry.clear();
+
+  pruneCache();
 }
 
 /// gold informs us that all symbols have been read. At this point, we use
@@ -853,6 +1408,25 @@ static ld_plugin_status allSymbolsReadHook(raw_fd_ostream *ApiFile) {
   if (Modules.empty())
     return LDPS_OK;
 
+  // The cache only holds the objects of a normal link.
+  std::string CacheKey;
+  if (!options::cache_dir.empty() &&
+      options::TheOutputType == options::OT_NORMAL &&
+      !options::generate_api_file) {
+    if (std::error_code EC =
+            sys::fs::create_directories(options::cache_dir, true))
+      message(LDPL_FATAL, "Could not create the LTO cache directory %s: %s",
+              options::cache_dir.c_str(), EC.message().c_str());
+    CacheKey = computeCacheKey();
+    if (loadFromCache(CacheKey)) {
+      if (!options::extra_library_path.empty() &&
+          set_extra_library_path(options::extra_library_path.c_str()) !=
+              LDPS_OK)
+        message(LDPL_FATAL, "Unable to set the extra library path.");
+      return LDPS_OK;
+    }
+  }
+
   LLVMContext Context;
   Context.setDiagnosticHandler(diagnosticHandler, nullptr, true);
 
@@ -862,23 +1436,32 @@ static ld_plugin_status allSymbolsReadHook(raw_fd_ostream *ApiFile) {
   std::string DefaultTriple = sys::getDefaultTargetTriple();
 
   StringSet<> Internalize;
-  StringSet<> Maybe;
-  for (claimed_file &F : Modules) {
-    ld_plugin_input_file File;
-    if (get_input_file(F.handle, &File) != LDPS_OK)
-      message(LDPL_FATAL, "Failed to get file information");
-    std::unique_ptr<Module> M =
-        getModuleForFile(Context, F, File, ApiFile, Internalize, Maybe);
-    if (!options::triple.empty())
-      M->setTargetTriple(options::triple.c_str());
-    else if (M->getTargetTriple().empty()) {
-      M->setTargetTriple(DefaultTriple);
+  StringMap<bool> Maybe;
+  unsigned Threads = std::min<size_t>(options::Parallelism, Modules.size());
+  if (Threads > 1 && llvm_is_multithreaded() && !options::generate_api_file) {
+    std::vector<claimed_input> Inputs;
+    for (claimed_file &F : Modules)
+      Inputs.push_back(getClaimedInput(F));
+    parallelLinkInputs(L, Inputs, Threads, DefaultTriple, Internalize, Maybe);
+    for (claimed_input &Input : Inputs)
+      if (release_input_file(Input.F->handle) != LDPS_OK)
+        message(LDPL_FATAL, "Failed to release file information");
+  } else {
+    for (claimed_file &F : Modules) {
+      claimed_input Input = getClaimedInput(F);
+      ErrorOr<std::unique_ptr<Module>> MOrErr =
+          getModuleForFile(Context, Input, ApiFile, Internalize, Maybe);
+      if (std::error_code EC = MOrErr.getError())
+        message(LDPL_FATAL, "Could not read bitcode from file : %s",
+                EC.message().c_str());
+      std::unique_ptr<Module> M = std::move(*MOrErr);
+      setModuleTriple(*M, DefaultTriple);
+
+      if (L.linkInModule(M.get()))
+        message(LDPL_FATAL, "Failed to link module");
+      if (release_input_file(F.handle) != LDPS_OK)
+        message(LDPL_FATAL, "Failed to release file information");
     }
-
-    if (L.linkInModule(M.get()))
-      message(LDPL_FATAL, "Failed to link module");
-    if (release_input_file(F.handle) != LDPS_OK)
-      message(LDPL_FATAL, "Failed to release file information");
   }
 
   for (const auto &Name : Internalize) {
@@ -888,6 +1471,8 @@ static ld_plugin_status allSymbolsReadHook(raw_fd_ostream *ApiFile) {
   }
 
   for (const auto &Name : Maybe) {
+    if (!Name.second)
+      continue;
     GlobalValue *GV = Combined->getNamedValue(Name.first());
     if (!GV)
       continue;
@@ -910,7 +1495,11 @@ static ld_plugin_status allSymbolsReadHook(raw_fd_ostream *ApiFile) {
       return LDPS_OK;
   }
 
-  codegen(*L.getModule());
+  std::vector<std::string> Objects = codegen(*L.getModule());
+  // cleanup_hook publishes the entry, the SDAnalysis may still be writing its
+  // files while the linker writes the output
+  if (!CacheKey.empty())
+    startCacheEntry(CacheKey, Objects);
 
   if (!options::extra_library_path.empty() &&
       set_extra_library_path(options::extra_library_path.c_str()) != LDPS_OK)
@@ -932,10 +1521,12 @@ static ld_plugin_status all_symbols_read_hook(void) {
     Ret = allSymbolsReadHook(&ApiFile);
   }
 
-  llvm_shutdown();
-
+  // cleanup_hook calls llvm_shutdown after joining the SDAnalysis, it is not
+  // reached if we exit here
   if (options::TheOutputType == options::OT_BC_ONLY ||
       options::TheOutputType == options::OT_DISABLE) {
+    waitForSDAnalysis();
+    llvm_shutdown();
     if (options::TheOutputType == options::OT_DISABLE)
       // Remove the output file here since ld.bfd creates the output file
       // early.
@@ -947,6 +1538,12 @@ static ld_plugin_status all_symbols_read_hook(void) {
 }
 
 static ld_plugin_status cleanup_hook(void) {
+  // the SDAnalysis ran in the background while the linker wrote the output,
+  // its files complete the cache entry
+  waitForSDAnalysis();
+  finishCacheEntry();
+  llvm_shutdown();
+
   for (std::string &Name : Cleanup) {
     std::error_code EC = sys::fs::remove(Name);
     if (EC)
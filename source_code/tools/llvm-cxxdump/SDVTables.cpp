@@ -0,0 +1,362 @@
+//===- SDVTables.cpp - Dump Itanium and SafeDispatch vtables ----*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Implements -sd-vtables: dumps the vtables (_ZTV), construction vtables (_ZTC)
+// and the interleaved/ordered SafeDispatch vtables (_SD_ZTV, _SD_ZTC) of an ELF
+// file entry by entry, in the report format of scripts/extract_vtables.py.
+//
+// Entries of linked binaries are resolved through the symbol table, entries of
+// relocatable objects through their relocations. The sections holding vtables
+// are decoded on several threads, the output is in section order.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm-cxxdump.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Demangle/Demangle.h"
+#include "llvm/Object/ELFObjectFile.h"
+#include "llvm/Support/ELF.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <iterator>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace llvm;
+using namespace llvm::object;
+
+namespace {
+
+struct VTableSymbol {
+  StringRef Name;    // without the _SD prefix
+  uint64_t Address;
+  uint64_t Size;
+};
+
+struct RelocTarget {
+  StringRef SymName;
+  bool IsSection;    // a section symbol, resolved through the addend
+  unsigned SymSection;
+  int64_t Addend;
+};
+
+struct VTableSection {
+  SectionRef Sec;
+  unsigned Index;
+  std::vector<VTableSymbol> VTables;
+  std::string Out;
+  bool Failed;
+};
+
+class SDVTableDumper {
+public:
+  SDVTableDumper(const ObjectFile *Obj, StringRef FileName)
+      : Obj(Obj), FileName(FileName), IsRel(Obj->isRelocatableObject()) {}
+
+  bool dump();
+
+private:
+  void addSymbol(const SymbolRef &Sym);
+  void dumpSection(VTableSection &VS) const;
+  void dumpVTable(const VTableSection &VS, StringRef Contents,
+                  const std::map<uint64_t, RelocTarget> &Relocs,
+                  const VTableSymbol &VT, raw_ostream &OS) const;
+  std::string entryName(const std::map<uint64_t, RelocTarget> &Relocs,
+                        uint64_t Offset, int64_t Value) const;
+  bool wanted(StringRef FullName) const;
+  bool isMapped(uint64_t Address) const;
+
+  const ObjectFile *Obj;
+  StringRef FileName;
+  bool IsRel;
+
+  std::map<SectionRef, unsigned> SectionIndex;
+  std::map<SectionRef, std::vector<SectionRef>> RelocSections;
+  // the defined symbols, the first one of every address and section wins
+  std::map<std::pair<uint64_t, unsigned>, StringRef> Defined;
+  // the name printed for an entry holding an address, the last one wins
+  std::map<uint64_t, StringRef> AddressNames;
+  std::map<unsigned, VTableSection> VTableSections;
+  // the sorted, merged [begin, end) address ranges of the SHF_ALLOC sections
+  std::vector<std::pair<uint64_t, uint64_t>> MappedRanges;
+};
+
+} // end anonymous namespace
+
+static bool isVTableName(StringRef Name) {
+  return (Name.startswith("_ZTV") || Name.startswith("_ZTC")) &&
+         Name.find("__cxx") == StringRef::npos;
+}
+
+// "vtable for A" -> A, "construction vtable for B-in-A" -> B-in-A
+static std::string vtableClassName(StringRef Name, bool &IsCons) {
+  int Status;
+  char *Demangled = itaniumDemangle(Name.str().c_str(), nullptr, nullptr,
+                                    &Status);
+  std::string Result = Demangled && Status == 0 ? Demangled : Name.str();
+  free(Demangled);
+
+  StringRef R(Result);
+  IsCons = R.startswith("construction vtable for ");
+  if (IsCons)
+    return R.substr(strlen("construction vtable for ")).str();
+  if (R.startswith("vtable for "))
+    return R.substr(strlen("vtable for ")).str();
+  return Result;
+}
+
+// the bytes of an entry as readelf -x prints them, in groups of 4
+static void printBytes(raw_ostream &OS, StringRef Bytes) {
+  for (size_t I = 0; I != Bytes.size(); ++I) {
+    if (I && I % 4 == 0)
+      OS << ' ';
+    OS << format("%02x", (unsigned char)Bytes[I]);
+  }
+}
+
+void SDVTableDumper::addSymbol(const SymbolRef &Sym) {
+  StringRef Name;
+  section_iterator SecI = Obj->section_end();
+  uint64_t Address, Size;
+  if (Sym.getName(Name) || Sym.getSection(SecI) || Sym.getAddress(Address) ||
+      Sym.getSize(Size))
+    return;
+  if (SecI == Obj->section_end())
+    return;
+
+  StringRef Stripped = Name;
+  if (Name.startswith("_SD_Z"))
+    Stripped = Name.drop_front(3);
+  else if (!Name.startswith("_Z") && !Name.startswith("_SVT_Z"))
+    return;
+
+  unsigned Index = SectionIndex[*SecI];
+  if (!Defined.insert(std::make_pair(std::make_pair(Address, Index), Name))
+           .second)
+    return;
+
+  if (!isVTableName(Stripped)) {
+    AddressNames[Address] = Name;
+    return;
+  }
+  AddressNames[Address] = Stripped;
+
+  VTableSection &VS = VTableSections[Index];
+  VS.Sec = *SecI;
+  VS.Index = Index;
+  VS.Failed = false;
+  VS.VTables.push_back({Stripped, Address, Size});
+}
+
+bool SDVTableDumper::wanted(StringRef FullName) const {
+  if (opts::SDClasses.empty())
+    return true;
+  for (const std::string &C : opts::SDClasses)
+    if (FullName == C)
+      return true;
+  return false;
+}
+
+bool SDVTableDumper::isMapped(uint64_t Address) const {
+  auto R = std::upper_bound(
+      MappedRanges.begin(), MappedRanges.end(), Address,
+      [](uint64_t A, const std::pair<uint64_t, uint64_t> &Range) {
+        return A < Range.first;
+      });
+  return R != MappedRanges.begin() && Address < std::prev(R)->second;
+}
+
+std::string
+SDVTableDumper::entryName(const std::map<uint64_t, RelocTarget> &Relocs,
+                          uint64_t Offset, int64_t Value) const {
+  if (!IsRel) {
+    auto Name = AddressNames.find(Value);
+    if (Name != AddressNames.end())
+      return Name->second.str();
+    // addresses point into the loaded sections, anything else is an offset
+    // (offset-to-top, vbase and vcall offsets)
+    if (isMapped(Value))
+      return "0x" + utohexstr(Value, /*LowerCase=*/true);
+    return itostr(Value);
+  }
+
+  auto R = Relocs.find(Offset);
+  if (R == Relocs.end())
+    return itostr(Value);
+  if (!R->second.IsSection)
+    return R->second.SymName.str();
+  // an offset into a section, name the symbol defined there
+  auto Sym = Defined.find(std::make_pair((uint64_t)R->second.Addend,
+                                         R->second.SymSection));
+  return Sym == Defined.end() ? "???" : Sym->second.str();
+}
+
+void SDVTableDumper::dumpVTable(const VTableSection &VS, StringRef Contents,
+                                const std::map<uint64_t, RelocTarget> &Relocs,
+                                const VTableSymbol &VT,
+                                raw_ostream &OS) const {
+  bool IsCons;
+  std::string FullName = vtableClassName(VT.Name, IsCons);
+  if (!wanted(FullName))
+    return;
+
+  OS << "HEXDUMP for " << (IsCons ? "(cons) " : "") << FullName << '\n';
+  OS << format("0x%" PRIx64 " to 0x%" PRIx64, VT.Address, VT.Address + VT.Size)
+     << '\n';
+
+  unsigned EntrySize = Obj->getBytesInAddress();
+  uint64_t SecAddress = VS.Sec.getAddress();
+  uint64_t FileOffset = Contents.data() - Obj->getData().data();
+  uint64_t Begin = VT.Address - SecAddress;
+  for (uint64_t I = 0; I + EntrySize <= VT.Size; I += EntrySize) {
+    uint64_t Offset = Begin + I;
+    if (Offset + EntrySize > Contents.size())
+      break;
+    StringRef Bytes = Contents.substr(Offset, EntrySize);
+    int64_t Value;
+    if (EntrySize == 8)
+      Value = Obj->isLittleEndian()
+                  ? (int64_t)support::endian::read64le(Bytes.data())
+                  : (int64_t)support::endian::read64be(Bytes.data());
+    else
+      Value = Obj->isLittleEndian()
+                  ? (int32_t)support::endian::read32le(Bytes.data())
+                  : (int32_t)support::endian::read32be(Bytes.data());
+
+    if (IsRel)
+      OS << format("0x%" PRIx64 ": ", FileOffset + Offset);
+    else
+      OS << format("%-3u: %" PRIx64 ": ", (unsigned)(I / EntrySize),
+                   SecAddress + Offset);
+    printBytes(OS, Bytes);
+    OS << " => " << entryName(Relocs, Offset, Value) << '\n';
+  }
+  OS << '\n';
+}
+
+void SDVTableDumper::dumpSection(VTableSection &VS) const {
+  raw_string_ostream OS(VS.Out);
+  StringRef Contents;
+  if (VS.Sec.getContents(Contents)) {
+    errs() << FileName << ": cannot read the contents of section " << VS.Index
+           << '\n';
+    VS.Failed = true;
+    return;
+  }
+
+  std::map<uint64_t, RelocTarget> Relocs;
+  if (IsRel) {
+    auto RS = RelocSections.find(VS.Sec);
+    if (RS != RelocSections.end())
+      for (const SectionRef &R : RS->second)
+        for (const RelocationRef &Reloc : R.relocations()) {
+          symbol_iterator SymI = Reloc.getSymbol();
+          uint64_t Offset;
+          if (SymI == Obj->symbol_end() || Reloc.getOffset(Offset))
+            continue;
+          RelocTarget T = {StringRef(), false, 0, 0};
+          SymbolRef::Type Type;
+          section_iterator SymSec = Obj->section_end();
+          if (!SymI->getType(Type) && Type == SymbolRef::ST_Debug &&
+              !SymI->getSection(SymSec) && SymSec != Obj->section_end()) {
+            T.IsSection = true;
+            T.SymSection = SectionIndex.find(*SymSec)->second;
+            getELFRelocationAddend(Reloc, T.Addend);
+          } else {
+            SymI->getName(T.SymName);
+          }
+          Relocs[Offset] = T;
+        }
+  }
+
+  for (const VTableSymbol &VT : VS.VTables)
+    dumpVTable(VS, Contents, Relocs, VT, OS);
+  OS.flush();
+}
+
+bool SDVTableDumper::dump() {
+  const ELFObjectFileBase *ELF = cast<ELFObjectFileBase>(Obj);
+  unsigned Index = 0;
+  for (const SectionRef &Sec : Obj->sections()) {
+    SectionIndex[Sec] = Index++;
+    section_iterator Target = Sec.getRelocatedSection();
+    if (Target != Obj->section_end())
+      RelocSections[*Target].push_back(Sec);
+    if ((ELF->getSectionFlags(Sec) & ELF::SHF_ALLOC) && Sec.getSize())
+      MappedRanges.push_back(
+          std::make_pair(Sec.getAddress(), Sec.getAddress() + Sec.getSize()));
+  }
+
+  std::sort(MappedRanges.begin(), MappedRanges.end());
+  size_t Merged = 0;
+  for (const auto &R : MappedRanges) {
+    if (Merged && R.first <= MappedRanges[Merged - 1].second)
+      MappedRanges[Merged - 1].second =
+          std::max(MappedRanges[Merged - 1].second, R.second);
+    else
+      MappedRanges[Merged++] = R;
+  }
+  MappedRanges.resize(Merged);
+
+  for (const SymbolRef &Sym : Obj->symbols())
+    addSymbol(Sym);
+  auto DynSyms = ELF->getELFDynamicSymbolIterators();
+  for (symbol_iterator I = DynSyms.first; I != DynSyms.second; ++I)
+    addSymbol(*I);
+
+  std::vector<VTableSection *> Work;
+  for (auto &VS : VTableSections)
+    Work.push_back(&VS.second);
+
+  unsigned Threads = opts::SDThreads;
+  if (Threads == 0)
+    Threads = std::thread::hardware_concurrency();
+  if (!llvm_is_multithreaded())
+    Threads = 1;
+  if (Threads > Work.size())
+    Threads = Work.size();
+
+  if (Threads <= 1) {
+    for (VTableSection *VS : Work)
+      dumpSection(*VS);
+  } else {
+    std::atomic<unsigned> Next(0);
+    std::vector<std::thread> Workers;
+    for (unsigned T = 0; T != Threads; ++T)
+      Workers.emplace_back([this, &Work, &Next]() {
+        for (unsigned I = Next++; I < Work.size(); I = Next++)
+          dumpSection(*Work[I]);
+      });
+    for (std::thread &T : Workers)
+      T.join();
+  }
+
+  bool Failed = false;
+  for (VTableSection *VS : Work) {
+    outs() << VS->Out;
+    Failed |= VS->Failed;
+  }
+  return Failed;
+}
+
+bool dumpSDVTables(const ObjectFile *Obj, StringRef FileName) {
+  if (!isa<ELFObjectFileBase>(Obj)) {
+    errs() << FileName << ": -sd-vtables only supports ELF files\n";
+    return true;
+  }
+  return SDVTableDumper(Obj, FileName).dump();
+}
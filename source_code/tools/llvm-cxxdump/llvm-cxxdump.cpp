@@ -37,6 +37,20 @@ namespace opts {
 cl::list<std::string> InputFilenames(cl::Positional,
                                      cl::desc("<input object files>"),
                                      cl::ZeroOrMore);
+
+cl::opt<bool> SDVTables("sd-vtables",
+                        cl::desc("Dump the Itanium and SafeDispatch vtables "
+                                 "entry by entry (ELF only)"));
+
+cl::list<std::string> SDClasses("sd-class",
+                                cl::desc("With -sd-vtables, only dump the "
+                                         "vtables of this (demangled) class"),
+                                cl::ZeroOrMore);
+
+cl::opt<unsigned> SDThreads("j",
+                            cl::desc("With -sd-vtables, the number of threads "
+                                     "(default: one per core)"),
+                            cl::init(0));
 } // namespace opts
 
 static int ReturnValue = EXIT_SUCCESS;
@@ -505,6 +519,13 @@ static void dumpCXXData(const ObjectFile *Obj) {
   }
 }
 
+static void dumpObject(const ObjectFile *Obj, StringRef File) {
+  if (!opts::SDVTables)
+    dumpCXXData(Obj);
+  else if (dumpSDVTables(Obj, File))
+    ReturnValue = EXIT_FAILURE;
+}
+
 static void dumpArchive(const Archive *Arc) {
   for (const Archive::Child &ArcC : Arc->children()) {
     ErrorOr<std::unique_ptr<Binary>> ChildOrErr = ArcC.getAsBinary();
@@ -516,7 +537,7 @@ static void dumpArchive(const Archive *Arc) {
     }
 
     if (ObjectFile *Obj = dyn_cast<ObjectFile>(&*ChildOrErr.get()))
-      dumpCXXData(Obj);
+      dumpObject(Obj, Arc->getFileName());
     else
       reportError(Arc->getFileName(), cxxdump_error::unrecognized_file_format);
   }
@@ -540,7 +561,7 @@ static void dumpInput(StringRef File) {
   if (Archive *Arc = dyn_cast<Archive>(&Binary))
     dumpArchive(Arc);
   else if (ObjectFile *Obj = dyn_cast<ObjectFile>(&Binary))
-    dumpCXXData(Obj);
+    dumpObject(Obj, File);
   else
     reportError(File, cxxdump_error::unrecognized_file_format);
 }
@@ -13,10 +13,24 @@
 #include "llvm/Support/CommandLine.h"
 #include <string>
 
+namespace llvm {
+namespace object {
+class ObjectFile;
+}
+}
+
 namespace opts {
 extern llvm::cl::list<std::string> InputFilenames;
+extern llvm::cl::opt<bool> SDVTables;
+extern llvm::cl::list<std::string> SDClasses;
+extern llvm::cl::opt<unsigned> SDThreads;
 } // namespace opts
 
+/// Dumps the Itanium and SafeDispatch vtables of an ELF file in the format of
+/// scripts/extract_vtables.py. Returns true on error.
+bool dumpSDVTables(const llvm::object::ObjectFile *Obj,
+                   llvm::StringRef FileName);
+
 #define LLVM_CXXDUMP_ENUM_ENT(ns, enum)                                        \
   { #enum, ns::enum }
 
@@ -46,6 +46,18 @@ static cl::opt<bool>
 DisableLTOVectorization("disable-lto-vectorization", cl::init(false),
   cl::desc("Do not run loop or slp vectorization during LTO"));
 
+static cl::opt<bool>
+SDIVTBL("sd-ivtbl", cl::init(false),
+  cl::desc("Run the SafeDispatch passes with interleaved vtables"));
+
+static cl::opt<bool>
+SDOVTBL("sd-ovtbl", cl::init(false),
+  cl::desc("Run the SafeDispatch passes with ordered vtables"));
+
+static cl::opt<bool>
+SDReturn("sd-return", cl::init(false),
+  cl::desc("Run the SafeDispatch return checks analysis"));
+
 static cl::opt<bool>
 UseDiagnosticHandler("use-diagnostic-handler", cl::init(false),
   cl::desc("Use a diagnostic handler to test the handler interface"));
@@ -242,6 +254,11 @@ int main(int argc, char **argv) {
 
   CodeGen.setOptLevel(OptLevel - '0');
 
+  // The SafeDispatch output files are named after -o, as with gold.
+  CodeGen.setSafeDispatch(SDIVTBL, SDOVTBL, SDReturn);
+  if (!OutputFilename.empty())
+    CodeGen.setSDOutputName(OutputFilename.c_str());
+
   std::string attrs;
   for (unsigned i = 0; i < MAttrs.size(); ++i) {
     if (i > 0)
@@ -0,0 +1,788 @@
+//===- llvm-sd-targets.cpp - SafeDispatch target sets of an ELF file ------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Recovers the SafeDispatch range checks of a linked x86-64 ELF file from its
+// machine code and computes the targets that every checked virtual call site
+// allows, i.e. what actually shipped rather than what the IR passes intended.
+//
+// - The interleaved (or ordered) vtables are the _SD_ZTV symbols of the file.
+// - SDSubstModule emits a range check as ror(vptr - start, log2(align)) <=
+//   width, which becomes sub/add/lea, ror/rol, cmp and ja/jbe/jae/jb, and an
+//   equality check as vptr == start, which becomes cmp and je/jne.
+// - A check belongs to the first indirect call at or after the address its
+//   success path continues at, so the checks of a call site with several
+//   ranges are found even if the failure blocks were moved away.
+// - A range check allows the vptrs start + i * align for i = 0 ... width, the
+//   targets of the call site are the function pointers at vptr + the offset
+//   of the call.
+//
+// The functions of the executable sections are decoded on several threads,
+// in chunks of about the same size.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/Triple.h"
+#include "llvm/MC/MCAsmInfo.h"
+#include "llvm/MC/MCContext.h"
+#include "llvm/MC/MCDisassembler.h"
+#include "llvm/MC/MCInst.h"
+#include "llvm/MC/MCInstrInfo.h"
+#include "llvm/MC/MCObjectFileInfo.h"
+#include "llvm/MC/MCRegisterInfo.h"
+#include "llvm/MC/MCSubtargetInfo.h"
+#include "llvm/Object/ELFObjectFile.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/PrettyStackTrace.h"
+#include "llvm/Support/Signals.h"
+#include "llvm/Support/TargetRegistry.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace llvm;
+using namespace llvm::object;
+
+static cl::opt<std::string> InputFilename(cl::Positional,
+                                          cl::desc("<input ELF file>"),
+                                          cl::Required);
+
+static cl::opt<std::string>
+    CSVFilename("csv", cl::desc("Write one line per indirect call site to "
+                                "this file"),
+                cl::value_desc("filename"));
+
+static cl::opt<unsigned> Threads("j",
+                                 cl::desc("Number of threads (default: one "
+                                          "per core)"),
+                                 cl::init(0));
+
+static cl::opt<unsigned>
+    MaxWidth("max-width",
+             cl::desc("Do not enumerate the vptrs of wider range checks"),
+             cl::init(1 << 16));
+
+static const char *ToolName;
+
+namespace {
+
+// a range or equality check, as recovered from the machine code
+struct Check {
+  uint64_t Address; // of the conditional branch
+  uint64_t Start;
+  uint64_t Width;   // the vptrs start + i * Align, i = 0 ... Width
+  uint64_t Align;
+  bool IsEq;
+  bool InSDVTable;  // Start lies in an interleaved/ordered vtable
+  uint64_t Success; // where the success path continues
+};
+
+struct CallSite {
+  StringRef Function;
+  uint64_t Address;
+  bool IsTailCall;
+  bool HasOffset;
+  int64_t Offset;   // of the function pointer from the vptr
+  std::vector<Check> Checks;
+  uint64_t NumVPtrs;
+  bool TooWide;
+  std::set<uint64_t> Targets;
+};
+
+struct Function {
+  StringRef Name;
+  uint64_t Begin;
+  StringRef Bytes;
+};
+
+struct Chunk {
+  std::vector<const Function *> Functions;
+  std::vector<CallSite> CallSites;
+  unsigned NumChecks;
+  unsigned OrphanChecks;  // with no indirect call after their success path
+  unsigned InvalidBytes;
+};
+
+struct SDVTable {
+  StringRef Name;
+  uint64_t Begin;
+  uint64_t End;
+};
+
+// the state of the file shared by the workers, read only once they run
+struct SDFile {
+  const ObjectFile *Obj;
+  const Target *TheTarget;
+  std::string TripleName;
+  std::vector<SDVTable> SDVTables;
+  std::map<uint64_t, StringRef> FunctionNames;
+  // the allocated sections with contents: address -> (size, contents)
+  std::map<uint64_t, std::pair<uint64_t, StringRef>> Memory;
+  // the value of the pointers the dynamic relocations fill in (PIE, DSOs)
+  std::map<uint64_t, uint64_t> Relocated;
+
+  bool inSDVTable(uint64_t Address) const;
+  bool readPointer(uint64_t Address, uint64_t &Value) const;
+};
+
+// the value a register is known to hold at some point of a function
+struct RegState {
+  enum KindTy {
+    Const,   // Value
+    Diff,    // x - Value
+    Rotated, // ror(x - Value, log2(Align))
+    Load     // load [base + Disp]
+  } Kind;
+  uint64_t Value;
+  uint64_t Align;
+  int64_t Disp;
+};
+
+// one MC disassembler per thread
+class Decoder {
+public:
+  Decoder(const SDFile &B);
+  bool valid() const { return DisAsm != nullptr; }
+  void decode(Chunk &C);
+
+private:
+  void decodeFunction(const Function &F, Chunk &C);
+  unsigned top(unsigned Reg) const;
+  const RegState *state(unsigned Reg) const;
+  void set(unsigned Reg, RegState S) { Regs[top(Reg)] = S; }
+  void kill(unsigned Reg) { Regs.erase(top(Reg)); }
+  void killDefs(const MCInst &Inst);
+  void computeTargets(CallSite &CS) const;
+
+  const SDFile &B;
+  std::unique_ptr<const MCRegisterInfo> MRI;
+  std::unique_ptr<const MCAsmInfo> AsmInfo;
+  std::unique_ptr<const MCSubtargetInfo> STI;
+  std::unique_ptr<const MCInstrInfo> MII;
+  std::unique_ptr<const MCObjectFileInfo> MOFI;
+  std::unique_ptr<MCContext> Ctx;
+  std::unique_ptr<MCDisassembler> DisAsm;
+  unsigned RIP, RAX;
+
+  std::map<unsigned, RegState> Regs;
+};
+
+} // end anonymous namespace
+
+static void reportError(StringRef Message) {
+  errs() << ToolName << ": " << InputFilename << ": " << Message << '\n';
+  exit(1);
+}
+
+bool SDFile::inSDVTable(uint64_t Address) const {
+  auto I = std::upper_bound(SDVTables.begin(), SDVTables.end(), Address,
+                            [](uint64_t A, const SDVTable &V) {
+                              return A < V.Begin;
+                            });
+  return I != SDVTables.begin() && Address < std::prev(I)->End;
+}
+
+bool SDFile::readPointer(uint64_t Address, uint64_t &Value) const {
+  auto R = Relocated.find(Address);
+  if (R != Relocated.end()) {
+    Value = R->second;
+    return true;
+  }
+  auto I = Memory.upper_bound(Address);
+  if (I == Memory.begin())
+    return false;
+  --I;
+  uint64_t Offset = Address - I->first;
+  if (Offset + 8 > I->second.second.size())
+    return false;
+  Value = support::endian::read64le(I->second.second.data() + Offset);
+  return true;
+}
+
+Decoder::Decoder(const SDFile &B) : B(B), RIP(0), RAX(0) {
+  MRI.reset(B.TheTarget->createMCRegInfo(B.TripleName));
+  if (!MRI)
+    return;
+  AsmInfo.reset(B.TheTarget->createMCAsmInfo(*MRI, B.TripleName));
+  STI.reset(B.TheTarget->createMCSubtargetInfo(B.TripleName, "", ""));
+  MII.reset(B.TheTarget->createMCInstrInfo());
+  if (!AsmInfo || !STI || !MII)
+    return;
+  MOFI.reset(new MCObjectFileInfo);
+  Ctx.reset(new MCContext(AsmInfo.get(), MRI.get(), MOFI.get()));
+  DisAsm.reset(B.TheTarget->createMCDisassembler(*STI, *Ctx));
+
+  for (unsigned R = 1; R < MRI->getNumRegs(); ++R) {
+    if (StringRef(MRI->getName(R)) == "RIP")
+      RIP = R;
+    if (StringRef(MRI->getName(R)) == "RAX")
+      RAX = R;
+  }
+}
+
+// the widest register that Reg is part of, e.g. RAX for EAX
+unsigned Decoder::top(unsigned Reg) const {
+  for (MCSuperRegIterator SR(Reg, MRI.get()); SR.isValid(); ++SR)
+    if (!MCSuperRegIterator(*SR, MRI.get()).isValid())
+      return *SR;
+  return Reg;
+}
+
+const RegState *Decoder::state(unsigned Reg) const {
+  auto I = Regs.find(top(Reg));
+  return I == Regs.end() ? nullptr : &I->second;
+}
+
+void Decoder::killDefs(const MCInst &Inst) {
+  const MCInstrDesc &Desc = MII->get(Inst.getOpcode());
+  for (unsigned I = 0; I < Desc.getNumDefs() && I < Inst.getNumOperands(); ++I)
+    if (Inst.getOperand(I).isReg() && Inst.getOperand(I).getReg())
+      kill(Inst.getOperand(I).getReg());
+  if (const uint16_t *Defs = Desc.getImplicitDefs())
+    for (; *Defs; ++Defs)
+      kill(*Defs);
+}
+
+static bool isJcc(StringRef Name, StringRef Cond) {
+  return Name.startswith(Cond) &&
+         (Name.substr(Cond.size()) == "_1" || Name.substr(Cond.size()) == "_2" ||
+          Name.substr(Cond.size()) == "_4");
+}
+
+void Decoder::decodeFunction(const Function &F, Chunk &C) {
+  // a compare of the instruction before
+  struct {
+    bool Valid;
+    bool IsEq;
+    uint64_t Start, Bound, Align;
+  } Cmp = {false, false, 0, 0, 0};
+  std::vector<Check> Checks;
+  size_t FirstCallSite = C.CallSites.size();
+
+  Regs.clear();
+  ArrayRef<uint8_t> Bytes(reinterpret_cast<const uint8_t *>(F.Bytes.data()),
+                          F.Bytes.size());
+  uint64_t Size;
+  for (uint64_t Index = 0; Index < Bytes.size(); Index += Size) {
+    MCInst Inst;
+    uint64_t Address = F.Begin + Index;
+    if (!DisAsm->getInstruction(Inst, Size, Bytes.slice(Index), Address,
+                                nulls(), nulls())) {
+      if (Size == 0)
+        Size = 1;
+      C.InvalidBytes += Size;
+      Regs.clear();
+      Cmp.Valid = false;
+      continue;
+    }
+    uint64_t Next = Address + Size;
+    StringRef Name = MII->getName(Inst.getOpcode());
+    bool WasCmp = Cmp.Valid;
+    Cmp.Valid = false;
+
+    auto reg = [&](unsigned I) { return Inst.getOperand(I).getReg(); };
+    auto imm = [&](unsigned I) {
+      return Inst.getOperand(I).isImm() ? Inst.getOperand(I).getImm() : 0;
+    };
+    auto constant = [&](const RegState *S) {
+      return S && S->Kind == RegState::Const;
+    };
+    // a vptr, or anything else the checks may subtract a start from
+    auto unknown = [&](const RegState *S) {
+      return !S || S->Kind == RegState::Load;
+    };
+
+    if (Name == "MOV64ri" || Name == "MOV64ri32") {
+      set(reg(0), {RegState::Const, (uint64_t)imm(1), 0, 0});
+    } else if (Name == "MOV32ri") {
+      set(reg(0), {RegState::Const, (uint32_t)imm(1), 0, 0});
+    } else if (Name.startswith("MOV64rr")) {
+      if (const RegState *S = state(reg(1)))
+        set(reg(0), *S);
+      else
+        kill(reg(0));
+    } else if (Name == "LEA64r" && reg(3) == 0) {
+      // dst, base, scale, index, disp, segment
+      const RegState *S = state(reg(1));
+      int64_t Disp = imm(4);
+      if (reg(1) == RIP)
+        set(reg(0), {RegState::Const, Next + Disp, 0, 0});
+      else if (reg(1) && constant(S))
+        set(reg(0), {RegState::Const, S->Value + Disp, 0, 0});
+      else if (reg(1) && unknown(S) && Disp < 0)
+        set(reg(0), {RegState::Diff, (uint64_t)-Disp, 0, 0});
+      else
+        kill(reg(0));
+    } else if (Name.startswith("SUB64ri") || Name.startswith("ADD64ri") ||
+               Name == "SUB64i32" || Name == "ADD64i32") {
+      // dst, src, imm or the short form on RAX: x - start may also be
+      // x + -start
+      bool Short = Name.endswith("64i32");
+      unsigned Dst = Short ? RAX : reg(0);
+      const RegState *S = state(Short ? RAX : reg(1));
+      int64_t Imm = Short ? imm(0) : imm(2);
+      if (Name.startswith("ADD"))
+        Imm = -Imm;
+      if (unknown(S) && (Name.startswith("SUB") || Imm > 0))
+        set(Dst, {RegState::Diff, (uint64_t)Imm, 0, 0});
+      else if (constant(S))
+        set(Dst, {RegState::Const, S->Value - Imm, 0, 0});
+      else if (S && S->Kind == RegState::Diff)
+        set(Dst, {RegState::Diff, S->Value + Imm, 0, 0});
+      else
+        kill(Dst);
+    } else if (Name.startswith("SUB64rr")) {
+      const RegState *S1 = state(reg(1)), *S2 = state(reg(2));
+      if (constant(S2) && unknown(S1))
+        set(reg(0), {RegState::Diff, S2->Value, 0, 0});
+      else
+        kill(reg(0));
+    } else if (Name == "ROR64ri" || Name == "ROL64ri" || Name == "ROR64r1" ||
+               Name == "ROL64r1") {
+      const RegState *S = state(reg(1));
+      unsigned Amount = Name.endswith("r1") ? 1 : imm(2) & 63;
+      unsigned Bits = Name.startswith("ROR") ? Amount : (64 - Amount) & 63;
+      if (S && S->Kind == RegState::Diff && Bits)
+        set(reg(0), {RegState::Rotated, S->Value, 1ULL << Bits, 0});
+      else
+        kill(reg(0));
+    } else if (Name.startswith("CMP64ri") || Name == "CMP64i32") {
+      bool Short = Name == "CMP64i32";
+      const RegState *S = state(Short ? RAX : reg(0));
+      uint64_t Imm = Short ? imm(0) : imm(1);
+      if (S && S->Kind == RegState::Rotated)
+        Cmp = {true, false, S->Value, Imm, S->Align};
+      else if (B.inSDVTable(Imm))
+        Cmp = {true, true, Imm, 0, 0};
+    } else if (Name.startswith("CMP64rr")) {
+      const RegState *S1 = state(reg(0)), *S2 = state(reg(1));
+      if (S1 && S1->Kind == RegState::Rotated && constant(S2))
+        Cmp = {true, false, S1->Value, S2->Value, S1->Align};
+      else if (constant(S2) && B.inSDVTable(S2->Value))
+        Cmp = {true, true, S2->Value, 0, 0};
+      else if (constant(S1) && B.inSDVTable(S1->Value))
+        Cmp = {true, true, S1->Value, 0, 0};
+    } else if (Name.startswith("CMP64mi")) {
+      // base, scale, index, disp, segment, imm
+      uint64_t Imm = imm(5);
+      if (B.inSDVTable(Imm))
+        Cmp = {true, true, Imm, 0, 0};
+    } else if (WasCmp && Inst.getNumOperands() == 1 &&
+               Inst.getOperand(0).isImm()) {
+      // the conditional branch of the compare before
+      uint64_t Target = Next + Inst.getOperand(0).getImm();
+      Check Ch = {Address, Cmp.Start, 0, Cmp.Align, Cmp.IsEq,
+                  B.inSDVTable(Cmp.Start), 0};
+      bool Found = true;
+      if (Cmp.IsEq && isJcc(Name, "JE"))
+        Ch.Success = Target;
+      else if (Cmp.IsEq && isJcc(Name, "JNE"))
+        Ch.Success = Next;
+      else if (!Cmp.IsEq && isJcc(Name, "JBE"))
+        Ch.Success = Target, Ch.Width = Cmp.Bound;
+      else if (!Cmp.IsEq && isJcc(Name, "JA"))
+        Ch.Success = Next, Ch.Width = Cmp.Bound;
+      else if (!Cmp.IsEq && isJcc(Name, "JB") && Cmp.Bound)
+        Ch.Success = Target, Ch.Width = Cmp.Bound - 1;
+      else if (!Cmp.IsEq && isJcc(Name, "JAE") && Cmp.Bound)
+        Ch.Success = Next, Ch.Width = Cmp.Bound - 1;
+      else
+        Found = false;
+      if (Found)
+        Checks.push_back(Ch);
+    } else if (Name == "MOV64rm") {
+      // dst, base, scale, index, disp, segment
+      if (reg(1) && reg(1) != RIP && reg(3) == 0)
+        set(reg(0), {RegState::Load, 0, 0, imm(4)});
+      else
+        kill(reg(0));
+    } else if (Name == "CALL64m" || Name == "CALL64r" || Name == "JMP64m" ||
+               Name == "JMP64r") {
+      CallSite CS = {F.Name, Address, Name.startswith("JMP"), false, 0, {},
+                     0, false, {}};
+      bool Virtual = false;
+      if (Name.endswith("m")) {
+        // through memory: base, scale, index, disp, segment
+        Virtual = reg(0) && reg(0) != RIP && reg(2) == 0;
+        CS.HasOffset = Virtual;
+        CS.Offset = imm(3);
+      } else {
+        const RegState *S = state(reg(0));
+        Virtual = !CS.IsTailCall || (S && S->Kind == RegState::Load);
+        CS.HasOffset = S && S->Kind == RegState::Load;
+        CS.Offset = CS.HasOffset ? S->Disp : 0;
+      }
+      // indirect jumps are switch tables more often than tail calls, they
+      // only count when they load a function pointer like a virtual call
+      if (Virtual)
+        C.CallSites.push_back(CS);
+      Regs.clear();
+    } else if (Name.startswith("JMP") || Name.startswith("RET") ||
+               Name.startswith("CALL")) {
+      Regs.clear();
+    } else {
+      killDefs(Inst);
+    }
+  }
+
+  // every check belongs to the first call site at or after its success path
+  C.NumChecks += Checks.size();
+  auto Begin = C.CallSites.begin() + FirstCallSite, End = C.CallSites.end();
+  for (const Check &Ch : Checks) {
+    auto CS = std::lower_bound(Begin, End, Ch.Success,
+                               [](const CallSite &CS, uint64_t A) {
+                                 return CS.Address < A;
+                               });
+    if (CS == End)
+      C.OrphanChecks++;
+    else
+      CS->Checks.push_back(Ch);
+  }
+  for (auto CS = Begin; CS != End; ++CS)
+    computeTargets(*CS);
+}
+
+void Decoder::computeTargets(CallSite &CS) const {
+  std::set<uint64_t> VPtrs;
+  for (const Check &Ch : CS.Checks) {
+    if (Ch.IsEq) {
+      VPtrs.insert(Ch.Start);
+      continue;
+    }
+    if (Ch.Width > MaxWidth) {
+      CS.TooWide = true;
+      continue;
+    }
+    for (uint64_t I = 0; I <= Ch.Width; ++I)
+      VPtrs.insert(Ch.Start + I * Ch.Align);
+  }
+  CS.NumVPtrs = VPtrs.size();
+  if (!CS.HasOffset)
+    return;
+  for (uint64_t VPtr : VPtrs) {
+    uint64_t Target;
+    if (B.readPointer(VPtr + CS.Offset, Target) && Target)
+      CS.Targets.insert(Target);
+  }
+}
+
+void Decoder::decode(Chunk &C) {
+  C.NumChecks = C.OrphanChecks = C.InvalidBytes = 0;
+  for (const Function *F : C.Functions)
+    decodeFunction(*F, C);
+}
+
+static const Target *getTarget(const ObjectFile *Obj, std::string &TripleName) {
+  Triple TheTriple("unknown-unknown-unknown");
+  TheTriple.setArch(Triple::ArchType(Obj->getArch()));
+  if (TheTriple.getArch() != Triple::x86_64)
+    reportError("only x86-64 files are supported");
+  std::string Error;
+  const Target *TheTarget = TargetRegistry::lookupTarget("", TheTriple, Error);
+  if (!TheTarget)
+    reportError(Error);
+  TripleName = TheTriple.getTriple();
+  return TheTarget;
+}
+
+static void collectSymbols(SDFile &B, std::vector<Function> &Functions) {
+  const ObjectFile *Obj = B.Obj;
+  std::map<uint64_t, std::pair<StringRef, SectionRef>> Starts;
+
+  auto addSymbol = [&](const SymbolRef &Sym) {
+    StringRef Name;
+    section_iterator SecI = Obj->section_end();
+    uint64_t Address, Size;
+    SymbolRef::Type Type;
+    if (Sym.getName(Name) || Sym.getSection(SecI) || Sym.getAddress(Address) ||
+        Sym.getSize(Size) || Sym.getType(Type) || SecI == Obj->section_end())
+      return;
+    if (Name.startswith("_SD_ZTV") || Name.startswith("_SD_ZTC"))
+      B.SDVTables.push_back({Name, Address, Address + Size});
+    if (Type != SymbolRef::ST_Function)
+      return;
+    B.FunctionNames.insert(std::make_pair(Address, Name));
+    if (SecI->isText())
+      Starts.insert(std::make_pair(Address, std::make_pair(Name, *SecI)));
+  };
+  for (const SymbolRef &Sym : Obj->symbols())
+    addSymbol(Sym);
+  auto DynSyms = cast<ELFObjectFileBase>(Obj)->getELFDynamicSymbolIterators();
+  for (symbol_iterator I = DynSyms.first; I != DynSyms.second; ++I)
+    addSymbol(*I);
+
+  std::sort(B.SDVTables.begin(), B.SDVTables.end(),
+            [](const SDVTable &A, const SDVTable &V) {
+              return A.Begin < V.Begin;
+            });
+
+  for (const SectionRef &Sec : Obj->sections()) {
+    StringRef Contents;
+    if (!Sec.getSize() || Sec.isBSS() || Sec.isVirtual() || !Sec.getAddress() ||
+        Sec.getContents(Contents))
+      continue;
+    B.Memory[Sec.getAddress()] = std::make_pair(Sec.getSize(), Contents);
+
+    if (!Sec.isText())
+      continue;
+    // a function ends where the next one or the section starts, without
+    // symbols the section is one function
+    uint64_t SecBegin = Sec.getAddress(), SecEnd = SecBegin + Sec.getSize();
+    StringRef SecName;
+    Sec.getName(SecName);
+    auto I = Starts.lower_bound(SecBegin);
+    if (I == Starts.end() || I->first != SecBegin) {
+      uint64_t End = I == Starts.end() || I->first >= SecEnd ? SecEnd : I->first;
+      Functions.push_back({SecName, SecBegin,
+                           Contents.substr(0, End - SecBegin)});
+    }
+    for (; I != Starts.end() && I->first < SecEnd; ++I) {
+      auto N = std::next(I);
+      uint64_t End = N == Starts.end() || N->first >= SecEnd ? SecEnd : N->first;
+      Functions.push_back({I->second.first, I->first,
+                           Contents.substr(I->first - SecBegin, End - I->first)});
+    }
+  }
+
+  // the pointers in the vtables of position independent files are filled in
+  // by R_X86_64_RELATIVE and R_X86_64_64 relocations
+  for (const SectionRef &Sec : Obj->sections()) {
+    if (cast<ELFObjectFileBase>(Obj)->getSectionType(Sec) != ELF::SHT_RELA)
+      continue;
+    for (const RelocationRef &Reloc : Sec.relocations()) {
+      uint64_t Address, Type;
+      int64_t Addend;
+      if (Reloc.getAddress(Address) || Reloc.getType(Type) ||
+          getELFRelocationAddend(Reloc, Addend))
+        continue;
+      if (Type == ELF::R_X86_64_RELATIVE) {
+        B.Relocated[Address] = Addend;
+      } else if (Type == ELF::R_X86_64_64) {
+        symbol_iterator Sym = Reloc.getSymbol();
+        uint64_t Value;
+        if (Sym != Obj->symbol_end() && !Sym->getAddress(Value) &&
+            Value != UnknownAddressOrSize)
+          B.Relocated[Address] = Value + Addend;
+      }
+    }
+  }
+}
+
+static std::vector<Chunk> split(const std::vector<Function> &Functions,
+                                unsigned Parts) {
+  uint64_t Total = 0;
+  for (const Function &F : Functions)
+    Total += F.Bytes.size();
+
+  std::vector<Chunk> Chunks(1);
+  uint64_t Size = 0;
+  for (const Function &F : Functions) {
+    if (!Chunks.back().Functions.empty() && Chunks.size() < Parts &&
+        Size * Parts >= Total * Chunks.size())
+      Chunks.emplace_back();
+    Chunks.back().Functions.push_back(&F);
+    Size += F.Bytes.size();
+  }
+  return Chunks;
+}
+
+static std::string hex(uint64_t V) {
+  return "0x" + utohexstr(V, /*LowerCase=*/true);
+}
+
+static void printDistribution(StringRef What, std::vector<uint64_t> Values) {
+  outs() << format("  %-34s", What.str().c_str());
+  if (Values.empty()) {
+    outs() << "-\n";
+    return;
+  }
+  std::sort(Values.begin(), Values.end());
+  uint64_t Sum = 0;
+  for (uint64_t V : Values)
+    Sum += V;
+  outs() << "min " << Values.front() << ", median " << Values[Values.size() / 2]
+         << ", avg " << format("%.2f", (double)Sum / Values.size()) << ", max "
+         << Values.back() << '\n';
+}
+
+int main(int argc, const char *argv[]) {
+  sys::PrintStackTraceOnErrorSignal();
+  PrettyStackTraceProgram X(argc, argv);
+  llvm_shutdown_obj Y;
+  ToolName = argv[0];
+
+  InitializeAllTargetInfos();
+  InitializeAllTargetMCs();
+  InitializeAllDisassemblers();
+
+  cl::ParseCommandLineOptions(argc, argv,
+                              "SafeDispatch range checks and target sets\n");
+
+  if (!sys::fs::exists(InputFilename))
+    reportError("no such file");
+  ErrorOr<OwningBinary<ObjectFile>> ObjOrErr =
+      ObjectFile::createObjectFile(InputFilename);
+  if (std::error_code EC = ObjOrErr.getError())
+    reportError(EC.message());
+  const ObjectFile *Obj = ObjOrErr.get().getBinary();
+  if (!isa<ELFObjectFileBase>(Obj) || Obj->isRelocatableObject())
+    reportError("not a linked ELF file");
+
+  SDFile B;
+  B.Obj = Obj;
+  B.TheTarget = getTarget(Obj, B.TripleName);
+  std::vector<Function> Functions;
+  collectSymbols(B, Functions);
+
+  unsigned NumThreads = Threads;
+  if (NumThreads == 0)
+    NumThreads = std::max(1u, std::thread::hardware_concurrency());
+  if (!llvm_is_multithreaded())
+    NumThreads = 1;
+
+  // several chunks per thread, so that one with large functions does not
+  // keep the others waiting
+  std::vector<Chunk> Chunks = split(Functions, NumThreads * 4);
+  std::atomic<unsigned> Next(0);
+  std::atomic<bool> Failed(false);
+  auto work = [&]() {
+    Decoder D(B);
+    if (!D.valid()) {
+      Failed = true;
+      return;
+    }
+    for (unsigned I = Next++; I < Chunks.size(); I = Next++)
+      D.decode(Chunks[I]);
+  };
+  if (NumThreads == 1) {
+    work();
+  } else {
+    std::vector<std::thread> Workers;
+    for (unsigned T = 0; T != NumThreads; ++T)
+      Workers.emplace_back(work);
+    for (std::thread &T : Workers)
+      T.join();
+  }
+  if (Failed)
+    reportError("no disassembler for " + B.TripleName);
+
+  std::unique_ptr<raw_fd_ostream> CSV;
+  if (!CSVFilename.empty()) {
+    std::error_code EC;
+    CSV.reset(new raw_fd_ostream(CSVFilename, EC, sys::fs::F_Text));
+    if (EC)
+      reportError(CSVFilename + ": " + EC.message());
+    *CSV << "function,address,tail_call,checks,vtable_offset,allowed_vptrs,"
+            "allowed_targets,ranges,targets\n";
+  }
+
+  unsigned NumCallSites = 0, NumTailCalls = 0, Checked = 0, RangeChecked = 0,
+           EqChecked = 0, NumChecks = 0, RangeChecks = 0, EqChecks = 0,
+           OutsideChecks = 0, OrphanChecks = 0, TooWide = 0, NoOffset = 0,
+           InvalidBytes = 0;
+  std::vector<uint64_t> VPtrCounts, TargetCounts, ChecksPerSite;
+  for (const Chunk &C : Chunks) {
+    NumChecks += C.NumChecks;
+    OrphanChecks += C.OrphanChecks;
+    InvalidBytes += C.InvalidBytes;
+    for (const CallSite &CS : C.CallSites) {
+      NumCallSites++;
+      NumTailCalls += CS.IsTailCall;
+      bool HasRange = false;
+      for (const Check &Ch : CS.Checks) {
+        HasRange |= !Ch.IsEq;
+        RangeChecks += !Ch.IsEq;
+        EqChecks += Ch.IsEq;
+        OutsideChecks += !Ch.InSDVTable;
+      }
+      if (!CS.Checks.empty()) {
+        Checked++;
+        RangeChecked += HasRange;
+        EqChecked += !HasRange;
+        TooWide += CS.TooWide;
+        NoOffset += !CS.HasOffset;
+        ChecksPerSite.push_back(CS.Checks.size());
+        if (!CS.TooWide) {
+          VPtrCounts.push_back(CS.NumVPtrs);
+          if (CS.HasOffset)
+            TargetCounts.push_back(CS.Targets.size());
+        }
+      }
+
+      if (!CSV)
+        continue;
+      *CSV << CS.Function << ',' << hex(CS.Address) << ','
+           << (CS.IsTailCall ? 1 : 0) << ',' << CS.Checks.size() << ',';
+      if (CS.HasOffset)
+        *CSV << CS.Offset;
+      *CSV << ',';
+      if (!CS.Checks.empty() && !CS.TooWide)
+        *CSV << CS.NumVPtrs;
+      *CSV << ',';
+      if (!CS.Checks.empty() && !CS.TooWide && CS.HasOffset)
+        *CSV << CS.Targets.size();
+      *CSV << ',';
+      for (unsigned I = 0; I < CS.Checks.size(); ++I) {
+        const Check &Ch = CS.Checks[I];
+        *CSV << (I ? ";" : "") << hex(Ch.Start);
+        if (!Ch.IsEq)
+          *CSV << '+' << Ch.Width << '*' << Ch.Align;
+      }
+      *CSV << ',';
+      bool First = true;
+      for (uint64_t T : CS.Targets) {
+        auto Name = B.FunctionNames.find(T);
+        *CSV << (First ? "" : ";")
+             << (Name == B.FunctionNames.end() ? hex(T) : Name->second.str());
+        First = false;
+      }
+      *CSV << '\n';
+    }
+  }
+
+  outs() << InputFilename << ":\n";
+  outs() << "  interleaved/ordered vtables (_SD) " << B.SDVTables.size() << '\n';
+  for (const SDVTable &V : B.SDVTables)
+    outs() << "    " << V.Name << " [" << hex(V.Begin) << ", " << hex(V.End)
+           << ")\n";
+  outs() << "  functions                          " << Functions.size() << '\n';
+  outs() << "  indirect call sites                " << NumCallSites << " ("
+         << NumTailCalls << " tail calls)\n";
+  outs() << "    checked                          " << Checked << " ("
+         << RangeChecked << " with range checks, " << EqChecked
+         << " with equality checks only)\n";
+  outs() << "    unchecked                        " << NumCallSites - Checked
+         << '\n';
+  outs() << "  checks                             " << NumChecks << " ("
+         << RangeChecks << " range, " << EqChecks << " equality)\n";
+  outs() << "    outside the _SD vtables          " << OutsideChecks << '\n';
+  outs() << "    without an indirect call         " << OrphanChecks << '\n';
+  printDistribution("checks per checked call site", ChecksPerSite);
+  printDistribution("allowed vptrs per call site", VPtrCounts);
+  printDistribution("allowed targets per call site", TargetCounts);
+  if (TooWide)
+    outs() << "  call sites wider than -max-width   " << TooWide << '\n';
+  if (NoOffset)
+    outs() << "  call sites with an unknown offset  " << NoOffset << '\n';
+  if (InvalidBytes)
+    outs() << "  undecodable bytes                  " << InvalidBytes << '\n';
+  return 0;
+}
@@ -43,6 +43,24 @@ static cl::opt<bool>
 DisableLTOVectorization("disable-lto-vectorization", cl::init(false),
   cl::desc("Do not run loop or slp vectorization during LTO"));
 
+// SafeDispatch, passed by the linker with -mllvm like the options above
+static cl::opt<bool>
+SDIVTBL("sd-ivtbl", cl::init(false),
+  cl::desc("Run the SafeDispatch passes with interleaved vtables"));
+
+static cl::opt<bool>
+SDOVTBL("sd-ovtbl", cl::init(false),
+  cl::desc("Run the SafeDispatch passes with ordered vtables"));
+
+static cl::opt<bool>
+SDReturn("sd-return", cl::init(false),
+  cl::desc("Run the SafeDispatch return checks analysis"));
+
+static cl::opt<std::string>
+SDOutputName("sd-output-name", cl::init("a.out"),
+  cl::desc("Name the SafeDispatch output files after this linker output"),
+  cl::value_desc("filename"));
+
 // Holds most recent error string.
 // *** Not thread safe ***
 static std::string sLastErrorString;
@@ -93,6 +111,9 @@ static void lto_add_attrs(lto_code_gen_t cg) {
   if (OptLevel < '0' || OptLevel > '3')
     report_fatal_error("Optimization level must be between 0 and 3");
   CG->setOptLevel(OptLevel - '0');
+
+  CG->setSafeDispatch(SDIVTBL, SDOVTBL, SDReturn);
+  CG->setSDOutputName(SDOutputName.c_str());
 }
 
 extern const char* lto_get_version() {
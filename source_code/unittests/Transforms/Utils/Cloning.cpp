@@ -8,6 +8,7 @@
 //===----------------------------------------------------------------------===//
 
 #include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/SplitModule.h"
 #include "llvm/ADT/ArrayRef.h"
 #include "llvm/ADT/STLExtras.h"
 #include "llvm/ADT/SmallPtrSet.h"
@@ -16,6 +17,7 @@
 #include "llvm/IR/DIBuilder.h"
 #include "llvm/IR/DebugInfo.h"
 #include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalVariable.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/InstIterator.h"
 #include "llvm/IR/Instructions.h"
@@ -415,4 +417,36 @@ TEST_F(CloneFunc, DebugIntrinsics) {
   }
 }
 
+// A declaration that hashes into another partition must keep its linkage, an
+// extern_weak reference would otherwise become a strong undefined one.
+TEST(SplitModule, ExternWeakDeclarations) {
+  LLVMContext C;
+  Module M("split", C);
+  FunctionType *FTy = FunctionType::get(Type::getVoidTy(C), false);
+  for (unsigned I = 0; I != 8; ++I) {
+    Function::Create(FTy, GlobalValue::ExternalWeakLinkage,
+                     "weak_fn" + Twine(I), &M);
+    new GlobalVariable(M, Type::getInt32Ty(C), false,
+                       GlobalValue::ExternalWeakLinkage, nullptr,
+                       "weak_var" + Twine(I));
+  }
+  Function *Def = Function::Create(FTy, GlobalValue::ExternalLinkage, "def", &M);
+  ReturnInst::Create(C, BasicBlock::Create(C, "", Def));
+
+  unsigned Parts = 0;
+  SplitModule(M, 3, [&](std::unique_ptr<Module> MPart) {
+    ++Parts;
+    EXPECT_FALSE(verifyModule(*MPart));
+    for (Function &F : *MPart) {
+      if (F.getName() == "def")
+        EXPECT_EQ(GlobalValue::ExternalLinkage, F.getLinkage());
+      else
+        EXPECT_TRUE(F.hasExternalWeakLinkage()) << F.getName().str();
+    }
+    for (GlobalVariable &GV : MPart->globals())
+      EXPECT_TRUE(GV.hasExternalWeakLinkage()) << GV.getName().str();
+  });
+  EXPECT_EQ(3u, Parts);
+}
+
 }